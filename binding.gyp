@@ -8,7 +8,28 @@
             "cppsrc/main.cpp",
             "cppsrc/kudunode.cpp",
             "cppsrc/kuduclass.cpp",
-            "cppsrc/kudujs.cpp"
+            "cppsrc/kudujs.cpp",
+            "cppsrc/kuduworkers.cpp",
+            "cppsrc/columnarbatch.cpp",
+            "cppsrc/arrowipc.cpp",
+            "cppsrc/tableexport.cpp",
+            "cppsrc/rowcodec.cpp",
+            "cppsrc/spillqueue.cpp",
+            "cppsrc/writecoalescer.cpp",
+            "cppsrc/scancache.cpp",
+            "cppsrc/rowmaterializer.cpp",
+            "cppsrc/stringdictionary.cpp",
+            "cppsrc/writepipeline.cpp",
+            "cppsrc/workscheduler.cpp",
+            "cppsrc/memtracker.cpp",
+            "cppsrc/orderedscan.cpp",
+            "cppsrc/timepartitions.cpp",
+            "cppsrc/hashjoin.cpp",
+            "cppsrc/scanplan.cpp",
+            "cppsrc/trafficcapture.cpp",
+            "cppsrc/tenantlimiter.cpp",
+            "cppsrc/rollup.cpp",
+            "cppsrc/completionchannel.cpp"
         ],
         "link_settings": {
           "libraries": [
@@ -0,0 +1,798 @@
+#include "arrowipc.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Arrow format constants (see format/Schema.fbs and format/Message.fbs).
+static const int16_t kMetadataVersionV5 = 4;
+static const uint8_t kHeaderSchema = 1;
+static const uint8_t kHeaderDictionaryBatch = 2;
+static const uint8_t kHeaderRecordBatch = 3;
+static const uint8_t kTypeInt = 2;
+static const uint8_t kTypeFloatingPoint = 3;
+static const uint8_t kTypeBinary = 4;
+static const uint8_t kTypeUtf8 = 5;
+static const uint8_t kTypeBool = 6;
+static const uint8_t kTypeTimestamp = 10;
+static const char kArrowMagic[] = "ARROW1\0";
+
+static void Pad(string* buf, size_t align) {
+  buf->resize((buf->size() + align - 1) / align * align, '\0');
+}
+
+template <typename T>
+static void Put(string* buf, size_t pos, T value) {
+  memcpy(&(*buf)[pos], &value, sizeof(T));
+}
+
+template <typename T>
+static void Push(string* buf, T value) {
+  buf->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T Load(const uint8_t* data) {
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+static bool GetBit(const uint8_t* bitmap, int64_t index) {
+  return (bitmap[index >> 3] >> (index & 7)) & 1;
+}
+
+/*
+ * FlatBuilder
+ */
+
+int FlatBuilder::Table() {
+  Node n;
+  n.kind = TABLE;
+  n.count = 0;
+  n.align = 4;
+  this->nodes_.push_back(n);
+  return this->nodes_.size() - 1;
+}
+
+void FlatBuilder::AddScalar(int table, int field, uint64_t bits, int size) {
+  this->nodes_[table].slots.push_back({field, size, bits, -1});
+}
+
+void FlatBuilder::AddOffset(int table, int field, int child) {
+  this->nodes_[table].slots.push_back({field, 4, 0, child});
+}
+
+int FlatBuilder::String(const string& value) {
+  Node n;
+  n.kind = STRING;
+  n.data = value;
+  n.count = value.size();
+  n.align = 4;
+  this->nodes_.push_back(n);
+  return this->nodes_.size() - 1;
+}
+
+int FlatBuilder::TableVector(const vector<int>& tables) {
+  Node n;
+  n.kind = TABLE_VECTOR;
+  n.children = tables;
+  n.count = tables.size();
+  n.align = 4;
+  this->nodes_.push_back(n);
+  return this->nodes_.size() - 1;
+}
+
+int FlatBuilder::StructVector(const string& raw, int count, int align) {
+  Node n;
+  n.kind = STRUCT_VECTOR;
+  n.data = raw;
+  n.count = count;
+  n.align = align;
+  this->nodes_.push_back(n);
+  return this->nodes_.size() - 1;
+}
+
+string FlatBuilder::Finish(int root) {
+  string buf(4, '\0');
+  size_t pos = Write(root, &buf);
+  Put<uint32_t>(&buf, 0, pos);
+  Pad(&buf, 8);
+  return buf;
+}
+
+size_t FlatBuilder::Write(int node, string* buf) {
+  const Node& n = this->nodes_[node];
+  switch (n.kind) {
+    case TABLE:
+    {
+      int numFields = 0;
+      bool wide = false;
+      for (const Slot& slot : n.slots) {
+        numFields = std::max(numFields, slot.field + 1);
+        wide = wide || slot.size == 8;
+      }
+      // vtable first, then the table itself pointing back at it.
+      Pad(buf, 2);
+      size_t vtable = buf->size();
+      uint16_t vtableSize = 4 + 2 * numFields;
+      buf->append(vtableSize, '\0');
+      Pad(buf, 4);
+      if (wide && (buf->size() + 4) % 8 != 0) {
+        buf->append(4, '\0');
+      }
+      size_t table = buf->size();
+      Push<int32_t>(buf, table - vtable);
+
+      // Largest fields first keeps every field naturally aligned.
+      vector<size_t> order(n.slots.size());
+      for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+      }
+      std::stable_sort(order.begin(), order.end(), [&n](size_t a, size_t b) {
+        return n.slots[a].size > n.slots[b].size;
+      });
+      vector<size_t> at(n.slots.size());
+      for (size_t i : order) {
+        const Slot& slot = n.slots[i];
+        Pad(buf, slot.size);
+        at[i] = buf->size();
+        buf->append(reinterpret_cast<const char*>(&slot.bits), slot.size);
+      }
+      Put<uint16_t>(buf, vtable, vtableSize);
+      Put<uint16_t>(buf, vtable + 2, buf->size() - table);
+      for (size_t i = 0; i < n.slots.size(); i++) {
+        Put<uint16_t>(buf, vtable + 4 + 2 * n.slots[i].field, at[i] - table);
+      }
+      for (size_t i = 0; i < n.slots.size(); i++) {
+        if (n.slots[i].child >= 0) {
+          size_t child = Write(n.slots[i].child, buf);
+          Put<uint32_t>(buf, at[i], child - at[i]);
+        }
+      }
+      return table;
+    }
+    case STRING:
+    {
+      Pad(buf, 4);
+      size_t pos = buf->size();
+      Push<uint32_t>(buf, n.count);
+      buf->append(n.data);
+      buf->push_back('\0');
+      return pos;
+    }
+    case TABLE_VECTOR:
+    {
+      Pad(buf, 4);
+      size_t pos = buf->size();
+      Push<uint32_t>(buf, n.count);
+      size_t slots = buf->size();
+      buf->append(4 * n.count, '\0');
+      for (int i = 0; i < n.count; i++) {
+        size_t child = Write(n.children[i], buf);
+        Put<uint32_t>(buf, slots + 4 * i, child - (slots + 4 * i));
+      }
+      return pos;
+    }
+    case STRUCT_VECTOR:
+    default:
+    {
+      Pad(buf, 4);
+      while ((buf->size() + 4) % n.align != 0) {
+        buf->append(4, '\0');
+      }
+      size_t pos = buf->size();
+      Push<uint32_t>(buf, n.count);
+      buf->append(n.data);
+      return pos;
+    }
+  }
+}
+
+/*
+ * FlatTable
+ */
+
+FlatTable::FlatTable() {
+  this->base_ = NULL;
+  this->size_ = 0;
+  this->table_ = 0;
+  this->vtable_ = 0;
+  this->vtableSize_ = 0;
+}
+
+bool FlatTable::Root(const uint8_t* base, size_t size) {
+  if (size < 4) {
+    return false;
+  }
+  return Init(base, size, Load<uint32_t>(base));
+}
+
+bool FlatTable::Init(const uint8_t* base, size_t size, size_t table) {
+  this->base_ = base;
+  this->size_ = size;
+  this->table_ = table;
+  if (table + 4 > size) {
+    return false;
+  }
+  int64_t vtable = static_cast<int64_t>(table) - Load<int32_t>(base + table);
+  if (vtable < 0 || static_cast<size_t>(vtable) + 4 > size) {
+    return false;
+  }
+  this->vtable_ = vtable;
+  this->vtableSize_ = Load<uint16_t>(base + vtable);
+  return this->vtableSize_ >= 4 && this->vtable_ + this->vtableSize_ <= size;
+}
+
+size_t FlatTable::FieldPos(int field) const {
+  size_t entry = 4 + 2 * field;
+  if (entry + 2 > this->vtableSize_) {
+    return 0;
+  }
+  uint16_t offset = Load<uint16_t>(this->base_ + this->vtable_ + entry);
+  return offset == 0 ? 0 : this->table_ + offset;
+}
+
+bool FlatTable::Follow(size_t pos, size_t* target) const {
+  if (pos == 0 || pos + 4 > this->size_) {
+    return false;
+  }
+  *target = pos + Load<uint32_t>(this->base_ + pos);
+  return *target < this->size_;
+}
+
+template <typename T>
+T FlatTable::Scalar(int field, T defaultValue) const {
+  size_t pos = FieldPos(field);
+  if (pos == 0 || pos + sizeof(T) > this->size_) {
+    return defaultValue;
+  }
+  return Load<T>(this->base_ + pos);
+}
+
+bool FlatTable::Table(int field, FlatTable* table) const {
+  size_t target;
+  return Follow(FieldPos(field), &target) && table->Init(this->base_, this->size_, target);
+}
+
+bool FlatTable::Vector(int field, size_t* elements, uint32_t* count) const {
+  size_t target;
+  if (!Follow(FieldPos(field), &target) || target + 4 > this->size_) {
+    return false;
+  }
+  *count = Load<uint32_t>(this->base_ + target);
+  *elements = target + 4;
+  return true;
+}
+
+bool FlatTable::TableAt(size_t elements, uint32_t index, FlatTable* table) const {
+  size_t target;
+  return Follow(elements + 4 * static_cast<size_t>(index), &target) && table->Init(this->base_, this->size_, target);
+}
+
+bool FlatTable::String(int field, string* value) const {
+  size_t elements;
+  uint32_t count;
+  if (!Vector(field, &elements, &count) || elements + count > this->size_) {
+    return false;
+  }
+  value->assign(reinterpret_cast<const char*>(this->base_ + elements), count);
+  return true;
+}
+
+const uint8_t* FlatTable::base() const {
+  return this->base_;
+}
+
+size_t FlatTable::size() const {
+  return this->size_;
+}
+
+/*
+ * ArrowWriter
+ */
+
+ArrowWriter::ArrowWriter(FILE* file, bool fileFormat) {
+  this->file_ = file;
+  this->buffer_ = NULL;
+  this->fileFormat_ = fileFormat;
+  this->position_ = 0;
+}
+
+ArrowWriter::ArrowWriter(string* buffer, bool fileFormat) {
+  this->file_ = NULL;
+  this->buffer_ = buffer;
+  this->fileFormat_ = fileFormat;
+  this->position_ = 0;
+}
+
+Status ArrowWriter::Append(const string& data) {
+  if (this->buffer_ != NULL) {
+    this->buffer_->append(data);
+  } else if (fwrite(data.data(), 1, data.size(), this->file_) != data.size()) {
+    return Status::IOError("Short write to export file");
+  }
+  this->position_ += data.size();
+  return Status::OK();
+}
+
+Status ArrowWriter::WriteMessage(const string& metadata, const string& body, Block* block) {
+  // Continuation marker and metadata length; Finish() already padded the
+  // flatbuffer so the body starts 8-byte aligned.
+  string prefix;
+  Push<int32_t>(&prefix, -1);
+  Push<int32_t>(&prefix, metadata.size());
+  if (block != NULL) {
+    block->offset = this->position_;
+    block->metadataLength = prefix.size() + metadata.size();
+    block->bodyLength = body.size();
+  }
+  KUDU_RETURN_NOT_OK(Append(prefix));
+  KUDU_RETURN_NOT_OK(Append(metadata));
+  return Append(body);
+}
+
+int ArrowWriter::EncodeSchema(FlatBuilder* fb, const vector<ColumnarBatch::Column>& fields) {
+  vector<int> tables;
+  for (const ColumnarBatch::Column& col : fields) {
+    int type = fb->Table();
+    uint8_t typeId = 0;
+    switch (col.type) {
+      case KuduColumnSchema::INT8:
+      case KuduColumnSchema::INT16:
+      case KuduColumnSchema::INT32:
+      case KuduColumnSchema::INT64:
+        fb->AddScalar(type, 0, col.width * 8, 4);
+        fb->AddScalar(type, 1, 1, 1);
+        typeId = kTypeInt;
+        break;
+      case KuduColumnSchema::FLOAT:
+        fb->AddScalar(type, 0, 1, 2);
+        typeId = kTypeFloatingPoint;
+        break;
+      case KuduColumnSchema::DOUBLE:
+        fb->AddScalar(type, 0, 2, 2);
+        typeId = kTypeFloatingPoint;
+        break;
+      case KuduColumnSchema::STRING:
+        typeId = kTypeUtf8;
+        break;
+      case KuduColumnSchema::BINARY:
+        typeId = kTypeBinary;
+        break;
+      case KuduColumnSchema::BOOL:
+        typeId = kTypeBool;
+        break;
+      case KuduColumnSchema::UNIXTIME_MICROS:
+        fb->AddScalar(type, 0, 2, 2);
+        fb->AddOffset(type, 1, fb->String("UTC"));
+        typeId = kTypeTimestamp;
+        break;
+      default:
+        break;
+    }
+    int field = fb->Table();
+    fb->AddOffset(field, 0, fb->String(col.name));
+    fb->AddScalar(field, 1, col.nullable, 1);
+    fb->AddScalar(field, 2, typeId, 1);
+    fb->AddOffset(field, 3, type);
+    fb->AddOffset(field, 5, fb->TableVector(vector<int>()));
+    tables.push_back(field);
+  }
+  int schema = fb->Table();
+  fb->AddScalar(schema, 0, 0, 2);
+  fb->AddOffset(schema, 1, fb->TableVector(tables));
+  return schema;
+}
+
+string ArrowWriter::EncodeRecordBatch(const ColumnarBatch& batch, string* body) {
+  string nodes;
+  string buffers;
+  int numBuffers = 0;
+  int64_t numRows = batch.num_rows();
+  auto addBuffer = [&](const char* data, size_t length) {
+    Push<int64_t>(&buffers, body->size());
+    Push<int64_t>(&buffers, length);
+    body->append(data, length);
+    Pad(body, 8);
+    numBuffers++;
+  };
+
+  for (const ColumnarBatch::Column& col : batch.columns()) {
+    Push<int64_t>(&nodes, numRows);
+    Push<int64_t>(&nodes, col.null_count);
+    if (col.null_count > 0) {
+      addBuffer(col.validity.data(), std::min<size_t>(col.validity.size(), (numRows + 7) / 8));
+    } else {
+      addBuffer("", 0);
+    }
+    if (!col.offsets.empty()) {
+      addBuffer(reinterpret_cast<const char*>(col.offsets.data()), col.offsets.size() * sizeof(int32_t));
+    }
+    addBuffer(col.values.data(), col.values.size());
+  }
+
+  FlatBuilder fb;
+  int recordBatch = fb.Table();
+  fb.AddScalar(recordBatch, 0, numRows, 8);
+  fb.AddOffset(recordBatch, 1, fb.StructVector(nodes, batch.columns().size(), 8));
+  fb.AddOffset(recordBatch, 2, fb.StructVector(buffers, numBuffers, 8));
+  int message = fb.Table();
+  fb.AddScalar(message, 0, kMetadataVersionV5, 2);
+  fb.AddScalar(message, 1, kHeaderRecordBatch, 1);
+  fb.AddOffset(message, 2, recordBatch);
+  fb.AddScalar(message, 3, body->size(), 8);
+  return fb.Finish(message);
+}
+
+Status ArrowWriter::WriteSchema(const ColumnarBatch& batch) {
+  if (this->fileFormat_) {
+    KUDU_RETURN_NOT_OK(Append(string(kArrowMagic, 8)));
+  }
+  for (const ColumnarBatch::Column& col : batch.columns()) {
+    if (col.type == KuduColumnSchema::DECIMAL) {
+      return Status::NotSupported("Unsupported column type for Arrow output: " + col.name);
+    }
+    ColumnarBatch::Column field;
+    field.name = col.name;
+    field.type = col.type;
+    field.nullable = col.nullable;
+    field.width = col.width;
+    field.null_count = 0;
+    this->fields_.push_back(field);
+  }
+
+  FlatBuilder fb;
+  int schema = EncodeSchema(&fb, this->fields_);
+  int message = fb.Table();
+  fb.AddScalar(message, 0, kMetadataVersionV5, 2);
+  fb.AddScalar(message, 1, kHeaderSchema, 1);
+  fb.AddOffset(message, 2, schema);
+  fb.AddScalar(message, 3, 0, 8);
+  return WriteMessage(fb.Finish(message), string(), NULL);
+}
+
+Status ArrowWriter::WriteBatch(const ColumnarBatch& batch) {
+  string body;
+  string metadata = EncodeRecordBatch(batch, &body);
+  Block block;
+  KUDU_RETURN_NOT_OK(WriteMessage(metadata, body, &block));
+  this->blocks_.push_back(block);
+  return Status::OK();
+}
+
+Status ArrowWriter::Finish() {
+  // End-of-stream marker.
+  string eos;
+  Push<int32_t>(&eos, -1);
+  Push<int32_t>(&eos, 0);
+  KUDU_RETURN_NOT_OK(Append(eos));
+  if (!this->fileFormat_) {
+    return Status::OK();
+  }
+
+  string blocks;
+  for (const Block& block : this->blocks_) {
+    Push<int64_t>(&blocks, block.offset);
+    Push<int32_t>(&blocks, block.metadataLength);
+    Push<int32_t>(&blocks, 0);
+    Push<int64_t>(&blocks, block.bodyLength);
+  }
+  FlatBuilder fb;
+  int footer = fb.Table();
+  fb.AddScalar(footer, 0, kMetadataVersionV5, 2);
+  fb.AddOffset(footer, 1, EncodeSchema(&fb, this->fields_));
+  fb.AddOffset(footer, 2, fb.StructVector(string(), 0, 8));
+  fb.AddOffset(footer, 3, fb.StructVector(blocks, this->blocks_.size(), 8));
+  string encoded = fb.Finish(footer);
+  Push<int32_t>(&encoded, encoded.size());
+  encoded.append(kArrowMagic, 6);
+  return Append(encoded);
+}
+
+int64_t ArrowWriter::bytes_written() const {
+  return this->position_;
+}
+
+/*
+ * ArrowReader
+ */
+
+ArrowReader::ArrowReader(const uint8_t* data, size_t length) {
+  this->data_ = data;
+  this->length_ = length;
+  this->position_ = 0;
+  this->numRows_ = 0;
+}
+
+Status ArrowReader::NextMessage(FlatTable* message, const uint8_t** body, int64_t* bodyLength, bool* done) {
+  *done = false;
+  if (this->position_ + 4 > this->length_) {
+    *done = true;
+    return Status::OK();
+  }
+  int32_t metadataLength = Load<int32_t>(this->data_ + this->position_);
+  this->position_ += 4;
+  if (metadataLength == -1) {
+    // Continuation marker, the real length follows.
+    if (this->position_ + 4 > this->length_) {
+      return Status::Corruption("Truncated Arrow IPC message");
+    }
+    metadataLength = Load<int32_t>(this->data_ + this->position_);
+    this->position_ += 4;
+  }
+  if (metadataLength == 0) {
+    *done = true;
+    return Status::OK();
+  }
+  if (metadataLength < 0 || this->position_ + metadataLength > this->length_) {
+    return Status::Corruption("Truncated Arrow IPC message");
+  }
+  if (!message->Root(this->data_ + this->position_, metadataLength)) {
+    return Status::Corruption("Invalid Arrow IPC message metadata");
+  }
+  this->position_ += metadataLength;
+  *bodyLength = message->Scalar<int64_t>(3, 0);
+  if (*bodyLength < 0 || this->position_ + *bodyLength > this->length_) {
+    return Status::Corruption("Truncated Arrow IPC message body");
+  }
+  *body = this->data_ + this->position_;
+  this->position_ += *bodyLength;
+  return Status::OK();
+}
+
+Status ArrowReader::ReadField(const FlatTable& field, Field* out) {
+  field.String(0, &out->name);
+  out->nullable = field.Scalar<uint8_t>(1, 0) != 0;
+  out->typeId = field.Scalar<uint8_t>(2, 0);
+  out->bitWidth = 0;
+  out->isSigned = true;
+  out->precision = 0;
+  out->unitDivisor = 1;
+  out->unitMultiplier = 1;
+
+  FlatTable dictionary;
+  if (field.Table(4, &dictionary)) {
+    return Status::NotSupported("Dictionary-encoded Arrow field: " + out->name);
+  }
+  size_t elements;
+  uint32_t children = 0;
+  if (field.Vector(5, &elements, &children) && children > 0) {
+    return Status::NotSupported("Nested Arrow field: " + out->name);
+  }
+
+  FlatTable type;
+  bool hasType = field.Table(3, &type);
+  switch (out->typeId) {
+    case kTypeInt:
+      out->bitWidth = hasType ? type.Scalar<int32_t>(0, 0) : 0;
+      out->isSigned = hasType && type.Scalar<uint8_t>(1, 0) != 0;
+      if (out->bitWidth != 8 && out->bitWidth != 16 && out->bitWidth != 32 && out->bitWidth != 64) {
+        return Status::NotSupported("Unsupported Arrow integer width for field " + out->name);
+      }
+      return Status::OK();
+    case kTypeFloatingPoint:
+      out->precision = hasType ? type.Scalar<int16_t>(0, 0) : 0;
+      if (out->precision != 1 && out->precision != 2) {
+        return Status::NotSupported("Unsupported Arrow float precision for field " + out->name);
+      }
+      return Status::OK();
+    case kTypeTimestamp:
+      switch (hasType ? type.Scalar<int16_t>(0, 0) : 0) {
+        case 0:
+          out->unitMultiplier = 1000000;
+          break;
+        case 1:
+          out->unitMultiplier = 1000;
+          break;
+        case 2:
+          break;
+        default:
+          out->unitDivisor = 1000;
+          break;
+      }
+      return Status::OK();
+    case kTypeUtf8:
+    case kTypeBinary:
+    case kTypeBool:
+      return Status::OK();
+    default:
+      return Status::NotSupported("Unsupported Arrow type for field " + out->name);
+  }
+}
+
+Status ArrowReader::ReadSchema() {
+  size_t end = this->length_;
+  if (this->length_ >= 8 + 10 && memcmp(this->data_, kArrowMagic, 6) == 0) {
+    // IPC file: skip the magic and stop where the footer starts.
+    int32_t footerLength = Load<int32_t>(this->data_ + this->length_ - 10);
+    if (footerLength < 0 || static_cast<size_t>(footerLength) + 18 > this->length_) {
+      return Status::Corruption("Invalid Arrow IPC file footer");
+    }
+    end = this->length_ - 10 - footerLength;
+    this->position_ = 8;
+  }
+  this->length_ = end;
+
+  FlatTable message;
+  const uint8_t* body;
+  int64_t bodyLength;
+  bool done;
+  KUDU_RETURN_NOT_OK(NextMessage(&message, &body, &bodyLength, &done));
+  FlatTable schema;
+  if (done || message.Scalar<uint8_t>(1, 0) != kHeaderSchema || !message.Table(2, &schema)) {
+    return Status::Corruption("Arrow IPC data does not start with a schema");
+  }
+  size_t elements;
+  uint32_t count;
+  if (!schema.Vector(1, &elements, &count)) {
+    return Status::Corruption("Arrow schema without fields");
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    FlatTable field;
+    if (!schema.TableAt(elements, i, &field)) {
+      return Status::Corruption("Invalid Arrow schema field");
+    }
+    Field f;
+    KUDU_RETURN_NOT_OK(ReadField(field, &f));
+    this->fields_.push_back(f);
+  }
+  return Status::OK();
+}
+
+Status ArrowReader::Next(bool* done) {
+  FlatTable message;
+  const uint8_t* body;
+  int64_t bodyLength;
+  for (;;) {
+    KUDU_RETURN_NOT_OK(NextMessage(&message, &body, &bodyLength, done));
+    if (*done) {
+      return Status::OK();
+    }
+    uint8_t headerType = message.Scalar<uint8_t>(1, 0);
+    if (headerType == kHeaderDictionaryBatch) {
+      return Status::NotSupported("Arrow dictionary batches are not supported");
+    }
+    if (headerType == kHeaderRecordBatch) {
+      break;
+    }
+  }
+
+  FlatTable batch;
+  FlatTable compression;
+  if (!message.Table(2, &batch)) {
+    return Status::Corruption("Invalid Arrow record batch");
+  }
+  if (batch.Table(3, &compression)) {
+    return Status::NotSupported("Compressed Arrow record batches are not supported");
+  }
+  int64_t length = batch.Scalar<int64_t>(0, 0);
+  size_t nodes;
+  uint32_t numNodes;
+  size_t buffers;
+  uint32_t numBuffers;
+  if (!batch.Vector(1, &nodes, &numNodes) || !batch.Vector(2, &buffers, &numBuffers) ||
+      numNodes != this->fields_.size() || nodes + 16 * static_cast<size_t>(numNodes) > batch.size() ||
+      buffers + 16 * static_cast<size_t>(numBuffers) > batch.size()) {
+    return Status::Corruption("Arrow record batch does not match its schema");
+  }
+
+  const uint8_t* meta = batch.base();
+  uint32_t bufferIndex = 0;
+  auto nextBuffer = [&](Buffer* out) {
+    if (bufferIndex >= numBuffers) {
+      return false;
+    }
+    const uint8_t* entry = meta + buffers + 16 * bufferIndex++;
+    int64_t offset = Load<int64_t>(entry);
+    int64_t size = Load<int64_t>(entry + 8);
+    if (offset < 0 || size < 0 || offset + size > bodyLength) {
+      return false;
+    }
+    out->data = body + offset;
+    out->length = size;
+    return true;
+  };
+
+  this->arrays_.clear();
+  for (size_t i = 0; i < this->fields_.size(); i++) {
+    const Field& field = this->fields_[i];
+    Array a;
+    a.nullCount = Load<int64_t>(meta + nodes + 16 * i + 8);
+    a.offsets.data = NULL;
+    a.offsets.length = 0;
+    int64_t needed;
+    bool ok = Load<int64_t>(meta + nodes + 16 * i) == length && nextBuffer(&a.validity);
+    if (field.typeId == kTypeUtf8 || field.typeId == kTypeBinary) {
+      ok = ok && nextBuffer(&a.offsets) && nextBuffer(&a.values) && (length == 0 ||
+          (a.offsets.length >= (length + 1) * 4 && Load<int32_t>(a.offsets.data + length * 4) <= a.values.length));
+      needed = 0;
+    } else if (field.typeId == kTypeBool) {
+      ok = ok && nextBuffer(&a.values);
+      needed = (length + 7) / 8;
+    } else if (field.typeId == kTypeInt) {
+      ok = ok && nextBuffer(&a.values);
+      needed = length * field.bitWidth / 8;
+    } else {
+      ok = ok && nextBuffer(&a.values);
+      needed = length * (field.precision == 1 ? 4 : 8);
+    }
+    if (!ok || a.values.length < needed ||
+        (a.nullCount > 0 && a.validity.length < (length + 7) / 8)) {
+      return Status::Corruption("Invalid Arrow buffers for field " + field.name);
+    }
+    this->arrays_.push_back(a);
+  }
+  this->numRows_ = length;
+  return Status::OK();
+}
+
+const vector<ArrowReader::Field>& ArrowReader::fields() const {
+  return this->fields_;
+}
+
+int64_t ArrowReader::num_rows() const {
+  return this->numRows_;
+}
+
+bool ArrowReader::IsNull(int field, int64_t row) const {
+  const Array& a = this->arrays_[field];
+  return a.nullCount > 0 && !GetBit(a.validity.data, row);
+}
+
+bool ArrowReader::IsIntegral(int field) const {
+  uint8_t typeId = this->fields_[field].typeId;
+  return typeId == kTypeInt || typeId == kTypeBool || typeId == kTypeTimestamp;
+}
+
+bool ArrowReader::IsBinary(int field) const {
+  uint8_t typeId = this->fields_[field].typeId;
+  return typeId == kTypeUtf8 || typeId == kTypeBinary;
+}
+
+int64_t ArrowReader::GetInt(int field, int64_t row) const {
+  const Field& f = this->fields_[field];
+  const uint8_t* values = this->arrays_[field].values.data;
+  switch (f.typeId) {
+    case kTypeInt:
+      switch (f.bitWidth) {
+        case 8:
+          return f.isSigned ? Load<int8_t>(values + row) : Load<uint8_t>(values + row);
+        case 16:
+          return f.isSigned ? Load<int16_t>(values + row * 2) : Load<uint16_t>(values + row * 2);
+        case 32:
+          return f.isSigned ? Load<int32_t>(values + row * 4) : Load<uint32_t>(values + row * 4);
+        default:
+          return Load<int64_t>(values + row * 8);
+      }
+    case kTypeBool:
+      return GetBit(values, row);
+    case kTypeTimestamp:
+      return Load<int64_t>(values + row * 8) * f.unitMultiplier / f.unitDivisor;
+    case kTypeFloatingPoint:
+      return static_cast<int64_t>(GetDouble(field, row));
+    default:
+      return 0;
+  }
+}
+
+double ArrowReader::GetDouble(int field, int64_t row) const {
+  const Field& f = this->fields_[field];
+  if (f.typeId != kTypeFloatingPoint) {
+    return static_cast<double>(GetInt(field, row));
+  }
+  const uint8_t* values = this->arrays_[field].values.data;
+  return f.precision == 1 ? Load<float>(values + row * 4) : Load<double>(values + row * 8);
+}
+
+kudu::Slice ArrowReader::GetBytes(int field, int64_t row) const {
+  const Array& a = this->arrays_[field];
+  if (a.offsets.data == NULL) {
+    return kudu::Slice();
+  }
+  int32_t start = Load<int32_t>(a.offsets.data + row * 4);
+  int32_t end = Load<int32_t>(a.offsets.data + (row + 1) * 4);
+  if (start < 0 || end < start || end > a.values.length) {
+    return kudu::Slice();
+  }
+  return kudu::Slice(a.values.data + start, end - start);
+}
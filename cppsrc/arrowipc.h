@@ -0,0 +1,149 @@
+#ifndef KUDUJS_ARROWIPC_H
+#define KUDUJS_ARROWIPC_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "columnarbatch.h"
+
+using std::string;
+using std::vector;
+using kudu::Status;
+
+// Minimal flatbuffers serializer, just enough to encode the Arrow IPC
+// metadata (Message, Schema, RecordBatch and Footer tables). Objects are laid
+// out parent first, so every uoffset points forward as the format requires.
+class FlatBuilder {
+ public:
+  int Table();
+  void AddScalar(int table, int field, uint64_t bits, int size);
+  void AddOffset(int table, int field, int child);
+  int String(const string& value);
+  int TableVector(const vector<int>& tables);
+  int StructVector(const string& raw, int count, int align);
+  string Finish(int root);
+
+ private:
+  enum Kind { TABLE, STRING, TABLE_VECTOR, STRUCT_VECTOR };
+  struct Slot {
+    int field;
+    int size;
+    uint64_t bits;
+    int child; // -1 for scalars
+  };
+  struct Node {
+    Kind kind;
+    vector<Slot> slots;
+    vector<int> children;
+    string data;
+    int count;
+    int align;
+  };
+  vector<Node> nodes_;
+  size_t Write(int node, string* buf);
+};
+
+// Bounds-checked view over a serialized flatbuffers table.
+class FlatTable {
+ public:
+  FlatTable();
+  bool Init(const uint8_t* base, size_t size, size_t table);
+  bool Root(const uint8_t* base, size_t size);
+  template <typename T> T Scalar(int field, T defaultValue) const;
+  bool Table(int field, FlatTable* table) const;
+  bool Vector(int field, size_t* elements, uint32_t* count) const;
+  bool TableAt(size_t elements, uint32_t index, FlatTable* table) const;
+  bool String(int field, string* value) const;
+  const uint8_t* base() const;
+  size_t size() const;
+
+ private:
+  const uint8_t* base_;
+  size_t size_;
+  size_t table_;
+  size_t vtable_;
+  uint16_t vtableSize_;
+  size_t FieldPos(int field) const;
+  bool Follow(size_t pos, size_t* target) const;
+};
+
+// Writes ColumnarBatch instances as an Arrow IPC stream, or as an Arrow IPC
+// file when fileFormat is set. Every message is assembled in memory first so
+// that it reaches the output with a single large sequential write.
+class ArrowWriter {
+ public:
+  ArrowWriter(FILE* file, bool fileFormat);
+  ArrowWriter(string* buffer, bool fileFormat);
+  Status WriteSchema(const ColumnarBatch& batch);
+  Status WriteBatch(const ColumnarBatch& batch);
+  Status Finish();
+  int64_t bytes_written() const;
+
+ private:
+  struct Block {
+    int64_t offset;
+    int32_t metadataLength;
+    int64_t bodyLength;
+  };
+  FILE* file_;
+  string* buffer_;
+  bool fileFormat_;
+  int64_t position_;
+  vector<ColumnarBatch::Column> fields_;
+  vector<Block> blocks_;
+  Status Append(const string& data);
+  Status WriteMessage(const string& metadata, const string& body, Block* block);
+  static int EncodeSchema(FlatBuilder* fb, const vector<ColumnarBatch::Column>& fields);
+  static string EncodeRecordBatch(const ColumnarBatch& batch, string* body);
+};
+
+// Decodes an Arrow IPC stream (or the stream part of an IPC file) in place.
+// Only flat, uncompressed columns are supported: integers, floating point,
+// bool, utf8, binary and timestamps, which covers every Kudu column type.
+class ArrowReader {
+ public:
+  struct Field {
+    string name;
+    bool nullable;
+    uint8_t typeId;
+    int bitWidth; // Int only
+    bool isSigned;
+    int precision; // FloatingPoint only
+    int64_t unitDivisor; // Timestamp only, divisor that converts to micros
+    int64_t unitMultiplier;
+  };
+
+  ArrowReader(const uint8_t* data, size_t length);
+  Status ReadSchema();
+  Status Next(bool* done);
+  const vector<Field>& fields() const;
+  int64_t num_rows() const;
+  bool IsNull(int field, int64_t row) const;
+  bool IsIntegral(int field) const;
+  bool IsBinary(int field) const;
+  int64_t GetInt(int field, int64_t row) const;
+  double GetDouble(int field, int64_t row) const;
+  kudu::Slice GetBytes(int field, int64_t row) const;
+
+ private:
+  struct Buffer {
+    const uint8_t* data;
+    int64_t length;
+  };
+  struct Array {
+    int64_t nullCount;
+    Buffer validity;
+    Buffer values;
+    Buffer offsets;
+  };
+  const uint8_t* data_;
+  size_t length_;
+  size_t position_;
+  int64_t numRows_;
+  vector<Field> fields_;
+  vector<Array> arrays_;
+  Status NextMessage(FlatTable* message, const uint8_t** body, int64_t* bodyLength, bool* done);
+  Status ReadField(const FlatTable& field, Field* out);
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "columnarbatch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using kudu::Slice;
+
+// STRING/BINARY offsets are int32, as in Arrow's non-large string types.
+static const size_t kMaxValueBytes = std::numeric_limits<int32_t>::max();
+
+static Status ValuesTooLarge(const string& column) {
+  return Status::RuntimeError("Column " + column + " holds more than 2 GiB of values in one result,"
+                              " narrow the scan with predicates, a projection or a limit");
+}
+
+ColumnarBatch::ColumnarBatch(const KuduSchema& schema) {
+  this->num_rows_ = 0;
+  for (int i = 0, l = schema.num_columns(); i < l; i++) {
+    KuduColumnSchema col = schema.Column(i);
+    Column c;
+    c.name = col.name();
+    c.type = col.type();
+    c.nullable = col.is_nullable();
+    c.width = ValueWidth(col.type());
+    c.null_count = 0;
+    if (c.type == KuduColumnSchema::STRING || c.type == KuduColumnSchema::BINARY) {
+      c.offsets.push_back(0);
+    }
+    this->columns_.push_back(c);
+  }
+}
+
+ColumnarBatch::ColumnarBatch(const vector<Column>& shape) {
+  this->num_rows_ = 0;
+  for (const Column& from : shape) {
+    Column c;
+    c.name = from.name;
+    c.type = from.type;
+    c.nullable = from.nullable;
+    c.width = from.width;
+    c.null_count = 0;
+    if (c.type == KuduColumnSchema::STRING || c.type == KuduColumnSchema::BINARY) {
+      c.offsets.push_back(0);
+    }
+    this->columns_.push_back(c);
+  }
+}
+
+int ColumnarBatch::ValueWidth(KuduColumnSchema::DataType type) {
+  switch (type) {
+    case KuduColumnSchema::INT8:
+      return 1;
+    case KuduColumnSchema::INT16:
+      return 2;
+    case KuduColumnSchema::INT32:
+    case KuduColumnSchema::FLOAT:
+      return 4;
+    case KuduColumnSchema::INT64:
+    case KuduColumnSchema::DOUBLE:
+    case KuduColumnSchema::UNIXTIME_MICROS:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+template <typename T>
+static int CompareFixed(const string& a, int64_t ra, const string& b, int64_t rb) {
+  T x;
+  T y;
+  memcpy(&x, a.data() + ra * sizeof(T), sizeof(T));
+  memcpy(&y, b.data() + rb * sizeof(T), sizeof(T));
+  return x < y ? -1 : (y < x ? 1 : 0);
+}
+
+int ColumnarBatch::CompareValues(const Column& a, int64_t ra, const Column& b, int64_t rb) {
+  switch (a.type) {
+    case KuduColumnSchema::INT8:
+      return CompareFixed<int8_t>(a.values, ra, b.values, rb);
+    case KuduColumnSchema::INT16:
+      return CompareFixed<int16_t>(a.values, ra, b.values, rb);
+    case KuduColumnSchema::INT32:
+      return CompareFixed<int32_t>(a.values, ra, b.values, rb);
+    case KuduColumnSchema::INT64:
+    case KuduColumnSchema::UNIXTIME_MICROS:
+      return CompareFixed<int64_t>(a.values, ra, b.values, rb);
+    case KuduColumnSchema::FLOAT:
+      return CompareFixed<float>(a.values, ra, b.values, rb);
+    case KuduColumnSchema::DOUBLE:
+      return CompareFixed<double>(a.values, ra, b.values, rb);
+    case KuduColumnSchema::BOOL:
+    {
+      bool x = (a.values[ra >> 3] & (1 << (ra & 7))) != 0;
+      bool y = (b.values[rb >> 3] & (1 << (rb & 7))) != 0;
+      return x == y ? 0 : (x ? 1 : -1);
+    }
+    case KuduColumnSchema::STRING:
+    case KuduColumnSchema::BINARY:
+    {
+      // Byte-wise, the order Kudu uses for keys.
+      size_t lx = a.offsets[ra + 1] - a.offsets[ra];
+      size_t ly = b.offsets[rb + 1] - b.offsets[rb];
+      int cmp = memcmp(a.values.data() + a.offsets[ra], b.values.data() + b.offsets[rb], std::min(lx, ly));
+      if (cmp != 0) {
+        return cmp < 0 ? -1 : 1;
+      }
+      return lx == ly ? 0 : (lx < ly ? -1 : 1);
+    }
+    default:
+      return 0;
+  }
+}
+
+void ColumnarBatch::AppendBit(string* bitmap, int64_t index, bool value) {
+  size_t byte = index >> 3;
+  if (bitmap->size() <= byte) {
+    bitmap->resize(byte + 1, 0);
+  }
+  if (value) {
+    (*bitmap)[byte] |= static_cast<char>(1 << (index & 7));
+  } else {
+    (*bitmap)[byte] &= static_cast<char>(~(1 << (index & 7)));
+  }
+}
+
+Status ColumnarBatch::Append(const KuduScanBatch& batch) {
+  int n = batch.NumRows();
+  // Column-at-a-time so the type dispatch happens once per column and batch.
+  for (size_t c = 0; c < this->columns_.size(); c++) {
+    Column& col = this->columns_[c];
+    if (col.type == KuduColumnSchema::DECIMAL) {
+      // Not materialized, the column stays empty and readers leave it out.
+      continue;
+    }
+    for (int r = 0; r < n; r++) {
+      KuduScanBatch::RowPtr row = batch.Row(r);
+      int64_t index = this->num_rows_ + r;
+      bool isNull = col.nullable && row.IsNull(c);
+      if (isNull && col.validity.empty()) {
+        // First null of this column: every previous row was valid.
+        col.validity.assign((index >> 3) + 1, static_cast<char>(0xFF));
+      }
+      if (isNull) {
+        col.null_count++;
+      }
+      if (!col.validity.empty()) {
+        AppendBit(&col.validity, index, !isNull);
+      }
+
+      switch (col.type) {
+        case KuduColumnSchema::BOOL:
+        {
+          bool val = false;
+          if (!isNull) {
+            row.GetBool(c, &val);
+          }
+          AppendBit(&col.values, index, val);
+          break;
+        }
+        case KuduColumnSchema::STRING:
+        case KuduColumnSchema::BINARY:
+        {
+          if (!isNull) {
+            Slice val;
+            if (col.type == KuduColumnSchema::STRING) {
+              row.GetString(c, &val);
+            } else {
+              row.GetBinary(c, &val);
+            }
+            if (col.values.size() + val.size() > kMaxValueBytes) {
+              return ValuesTooLarge(col.name);
+            }
+            col.values.append(reinterpret_cast<const char*>(val.data()), val.size());
+          }
+          col.offsets.push_back(static_cast<int32_t>(col.values.size()));
+          break;
+        }
+        default:
+        {
+          if (isNull) {
+            col.values.append(col.width, '\0');
+          } else {
+            col.values.append(static_cast<const char*>(row.cell(c)), col.width);
+          }
+          break;
+        }
+      }
+    }
+  }
+  this->num_rows_ += n;
+  return Status::OK();
+}
+
+void ColumnarBatch::AppendRow(const ColumnarBatch& source, int64_t row) {
+  for (size_t c = 0; c < this->columns_.size(); c++) {
+    AppendValue(c, source, c, row);
+  }
+  this->num_rows_++;
+}
+
+void ColumnarBatch::AppendCells(size_t first, const ColumnarBatch& source, const vector<int>& columns, int64_t row) {
+  for (size_t i = 0; i < columns.size(); i++) {
+    AppendValue(first + i, source, columns[i], row);
+  }
+}
+
+void ColumnarBatch::EndRow() {
+  this->num_rows_++;
+}
+
+void ColumnarBatch::AppendValue(size_t column, const ColumnarBatch& source, size_t sourceColumn, int64_t row) {
+  int64_t index = this->num_rows_;
+  Column& col = this->columns_[column];
+  const Column& from = source.columns_[sourceColumn];
+  bool isNull = source.IsNull(sourceColumn, row);
+  if (isNull && col.validity.empty()) {
+    col.validity.assign((index >> 3) + 1, static_cast<char>(0xFF));
+  }
+  if (isNull) {
+    col.null_count++;
+  }
+  if (!col.validity.empty()) {
+    AppendBit(&col.validity, index, !isNull);
+  }
+
+  switch (col.type) {
+    case KuduColumnSchema::BOOL:
+      AppendBit(&col.values, index, (from.values[row >> 3] & (1 << (row & 7))) != 0);
+      break;
+    case KuduColumnSchema::STRING:
+    case KuduColumnSchema::BINARY:
+    {
+      size_t length = from.offsets[row + 1] - from.offsets[row];
+      if (col.values.size() + length > kMaxValueBytes) {
+        // The row keeps an empty value so offsets stay valid until the
+        // caller sees CheckSize fail and drops the batch.
+        if (this->overflow_.empty()) {
+          this->overflow_ = col.name;
+        }
+        length = 0;
+      }
+      col.values.append(from.values, from.offsets[row], length);
+      col.offsets.push_back(static_cast<int32_t>(col.values.size()));
+      break;
+    }
+    default:
+      col.values.append(from.values, row * col.width, col.width);
+      break;
+  }
+}
+
+Status ColumnarBatch::CheckSize() const {
+  return this->overflow_.empty() ? Status::OK() : ValuesTooLarge(this->overflow_);
+}
+
+void ColumnarBatch::Clear() {
+  this->num_rows_ = 0;
+  this->overflow_.clear();
+  for (Column& col : this->columns_) {
+    col.null_count = 0;
+    col.validity.clear();
+    col.values.clear();
+    if (!col.offsets.empty()) {
+      col.offsets.assign(1, 0);
+    }
+  }
+}
+
+int64_t ColumnarBatch::num_rows() const {
+  return this->num_rows_;
+}
+
+bool ColumnarBatch::IsNull(size_t column, int64_t row) const {
+  const string& validity = this->columns_[column].validity;
+  return !validity.empty() && (validity[row >> 3] & (1 << (row & 7))) == 0;
+}
+
+size_t ColumnarBatch::ByteSize() const {
+  size_t size = 0;
+  for (const Column& col : this->columns_) {
+    size += col.validity.size() + col.values.size() + col.offsets.size() * sizeof(int32_t);
+  }
+  return size;
+}
+
+const vector<ColumnarBatch::Column>& ColumnarBatch::columns() const {
+  return this->columns_;
+}
@@ -0,0 +1,65 @@
+#ifndef KUDUJS_COLUMNARBATCH_H
+#define KUDUJS_COLUMNARBATCH_H
+
+#include <string>
+#include <vector>
+#include <kudu/client/client.h>
+#include <kudu/client/scan_batch.h>
+
+using std::string;
+using std::vector;
+using kudu::Status;
+using kudu::client::KuduColumnSchema;
+using kudu::client::KuduScanBatch;
+using kudu::client::KuduSchema;
+
+// Column-major copy of one or more KuduScanBatch, laid out the way Apache
+// Arrow expects it: LSB validity bitmaps, bit-packed booleans and int32
+// offsets followed by the raw bytes for STRING/BINARY columns. DECIMAL
+// columns keep their place in the shape but hold no values, as scanRow has
+// always left them out. A STRING/BINARY column is capped at 2 GiB of values.
+class ColumnarBatch {
+ public:
+  struct Column {
+    string name;
+    KuduColumnSchema::DataType type;
+    bool nullable;
+    int width; // bytes per value, 0 for BOOL and variable length columns
+    int64_t null_count;
+    string validity; // empty while the column has no nulls
+    string values;
+    vector<int32_t> offsets; // STRING/BINARY only, num_rows + 1 entries
+  };
+
+  explicit ColumnarBatch(const KuduSchema& schema);
+  // Empty batch with the given columns, which may come from several batches.
+  explicit ColumnarBatch(const vector<Column>& shape);
+  Status Append(const KuduScanBatch& batch);
+  // Copies one row of a batch with the same columns. Values that would push a
+  // column past 2 GiB are left empty and fail CheckSize.
+  void AppendRow(const ColumnarBatch& source, int64_t row);
+  // Copies the given columns of one source row into consecutive columns
+  // starting at first. A row built this way is complete once EndRow is called.
+  void AppendCells(size_t first, const ColumnarBatch& source, const vector<int>& columns, int64_t row);
+  void EndRow();
+  // Fails once AppendRow or AppendCells dropped a value, the batch is then unusable.
+  Status CheckSize() const;
+  void Clear();
+  int64_t num_rows() const;
+  bool IsNull(size_t column, int64_t row) const;
+  size_t ByteSize() const;
+  const vector<Column>& columns() const;
+  static int ValueWidth(KuduColumnSchema::DataType type);
+  // Orders two non-null values of columns of the same type: numerically, or
+  // byte-wise for strings and binaries. Returns -1, 0 or 1.
+  static int CompareValues(const Column& a, int64_t ra, const Column& b, int64_t rb);
+
+ private:
+  int64_t num_rows_;
+  vector<Column> columns_;
+  string overflow_; // first column that outgrew its offsets, empty if none
+  static void AppendBit(string* bitmap, int64_t index, bool value);
+  void AppendValue(size_t column, const ColumnarBatch& source, size_t sourceColumn, int64_t row);
+};
+
+#endif
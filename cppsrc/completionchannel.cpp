@@ -0,0 +1,221 @@
+#include "completionchannel.h"
+#include "rowmaterializer.h"
+
+#include <algorithm>
+
+CompletionWindow::CompletionWindow(size_t size) : size_(std::max<size_t>(size, 1)), out_(0) {
+}
+
+bool CompletionWindow::TryAcquire() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->out_ >= this->size_) {
+    return false;
+  }
+  this->out_++;
+  return true;
+}
+
+void CompletionWindow::Release() {
+  std::function<void()> resume;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->out_--;
+    resume.swap(this->resume_);
+  }
+  if (resume) {
+    resume();
+  }
+}
+
+bool CompletionWindow::ResumeOnRelease(std::function<void()> resume) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->out_ < this->size_) {
+    return false;
+  }
+  this->resume_ = resume;
+  return true;
+}
+
+void CompletionWindow::Abandon() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->resume_ = nullptr;
+}
+
+Completion::Completion(Kind kind, int64_t id, const string& table)
+    : kind(kind), id(id), table(table), rows(0), last(false), next(NULL) {
+}
+
+Completion::~Completion() {
+  if (this->window) {
+    this->window->Release();
+  }
+}
+
+CompletionChannel::CompletionChannel(const CompletionOptions& options)
+    : options_(options), head_(&stub_), tail_(&stub_), stub_(Completion::FLUSH, 0, ""),
+      scheduled_(false), closed_(false), opened_(false), pushed_(0), delivered_(0),
+      dropped_(0), ticks_(0), wakeups_(0) {
+  this->options_.maxPerTick = std::max<size_t>(this->options_.maxPerTick, 1);
+}
+
+CompletionChannel::~CompletionChannel() {
+  Completion* completion;
+  while ((completion = Pop()) != NULL) {
+    // Only reached with completions left once the event loop is gone, and
+    // possibly on another thread, so paused scans stay paused.
+    if (completion->window) {
+      completion->window->Abandon();
+    }
+    delete completion;
+  }
+  if (this->opened_) {
+    this->tsfn_.Release();
+  }
+}
+
+void CompletionChannel::Open(Napi::Env env, const Napi::Function& callback) {
+  this->tsfn_ = Napi::ThreadSafeFunction::New(env, callback, "kudujs:completions", 0, 1);
+  // An idle listener must not keep the process from exiting.
+  this->tsfn_.Unref(env);
+  this->opened_ = true;
+}
+
+void CompletionChannel::Push(Completion* completion) {
+  if (this->closed_) {
+    this->dropped_++;
+    delete completion;
+    return;
+  }
+  this->pushed_++;
+  Enqueue(completion);
+  Schedule();
+}
+
+void CompletionChannel::Close() {
+  this->closed_ = true;
+}
+
+CompletionMetrics CompletionChannel::metrics() const {
+  CompletionMetrics metrics;
+  metrics.pushed = this->pushed_;
+  metrics.delivered = this->delivered_;
+  metrics.dropped = this->dropped_;
+  metrics.ticks = this->ticks_;
+  metrics.wakeups = this->wakeups_;
+  return metrics;
+}
+
+// Vyukov's intrusive MPSC queue: producers only swap the head and link the
+// previous one to it, so pushing never waits on another thread.
+void CompletionChannel::Enqueue(Completion* completion) {
+  completion->next.store(NULL, std::memory_order_relaxed);
+  Completion* previous = this->head_.exchange(completion, std::memory_order_acq_rel);
+  previous->next.store(completion, std::memory_order_release);
+}
+
+// Returns NULL when the queue is empty, or when a producer has swapped the
+// head but not linked it yet; that producer schedules a drain of its own.
+Completion* CompletionChannel::Pop() {
+  Completion* tail = this->tail_;
+  Completion* next = tail->next.load(std::memory_order_acquire);
+  if (tail == &this->stub_) {
+    if (next == NULL) {
+      return NULL;
+    }
+    this->tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next != NULL) {
+    this->tail_ = next;
+    return tail;
+  }
+  if (tail != this->head_.load(std::memory_order_acquire)) {
+    return NULL;
+  }
+  // The last completion can only be taken once something follows it.
+  Enqueue(&this->stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next != NULL) {
+    this->tail_ = next;
+    return tail;
+  }
+  return NULL;
+}
+
+// Wakes the event loop unless a drain is already pending. Each pending call
+// holds a reference, so the channel outlives the calls it queued.
+void CompletionChannel::Schedule() {
+  if (this->scheduled_.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  this->wakeups_++;
+  std::shared_ptr<CompletionChannel>* self = new std::shared_ptr<CompletionChannel>(shared_from_this());
+  napi_status status = this->tsfn_.NonBlockingCall(self,
+      [](Napi::Env env, Napi::Function callback, std::shared_ptr<CompletionChannel>* self) {
+        (*self)->Deliver(env, callback);
+        delete self;
+      });
+  if (status != napi_ok) {
+    // Nothing is pending after all, so a later push may try again.
+    this->scheduled_.store(false, std::memory_order_seq_cst);
+    delete self;
+  }
+}
+
+void CompletionChannel::Deliver(Napi::Env env, Napi::Function callback) {
+  // Cleared before draining, so anything pushed from now on schedules again.
+  this->scheduled_.store(false, std::memory_order_seq_cst);
+  vector<Completion*> ready;
+  Completion* completion;
+  while (ready.size() < this->options_.maxPerTick && (completion = Pop()) != NULL) {
+    ready.push_back(completion);
+  }
+  if (ready.size() == this->options_.maxPerTick) {
+    // Probably more left, delivered on a later tick so I/O is not starved.
+    Schedule();
+  }
+  if (ready.empty()) {
+    return;
+  }
+
+  Napi::HandleScope scope(env);
+  Napi::Array events = Napi::Array::New(env, ready.size());
+  for (size_t i = 0; i < ready.size(); i++) {
+    events.Set(static_cast<uint32_t>(i), ToValue(env, *ready[i]));
+    delete ready[i];
+  }
+  this->delivered_ += ready.size();
+  this->ticks_++;
+  callback.Call({ events });
+}
+
+Napi::Value CompletionChannel::ToValue(Napi::Env env, const Completion& completion) {
+  Napi::Object event = Napi::Object::New(env);
+  event.Set("type", completion.kind == Completion::FLUSH ? "flush" : "batch");
+  event.Set("id", Napi::Number::New(env, completion.id));
+  event.Set("table", completion.table);
+  event.Set("rows", Napi::Number::New(env, completion.rows));
+  if (!completion.status.ok()) {
+    event.Set("error", completion.status.ToString());
+  }
+  if (completion.kind == Completion::FLUSH) {
+    Napi::Array errors = Napi::Array::New(env, completion.errors.size());
+    for (size_t i = 0; i < completion.errors.size(); i++) {
+      Napi::Object error = Napi::Object::New(env);
+      error.Set("status", completion.errors[i].status);
+      error.Set("row", completion.errors[i].row);
+      errors.Set(static_cast<uint32_t>(i), error);
+    }
+    event.Set("errors", errors);
+    return event;
+  }
+
+  if (completion.batch != nullptr) {
+    RowMaterializer materializer(env, *completion.batch, RowMaterializer::COLUMNS, false);
+    materializer.Append(*completion.batch);
+    event.Set("columns", materializer.Result().As<Napi::Object>().Get("columns"));
+  }
+  event.Set("last", Napi::Boolean::New(env, completion.last));
+  return event;
+}
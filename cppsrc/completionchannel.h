@@ -0,0 +1,133 @@
+#ifndef KUDUJS_COMPLETIONCHANNEL_H
+#define KUDUJS_COMPLETIONCHANNEL_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <napi.h>
+#include "kuduclass.h"
+#include "columnarbatch.h"
+#include "memtracker.h"
+
+using kudu::client::KuduScanner;
+using kudu::client::KuduSession;
+
+struct CompletionOptions {
+  size_t maxPerTick; // completions handed to one listener call
+};
+
+struct CompletionMetrics {
+  int64_t pushed;
+  int64_t delivered;
+  int64_t dropped; // pushed after the channel closed
+  int64_t ticks; // listener calls
+  int64_t wakeups; // event loop wakeups requested by producers
+};
+
+// Bounds the completions of one producer that are pushed but not yet
+// delivered or dropped. Each holds a slot until it is deleted. A producer that
+// finds the window full stops instead of waiting, and is resumed by the
+// delivery that frees a slot.
+class CompletionWindow {
+ public:
+  explicit CompletionWindow(size_t size);
+  // Takes a slot if one is free.
+  bool TryAcquire();
+  void Release();
+  // Has the next Release run resume, from the JS thread that delivers the
+  // completion. Returns false, dropping resume, if a slot is already free.
+  bool ResumeOnRelease(std::function<void()> resume);
+  // Drops resume without running it, for completions deleted off the JS thread.
+  void Abandon();
+
+ private:
+  std::mutex mutex_;
+  size_t size_;
+  size_t out_;
+  std::function<void()> resume_;
+};
+
+struct RowError {
+  string status;
+  string row;
+};
+
+// Something that finished off the JS thread: an asynchronous flush, a
+// background flush of coalesced writes or one batch of a streamed scan.
+struct Completion {
+  enum Kind { FLUSH, SCAN_BATCH };
+
+  Kind kind;
+  int64_t id; // of the call that started it, 0 for background work
+  string table;
+  Status status;
+  int64_t rows;
+  vector<RowError> errors; // rows the tablet servers rejected
+  std::unique_ptr<ColumnarBatch> batch;
+  bool last; // final batch of its scan
+  // A flushed session is kept until its completion is delivered or dropped.
+  shared_ptr<KuduSession> session;
+  std::unique_ptr<MemoryReservation> memory;
+  std::shared_ptr<CompletionWindow> window; // slot given back on delete
+  std::atomic<Completion*> next;
+
+  Completion(Kind kind, int64_t id, const string& table);
+  ~Completion();
+};
+
+// A streamed scan between its runs on the thread pool. Each run pushes
+// batches until the scan ends or its window is full.
+struct StreamScanState {
+  std::shared_ptr<CompletionChannel> channel;
+  shared_ptr<KuduTable> table;
+  std::unique_ptr<KuduScanner> scanner;
+  std::shared_ptr<CompletionWindow> window;
+  std::shared_ptr<TrafficRecorder> recorder; // when the scan began
+  int64_t start;
+  int64_t rows;
+  bool done;
+};
+
+// Carries completions from Kudu reactor threads and native workers to a JS
+// listener. Producers push onto an intrusive lock-free MPSC queue and only
+// the one that finds the channel idle wakes the event loop, through a
+// ThreadSafeFunction call; the JS thread then drains up to maxPerTick
+// completions into a single listener call. However many completions arrive
+// between two ticks, they cost one wakeup and one call into JS.
+class CompletionChannel : public std::enable_shared_from_this<CompletionChannel> {
+ public:
+  explicit CompletionChannel(const CompletionOptions& options);
+  ~CompletionChannel();
+  // Starts delivering to callback, from the JS thread. The channel must be
+  // owned by a shared_ptr.
+  void Open(Napi::Env env, const Napi::Function& callback);
+  // Takes ownership of the completion, from any thread.
+  void Push(Completion* completion);
+  // Completions pushed from now on are dropped; those queued are delivered.
+  void Close();
+  CompletionMetrics metrics() const;
+
+ private:
+  CompletionOptions options_;
+  Napi::ThreadSafeFunction tsfn_;
+  std::atomic<Completion*> head_; // last pushed, swapped by producers
+  Completion* tail_; // next to pop, only touched by the JS thread
+  Completion stub_;
+  std::atomic<bool> scheduled_; // a drain is pending on the event loop
+  std::atomic<bool> closed_;
+  bool opened_;
+  std::atomic<int64_t> pushed_;
+  std::atomic<int64_t> delivered_;
+  std::atomic<int64_t> dropped_;
+  std::atomic<int64_t> ticks_;
+  std::atomic<int64_t> wakeups_;
+
+  void Enqueue(Completion* completion);
+  Completion* Pop();
+  void Schedule();
+  void Deliver(Napi::Env env, Napi::Function callback);
+  static Napi::Value ToValue(Napi::Env env, const Completion& completion);
+};
+
+#endif
@@ -0,0 +1,482 @@
+#include "hashjoin.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <kudu/client/value.h>
+
+using kudu::Slice;
+using kudu::client::KuduScanner;
+using kudu::client::KuduScanTokenBuilder;
+using kudu::client::KuduValue;
+
+enum KeyFamily { INTEGER_KEY, FLOAT_KEY, STRING_KEY, BOOL_KEY, UNSUPPORTED_KEY };
+
+static KeyFamily FamilyOf(KuduColumnSchema::DataType type) {
+  switch (type) {
+    case KuduColumnSchema::INT8:
+    case KuduColumnSchema::INT16:
+    case KuduColumnSchema::INT32:
+    case KuduColumnSchema::INT64:
+    case KuduColumnSchema::UNIXTIME_MICROS:
+      return INTEGER_KEY;
+    case KuduColumnSchema::FLOAT:
+    case KuduColumnSchema::DOUBLE:
+      return FLOAT_KEY;
+    case KuduColumnSchema::STRING:
+    case KuduColumnSchema::BINARY:
+      return STRING_KEY;
+    case KuduColumnSchema::BOOL:
+      return BOOL_KEY;
+    default:
+      return UNSUPPORTED_KEY;
+  }
+}
+
+static int64_t IntegerAt(const ColumnarBatch::Column& col, int64_t row) {
+  const char* p = col.values.data() + row * col.width;
+  switch (col.width) {
+    case 1:
+      return static_cast<int8_t>(*p);
+    case 2:
+    {
+      int16_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case 4:
+    {
+      int32_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    default:
+    {
+      int64_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+  }
+}
+
+static double FloatAt(const ColumnarBatch::Column& col, int64_t row) {
+  if (col.type == KuduColumnSchema::FLOAT) {
+    float v;
+    memcpy(&v, col.values.data() + row * sizeof(v), sizeof(v));
+    return v;
+  }
+  double v;
+  memcpy(&v, col.values.data() + row * sizeof(v), sizeof(v));
+  return v;
+}
+
+static bool BoolAt(const ColumnarBatch::Column& col, int64_t row) {
+  return (col.values[row >> 3] & (1 << (row & 7))) != 0;
+}
+
+static KuduValue* ValueAt(const ColumnarBatch::Column& col, int64_t row) {
+  switch (col.type) {
+    case KuduColumnSchema::FLOAT:
+    case KuduColumnSchema::DOUBLE:
+      return col.type == KuduColumnSchema::FLOAT ? KuduValue::FromFloat(static_cast<float>(FloatAt(col, row)))
+                                                 : KuduValue::FromDouble(FloatAt(col, row));
+    case KuduColumnSchema::STRING:
+    case KuduColumnSchema::BINARY:
+      return KuduValue::CopyString(Slice(col.values.data() + col.offsets[row], col.offsets[row + 1] - col.offsets[row]));
+    case KuduColumnSchema::BOOL:
+      return KuduValue::FromBool(BoolAt(col, row));
+    default:
+      return KuduValue::FromInt(IntegerAt(col, row));
+  }
+}
+
+static void EncodeValue(const ColumnarBatch::Column& col, int64_t row, string* out) {
+  switch (FamilyOf(col.type)) {
+    case INTEGER_KEY:
+    {
+      int64_t v = IntegerAt(col, row);
+      out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+      break;
+    }
+    case FLOAT_KEY:
+    {
+      double v = FloatAt(col, row);
+      out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+      break;
+    }
+    case STRING_KEY:
+    {
+      uint32_t length = col.offsets[row + 1] - col.offsets[row];
+      out->append(reinterpret_cast<const char*>(&length), sizeof(length));
+      out->append(col.values, col.offsets[row], length);
+      break;
+    }
+    default:
+      out->push_back(BoolAt(col, row) ? 1 : 0);
+      break;
+  }
+}
+
+JoinHashTable::JoinHashTable() {
+  this->mask_ = 0;
+}
+
+bool JoinHashTable::EncodeKey(const ColumnarBatch& batch, const vector<int>& keys, int64_t row, string* out) {
+  out->clear();
+  for (int c : keys) {
+    if (batch.IsNull(c, row)) {
+      return false;
+    }
+    EncodeValue(batch.columns()[c], row, out);
+  }
+  return true;
+}
+
+uint64_t JoinHashTable::Hash(const string& key) {
+  return std::hash<string>()(key);
+}
+
+bool JoinHashTable::KeyEquals(int64_t row, const string& key) const {
+  size_t length = this->keyOffsets_[row + 1] - this->keyOffsets_[row];
+  return length == key.size() && memcmp(this->keys_.data() + this->keyOffsets_[row], key.data(), length) == 0;
+}
+
+void JoinHashTable::Build(const ColumnarBatch& rows, const vector<int>& keys) {
+  int64_t n = rows.num_rows();
+  vector<bool> valid(n);
+  string key;
+  this->keyOffsets_.assign(1, 0);
+  for (int64_t r = 0; r < n; r++) {
+    valid[r] = EncodeKey(rows, keys, r, &key);
+    this->keys_.append(key);
+    this->keyOffsets_.push_back(this->keys_.size());
+  }
+
+  // At most half full, so probe sequences stay short.
+  size_t capacity = 16;
+  while (capacity < static_cast<size_t>(n) * 2) {
+    capacity *= 2;
+  }
+  this->slots_.assign(capacity, Slot{0, -1});
+  this->mask_ = capacity - 1;
+  this->next_.assign(n, -1);
+
+  // Inserted back to front so every chain ends up in build order.
+  for (int64_t r = n - 1; r >= 0; r--) {
+    if (!valid[r]) {
+      continue;
+    }
+    key.assign(this->keys_, this->keyOffsets_[r], this->keyOffsets_[r + 1] - this->keyOffsets_[r]);
+    uint64_t hash = Hash(key);
+    size_t i = hash & this->mask_;
+    while (this->slots_[i].row >= 0 && (this->slots_[i].hash != hash || !KeyEquals(this->slots_[i].row, key))) {
+      i = (i + 1) & this->mask_;
+    }
+    this->next_[r] = this->slots_[i].row;
+    this->slots_[i] = Slot{hash, r};
+  }
+}
+
+int64_t JoinHashTable::Find(const string& key) const {
+  if (this->slots_.empty()) {
+    return -1;
+  }
+  uint64_t hash = Hash(key);
+  for (size_t i = hash & this->mask_; this->slots_[i].row >= 0; i = (i + 1) & this->mask_) {
+    if (this->slots_[i].hash == hash && KeyEquals(this->slots_[i].row, key)) {
+      return this->slots_[i].row;
+    }
+  }
+  return -1;
+}
+
+int64_t JoinHashTable::Next(int64_t row) const {
+  return this->next_[row];
+}
+
+size_t JoinHashTable::ByteSize() const {
+  return this->slots_.size() * sizeof(Slot) + this->next_.size() * sizeof(int64_t) +
+      this->keys_.size() + this->keyOffsets_.size() * sizeof(size_t);
+}
+
+HashJoin::HashJoin(const shared_ptr<KuduTable>& left, const shared_ptr<KuduTable>& right, const JoinOptions& options)
+    : left_(left), right_(right), options_(options), nextToken_(0), failed_(false) {
+}
+
+HashJoin::~HashJoin() {
+  for (KuduScanToken* token : this->tokens_) {
+    delete token;
+  }
+}
+
+static int IndexOf(const vector<string>& names, const string& name) {
+  auto it = std::find(names.begin(), names.end(), name);
+  return it == names.end() ? -1 : static_cast<int>(it - names.begin());
+}
+
+static Status ColumnType(const KuduSchema& schema, const string& name, KuduColumnSchema::DataType* type) {
+  for (int i = 0, l = schema.num_columns(); i < l; i++) {
+    if (schema.Column(i).name() == name) {
+      *type = schema.Column(i).type();
+      return Status::OK();
+    }
+  }
+  return Status::NotFound("No such column: " + name);
+}
+
+Status HashJoin::Plan() {
+  const JoinOptions& options = this->options_;
+  if (options.leftKeys.empty() || options.leftKeys.size() != options.rightKeys.size()) {
+    return Status::InvalidArgument("Join needs the same number of keys on both sides");
+  }
+  KuduSchema leftSchema = this->left_->schema();
+  KuduSchema rightSchema = this->right_->schema();
+  for (size_t i = 0; i < options.leftKeys.size(); i++) {
+    KuduColumnSchema::DataType leftType;
+    KuduColumnSchema::DataType rightType;
+    KUDU_RETURN_NOT_OK(ColumnType(leftSchema, options.leftKeys[i], &leftType));
+    KUDU_RETURN_NOT_OK(ColumnType(rightSchema, options.rightKeys[i], &rightType));
+    if (FamilyOf(leftType) == UNSUPPORTED_KEY || FamilyOf(leftType) != FamilyOf(rightType)) {
+      return Status::InvalidArgument("Incompatible join key types: " + options.leftKeys[i] + ", " + options.rightKeys[i]);
+    }
+  }
+
+  // Key columns left out of a projection are still scanned, not returned.
+  this->leftScan_ = options.leftProjection;
+  if (this->leftScan_.empty()) {
+    for (int i = 0, l = leftSchema.num_columns(); i < l; i++) {
+      this->leftScan_.push_back(leftSchema.Column(i).name());
+    }
+  }
+  this->rightScan_ = options.rightProjection;
+  if (this->rightScan_.empty()) {
+    for (int i = 0, l = rightSchema.num_columns(); i < l; i++) {
+      string name = rightSchema.Column(i).name();
+      if (IndexOf(options.rightKeys, name) < 0) {
+        this->rightScan_.push_back(name);
+      }
+    }
+  }
+  for (size_t i = 0; i < this->leftScan_.size(); i++) {
+    this->leftOutput_.push_back(i);
+  }
+  if (!options.semi) {
+    for (size_t i = 0; i < this->rightScan_.size(); i++) {
+      this->rightOutput_.push_back(i);
+    }
+  }
+  for (size_t i = 0; i < options.leftKeys.size(); i++) {
+    if (IndexOf(this->leftScan_, options.leftKeys[i]) < 0) {
+      this->leftScan_.push_back(options.leftKeys[i]);
+    }
+    this->leftKeys_.push_back(IndexOf(this->leftScan_, options.leftKeys[i]));
+    if (IndexOf(this->rightScan_, options.rightKeys[i]) < 0) {
+      this->rightScan_.push_back(options.rightKeys[i]);
+    }
+    this->rightKeys_.push_back(IndexOf(this->rightScan_, options.rightKeys[i]));
+  }
+  return Status::OK();
+}
+
+Status HashJoin::ScanRight(MemoryReservation* memory) {
+  KuduScanner scanner(this->right_.get());
+  for (const KPredicate& predicate : this->options_.rightPredicates) {
+    KUDU_RETURN_NOT_OK(scanner.AddConjunctPredicate(predicate.ToKuduPredicate(this->right_.get())));
+  }
+  KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(this->rightScan_));
+  KUDU_RETURN_NOT_OK(scanner.Open());
+
+  this->build_.reset(new ColumnarBatch(scanner.GetProjectionSchema()));
+  KuduScanBatch batch;
+  while (scanner.HasMoreRows()) {
+    KUDU_RETURN_NOT_OK(scanner.NextBatch(&batch));
+    KUDU_RETURN_NOT_OK(this->build_->Append(batch));
+    if (this->build_->ByteSize() > memory->bytes()) {
+      KUDU_RETURN_NOT_OK(memory->Grow(this->build_->ByteSize() - memory->bytes()));
+    }
+  }
+  this->hashTable_.Build(*this->build_, this->rightKeys_);
+  return memory->Grow(this->hashTable_.ByteSize());
+}
+
+Status HashJoin::BuildLeftTokens() {
+  KuduScanTokenBuilder builder(this->left_.get());
+  for (const KPredicate& predicate : this->options_.leftPredicates) {
+    KUDU_RETURN_NOT_OK(builder.AddConjunctPredicate(predicate.ToKuduPredicate(this->left_.get())));
+  }
+  KUDU_RETURN_NOT_OK(builder.SetProjectedColumnNames(this->leftScan_));
+
+  // Every key column is filtered on its own, which lets through a superset of
+  // the joining rows for composite keys; the probe drops the rest.
+  KuduSchema leftSchema = this->left_->schema();
+  for (size_t k = 0; k < this->rightKeys_.size(); k++) {
+    const ColumnarBatch::Column& col = this->build_->columns()[this->rightKeys_[k]];
+    const string& name = this->options_.leftKeys[k];
+    KuduColumnSchema::DataType leftType;
+    KUDU_RETURN_NOT_OK(ColumnType(leftSchema, name, &leftType));
+
+    std::unordered_map<string, int64_t> distinct;
+    bool fewValues = true;
+    int64_t min = 0;
+    int64_t max = 0;
+    bool any = false;
+    string value;
+    for (int64_t r = 0; r < this->build_->num_rows(); r++) {
+      if (this->build_->IsNull(this->rightKeys_[k], r)) {
+        continue;
+      }
+      if (FamilyOf(col.type) == INTEGER_KEY) {
+        int64_t v = IntegerAt(col, r);
+        min = any ? std::min(min, v) : v;
+        max = any ? std::max(max, v) : v;
+      }
+      any = true;
+      if (fewValues) {
+        value.clear();
+        EncodeValue(col, r, &value);
+        distinct.emplace(value, r);
+        fewValues = distinct.size() <= this->options_.inListLimit;
+      }
+    }
+
+    if (fewValues && leftType == col.type) {
+      vector<KuduValue*> values;
+      for (const auto& entry : distinct) {
+        values.push_back(ValueAt(col, entry.second));
+      }
+      KUDU_RETURN_NOT_OK(builder.AddConjunctPredicate(this->left_->NewInListPredicate(name, &values)));
+    } else if (any && FamilyOf(col.type) == INTEGER_KEY) {
+      KUDU_RETURN_NOT_OK(builder.AddConjunctPredicate(
+          this->left_->NewComparisonPredicate(name, KuduPredicate::GREATER_EQUAL, KuduValue::FromInt(min))));
+      KUDU_RETURN_NOT_OK(builder.AddConjunctPredicate(
+          this->left_->NewComparisonPredicate(name, KuduPredicate::LESS_EQUAL, KuduValue::FromInt(max))));
+    }
+  }
+  return builder.Build(&this->tokens_);
+}
+
+Status HashJoin::Run(std::shared_ptr<ColumnarBatch>* result) {
+  KUDU_RETURN_NOT_OK(Plan());
+  MemoryReservation buildMemory(MemoryTracker::SCAN_BATCHES);
+  KUDU_RETURN_NOT_OK(ScanRight(&buildMemory));
+
+  KuduScanner scanner(this->left_.get());
+  KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(this->leftScan_));
+  ColumnarBatch leftShape(scanner.GetProjectionSchema());
+  for (int c : this->leftOutput_) {
+    this->shape_.push_back(leftShape.columns()[c]);
+  }
+  for (int c : this->rightOutput_) {
+    // Only the definition is copied, not the values.
+    const ColumnarBatch::Column& from = this->build_->columns()[c];
+    ColumnarBatch::Column col;
+    col.name = IndexOf(this->leftScan_, from.name) >= 0 ? this->right_->name() + "." + from.name : from.name;
+    col.type = from.type;
+    col.nullable = from.nullable;
+    col.width = from.width;
+    col.null_count = 0;
+    this->shape_.push_back(col);
+  }
+
+  std::shared_ptr<ColumnarBatch> joined(new ColumnarBatch(this->shape_));
+  if (this->build_->num_rows() == 0) {
+    *result = joined;
+    return Status::OK();
+  }
+
+  KUDU_RETURN_NOT_OK(BuildLeftTokens());
+  this->runs_.resize(this->tokens_.size());
+  vector<std::thread> threads;
+  this->mayWait_ = MemoryTracker::MayWait();
+  int parallelism = std::max(1, std::min<int>(this->options_.parallelism, this->tokens_.size()));
+  for (int i = 0; i < parallelism; i++) {
+    threads.push_back(std::thread(&HashJoin::ProbeTokens, this));
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  KUDU_RETURN_NOT_OK(this->error_);
+
+  for (ProbeRun& run : this->runs_) {
+    if (run.rows == nullptr) {
+      continue;
+    }
+    for (int64_t r = 0; r < run.rows->num_rows(); r++) {
+      joined->AppendRow(*run.rows, r);
+    }
+    run.rows.reset();
+  }
+  KUDU_RETURN_NOT_OK(joined->CheckSize());
+  *result = joined;
+  return Status::OK();
+}
+
+void HashJoin::ProbeTokens() {
+  MemoryTracker::WaitScope scope(this->mayWait_);
+  while (!this->failed_) {
+    size_t i = this->nextToken_++;
+    if (i >= this->tokens_.size()) {
+      break;
+    }
+    Status s = ProbeToken(this->tokens_[i], &this->runs_[i]);
+    if (!s.ok()) {
+      Fail(s);
+      break;
+    }
+  }
+}
+
+Status HashJoin::ProbeToken(KuduScanToken* token, ProbeRun* run) {
+  KuduScanner* raw;
+  KUDU_RETURN_NOT_OK(token->IntoKuduScanner(&raw));
+  std::unique_ptr<KuduScanner> scanner(raw);
+  KUDU_RETURN_NOT_OK(scanner->Open());
+
+  ColumnarBatch scratch(scanner->GetProjectionSchema());
+  run->rows.reset(new ColumnarBatch(this->shape_));
+  run->memory.reset(new MemoryReservation(MemoryTracker::SCAN_BATCHES));
+  ColumnarBatch* rows = run->rows.get();
+  size_t rightFirst = this->leftOutput_.size();
+  string key;
+
+  KuduScanBatch batch;
+  while (scanner->HasMoreRows() && !this->failed_) {
+    KUDU_RETURN_NOT_OK(scanner->NextBatch(&batch));
+    scratch.Clear();
+    KUDU_RETURN_NOT_OK(scratch.Append(batch));
+    for (int64_t r = 0; r < scratch.num_rows(); r++) {
+      if (!JoinHashTable::EncodeKey(scratch, this->leftKeys_, r, &key)) {
+        continue;
+      }
+      int64_t match = this->hashTable_.Find(key);
+      if (match < 0) {
+        continue;
+      }
+      if (this->options_.semi) {
+        rows->AppendCells(0, scratch, this->leftOutput_, r);
+        rows->EndRow();
+        continue;
+      }
+      for (; match >= 0; match = this->hashTable_.Next(match)) {
+        rows->AppendCells(0, scratch, this->leftOutput_, r);
+        rows->AppendCells(rightFirst, *this->build_, this->rightOutput_, match);
+        rows->EndRow();
+      }
+    }
+    KUDU_RETURN_NOT_OK(rows->CheckSize());
+    if (rows->ByteSize() > run->memory->bytes()) {
+      KUDU_RETURN_NOT_OK(run->memory->Grow(rows->ByteSize() - run->memory->bytes()));
+    }
+  }
+  return Status::OK();
+}
+
+void HashJoin::Fail(const Status& s) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (!this->failed_) {
+    this->error_ = s;
+    this->failed_ = true;
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef KUDUJS_HASHJOIN_H
+#define KUDUJS_HASHJOIN_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "kuduclass.h"
+#include "columnarbatch.h"
+#include "memtracker.h"
+
+using kudu::client::KuduScanToken;
+
+struct JoinOptions {
+  vector<string> leftKeys; // equal in number and order to rightKeys
+  vector<string> rightKeys;
+  vector<KPredicate> leftPredicates;
+  vector<KPredicate> rightPredicates;
+  vector<string> leftProjection; // empty for every column
+  vector<string> rightProjection; // empty for every non-key column
+  bool semi; // only left rows with a match, each once
+  int parallelism; // concurrent left scan tokens
+  size_t inListLimit; // most distinct values pushed down as an IN list
+};
+
+// Open-addressing hash table over the join keys of a columnar batch, with
+// linear probing. Build rows with equal keys are chained in build order.
+class JoinHashTable {
+ public:
+  JoinHashTable();
+  void Build(const ColumnarBatch& rows, const vector<int>& keys);
+  // First build row with the encoded key, or -1; Next walks its chain.
+  int64_t Find(const string& key) const;
+  int64_t Next(int64_t row) const;
+  size_t ByteSize() const;
+
+  // Encodes the key columns of a row so equal values of compatible types
+  // compare equal. Returns false when a key is null, as nulls never join.
+  static bool EncodeKey(const ColumnarBatch& batch, const vector<int>& keys, int64_t row, string* out);
+
+ private:
+  struct Slot {
+    uint64_t hash;
+    int64_t row; // head of the chain, -1 for an empty slot
+  };
+
+  vector<Slot> slots_;
+  size_t mask_;
+  vector<int64_t> next_;
+  string keys_; // encoded key of every build row
+  vector<size_t> keyOffsets_;
+
+  bool KeyEquals(int64_t row, const string& key) const;
+  static uint64_t Hash(const string& key);
+};
+
+// Joins a large left table to a small right one. The right side is scanned
+// whole into a JoinHashTable, its key values are pushed down into the left
+// scan, as IN lists when there are few of them or as min/max bounds for
+// integer keys otherwise, and the left scan tokens are probed in parallel.
+// The result holds the projected left columns followed by the projected
+// right ones, the latter prefixed by the right table name on collisions.
+class HashJoin {
+ public:
+  HashJoin(const shared_ptr<KuduTable>& left, const shared_ptr<KuduTable>& right, const JoinOptions& options);
+  ~HashJoin();
+  Status Run(std::shared_ptr<ColumnarBatch>* result);
+
+ private:
+  struct ProbeRun {
+    std::unique_ptr<ColumnarBatch> rows;
+    std::unique_ptr<MemoryReservation> memory;
+  };
+
+  shared_ptr<KuduTable> left_;
+  shared_ptr<KuduTable> right_;
+  JoinOptions options_;
+  vector<string> leftScan_; // projections actually scanned, keys included
+  vector<string> rightScan_;
+  vector<int> leftKeys_; // key and output columns by scanned index
+  vector<int> rightKeys_;
+  vector<int> leftOutput_;
+  vector<int> rightOutput_;
+  std::unique_ptr<ColumnarBatch> build_;
+  JoinHashTable hashTable_;
+  vector<ColumnarBatch::Column> shape_;
+  vector<KuduScanToken*> tokens_;
+  vector<ProbeRun> runs_;
+  std::atomic<size_t> nextToken_;
+
+  std::mutex mutex_;
+  Status error_;
+  std::atomic<bool> failed_;
+  bool mayWait_; // whether memory charges may wait, taken from the calling thread
+
+  Status Plan();
+  Status ScanRight(MemoryReservation* memory);
+  Status BuildLeftTokens();
+  void ProbeTokens();
+  Status ProbeToken(KuduScanToken* token, ProbeRun* run);
+  void Fail(const Status& s);
+};
+
+#endif
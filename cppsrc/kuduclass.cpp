@@ -1,4 +1,21 @@
 #include "kuduclass.h"
+#include "tableexport.h"
+#include "arrowipc.h"
+#include "rowcodec.h"
+#include "spillqueue.h"
+#include "writecoalescer.h"
+#include "scancache.h"
+#include "rowmaterializer.h"
+#include "writepipeline.h"
+#include "memtracker.h"
+#include "orderedscan.h"
+#include "hashjoin.h"
+#include "timepartitions.h"
+#include "scanplan.h"
+#include "trafficcapture.h"
+#include "tenantlimiter.h"
+#include "rollup.h"
+#include "completionchannel.h"
 #include <kudu/client/callbacks.h>
 #include <kudu/client/client.h>
 #include <kudu/client/row_result.h>
@@ -6,8 +23,12 @@
 #include <kudu/client/value.h>
 #include <kudu/common/partial_row.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <ctime>
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 using kudu::client::KuduClient;
@@ -17,16 +38,22 @@ using kudu::client::KuduError;
 using kudu::client::KuduInsert;
 using kudu::client::KuduUpdate;
 using kudu::client::KuduUpsert;
+using kudu::client::KuduDelete;
+using kudu::client::KuduWriteOperation;
 using kudu::client::KuduPredicate;
 using kudu::client::KuduScanBatch;
 using kudu::client::KuduRowResult;
 using kudu::client::KuduScanner;
+using kudu::client::KuduScanToken;
+using kudu::client::KuduScanTokenBuilder;
+using kudu::client::KuduPartitioner;
+using kudu::client::KuduPartitionerBuilder;
 using kudu::client::KuduSchema;
 using kudu::client::KuduSchemaBuilder;
 using kudu::client::KuduSession;
+using kudu::client::KuduStatusCallback;
 using kudu::client::KuduStatusFunctionCallback;
 using kudu::client::KuduTable;
-using kudu::client::KuduTableAlterer;
 using kudu::client::KuduTableCreator;
 using kudu::client::KuduValue;
 using kudu::client::sp::shared_ptr;
@@ -39,6 +66,11 @@ using std::ostringstream;
 using std::string;
 using std::vector;
 
+// Rough per-cell and per-row costs used to account for memory that is not
+// measured directly: JS values being built and buffered write operations.
+static const size_t kJsValueBytes = 16;
+static const size_t kRowOverheadBytes = 32;
+
 KSchema::KSchema(string key, int type, bool primaryKey, bool notNull) {
   this->key_ = key;
   this->type_ = type;
@@ -62,11 +94,150 @@ bool KSchema::IsNotNull() const {
   return this->notNull_;
 }
 
-KuduClass::KuduClass(vector<string> masters){
-  this->masters_ = masters;
+KPredicate::KPredicate(string colName, int comparisonOp, const Napi::Value value) {
+  this->colName_ = colName;
+  this->comparisonOp_ = comparisonOp;
+  this->isString_ = value.IsString();
+  this->isBool_ = value.IsBoolean();
+  this->number_ = 0;
+  if (this->isString_) {
+    this->string_ = value.ToString().Utf8Value();
+  } else if (this->isBool_) {
+    this->number_ = value.ToBoolean() ? 1 : 0;
+  } else {
+    this->number_ = value.ToNumber().DoubleValue();
+  }
+}
+
+KPredicate::KPredicate(string colName, int comparisonOp, double number, bool isBool) {
+  this->colName_ = colName;
+  this->comparisonOp_ = comparisonOp;
+  this->isString_ = false;
+  this->isBool_ = isBool;
+  this->number_ = number;
+}
+
+KPredicate::KPredicate(string colName, int comparisonOp, string value) {
+  this->colName_ = colName;
+  this->comparisonOp_ = comparisonOp;
+  this->isString_ = true;
+  this->isBool_ = false;
+  this->number_ = 0;
+  this->string_ = value;
+}
+
+string KPredicate::GetColName() const {
+  return this->colName_;
+}
+
+int KPredicate::GetComparisonOp() const {
+  return this->comparisonOp_;
+}
+
+bool KPredicate::IsString() const {
+  return this->isString_;
+}
+
+bool KPredicate::IsBool() const {
+  return this->isBool_;
+}
+
+double KPredicate::GetNumber() const {
+  return this->number_;
+}
+
+string KPredicate::GetString() const {
+  return this->string_;
+}
+
+KuduPredicate* KPredicate::ToKuduPredicate(KuduTable* table) const {
+  // Convert the JS value according to the column type so predicates work on
+  // every column type, not just integers. Unknown columns are left for Kudu to
+  // reject when the predicate is added to the scanner.
+  KuduValue* value = NULL;
+  KuduSchema schema = table->schema();
+  for (int i = 0, l = schema.num_columns(); i < l && value == NULL; i++) {
+    KuduColumnSchema col = schema.Column(i);
+    if (col.name().compare(this->colName_) != 0) {
+      continue;
+    }
+    switch (col.type()) {
+      case KuduColumnSchema::FLOAT:
+        value = KuduValue::FromFloat(this->number_);
+        break;
+      case KuduColumnSchema::DOUBLE:
+        value = KuduValue::FromDouble(this->number_);
+        break;
+      case KuduColumnSchema::BOOL:
+        value = KuduValue::FromBool(this->number_ != 0);
+        break;
+      case KuduColumnSchema::STRING:
+      case KuduColumnSchema::BINARY:
+        value = KuduValue::CopyString(this->string_);
+        break;
+      default:
+        value = KuduValue::FromInt(static_cast<int64_t>(this->number_));
+        break;
+    }
+  }
+  if (value == NULL) {
+    value = this->isString_ ? KuduValue::CopyString(this->string_) : KuduValue::FromInt(static_cast<int64_t>(this->number_));
+  }
+  return table->NewComparisonPredicate(this->colName_,
+      static_cast<KuduPredicate::ComparisonOp>(this->comparisonOp_), value);
+}
+
+string KPredicate::ToString() const {
+  ostringstream out;
+  out.precision(17);
+  out << this->colName_ << ' ' << this->comparisonOp_ << ' ';
+  if (this->isString_) {
+    out << 's' << this->string_;
+  } else {
+    out << (this->isBool_ ? 'b' : 'n') << this->number_;
+  }
+  return out.str();
+}
+
+Status BuildScanTokens(const shared_ptr<KuduTable>& table, const vector<KPredicate>& predicates,
+                       const vector<string>& projection, vector<KuduScanToken*>* tokens) {
+  KuduScanTokenBuilder builder(table.get());
+  for (const KPredicate& predicate : predicates) {
+    KUDU_RETURN_NOT_OK(builder.AddConjunctPredicate(predicate.ToKuduPredicate(table.get())));
+  }
+  if (!projection.empty()) {
+    KUDU_RETURN_NOT_OK(builder.SetProjectedColumnNames(projection));
+  }
+  return builder.Build(tokens);
+}
+
+TableCache::TableCache(const shared_ptr<KuduClient>& client) : client_(client) {
+}
+
+Status TableCache::Get(const string& tableName, shared_ptr<KuduTable>* table) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    auto it = this->tables_.find(tableName);
+    if (it != this->tables_.end()) {
+      *table = it->second;
+      return Status::OK();
+    }
+  }
+  // Opening a table is a master round trip; other tables must not wait on it.
+  // Two threads may open the same table at once, the first one kept wins.
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, table));
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  *table = this->tables_.insert(std::make_pair(tableName, *table)).first->second;
+  return Status::OK();
+}
 
+KuduClass::KuduClass(vector<string> masters, const ClientOptions& options){
+  this->masters_ = masters;
+  this->cache_ = std::make_shared<ScanCache>();
+  this->limiter_ = new TenantLimiter();
+  this->nextCompletionId_ = 1;
 
-  kudu::client::SetVerboseLogLevel(2);
+  kudu::client::SetVerboseLogLevel(options.verboseLogLevel);
   KUDU_LOG(INFO) << "Running with Kudu client version: " <<
       kudu::client::GetShortVersionString();
   KUDU_LOG(INFO) << "Long version info: " <<
@@ -74,14 +245,36 @@ KuduClass::KuduClass(vector<string> masters){
 
   // This is to install and automatically un-install custom logging callback.
   // LogCallbackHelper log_cb_helper;
-  // Enable verbose debugging for the client library.
-  
+
   KUDU_LOG(INFO) << "Created a client connection: " << masters[0];
-  KUDU_CHECK_OK(CreateClient(this->masters_, &this->client_));
+  // A failure is left for the caller to report, see status().
+  this->status_ = CreateClient(this->masters_, options, &this->client_);
+  if (!this->status_.ok()) {
+    KUDU_LOG(WARNING) << "Unable to create a client: " << this->status_.ToString();
+    return;
+  }
   KUDU_LOG(INFO) << "Created a client connection";
+}
 
-  // Disable the verbose logging.
-  kudu::client::SetVerboseLogLevel(0);
+Status KuduClass::status() const {
+  return this->status_;
+}
+
+// Stops the background threads before anything they use goes away: the
+// coalescer flushes through the spill queue, and the spill queue invalidates
+// the scan cache as it replays.
+KuduClass::~KuduClass() {
+  std::atomic_store(&this->coalescer_, std::shared_ptr<WriteCoalescer>());
+  std::shared_ptr<CompletionChannel> channel = std::atomic_exchange(&this->channel_, std::shared_ptr<CompletionChannel>());
+  if (channel) {
+    channel->Close();
+  }
+  std::atomic_store(&this->spill_, std::shared_ptr<SpillQueue>());
+  delete this->limiter_;
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_exchange(&this->recorder_, std::shared_ptr<TrafficRecorder>());
+  if (recorder) {
+    recorder->Stop();
+  }
 }
 
 string KuduClass::getValue()
@@ -107,25 +300,91 @@ void KuduClass::CreateTable(string tableName, vector<KSchema> schema, int numTab
     KUDU_LOG(INFO) << "Deleting old table before creating new one";
   }
   KUDU_CHECK_OK(CreateKuduTable(this->client_, tableName, sc, numTablets, partitioning, columns));
+  this->cache_->Invalidate(tableName);
   KUDU_LOG(INFO) << "Created a table " + tableName;
 }
 
 void KuduClass::DeleteTable(string tableName) {
   // Delete the table.
   KUDU_CHECK_OK(this->client_->DeleteTable(tableName));
+  this->cache_->Invalidate(tableName);
   KUDU_LOG(INFO) << "Deleted a table " + tableName;
 }
 
+static int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+Status KuduClass::CreateTimeSeriesTable(const string tableName, vector<KSchema> schema, const TimePartitioning& options, int64_t from) {
+  KuduSchema sc(CreateSchema(schema));
+  KUDU_RETURN_NOT_OK(::CreateTimeSeriesTable(this->client_, tableName, sc, options, from, NowMicros()));
+  this->cache_->Invalidate(tableName);
+  KUDU_LOG(INFO) << "Created a time series table " + tableName;
+  return Status::OK();
+}
+
+Status KuduClass::AlterRangePartition(const string tableName, const string column, int64_t lower, int64_t upper, bool drop) {
+  KUDU_RETURN_NOT_OK(AlterTimeRange(this->client_, tableName, column, lower, upper, drop));
+  // Dropping a range removes its rows.
+  this->cache_->Invalidate(tableName);
+  return Status::OK();
+}
+
+Status KuduClass::MaintainTimePartitions(const string tableName, const TimePartitioning& options, PartitionChanges* changes) {
+  KUDU_RETURN_NOT_OK(::MaintainTimePartitions(this->client_, tableName, options, NowMicros(), changes));
+  if (changes->dropped > 0) {
+    this->cache_->Invalidate(tableName);
+  }
+  return Status::OK();
+}
+
 /*
 * Kudu methods
 */
 
-Status KuduClass::CreateClient(const vector<string>& master_addrs,
+Status KuduClass::CreateClient(const vector<string>& master_addrs, const ClientOptions& options,
                           shared_ptr<KuduClient>* client) {
-  return KuduClientBuilder()
-      .master_server_addrs(master_addrs)
-      .default_admin_operation_timeout(MonoDelta::FromSeconds(20))
-      .Build(client);
+  KuduClientBuilder builder;
+  builder.master_server_addrs(master_addrs)
+      .default_admin_operation_timeout(MonoDelta::FromMilliseconds(options.adminTimeoutMillis));
+  if (options.rpcTimeoutMillis > 0) {
+    builder.default_rpc_timeout(MonoDelta::FromMilliseconds(options.rpcTimeoutMillis));
+  }
+  if (options.negotiationTimeoutMillis > 0) {
+    builder.connection_negotiation_timeout(MonoDelta::FromMilliseconds(options.negotiationTimeoutMillis));
+  }
+  if (options.numReactors > 0) {
+    builder.num_reactors(options.numReactors);
+  }
+  return builder.Build(client);
+}
+
+Status KuduClass::Prewarm(const vector<string>& tables, PrewarmStats* stats) {
+  // Opening a table caches its schema and partitioning, and building a
+  // partitioner looks up every tablet, so later writes and scans find their
+  // tablet locations in the client's meta cache. A table that fails is
+  // logged and skipped; it will be looked up on first use as before.
+  auto start = std::chrono::steady_clock::now();
+  for (const string& tableName : tables) {
+    shared_ptr<KuduTable> table;
+    KuduPartitioner* raw = NULL;
+    Status s = this->client_->OpenTable(tableName, &table);
+    if (s.ok()) {
+      s = KuduPartitionerBuilder(table).Build(&raw);
+    }
+    if (!s.ok()) {
+      KUDU_LOG(WARNING) << "Could not prewarm table " << tableName << ": " << s.ToString();
+      stats->failed++;
+      continue;
+    }
+    std::unique_ptr<KuduPartitioner> partitioner(raw);
+    stats->tables++;
+    stats->tablets += partitioner->NumPartitions();
+  }
+  stats->millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  KUDU_LOG(INFO) << "Prewarmed " << stats->tables << " tables with " << stats->tablets << " tablets";
+  return Status::OK();
 }
 
 KuduSchema KuduClass::CreateSchema(const vector<KSchema> schema) {
@@ -192,390 +451,705 @@ Status KuduClass::CreateKuduTable(const shared_ptr<KuduClient>& client,
   return s;
 }
 
-static Status AlterTable(const shared_ptr<KuduClient>& client,
-                        const string& table_name) {
-  KuduTableAlterer* table_alterer = client->NewTableAlterer(table_name);
-  table_alterer->AlterColumn("int_val")->RenameTo("integer_val");
-  table_alterer->AddColumn("another_val")->Type(KuduColumnSchema::BOOL);
-  table_alterer->DropColumn("string_val");
-  Status s = table_alterer->Alter();
-  delete table_alterer;
-  return s;
-}
-
-static void StatusCB(void* unused, const Status& status) {
+static void StatusCB(void*, const Status& status) {
   KUDU_LOG(INFO) << "Asynchronous flush finished with status: "
                       << status.ToString();
 }
 
-Status KuduClass::InsertRow(const string tableName, const Napi::Object value) {
-  KUDU_LOG(INFO) << "Inserting a single record in " << tableName;
-  // Insert a row into the table.
-  shared_ptr<KuduTable> table;
-  KUDU_CHECK_OK(this->client_->OpenTable(tableName, &table));
-
-  shared_ptr<KuduSession> session = table->client()->NewSession();
-  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::MANUAL_FLUSH));
-  session->SetTimeoutMillis(5000);
-
-  KuduSchema schema = table->schema();
-
-  KuduInsert* insert = table->NewInsert();
-  KuduPartialRow* row = insert->mutable_row();
-
+// Copies the properties of a JS object into the row, matching them to the
+// table columns by name. Properties without a matching column are ignored.
+// When bytes is given it is increased by an estimate of the row's size.
+static Status SetRowValues(KuduPartialRow* row, const KuduSchema& schema, const Napi::Object value, size_t* bytes) {
   Napi::Array props = value.GetPropertyNames();
 
-  for(int i = 0, l = props.Length(); i < l; i++) {
-    string prop = props.Get(i).ToString();
+  for (int p = 0, pl = props.Length(); p < pl; p++) {
+    string prop = props.Get(p).ToString();
 
     for (int i = 0, l = schema.num_columns(); i < l; i++) {
       KuduColumnSchema col = schema.Column(i);
-
-      if (col.name().compare(prop) == 0) {
-        switch (col.type())
-        {
-        case KuduColumnSchema::INT8:
-          KUDU_CHECK_OK(row->SetInt8(prop, (int)value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT16:
-          KUDU_CHECK_OK(row->SetInt16(prop, (int)value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT32:
-          KUDU_CHECK_OK(row->SetInt32(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT64:
-          KUDU_CHECK_OK(row->SetInt64(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::STRING:
-          KUDU_CHECK_OK(row->SetString(prop, value.Get(prop).ToString().Utf8Value()));
-          break;
-        case KuduColumnSchema::BOOL:
-          KUDU_CHECK_OK(row->SetBool(prop, value.Get(prop).ToBoolean()));
-          break;
-        case KuduColumnSchema::FLOAT:
-          KUDU_CHECK_OK(row->SetFloat(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::DOUBLE:
-          KUDU_CHECK_OK(row->SetDouble(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::BINARY:
-          KUDU_CHECK_OK(row->SetBinary(prop, value.Get(prop).ToString().Utf8Value()));
-          break;
-        case KuduColumnSchema::UNIXTIME_MICROS:
-          KUDU_CHECK_OK(row->SetUnixTimeMicros(prop, value.Get(prop).ToNumber()));
-          break;
-        
-        default:
-          break;
-        }
+      if (col.name().compare(prop) != 0) {
+        continue;
+      }
+      Napi::Value cell = value.Get(prop);
+      if (cell.IsNull() || cell.IsUndefined()) {
+        KUDU_RETURN_NOT_OK(row->SetNull(i));
+        break;
+      }
+      string text;
+      if (col.type() == KuduColumnSchema::STRING || col.type() == KuduColumnSchema::BINARY) {
+        text = cell.ToString().Utf8Value();
+      }
+      if (bytes != NULL) {
+        *bytes += text.empty() ? ColumnarBatch::ValueWidth(col.type()) : text.size();
+      }
+      switch (col.type())
+      {
+      case KuduColumnSchema::INT8:
+        KUDU_RETURN_NOT_OK(row->SetInt8(i, (int)cell.ToNumber()));
+        break;
+      case KuduColumnSchema::INT16:
+        KUDU_RETURN_NOT_OK(row->SetInt16(i, (int)cell.ToNumber()));
+        break;
+      case KuduColumnSchema::INT32:
+        KUDU_RETURN_NOT_OK(row->SetInt32(i, cell.ToNumber()));
+        break;
+      case KuduColumnSchema::INT64:
+        KUDU_RETURN_NOT_OK(row->SetInt64(i, cell.ToNumber()));
+        break;
+      case KuduColumnSchema::STRING:
+        KUDU_RETURN_NOT_OK(row->SetString(i, text));
+        break;
+      case KuduColumnSchema::BOOL:
+        KUDU_RETURN_NOT_OK(row->SetBool(i, cell.ToBoolean()));
+        break;
+      case KuduColumnSchema::FLOAT:
+        KUDU_RETURN_NOT_OK(row->SetFloat(i, cell.ToNumber()));
+        break;
+      case KuduColumnSchema::DOUBLE:
+        KUDU_RETURN_NOT_OK(row->SetDouble(i, cell.ToNumber()));
+        break;
+      case KuduColumnSchema::BINARY:
+        KUDU_RETURN_NOT_OK(row->SetBinary(i, text));
+        break;
+      case KuduColumnSchema::UNIXTIME_MICROS:
+        KUDU_RETURN_NOT_OK(row->SetUnixTimeMicros(i, cell.ToNumber()));
+        break;
+
+      default:
+        break;
       }
+      break;
     }
   }
-  KUDU_CHECK_OK(session->Apply(insert));
+  return Status::OK();
+}
 
-  Status s = session->Flush();
-  if (s.ok()) {
-    return s;
+static Status SetArrowCell(KuduPartialRow* row, int idx, KuduColumnSchema::DataType type,
+                           const ArrowReader& reader, int field, int64_t r) {
+  if (reader.IsBinary(field) != (type == KuduColumnSchema::STRING || type == KuduColumnSchema::BINARY)) {
+    return Status::InvalidArgument("Arrow type does not match column " + reader.fields()[field].name);
+  }
+  switch (type) {
+    case KuduColumnSchema::INT8:
+      return row->SetInt8(idx, reader.GetInt(field, r));
+    case KuduColumnSchema::INT16:
+      return row->SetInt16(idx, reader.GetInt(field, r));
+    case KuduColumnSchema::INT32:
+      return row->SetInt32(idx, reader.GetInt(field, r));
+    case KuduColumnSchema::INT64:
+      return row->SetInt64(idx, reader.GetInt(field, r));
+    case KuduColumnSchema::UNIXTIME_MICROS:
+      return row->SetUnixTimeMicros(idx, reader.GetInt(field, r));
+    case KuduColumnSchema::BOOL:
+      return row->SetBool(idx, reader.GetInt(field, r) != 0);
+    case KuduColumnSchema::FLOAT:
+      return row->SetFloat(idx, reader.GetDouble(field, r));
+    case KuduColumnSchema::DOUBLE:
+      return row->SetDouble(idx, reader.GetDouble(field, r));
+    case KuduColumnSchema::STRING:
+      return row->SetString(idx, reader.GetBytes(field, r));
+    case KuduColumnSchema::BINARY:
+      return row->SetBinary(idx, reader.GetBytes(field, r));
+    default:
+      return Status::NotSupported("Unsupported column type for column " + reader.fields()[field].name);
   }
+}
 
-  // Test asynchronous flush.
-  KuduStatusFunctionCallback<void*> status_cb(&StatusCB, NULL);
-  session->FlushAsync(&status_cb);
+static Status NewManualSession(const shared_ptr<KuduTable>& table, shared_ptr<KuduSession>* session) {
+  *session = table->client()->NewSession();
+  KUDU_RETURN_NOT_OK((*session)->SetFlushMode(KuduSession::MANUAL_FLUSH));
+  (*session)->SetTimeoutMillis(5000);
+  return Status::OK();
+}
 
-  // Look at the session's errors.
-  vector<KuduError*> errors;
-  bool overflow;
-  session->GetPendingErrors(&errors, &overflow);
-  if (!errors.empty()) {
-    s = overflow ? Status::IOError("Overflowed pending errors in session") :
-        errors.front()->status();
-    while (!errors.empty()) {
-      delete errors.back();
-      errors.pop_back();
-    }
+Status KuduClass::InsertRow(const string tableName, const Napi::Object value, const string tenant) {
+  KUDU_LOG(INFO) << "Inserting a single record in " << tableName;
+  Napi::Array rows = Napi::Array::New(value.Env(), 1);
+  rows.Set(0u, value);
+  return WriteRows(tableName, K_INSERT, rows, tenant);
+}
+
+Status KuduClass::UpdateRow(const string tableName, const Napi::Object value, const string tenant) {
+  KUDU_LOG(INFO) << "Updating a single record in " << tableName;
+  if (std::atomic_load(&this->coalescer_)) {
+    return BufferRow(tableName, K_UPDATE, value, tenant);
   }
-  KUDU_RETURN_NOT_OK(s);
+  Napi::Array rows = Napi::Array::New(value.Env(), 1);
+  rows.Set(0u, value);
+  return WriteRows(tableName, K_UPDATE, rows, tenant);
+}
 
-  // Close the session.
-  return session->Close();
+Status KuduClass::UpsertRow(const string tableName, const Napi::Object value, const string tenant) {
+  KUDU_LOG(INFO) << "Upserting a single record in " << tableName;
+  if (std::atomic_load(&this->coalescer_)) {
+    return BufferRow(tableName, K_UPSERT, value, tenant);
+  }
+  Napi::Array rows = Napi::Array::New(value.Env(), 1);
+  rows.Set(0u, value);
+  return WriteRows(tableName, K_UPSERT, rows, tenant);
 }
 
-Status KuduClass::UpdateRow(const string tableName, const Napi::Object value) {
-  KUDU_LOG(INFO) << "Updating a single record in " << tableName;
-  // Insert a row into the table.
-  shared_ptr<KuduTable> table;
-  KUDU_CHECK_OK(this->client_->OpenTable(tableName, &table));
+Status KuduClass::InsertRows(const string tableName, const Napi::Array rows, const string tenant) {
+  KUDU_LOG(INFO) << "Inserting multiple records in " << tableName;
+  return WriteRows(tableName, K_INSERT, rows, tenant);
+}
 
-  shared_ptr<KuduSession> session = table->client()->NewSession();
-  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::MANUAL_FLUSH));
-  session->SetTimeoutMillis(5000);
+Status KuduClass::WriteRows(const string tableName, int operation, const Napi::Array rows, const string tenant) {
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+  KUDU_RETURN_NOT_OK(FlushCoalesced(tableName));
+
+  shared_ptr<KuduSession> session;
+  KUDU_RETURN_NOT_OK(NewManualSession(table, &session));
+
+  // Runs on the JS thread, so a throttled tenant is turned away rather than
+  // made to wait. Bytes are only known once the rows are encoded and are
+  // charged afterwards, the debt delaying the tenant's next call.
+  bool limited = this->limiter_->enabled();
+  if (limited) {
+    KUDU_RETURN_NOT_OK(this->limiter_->TryAcquire(tenant, rows.Length(), 0));
+  }
 
   KuduSchema schema = table->schema();
+  MemoryReservation buffer(MemoryTracker::WRITE_BUFFERS);
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  int64_t start = recorder ? recorder->Now() : 0;
+  string captured;
+  size_t written = 0;
 
-  KuduUpdate* update = table->NewUpdate();
-  KuduPartialRow* row = update->mutable_row();
+  for (unsigned int i = 0; i < rows.Length(); i++) {
+    KuduWriteOperation* op = NewOperation(table.get(), operation);
+    if (op == NULL) {
+      return Status::InvalidArgument("Unknown write operation");
+    }
+    size_t bytes = kRowOverheadBytes;
+    Status s = SetRowValues(op->mutable_row(), schema, rows.Get(i).ToObject(), &bytes);
+    // Once the write budget is used up, the rows buffered so far are written
+    // out before more are taken on.
+    if (s.ok() && !buffer.TryGrow(bytes)) {
+      if (buffer.bytes() > 0) {
+        s = FlushSession(table, operation, session, NULL);
+        buffer.Release();
+        if (s.ok()) {
+          s = NewManualSession(table, &session);
+        }
+      }
+      if (s.ok()) {
+        s = buffer.Grow(bytes);
+      }
+    }
+    if (!s.ok()) {
+      delete op;
+      return s;
+    }
+    written += bytes - kRowOverheadBytes;
+    if (recorder) {
+      AppendCapturedRow(*op->mutable_row(), schema, &captured);
+    }
+    KUDU_RETURN_NOT_OK(session->Apply(op));
+  }
+  if (limited) {
+    this->limiter_->Charge(tenant, 0, written);
+  }
+  Status s = FlushSession(table, operation, session, NULL);
+  if (recorder) {
+    recorder->RecordWrite(tableName, operation, start, captured, rows.Length());
+  }
+  return s;
+}
 
-  Napi::Array props = value.GetPropertyNames();
+Status KuduClass::WriteRowsParallel(const string tableName, int operation, const MarshaledRows& rows, const PipelineOptions& options, PipelineStats* stats) {
+  KUDU_LOG(INFO) << "Writing " << rows.num_rows() << " records to " << tableName << " in parallel";
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+  KUDU_RETURN_NOT_OK(FlushCoalesced(tableName));
+
+  WritePipeline pipeline(table, operation, options,
+      [this](const shared_ptr<KuduTable>& table, int operation, const shared_ptr<KuduSession>& session) {
+        return FlushSession(table, operation, session, NULL);
+      });
+  if (this->limiter_->enabled()) {
+    pipeline.Throttle(this->limiter_);
+  }
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  if (!recorder) {
+    return pipeline.Run(rows, stats);
+  }
+  int64_t start = recorder->Now();
+  string captured;
+  int64_t count = 0;
+  pipeline.CaptureRows(&captured, &count);
+  Status s = pipeline.Run(rows, stats);
+  recorder->RecordWrite(tableName, operation, start, captured, count);
+  return s;
+}
 
-  for(int i = 0, l = props.Length(); i < l; i++) {
-    string prop = props.Get(i).ToString();
+Status KuduClass::BufferRow(const string tableName, int operation, const Napi::Object value, const string tenant) {
+  std::shared_ptr<WriteCoalescer> coalescer = std::atomic_load(&this->coalescer_);
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(coalescer->GetTable(tableName, &table));
+
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  int64_t start = recorder ? recorder->Now() : 0;
+  std::unique_ptr<KuduPartialRow> row(table->schema().NewRow());
+  size_t bytes = 0;
+  KUDU_RETURN_NOT_OK(SetRowValues(row.get(), table->schema(), value, &bytes));
+  if (this->limiter_->enabled()) {
+    KUDU_RETURN_NOT_OK(this->limiter_->TryAcquire(tenant, 1, bytes));
+  }
+  Status s = coalescer->Add(table, operation, *row);
+  if (s.IsNotSupported()) {
+    // Rows that cannot be merged are written on their own, after what is
+    // already buffered for the table.
+    shared_ptr<KuduSession> session;
+    s = coalescer->FlushTable(tableName);
+    if (s.ok()) {
+      s = NewManualSession(table, &session);
+    }
+    if (s.ok()) {
+      KuduWriteOperation* op = NewOperation(table.get(), operation);
+      *op->mutable_row() = *row;
+      s = session->Apply(op);
+    }
+    if (s.ok()) {
+      s = FlushSession(table, operation, session, NULL);
+    }
+  }
+  if (recorder) {
+    string captured;
+    AppendCapturedRow(*row, table->schema(), &captured);
+    recorder->RecordWrite(tableName, operation, start, captured, 1);
+  }
+  return s;
+}
 
-    for (int i = 0, l = schema.num_columns(); i < l; i++) {
-      KuduColumnSchema col = schema.Column(i);
+// Coalesced rows still buffered for a table are older than a write about to
+// be made to it directly, so they go out first.
+Status KuduClass::FlushCoalesced(const string& tableName) {
+  std::shared_ptr<WriteCoalescer> coalescer = std::atomic_load(&this->coalescer_);
+  return coalescer ? coalescer->FlushTable(tableName) : Status::OK();
+}
 
-      if (col.name().compare(prop) == 0) {
-        switch (col.type())
-        {
-        case KuduColumnSchema::INT8:
-          KUDU_CHECK_OK(row->SetInt8(prop, (int)value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT16:
-          KUDU_CHECK_OK(row->SetInt16(prop, (int)value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT32:
-          KUDU_CHECK_OK(row->SetInt32(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT64:
-          KUDU_CHECK_OK(row->SetInt64(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::STRING:
-          KUDU_CHECK_OK(row->SetString(prop, value.Get(prop).ToString().Utf8Value()));
-          break;
-        case KuduColumnSchema::BOOL:
-          KUDU_CHECK_OK(row->SetBool(prop, value.Get(prop).ToBoolean()));
-          break;
-        case KuduColumnSchema::FLOAT:
-          KUDU_CHECK_OK(row->SetFloat(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::DOUBLE:
-          KUDU_CHECK_OK(row->SetDouble(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::BINARY:
-          KUDU_CHECK_OK(row->SetBinary(prop, value.Get(prop).ToString().Utf8Value()));
-          break;
-        case KuduColumnSchema::UNIXTIME_MICROS:
-          KUDU_CHECK_OK(row->SetUnixTimeMicros(prop, value.Get(prop).ToNumber()));
-          break;
-        
-        default:
-          break;
-        }
+// Appends the rows that failed for a transient reason to the spill queue, if
+// one is enabled. Takes ownership of the errors, and leaves those whose rows
+// were not spilled.
+static void SpillRetryable(const std::shared_ptr<SpillQueue>& spill, const shared_ptr<KuduTable>& table, int operation, vector<KuduError*>* errors) {
+  if (!spill) {
+    return;
+  }
+  vector<KuduError*> left;
+  int64_t spilled = 0;
+  for (KuduError* error : *errors) {
+    if (SpillQueue::IsRetryable(error->status())) {
+      Status ss = spill->Append(table->name(), table->schema(), operation, error->failed_op().row());
+      if (ss.ok()) {
+        spilled++;
+        delete error;
+        continue;
       }
+      KUDU_LOG(WARNING) << "Unable to spill a row for table " << table->name() << ": " << ss.ToString();
     }
+    left.push_back(error);
   }
-  KUDU_CHECK_OK(session->Apply(update));
+  errors->swap(left);
+  if (spilled > 0) {
+    KUDU_LOG(INFO) << "Spilled " << spilled << " rows for table " << table->name();
+  }
+}
 
+Status KuduClass::FlushSession(const shared_ptr<KuduTable>& table, int operation, const shared_ptr<KuduSession>& session, int64_t* failed) {
   Status s = session->Flush();
+  // Invalidate only once the writes are done, so a scan that ran before them
+  // cannot be cached under the new generation.
+  this->cache_->Invalidate(table->name());
   if (s.ok()) {
-    return s;
+    return session->Close();
   }
 
-  // Test asynchronous flush.
-  KuduStatusFunctionCallback<void*> status_cb(&StatusCB, NULL);
-  session->FlushAsync(&status_cb);
-
-  // Look at the session's errors.
+  // Rows that failed for a transient reason go to the spill queue when one is
+  // enabled, and only count as failed, with their own error, if they cannot
+  // be spilled either.
   vector<KuduError*> errors;
   bool overflow;
   session->GetPendingErrors(&errors, &overflow);
-  if (!errors.empty()) {
-    s = overflow ? Status::IOError("Overflowed pending errors in session") :
-        errors.front()->status();
-    while (!errors.empty()) {
-      delete errors.back();
-      errors.pop_back();
+  Status result = errors.empty() ? s : Status::OK();
+  SpillRetryable(std::atomic_load(&this->spill_), table, operation, &errors);
+  if (failed != NULL) {
+    *failed = errors.size();
+  }
+  for (KuduError* error : errors) {
+    if (result.ok()) {
+      result = error->status();
     }
+    delete error;
   }
-  KUDU_RETURN_NOT_OK(s);
+  if (overflow && result.ok()) {
+    result = Status::IOError("Overflowed pending errors in session");
+  }
+  return result;
+}
 
-  // Close the session.
-  return session->Close();
+Status KuduClass::EnableSpillQueue(const SpillOptions& options) {
+  // Writes flushed from worker and reactor threads may hold on to the queue
+  // for a while, so it is never swapped out once in use.
+  if (std::atomic_load(&this->spill_)) {
+    return Status::IllegalState("Spill queue is already enabled");
+  }
+  SpillOptions withListener = options;
+  std::shared_ptr<ScanCache> cache = this->cache_;
+  withListener.onReplayed = [cache](const string& tableName) {
+    cache->Invalidate(tableName);
+  };
+  std::shared_ptr<SpillQueue> spill = std::make_shared<SpillQueue>(this->client_, withListener);
+  KUDU_RETURN_NOT_OK(spill->Open());
+  std::atomic_store(&this->spill_, spill);
+  return Status::OK();
 }
 
-Status KuduClass::UpsertRow(const string tableName, const Napi::Object value) {
-  KUDU_LOG(INFO) << "Upserting a single record in " << tableName;
-  // Insert a row into the table.
-  shared_ptr<KuduTable> table;
-  KUDU_CHECK_OK(this->client_->OpenTable(tableName, &table));
+bool KuduClass::SpillQueueMetrics(SpillMetrics* metrics) {
+  std::shared_ptr<SpillQueue> spill = std::atomic_load(&this->spill_);
+  if (!spill) {
+    return false;
+  }
+  *metrics = spill->metrics();
+  return true;
+}
 
-  shared_ptr<KuduSession> session = table->client()->NewSession();
-  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::MANUAL_FLUSH));
-  session->SetTimeoutMillis(5000);
+void KuduClass::EnableScanCache(const ScanCacheOptions& options) {
+  this->cache_->Configure(options);
+}
 
-  KuduSchema schema = table->schema();
+ScanCacheMetrics KuduClass::GetScanCacheMetrics() {
+  return this->cache_->metrics();
+}
 
-  KuduUpsert* upsert = table->NewUpsert();
-  KuduPartialRow* row = upsert->mutable_row();
+Status KuduClass::StartCapture(const CaptureOptions& options) {
+  if (std::atomic_load(&this->recorder_)) {
+    return Status::IllegalState("Traffic capture is already running");
+  }
+  std::shared_ptr<TrafficRecorder> recorder(new TrafficRecorder(options));
+  KUDU_RETURN_NOT_OK(recorder->Open());
+  std::atomic_store(&this->recorder_, recorder);
+  return Status::OK();
+}
 
-  Napi::Array props = value.GetPropertyNames();
+bool KuduClass::StopCapture(CaptureStats* stats) {
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_exchange(&this->recorder_, std::shared_ptr<TrafficRecorder>());
+  if (!recorder) {
+    return false;
+  }
+  // Writes and scans still running may hold the recorder; what they record
+  // from now on is counted as dropped.
+  recorder->Stop();
+  *stats = recorder->stats();
+  return true;
+}
 
-  for(int i = 0, l = props.Length(); i < l; i++) {
-    string prop = props.Get(i).ToString();
+Status KuduClass::ReplayCapture(const string path, const ReplayOptions& options, ReplayStats* stats) {
+  TrafficReplayer replayer(this->client_, options);
+  return replayer.Run(path, stats);
+}
 
-    for (int i = 0, l = schema.num_columns(); i < l; i++) {
-      KuduColumnSchema col = schema.Column(i);
+void KuduClass::ConfigureTenants(const TenantLimits& limits) {
+  this->limiter_->Configure(limits);
+}
 
-      if (col.name().compare(prop) == 0) {
-        switch (col.type())
-        {
-        case KuduColumnSchema::INT8:
-          KUDU_CHECK_OK(row->SetInt8(prop, (int)value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT16:
-          KUDU_CHECK_OK(row->SetInt16(prop, (int)value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT32:
-          KUDU_CHECK_OK(row->SetInt32(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::INT64:
-          KUDU_CHECK_OK(row->SetInt64(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::STRING:
-          KUDU_CHECK_OK(row->SetString(prop, value.Get(prop).ToString().Utf8Value()));
-          break;
-        case KuduColumnSchema::BOOL:
-          KUDU_CHECK_OK(row->SetBool(prop, value.Get(prop).ToBoolean()));
-          break;
-        case KuduColumnSchema::FLOAT:
-          KUDU_CHECK_OK(row->SetFloat(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::DOUBLE:
-          KUDU_CHECK_OK(row->SetDouble(prop, value.Get(prop).ToNumber()));
-          break;
-        case KuduColumnSchema::BINARY:
-          KUDU_CHECK_OK(row->SetBinary(prop, value.Get(prop).ToString().Utf8Value()));
-          break;
-        case KuduColumnSchema::UNIXTIME_MICROS:
-          KUDU_CHECK_OK(row->SetUnixTimeMicros(prop, value.Get(prop).ToNumber()));
-          break;
-        
-        default:
-          break;
-        }
-      }
+void KuduClass::SetTenantQuota(const string key, const TenantQuota& quota) {
+  this->limiter_->SetQuota(key, quota);
+}
+
+std::map<string, TenantMetrics> KuduClass::GetTenantMetrics() {
+  return this->limiter_->metrics();
+}
+
+Status KuduClass::EnableWriteCoalescing(const CoalesceOptions& options) {
+  if (std::atomic_load(&this->coalescer_)) {
+    return Status::IllegalState("Write coalescing is already enabled");
+  }
+  // Background flushes have no caller to return to, so their outcome goes to
+  // the completion listener when there is one.
+  CoalesceOptions withListener = options;
+  withListener.onFlushed = [this](const string& tableName, int64_t rows, const Status& s) {
+    std::shared_ptr<CompletionChannel> channel = std::atomic_load(&this->channel_);
+    if (channel) {
+      Completion* completion = new Completion(Completion::FLUSH, 0, tableName);
+      completion->rows = rows;
+      completion->status = s;
+      channel->Push(completion);
     }
+  };
+  std::shared_ptr<WriteCoalescer> coalescer = std::make_shared<WriteCoalescer>(this->client_, withListener,
+      [this](const shared_ptr<KuduTable>& table, int operation, const shared_ptr<KuduSession>& session) {
+        return FlushSession(table, operation, session, NULL);
+      });
+  coalescer->Start();
+  std::atomic_store(&this->coalescer_, coalescer);
+  return Status::OK();
+}
+
+Status KuduClass::FlushWrites() {
+  std::shared_ptr<WriteCoalescer> coalescer = std::atomic_load(&this->coalescer_);
+  if (!coalescer) {
+    return Status::OK();
   }
-  KUDU_CHECK_OK(session->Apply(upsert));
+  return coalescer->Flush();
+}
 
-  Status s = session->Flush();
-  if (s.ok()) {
-    return s;
+bool KuduClass::WriteCoalescerMetrics(CoalesceMetrics* metrics) {
+  std::shared_ptr<WriteCoalescer> coalescer = std::atomic_load(&this->coalescer_);
+  if (!coalescer) {
+    return false;
   }
+  *metrics = coalescer->metrics();
+  return true;
+}
 
-  // Test asynchronous flush.
-  KuduStatusFunctionCallback<void*> status_cb(&StatusCB, NULL);
-  session->FlushAsync(&status_cb);
+// Hands the outcome of a FlushAsync to the completion channel, with the rows
+// the tablet servers rejected. Runs on a reactor thread and deletes itself.
+class FlushCompletion : public KuduStatusCallback {
+ public:
+  FlushCompletion(const std::shared_ptr<CompletionChannel>& channel, Completion* completion, const std::shared_ptr<ScanCache>& cache,
+                  const std::shared_ptr<SpillQueue>& spill, const shared_ptr<KuduTable>& table, int operation)
+      : channel_(channel), completion_(completion), cache_(cache), spill_(spill), table_(table), operation_(operation) {
+  }
 
-  // Look at the session's errors.
-  vector<KuduError*> errors;
-  bool overflow;
-  session->GetPendingErrors(&errors, &overflow);
-  if (!errors.empty()) {
-    s = overflow ? Status::IOError("Overflowed pending errors in session") :
-        errors.front()->status();
-    while (!errors.empty()) {
-      delete errors.back();
-      errors.pop_back();
+  void Run(const Status& status) override {
+    Completion* completion = this->completion_;
+    completion->status = status;
+    if (!status.ok()) {
+      // As with a synchronous flush, rows that were spilled are not reported,
+      // and the flush only fails if some row could not be spilled.
+      vector<KuduError*> errors;
+      bool overflow;
+      completion->session->GetPendingErrors(&errors, &overflow);
+      bool failed = !errors.empty();
+      SpillRetryable(this->spill_, this->table_, this->operation_, &errors);
+      for (KuduError* error : errors) {
+        completion->errors.push_back(RowError{ error->status().ToString(), error->failed_op().ToString() });
+        delete error;
+      }
+      if (overflow) {
+        completion->status = Status::IOError("Overflowed pending errors in session");
+      } else if (failed && completion->errors.empty()) {
+        completion->status = Status::OK();
+      }
     }
+    this->cache_->Invalidate(completion->table);
+    this->channel_->Push(completion);
+    delete this;
   }
-  KUDU_RETURN_NOT_OK(s);
 
-  // Close the session.
-  return session->Close();
+ private:
+  std::shared_ptr<CompletionChannel> channel_;
+  Completion* completion_;
+  std::shared_ptr<ScanCache> cache_;
+  std::shared_ptr<SpillQueue> spill_;
+  shared_ptr<KuduTable> table_;
+  int operation_;
+};
+
+Status KuduClass::OpenCompletions(Napi::Env env, const Napi::Function callback, const CompletionOptions& options) {
+  if (std::atomic_load(&this->channel_)) {
+    return Status::IllegalState("A completion listener is already registered");
+  }
+  std::shared_ptr<CompletionChannel> channel(new CompletionChannel(options));
+  channel->Open(env, callback);
+  std::atomic_store(&this->channel_, channel);
+  return Status::OK();
 }
 
-Status KuduClass::InsertRows(const string tableName, const Napi::Array rows) {
-  KUDU_LOG(INFO) << "Inserting multiple records in " << tableName;
-  // Insert a row into the table.
-  shared_ptr<KuduTable> table;
-  KUDU_CHECK_OK(this->client_->OpenTable(tableName, &table));
+bool KuduClass::CloseCompletions(CompletionMetrics* metrics) {
+  std::shared_ptr<CompletionChannel> channel = std::atomic_exchange(&this->channel_, std::shared_ptr<CompletionChannel>());
+  if (!channel) {
+    return false;
+  }
+  // Flushes and scans still running hold the channel; what they push from
+  // now on is counted as dropped.
+  channel->Close();
+  *metrics = channel->metrics();
+  return true;
+}
 
-  shared_ptr<KuduSession> session = table->client()->NewSession();
-  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::MANUAL_FLUSH));
-  session->SetTimeoutMillis(5000);
+bool KuduClass::GetCompletionMetrics(CompletionMetrics* metrics) {
+  std::shared_ptr<CompletionChannel> channel = std::atomic_load(&this->channel_);
+  if (!channel) {
+    return false;
+  }
+  *metrics = channel->metrics();
+  return true;
+}
 
-  KuduSchema schema = table->schema();
+int64_t KuduClass::NextCompletionId() {
+  return this->nextCompletionId_++;
+}
 
-  for (unsigned int i = 0; i < rows.Length(); i++) {
-    Napi::Object value = rows.Get(i).ToObject();
-    KuduInsert* insert = table->NewInsert();
-    KuduPartialRow* row = insert->mutable_row();
+Status KuduClass::WriteRowsAsync(const string tableName, int operation, const Napi::Array rows, const string tenant, int64_t* id) {
+  std::shared_ptr<CompletionChannel> channel = std::atomic_load(&this->channel_);
+  if (!channel) {
+    return Status::IllegalState("No completion listener, call onCompletion first");
+  }
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+  KUDU_RETURN_NOT_OK(FlushCoalesced(tableName));
 
-    Napi::Array props = value.GetPropertyNames();
-
-    for(int i = 0, l = props.Length(); i < l; i++) {
-      string prop = props.Get(i).ToString();
-
-      for (int i = 0, l = schema.num_columns(); i < l; i++) {
-        KuduColumnSchema col = schema.Column(i);
-
-        if (col.name().compare(prop) == 0) {
-          switch (col.type())
-          {
-          case KuduColumnSchema::INT8:
-            KUDU_CHECK_OK(row->SetInt8(prop, (int)value.Get(prop).ToNumber()));
-            break;
-          case KuduColumnSchema::INT16:
-            KUDU_CHECK_OK(row->SetInt16(prop, (int)value.Get(prop).ToNumber()));
-            break;
-          case KuduColumnSchema::INT32:
-            KUDU_CHECK_OK(row->SetInt32(prop, value.Get(prop).ToNumber()));
-            break;
-          case KuduColumnSchema::INT64:
-            KUDU_CHECK_OK(row->SetInt64(prop, value.Get(prop).ToNumber()));
-            break;
-          case KuduColumnSchema::STRING:
-            KUDU_CHECK_OK(row->SetString(prop, value.Get(prop).ToString().Utf8Value()));
-            break;
-          case KuduColumnSchema::BOOL:
-            KUDU_CHECK_OK(row->SetBool(prop, value.Get(prop).ToBoolean()));
-            break;
-          case KuduColumnSchema::FLOAT:
-            KUDU_CHECK_OK(row->SetFloat(prop, value.Get(prop).ToNumber()));
-            break;
-          case KuduColumnSchema::DOUBLE:
-            KUDU_CHECK_OK(row->SetDouble(prop, value.Get(prop).ToNumber()));
-            break;
-          case KuduColumnSchema::BINARY:
-            KUDU_CHECK_OK(row->SetBinary(prop, value.Get(prop).ToString().Utf8Value()));
-            break;
-          case KuduColumnSchema::UNIXTIME_MICROS:
-            KUDU_CHECK_OK(row->SetUnixTimeMicros(prop, value.Get(prop).ToNumber()));
-            break;
-          
-          default:
-            break;
-          }
-        }
-      }
+  std::unique_ptr<Completion> completion(new Completion(Completion::FLUSH, NextCompletionId(), tableName));
+  KUDU_RETURN_NOT_OK(NewManualSession(table, &completion->session));
+  completion->memory.reset(new MemoryReservation(MemoryTracker::WRITE_BUFFERS));
+
+  // The whole call is flushed at once, so the buffer is sized for every row
+  // before the first one is applied.
+  KuduSchema schema = table->schema();
+  vector<KuduWriteOperation*> ops;
+  size_t total = 0;
+  Status s;
+  for (unsigned int i = 0; i < rows.Length() && s.ok(); i++) {
+    KuduWriteOperation* op = NewOperation(table.get(), operation);
+    if (op == NULL) {
+      s = Status::InvalidArgument("Unknown write operation");
+      break;
     }
-    KUDU_CHECK_OK(session->Apply(insert));
+    ops.push_back(op);
+    size_t bytes = kRowOverheadBytes;
+    s = SetRowValues(op->mutable_row(), schema, rows.Get(i).ToObject(), &bytes);
+    total += bytes;
+  }
+  if (s.ok()) {
+    s = completion->memory->Grow(total);
   }
-  Status s = session->Flush();
   if (s.ok()) {
+    s = completion->session->SetMutationBufferSpace(std::max(kSessionBufferBytes, total));
+  }
+  if (!s.ok()) {
+    for (KuduWriteOperation* op : ops) {
+      delete op;
+    }
     return s;
   }
 
-  // Test asynchronous flush.
-  KuduStatusFunctionCallback<void*> status_cb(&StatusCB, NULL);
-  session->FlushAsync(&status_cb);
+  if (this->limiter_->enabled()) {
+    s = this->limiter_->TryAcquire(tenant, ops.size(), total - ops.size() * kRowOverheadBytes);
+    if (!s.ok()) {
+      for (KuduWriteOperation* op : ops) {
+        delete op;
+      }
+      return s;
+    }
+  }
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  int64_t start = recorder ? recorder->Now() : 0;
+  string captured;
+  for (size_t i = 0; i < ops.size(); i++) {
+    if (recorder) {
+      AppendCapturedRow(*ops[i]->mutable_row(), schema, &captured);
+    }
+    // The session owns the operation even when Apply fails.
+    s = completion->session->Apply(ops[i]);
+    if (!s.ok()) {
+      for (size_t j = i + 1; j < ops.size(); j++) {
+        delete ops[j];
+      }
+      return s;
+    }
+  }
+  if (recorder) {
+    recorder->RecordWrite(tableName, operation, start, captured, ops.size());
+  }
 
-  // Look at the session's errors.
-  vector<KuduError*> errors;
-  bool overflow;
-  session->GetPendingErrors(&errors, &overflow);
-  if (!errors.empty()) {
-    s = overflow ? Status::IOError("Overflowed pending errors in session") :
-        errors.front()->status();
-    while (!errors.empty()) {
-      delete errors.back();
-      errors.pop_back();
+  completion->rows = ops.size();
+  *id = completion->id;
+  KuduSession* session = completion->session.get();
+  session->FlushAsync(new FlushCompletion(channel, completion.release(), this->cache_, std::atomic_load(&this->spill_), table, operation));
+  return Status::OK();
+}
+
+// Ends a streamed scan with a last, empty batch carrying its status.
+static Status EndStream(StreamScanState* state, int64_t id, const string& tableName, const Status& s) {
+  Completion* completion = new Completion(Completion::SCAN_BATCH, id, tableName);
+  completion->status = s;
+  completion->last = true;
+  state->done = true;
+  state->channel->Push(completion);
+  return s;
+}
+
+Status KuduClass::StreamScan(const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, int64_t id, StreamScanState* state) {
+  if (!state->scanner) {
+    state->channel = std::atomic_load(&this->channel_);
+    if (!state->channel) {
+      state->done = true;
+      return Status::IllegalState("No completion listener, call onCompletion first");
+    }
+    KUDU_LOG(INFO) << "Streaming rows out of table " + tableName;
+    state->recorder = std::atomic_load(&this->recorder_);
+    state->start = state->recorder ? state->recorder->Now() : 0;
+
+    Status s = this->client_->OpenTable(tableName, &state->table);
+    if (!s.ok()) {
+      return EndStream(state, id, tableName, s);
+    }
+    state->scanner.reset(new KuduScanner(state->table.get()));
+    for (size_t i = 0; i < predicates.size() && s.ok(); i++) {
+      s = state->scanner->AddConjunctPredicate(predicates[i].ToKuduPredicate(state->table.get()));
+    }
+    if (s.ok() && !options.projection.empty()) {
+      s = state->scanner->SetProjectedColumnNames(options.projection);
+    }
+    if (s.ok() && options.limit > 0) {
+      s = state->scanner->SetLimit(options.limit);
+    }
+    // Streamed scans run on the thread pool, so they may wait for tokens.
+    if (s.ok() && this->limiter_->enabled()) {
+      this->limiter_->Acquire(options.tenant, 0, 0);
+    }
+    if (s.ok()) {
+      s = state->scanner->Open();
+    }
+    if (!s.ok()) {
+      return EndStream(state, id, tableName, s);
+    }
+    state->window = std::make_shared<CompletionWindow>(options.maxInFlight);
+    if (!state->scanner->HasMoreRows()) {
+      EndStream(state, id, tableName, s);
     }
   }
-  KUDU_RETURN_NOT_OK(s);
 
-  // Close the session.
-  return session->Close();
+  // Every Kudu batch is pushed as it arrives, but at most maxInFlight of them
+  // wait for the listener at a time; past that the run ends, and the scan is
+  // resumed once a batch is delivered.
+  KuduScanBatch batch;
+  while (!state->done) {
+    if (!state->window->TryAcquire()) {
+      return Status::OK();
+    }
+    // The slot goes back when the completion is deleted, on every path.
+    std::unique_ptr<Completion> completion(new Completion(Completion::SCAN_BATCH, id, tableName));
+    completion->window = state->window;
+    Status s = state->scanner->NextBatch(&batch);
+    if (!s.ok()) {
+      return EndStream(state, id, tableName, s);
+    }
+    if (this->limiter_->enabled()) {
+      this->limiter_->Charge(options.tenant, batch.NumRows(), batch.direct_data().size() + batch.indirect_data().size());
+    }
+    completion->batch.reset(new ColumnarBatch(state->scanner->GetProjectionSchema()));
+    completion->memory.reset(new MemoryReservation(MemoryTracker::SCAN_BATCHES));
+    s = completion->batch->Append(batch);
+    if (s.ok()) {
+      s = completion->memory->Grow(completion->batch->ByteSize());
+    }
+    if (!s.ok()) {
+      return EndStream(state, id, tableName, s);
+    }
+    state->done = !state->scanner->HasMoreRows();
+    completion->rows = batch.NumRows();
+    completion->last = state->done;
+    state->rows += batch.NumRows();
+    state->channel->Push(completion.release());
+  }
+  if (state->recorder) {
+    state->recorder->RecordScan(tableName, state->start, predicates, options.projection, options.limit);
+  }
+  return Status::OK();
 }
 
 static Status InsertKuduRows(const shared_ptr<KuduTable>& table, int num_rows) {
@@ -668,122 +1242,361 @@ static Status ScanRows(const shared_ptr<KuduTable>& table) {
   return Status::OK();
 }
 
-Napi::Array KuduClass::ScanRow(const string tableName, const Napi::CallbackInfo& info) {
-  Napi::Env env = info.Env();
-  Napi::Array obj = Napi::Array::New(env);
+Status KuduClass::ScanColumns(const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, MemoryReservation* reservation, std::shared_ptr<const ColumnarBatch>* columns) {
+  const vector<string>& projection = options.projection;
+  bool sorted = options.ordered || !options.orderBy.empty();
+  if (sorted) {
+    KUDU_LOG(INFO) << "Scanning ordered rows out of table " + tableName;
+    shared_ptr<KuduTable> table;
+    KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+    ScanOrder order;
+    order.primaryKey = options.ordered;
+    order.columns = options.orderBy;
+    order.descending = options.descending;
+    order.limit = options.limit;
+    OrderedScanner scanner(table, predicates, projection, order, options.parallelism);
+    std::shared_ptr<ColumnarBatch> result;
+    if (this->limiter_->enabled()) {
+      KUDU_RETURN_NOT_OK(this->limiter_->TryAcquire(options.tenant, 0, 0));
+    }
+    KUDU_RETURN_NOT_OK(scanner.Run(&result));
+    if (this->limiter_->enabled()) {
+      this->limiter_->Charge(options.tenant, result->num_rows(), result->ByteSize());
+    }
+    KUDU_RETURN_NOT_OK(reservation->Grow(result->ByteSize()));
+    *columns = result;
+    return Status::OK();
+  }
+
+  bool cacheable = options.useCache && options.limit == 0 && this->cache_->enabled();
+  string key;
+  uint64_t generation = 0;
+  if (cacheable) {
+    key = ScanCache::Key(tableName, predicates, projection);
+    *columns = this->cache_->Get(key, tableName);
+    if (*columns) {
+      return Status::OK();
+    }
+    generation = this->cache_->Generation(tableName);
+  }
 
   shared_ptr<KuduTable> table;
-  KUDU_CHECK_OK(this->client_->OpenTable(tableName, &table));
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
   KuduScanner scanner(table.get());
 
   KUDU_LOG(INFO) << "Scanning rows out of table " + tableName;
 
-  Napi::Array predicates = info[1].As<Napi::Array>();
-  KuduPredicate* p;
-  for (unsigned int i = 0; i < predicates.Length(); i++) {
-    Napi::Object value = predicates.Get(i).ToObject();
-    KuduPredicate::ComparisonOp c = static_cast<KuduPredicate::ComparisonOp>(value.Get("comparisonOp").ToNumber().Int32Value());
-    p = table->NewComparisonPredicate(
-      value.Get("colName").ToString().Utf8Value(), c, KuduValue::FromInt(value.Get("value").ToNumber()));
-    scanner.AddConjunctPredicate(p);
+  for (const KPredicate& predicate : predicates) {
+    KUDU_RETURN_NOT_OK(scanner.AddConjunctPredicate(predicate.ToKuduPredicate(table.get())));
   }
+  if (!projection.empty()) {
+    KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(projection));
+  }
+  if (options.limit > 0) {
+    KUDU_RETURN_NOT_OK(scanner.SetLimit(options.limit));
+  }
+  // Rows and bytes are only known as batches arrive, so they are charged
+  // afterwards and the tenant's next scan or write waits the debt off.
+  bool limited = this->limiter_->enabled();
+  if (limited) {
+    KUDU_RETURN_NOT_OK(this->limiter_->TryAcquire(options.tenant, 0, 0));
+  }
+  KUDU_RETURN_NOT_OK(scanner.Open());
 
-  KUDU_LOG(INFO) << "Added predicate " + tableName;
-
-  scanner.Open();
+  std::shared_ptr<ColumnarBatch> result(new ColumnarBatch(scanner.GetProjectionSchema()));
   KuduScanBatch batch;
+  while (scanner.HasMoreRows()) {
+    KUDU_RETURN_NOT_OK(scanner.NextBatch(&batch));
+    if (limited) {
+      this->limiter_->Charge(options.tenant, batch.NumRows(), batch.direct_data().size() + batch.indirect_data().size());
+    }
+    KUDU_RETURN_NOT_OK(result->Append(batch));
+    // Charged as the result grows, so an oversized scan stops early.
+    if (result->ByteSize() > reservation->bytes()) {
+      KUDU_RETURN_NOT_OK(reservation->Grow(result->ByteSize() - reservation->bytes()));
+    }
+  }
+  *columns = result;
+  if (cacheable) {
+    this->cache_->Put(key, tableName, generation, *columns);
+  }
+  return Status::OK();
+}
+
+Status KuduClass::ScanRows(Napi::Env env, const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, Napi::Value* rows) {
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  int64_t start = recorder ? recorder->Now() : 0;
+  std::shared_ptr<const ColumnarBatch> columns;
+  MemoryReservation batches(MemoryTracker::SCAN_BATCHES);
+  KUDU_RETURN_NOT_OK(ScanColumns(tableName, predicates, options, &batches, &columns));
+  if (recorder) {
+    recorder->RecordScan(tableName, start, predicates, options.projection, options.limit);
+  }
+  return MaterializeRows(env, *columns, options.layout, options.dictionary, rows);
+}
+
+Status KuduClass::MaterializeRows(Napi::Env env, const ColumnarBatch& columns, int layout, bool dictionary, Napi::Value* rows) {
+  // JS values are only accounted for while they are built, once returned
+  // they belong to the V8 heap.
+  MemoryReservation results(MemoryTracker::SCAN_RESULTS);
+  KUDU_RETURN_NOT_OK(results.Grow(columns.num_rows() * columns.columns().size() * kJsValueBytes + columns.ByteSize()));
+  RowMaterializer materializer(env, columns, static_cast<RowMaterializer::Layout>(layout), dictionary);
+  materializer.Append(columns);
+  *rows = materializer.Result();
+  return Status::OK();
+}
+
+Status KuduClass::ScanJoin(const string leftTable, const string rightTable, const JoinOptions& options, MemoryReservation* reservation, std::shared_ptr<const ColumnarBatch>* columns) {
+  KUDU_LOG(INFO) << "Joining table " << leftTable << " with " << rightTable;
+  shared_ptr<KuduTable> left;
+  shared_ptr<KuduTable> right;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(leftTable, &left));
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(rightTable, &right));
+
+  std::shared_ptr<ColumnarBatch> result;
+  HashJoin join(left, right, options);
+  KUDU_RETURN_NOT_OK(join.Run(&result));
+  KUDU_RETURN_NOT_OK(reservation->Grow(result->ByteSize()));
+  *columns = result;
+  return Status::OK();
+}
+
+Status KuduClass::ScanRollup(const string tableName, const RollupOptions& options, const string tenant, RollupResult* result) {
+  KUDU_LOG(INFO) << "Rolling up table " << tableName << " by " << options.timeColumn;
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+  // Runs on the thread pool, so the tenant waits for its turn here.
+  bool limited = this->limiter_->enabled();
+  if (limited) {
+    this->limiter_->Acquire(tenant, 0, 0);
+  }
 
-  int i = 0;
-  KUDU_LOG(INFO) << "Iterating Scanner " + tableName;
+  Rollup runner(table, options);
+  KUDU_RETURN_NOT_OK(runner.Run(result));
+  if (limited) {
+    this->limiter_->Charge(tenant, result->rowsScanned, result->bytesScanned);
+  }
+  return Status::OK();
+}
+
+Status KuduClass::MaterializeRollup(Napi::Env env, const RollupOptions& options, const RollupResult& rollup, Napi::Value* result) {
+  size_t rows = rollup.buckets.size();
+  MemoryReservation results(MemoryTracker::SCAN_RESULTS);
+  KUDU_RETURN_NOT_OK(results.Grow(rows * (options.aggs.size() + 1) * sizeof(double) +
+                                  rows * options.groupBy.size() * kJsValueBytes + rollup.groups->ByteSize()));
+  Napi::Object out = Napi::Object::New(env);
+  out.Set("rowCount", Napi::Number::New(env, rows));
+  Napi::Float64Array buckets = Napi::Float64Array::New(env, rows);
+  for (size_t i = 0; i < rows; i++) {
+    buckets[i] = static_cast<double>(rollup.buckets[i]);
+  }
+  out.Set("buckets", buckets);
+  if (!options.groupBy.empty()) {
+    RowMaterializer materializer(env, *rollup.groups, RowMaterializer::COLUMNS, false);
+    materializer.Append(*rollup.groups);
+    out.Set("groups", materializer.Result().As<Napi::Object>().Get("columns"));
+  }
+  Napi::Object values = Napi::Object::New(env);
+  for (size_t a = 0; a < options.aggs.size(); a++) {
+    Napi::Float64Array array = Napi::Float64Array::New(env, rows);
+    if (rows > 0) {
+      memcpy(array.Data(), rollup.values[a].data(), rows * sizeof(double));
+    }
+    values.Set(options.aggs[a].name, array);
+  }
+  out.Set("values", values);
+  out.Set("rowsScanned", Napi::Number::New(env, rollup.rowsScanned));
+  *result = out;
+  return Status::OK();
+}
+
+Status KuduClass::ExplainScan(const string tableName, const vector<KPredicate>& predicates, const vector<string>& projection, bool execute, ScanPlan* plan) {
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+  return ::ExplainScan(this->client_, table, predicates, projection, execute, plan);
+}
+
+Status KuduClass::ExportTable(const string tableName, const string path, const ExportOptions& options, ExportStats* stats) {
+  KUDU_LOG(INFO) << "Exporting table " << tableName << " to " << path;
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+
+  TableExporter exporter(table, options);
+  return exporter.Run(path, stats);
+}
+
+Status KuduClass::ScanArrow(const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, string* ipc) {
+  KUDU_LOG(INFO) << "Scanning Arrow record batches out of table " << tableName;
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  int64_t start = recorder ? recorder->Now() : 0;
+  const vector<string>& projection = options.projection;
+  bool sorted = options.ordered || !options.orderBy.empty();
+  if (sorted || (options.useCache && this->cache_->enabled())) {
+    // Cached and sorted results are kept whole, so they go out as a single
+    // record batch.
+    std::shared_ptr<const ColumnarBatch> columns;
+    MemoryReservation batches(MemoryTracker::SCAN_BATCHES);
+    KUDU_RETURN_NOT_OK(ScanColumns(tableName, predicates, options, &batches, &columns));
+    ArrowWriter writer(ipc, false);
+    KUDU_RETURN_NOT_OK(writer.WriteSchema(*columns));
+    if (columns->num_rows() > 0) {
+      KUDU_RETURN_NOT_OK(writer.WriteBatch(*columns));
+    }
+    if (recorder) {
+      recorder->RecordScan(tableName, start, predicates, projection, options.limit);
+    }
+    return writer.Finish();
+  }
+
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+
+  KuduScanner scanner(table.get());
+  for (const KPredicate& predicate : predicates) {
+    KUDU_RETURN_NOT_OK(scanner.AddConjunctPredicate(predicate.ToKuduPredicate(table.get())));
+  }
+  if (!projection.empty()) {
+    KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(projection));
+  }
+  if (options.limit > 0) {
+    KUDU_RETURN_NOT_OK(scanner.SetLimit(options.limit));
+  }
+  bool limited = this->limiter_->enabled();
+  if (limited) {
+    KUDU_RETURN_NOT_OK(this->limiter_->TryAcquire(options.tenant, 0, 0));
+  }
+  KUDU_RETURN_NOT_OK(scanner.Open());
+
+  // One record batch per Kudu batch, so only a single batch is ever held in
+  // columnar form besides the IPC output itself.
+  ColumnarBatch columns(scanner.GetProjectionSchema());
+  ArrowWriter writer(ipc, false);
+  KUDU_RETURN_NOT_OK(writer.WriteSchema(columns));
+  MemoryReservation output(MemoryTracker::SCAN_BATCHES);
+  KuduScanBatch batch;
   while (scanner.HasMoreRows()) {
-    scanner.NextBatch(&batch);
-    for (KuduScanBatch::RowPtr row : batch) {
-      const KuduSchema *schema = batch.projection_schema();
-      Napi::Object tmp = Napi::Object::New(env);
-      for (int i = 0, l = schema->num_columns(); i < l; i++) {
-        KuduColumnSchema col = schema->Column(i);
-        switch (col.type())
-        {
-          case KuduColumnSchema::INT8:
-          {
-            int8_t val;
-            row.GetInt8(col.name(), &val);
-            tmp.Set(col.name(), val);
-            std::cout << "Got: " << val << std::endl;
-            break;
-          }
-          case KuduColumnSchema::INT16:
-          {
-            int16_t val;
-            row.GetInt16(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          case KuduColumnSchema::INT32:
-          {
-            int32_t val;
-            row.GetInt32(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          case KuduColumnSchema::INT64:
-          {
-            int64_t val;
-            row.GetInt64(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          case KuduColumnSchema::STRING:
-          {
-            kudu::Slice val;
-            row.GetString(col.name(), &val);
-            tmp.Set(col.name(), val.ToString());
-            break;
-          }
-          case KuduColumnSchema::BOOL:
-          {
-            bool val;
-            row.GetBool(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          case KuduColumnSchema::FLOAT:
-          {
-            float val;
-            row.GetFloat(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          case KuduColumnSchema::DOUBLE:
-          {
-            double val;
-            row.GetDouble(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          case KuduColumnSchema::BINARY:
-          {
-            kudu::Slice val;
-            row.GetBinary(col.name(), &val);
-            tmp.Set(col.name(), val.ToString());
-            break;
-          }
-          case KuduColumnSchema::UNIXTIME_MICROS:
-          {
-            int64_t val;
-            row.GetUnixTimeMicros(col.name(), &val);
-            tmp.Set(col.name(), val);
-            break;
-          }
-          default:
-            break;
-          }
+    KUDU_RETURN_NOT_OK(scanner.NextBatch(&batch));
+    if (limited) {
+      this->limiter_->Charge(options.tenant, batch.NumRows(), batch.direct_data().size() + batch.indirect_data().size());
+    }
+    KUDU_RETURN_NOT_OK(columns.Append(batch));
+    KUDU_RETURN_NOT_OK(writer.WriteBatch(columns));
+    columns.Clear();
+    if (ipc->size() > output.bytes()) {
+      KUDU_RETURN_NOT_OK(output.Grow(ipc->size() - output.bytes()));
+    }
+  }
+  if (recorder) {
+    recorder->RecordScan(tableName, start, predicates, projection, options.limit);
+  }
+  return writer.Finish();
+}
+
+Status KuduClass::WriteArrow(const string tableName, int operation, const uint8_t* ipc, size_t length, const string tenant, int64_t* applied) {
+  KUDU_LOG(INFO) << "Writing Arrow record batches to table " << tableName;
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, &table));
+  KUDU_RETURN_NOT_OK(FlushCoalesced(tableName));
+
+  shared_ptr<KuduSession> session = table->client()->NewSession();
+  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::AUTO_FLUSH_BACKGROUND));
+  session->SetTimeoutMillis(5000);
+  // Apply blocks while the buffer is full, so a smaller one under memory
+  // pressure slows the write down instead of failing it.
+  MemoryReservation buffer(MemoryTracker::WRITE_BUFFERS);
+  size_t bufferBytes;
+  KUDU_RETURN_NOT_OK(buffer.GrowUpTo(kSessionBufferBytes, kMinSessionBufferBytes, &bufferBytes));
+  KUDU_RETURN_NOT_OK(session->SetMutationBufferSpace(bufferBytes));
+
+  ArrowReader reader(ipc, length);
+  KUDU_RETURN_NOT_OK(reader.ReadSchema());
+
+  // Resolve every Arrow field to a column index once, so rows are applied with
+  // index-based setters only.
+  KuduSchema schema = table->schema();
+  const vector<ArrowReader::Field>& fields = reader.fields();
+  vector<int> indexes(fields.size(), -1);
+  vector<KuduColumnSchema::DataType> types(fields.size());
+  for (size_t f = 0; f < fields.size(); f++) {
+    for (int i = 0, l = schema.num_columns(); i < l; i++) {
+      KuduColumnSchema col = schema.Column(i);
+      if (col.name().compare(fields[f].name) == 0) {
+        indexes[f] = i;
+        types[f] = col.type();
+        break;
       }
-      obj.Set(i++, tmp);
     }
+    if (indexes[f] < 0) {
+      return Status::InvalidArgument("Unknown column in Arrow data: " + fields[f].name);
+    }
+  }
+
+  // Rows and bytes are only known as the stream is decoded, so the tenant is
+  // admitted up front and charged once at the end.
+  bool limited = this->limiter_->enabled();
+  if (limited) {
+    KUDU_RETURN_NOT_OK(this->limiter_->TryAcquire(tenant, 0, 0));
   }
-  // return Status::OK();
-  return obj;
+
+  std::shared_ptr<TrafficRecorder> recorder = std::atomic_load(&this->recorder_);
+  int64_t start = recorder ? recorder->Now() : 0;
+  string captured;
+  *applied = 0;
+  size_t written = 0;
+  bool done = false;
+  Status s;
+  while (s.ok()) {
+    s = reader.Next(&done);
+    if (!s.ok() || done) {
+      break;
+    }
+    for (int64_t r = 0; s.ok() && r < reader.num_rows(); r++) {
+      KuduWriteOperation* op = NewOperation(table.get(), operation);
+      if (op == NULL) {
+        s = Status::InvalidArgument("Unknown write operation");
+        break;
+      }
+      KuduPartialRow* row = op->mutable_row();
+      size_t bytes = 0;
+      for (size_t f = 0; s.ok() && f < fields.size(); f++) {
+        s = reader.IsNull(f, r) ? row->SetNull(indexes[f]) :
+            SetArrowCell(row, indexes[f], types[f], reader, f, r);
+        bytes += reader.IsBinary(f) ? reader.GetBytes(f, r).size() : ColumnarBatch::ValueWidth(types[f]);
+      }
+      if (!s.ok()) {
+        delete op;
+        break;
+      }
+      if (recorder) {
+        AppendCapturedRow(*row, schema, &captured);
+      }
+      s = session->Apply(op);
+      if (s.ok()) {
+        (*applied)++;
+        written += bytes;
+      }
+    }
+  }
+  if (limited) {
+    this->limiter_->Charge(tenant, *applied, written);
+  }
+  // The write is not atomic: when the stream turns out to be bad partway
+  // through, the rows applied before it are still flushed. Rows rejected as
+  // the session flushes are taken off, so *applied counts the rows written or
+  // spilled, though they need not be a prefix of the stream then.
+  int64_t failed = 0;
+  Status fs = FlushSession(table, operation, session, &failed);
+  *applied -= failed;
+  if (!fs.ok()) {
+    session->Close();
+  }
+  if (s.ok()) {
+    s = fs;
+  }
+  if (recorder) {
+    recorder->RecordWrite(tableName, operation, start, captured, *applied);
+  }
+  return s;
 }
 
 // A helper class providing custom logging callback. It also manages
@@ -798,7 +1611,7 @@ public:
     kudu::client::UninstallLoggingCallback();
   }
 
-  static void LogCb(void* unused,
+  static void LogCb(void*,
                     kudu::client::KuduLogSeverity severity,
                     const char* filename,
                     int line_number,
@@ -1,3 +1,10 @@
+#ifndef KUDUJS_KUDUCLASS_H
+#define KUDUJS_KUDUCLASS_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <kudu/client/client.h>
 #include <napi.h>
@@ -8,6 +15,44 @@ using kudu::client::KuduClient;
 using kudu::client::sp::shared_ptr;
 using kudu::Status;
 using kudu::client::KuduSchema;
+using kudu::client::KuduPredicate;
+using kudu::client::KuduTable;
+
+struct ExportOptions;
+struct ExportStats;
+struct SpillOptions;
+struct SpillMetrics;
+class SpillQueue;
+struct CoalesceOptions;
+struct CoalesceMetrics;
+class WriteCoalescer;
+struct TimePartitioning;
+struct PartitionChanges;
+struct ScanCacheOptions;
+struct ScanCacheMetrics;
+class ScanCache;
+class ColumnarBatch;
+class MemoryReservation;
+struct MarshaledRows;
+struct PipelineOptions;
+struct PipelineStats;
+struct JoinOptions;
+struct ScanPlan;
+struct RollupOptions;
+struct RollupResult;
+struct CaptureOptions;
+struct CaptureStats;
+struct ReplayOptions;
+struct ReplayStats;
+class TrafficRecorder;
+class TenantLimiter;
+struct TenantLimits;
+struct TenantQuota;
+struct TenantMetrics;
+struct CompletionOptions;
+struct CompletionMetrics;
+class CompletionChannel;
+struct StreamScanState;
 
 class KSchema {
   public:
@@ -23,25 +68,149 @@ class KSchema {
     bool notNull_;
 };
 
+class KPredicate {
+  public:
+    KPredicate(string colName, int comparisonOp, const Napi::Value value); // constructor
+    KPredicate(string colName, int comparisonOp, double number, bool isBool);
+    KPredicate(string colName, int comparisonOp, string value);
+    string GetColName() const;
+    int GetComparisonOp() const;
+    bool IsString() const;
+    bool IsBool() const;
+    double GetNumber() const;
+    string GetString() const;
+    KuduPredicate* ToKuduPredicate(KuduTable* table) const;
+    string ToString() const;
+  private:
+    string colName_;
+    int comparisonOp_;
+    bool isString_;
+    bool isBool_;
+    double number_;
+    string string_;
+};
+
+struct ClientOptions {
+  int adminTimeoutMillis;
+  int rpcTimeoutMillis; // 0 keeps the client default
+  int negotiationTimeoutMillis; // 0 keeps the client default
+  int numReactors; // 0 keeps the client default
+  int verboseLogLevel;
+};
+
+struct PrewarmStats {
+  int64_t tables;
+  int64_t tablets;
+  int64_t failed;
+  double millis;
+};
+
+struct ScanOptions {
+  vector<string> projection;
+  bool useCache;
+  int layout; // a RowMaterializer::Layout
+  bool dictionary;
+  bool ordered; // primary key order
+  vector<string> orderBy; // or order by these columns
+  vector<bool> descending; // per orderBy column
+  int64_t limit; // 0 for every row
+  int parallelism; // concurrent tablet scans of ordered scans
+  string tenant; // key the scan is rate limited under
+  int maxInFlight; // streamed batches pushed but not yet delivered
+};
+
+// Builds one scan token per tablet left after partition pruning, with the
+// given predicates and projection applied. The caller owns the tokens.
+Status BuildScanTokens(const shared_ptr<KuduTable>& table, const vector<KPredicate>& predicates,
+                       const vector<string>& projection, vector<kudu::client::KuduScanToken*>* tokens);
+
+// Tables opened once and shared by the threads of a long-lived component.
+class TableCache {
+ public:
+  explicit TableCache(const shared_ptr<KuduClient>& client);
+  Status Get(const string& tableName, shared_ptr<KuduTable>* table);
+
+ private:
+  shared_ptr<KuduClient> client_;
+  std::mutex mutex_;
+  std::map<string, shared_ptr<KuduTable>> tables_;
+};
+
 class KuduClass {
  public:
-  KuduClass(vector<string> masters); //constructor
+  KuduClass(vector<string> masters, const ClientOptions& options); //constructor
+  ~KuduClass();
+  // Whether the client could be created; nothing else may be called if not.
+  Status status() const;
   string getValue(); //getter for the value
   string add(string toAdd); //adds the toAdd value to the value_
   void CreateTable(string tableName, vector<KSchema> schema, int numTablets, int partitioning, vector<string>& columns);
   void DeleteTable(string tableName);
-  Status InsertRow(const string tableName, const Napi::Object value);
-  Status UpdateRow(const string tableName, const Napi::Object value);
-  Status UpsertRow(const string tableName, const Napi::Object value);
-  Status InsertRows(const string tableName, const Napi::Array rows);
-  Napi::Array ScanRow(const string tableName, const Napi::CallbackInfo& info);
+  Status CreateTimeSeriesTable(const string tableName, vector<KSchema> schema, const TimePartitioning& options, int64_t from);
+  Status AlterRangePartition(const string tableName, const string column, int64_t lower, int64_t upper, bool drop);
+  Status MaintainTimePartitions(const string tableName, const TimePartitioning& options, PartitionChanges* changes);
+  Status InsertRow(const string tableName, const Napi::Object value, const string tenant);
+  Status UpdateRow(const string tableName, const Napi::Object value, const string tenant);
+  Status UpsertRow(const string tableName, const Napi::Object value, const string tenant);
+  Status InsertRows(const string tableName, const Napi::Array rows, const string tenant);
+  Status Prewarm(const vector<string>& tables, PrewarmStats* stats);
+  Status WriteRowsParallel(const string tableName, int operation, const MarshaledRows& rows, const PipelineOptions& options, PipelineStats* stats);
+  Status ScanRows(Napi::Env env, const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, Napi::Value* rows);
+  Status ScanJoin(const string leftTable, const string rightTable, const JoinOptions& options, MemoryReservation* reservation, std::shared_ptr<const ColumnarBatch>* columns);
+  Status ScanRollup(const string tableName, const RollupOptions& options, const string tenant, RollupResult* result);
+  Status ExplainScan(const string tableName, const vector<KPredicate>& predicates, const vector<string>& projection, bool execute, ScanPlan* plan);
+  Status ExportTable(const string tableName, const string path, const ExportOptions& options, ExportStats* stats);
+  Status ScanArrow(const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, string* ipc);
+  Status WriteArrow(const string tableName, int operation, const uint8_t* ipc, size_t length, const string tenant, int64_t* applied);
+  Status EnableSpillQueue(const SpillOptions& options);
+  bool SpillQueueMetrics(SpillMetrics* metrics);
+  Status EnableWriteCoalescing(const CoalesceOptions& options);
+  Status FlushWrites();
+  bool WriteCoalescerMetrics(CoalesceMetrics* metrics);
+  void EnableScanCache(const ScanCacheOptions& options);
+  ScanCacheMetrics GetScanCacheMetrics();
+  Status StartCapture(const CaptureOptions& options);
+  bool StopCapture(CaptureStats* stats);
+  Status ReplayCapture(const string path, const ReplayOptions& options, ReplayStats* stats);
+  void ConfigureTenants(const TenantLimits& limits);
+  void SetTenantQuota(const string key, const TenantQuota& quota);
+  std::map<string, TenantMetrics> GetTenantMetrics();
+  Status OpenCompletions(Napi::Env env, const Napi::Function callback, const CompletionOptions& options);
+  bool CloseCompletions(CompletionMetrics* metrics);
+  bool GetCompletionMetrics(CompletionMetrics* metrics);
+  int64_t NextCompletionId();
+  Status WriteRowsAsync(const string tableName, int operation, const Napi::Array rows, const string tenant, int64_t* id);
+  // Pushes batches until the scan ends or maxInFlight of them are waiting for
+  // the listener; state->done tells which. Call again to carry on.
+  Status StreamScan(const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, int64_t id, StreamScanState* state);
+  // Builds the JS rows of a columnar result in the given RowMaterializer layout,
+  // charging them to scanResults while they are built. JS thread only.
+  static Status MaterializeRows(Napi::Env env, const ColumnarBatch& columns, int layout, bool dictionary, Napi::Value* rows);
+  // Builds the JS result of a rollup: typed arrays for buckets and values,
+  // group values in the columns layout. JS thread only.
+  static Status MaterializeRollup(Napi::Env env, const RollupOptions& options, const RollupResult& rollup, Napi::Value* result);
  private:
   string value_;
   vector<string> masters_;
   shared_ptr<KuduClient> client_;
-  Status CreateClient(const vector<string>& master_addrs, shared_ptr<KuduClient>* client);
+  Status status_; // of creating client_
+  std::shared_ptr<SpillQueue> spill_; // swapped atomically, flushes on background threads spill into it
+  std::shared_ptr<WriteCoalescer> coalescer_; // swapped atomically, direct writes on worker threads flush it
+  std::shared_ptr<ScanCache> cache_; // shared with asynchronous flushes, which may outlive the client
+  TenantLimiter* limiter_;
+  std::shared_ptr<TrafficRecorder> recorder_; // swapped atomically, writes and scans run on worker threads too
+  std::shared_ptr<CompletionChannel> channel_; // swapped atomically, pushed to from reactor and worker threads
+  std::atomic<int64_t> nextCompletionId_;
+  Status CreateClient(const vector<string>& master_addrs, const ClientOptions& options, shared_ptr<KuduClient>* client);
   KuduSchema CreateSchema(const vector<KSchema> schema);
   Status DoesTableExist(const shared_ptr<KuduClient>& client, const string& table_name, bool *exists);
+  Status WriteRows(const string tableName, int operation, const Napi::Array rows, const string tenant);
+  Status ScanColumns(const string tableName, const vector<KPredicate>& predicates, const ScanOptions& options, MemoryReservation* reservation, std::shared_ptr<const ColumnarBatch>* columns);
+  Status BufferRow(const string tableName, int operation, const Napi::Object value, const string tenant);
+  Status FlushCoalesced(const string& tableName);
+  // Counts the rows that were neither written nor spilled in *failed, unless NULL.
+  Status FlushSession(const shared_ptr<KuduTable>& table, int operation, const shared_ptr<kudu::client::KuduSession>& session, int64_t* failed);
   Status CreateKuduTable(const shared_ptr<KuduClient>& client, const string& table_name, const KuduSchema& schema, int num_tablets, int partitioning, vector<string>& columns);
 };
 
+#endif
@@ -1,20 +1,200 @@
 #include "kudujs.h"
+#include "spillqueue.h"
+#include "writecoalescer.h"
+#include "scancache.h"
+#include "rowmaterializer.h"
+#include "memtracker.h"
+#include "timepartitions.h"
+#include "hashjoin.h"
+#include "tenantlimiter.h"
+#include "rollup.h"
+#include "completionchannel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
 
 using std::string;
 
 Napi::FunctionReference KuduJS::constructor;
 
+static vector<KPredicate> ParsePredicates(const Napi::Array predicates) {
+  vector<KPredicate> result;
+  for (unsigned int i = 0; i < predicates.Length(); i++) {
+    Napi::Object value = predicates.Get(i).ToObject();
+    result.push_back(KPredicate(value.Get("colName").ToString(), value.Get("comparisonOp").ToNumber().Int32Value(), value.Get("value")));
+  }
+  return result;
+}
+
+static vector<string> ParseStrings(const Napi::Array values) {
+  vector<string> result;
+  for (unsigned int i = 0; i < values.Length(); i++) {
+    result.push_back(values.Get(i).ToString());
+  }
+  return result;
+}
+
+// The tenant key of an optional options object, empty when untagged.
+static string ParseTenant(const Napi::CallbackInfo& info, size_t index) {
+  if (info.Length() <= index || !info[index].IsObject()) {
+    return "";
+  }
+  Napi::Object opts = info[index].As<Napi::Object>();
+  return opts.Has("tenant") ? opts.Get("tenant").ToString().Utf8Value() : "";
+}
+
+// Bucket width in microseconds, from a number of microseconds or a count and
+// unit such as '30s', '5m', '1h' or '1d'. Returns 0 when malformed.
+static int64_t ParseBucket(const Napi::Value value) {
+  if (value.IsNumber()) {
+    return value.ToNumber().Int64Value();
+  }
+  string text = value.ToString().Utf8Value();
+  char* end;
+  long long count = strtoll(text.c_str(), &end, 10);
+  string unit(end);
+  int64_t micros = 0;
+  if (unit == "us") {
+    micros = 1;
+  } else if (unit == "ms") {
+    micros = 1000;
+  } else if (unit == "s") {
+    micros = 1000000;
+  } else if (unit == "m") {
+    micros = 60 * 1000000LL;
+  } else if (unit == "h") {
+    micros = 3600 * 1000000LL;
+  } else if (unit == "d") {
+    micros = 86400 * 1000000LL;
+  }
+  return end == text.c_str() ? 0 : count * micros;
+}
+
+// A finite number no lower than 0, for sizes and timeouts. Returns false
+// otherwise, rather than letting NaN or a negative turn into 0 or a huge
+// size_t.
+static bool ParseNonNegative(const Napi::Value value, double* number) {
+  if (!value.IsNumber()) {
+    return false;
+  }
+  *number = value.As<Napi::Number>().DoubleValue();
+  return std::isfinite(*number) && *number >= 0;
+}
+
+// A whole number option from 0 up to INT_MAX, left as it is when absent.
+// Returns false when it is set to anything else.
+static bool ParseIntOption(const Napi::Object opts, const char* name, int* value) {
+  if (!opts.Has(name)) {
+    return true;
+  }
+  double number;
+  if (!ParseNonNegative(opts.Get(name), &number) || number > std::numeric_limits<int>::max() || number != std::floor(number)) {
+    return false;
+  }
+  *value = static_cast<int>(number);
+  return true;
+}
+
+static TenantQuota ParseTenantQuota(const Napi::Object opts) {
+  TenantQuota quota;
+  quota.rowsPerSecond = opts.Has("rowsPerSecond") ? opts.Get("rowsPerSecond").ToNumber().DoubleValue() : 0;
+  quota.bytesPerSecond = opts.Has("bytesPerSecond") ? opts.Get("bytesPerSecond").ToNumber().DoubleValue() : 0;
+  quota.burstSeconds = opts.Has("burstSeconds") ? opts.Get("burstSeconds").ToNumber().DoubleValue() : 1;
+  quota.weight = opts.Has("weight") ? opts.Get("weight").ToNumber().DoubleValue() : 1;
+  return quota;
+}
+
+static vector<KSchema> ParseSchema(const Napi::Array schema) {
+  vector<KSchema> result;
+  for (unsigned int i = 0; i < schema.Length(); i++) {
+    Napi::Object value = schema.Get(i).ToObject();
+    result.push_back(KSchema(value.Get("key").ToString(), value.Get("type").ToNumber(), value.Get("primaryKey").ToBoolean(), value.Get("notNull").ToBoolean()));
+  }
+  return result;
+}
+
+// Reads the time partitioning options shared by createTimeSeriesTable and
+// maintainTimePartitions.
+static TimePartitioning ParseTimePartitioning(const Napi::Object opts) {
+  TimePartitioning options;
+  options.period = TimePartitioning::DAY;
+  options.ahead = 1;
+  options.retention = 0;
+  options.hashBuckets = 0;
+  if (opts.Has("column")) {
+    options.column = opts.Get("column").ToString();
+  }
+  if (opts.Has("period")) {
+    string period = opts.Get("period").ToString();
+    if (period == "hour") {
+      options.period = TimePartitioning::HOUR;
+    } else if (period == "week") {
+      options.period = TimePartitioning::WEEK;
+    } else if (period == "month") {
+      options.period = TimePartitioning::MONTH;
+    }
+  }
+  if (opts.Has("ahead")) {
+    options.ahead = opts.Get("ahead").ToNumber().Int64Value();
+  }
+  if (opts.Has("retention")) {
+    options.retention = opts.Get("retention").ToNumber().Int64Value();
+  }
+  if (opts.Has("hashColumns")) {
+    options.hashColumns = ParseStrings(opts.Get("hashColumns").As<Napi::Array>());
+    options.hashBuckets = opts.Has("hashBuckets") ? opts.Get("hashBuckets").ToNumber().Int32Value() : 2;
+  }
+  return options;
+}
+
 Napi::Object KuduJS::Init(Napi::Env env, Napi::Object exports) {
   Napi::HandleScope scope(env);
+  MemoryTracker::MarkJsThread();
 
   Napi::Function func = DefineClass(env, "KuduJS", {
     InstanceMethod("createTable", &KuduJS::CreateTable),
     InstanceMethod("deleteTable", &KuduJS::DeleteTable),
+    InstanceMethod("createTimeSeriesTable", &KuduJS::CreateTimeSeriesTable),
+    InstanceMethod("addRangePartition", &KuduJS::AddRangePartition),
+    InstanceMethod("dropRangePartition", &KuduJS::DropRangePartition),
+    InstanceMethod("maintainTimePartitions", &KuduJS::MaintainTimePartitions),
     InstanceMethod("insertRow", &KuduJS::InsertRow),
     InstanceMethod("updateRow", &KuduJS::UpdateRow),
     InstanceMethod("upsertRow", &KuduJS::UpsertRow),
     InstanceMethod("insertRows", &KuduJS::InsertRows),
     InstanceMethod("scanRow", &KuduJS::ScanRow),
+    InstanceMethod("scanJoin", &KuduJS::ScanJoin),
+    InstanceMethod("scanRollup", &KuduJS::ScanRollup),
+    InstanceMethod("explainScan", &KuduJS::ExplainScan),
+    InstanceMethod("exportTable", &KuduJS::ExportTable),
+    InstanceMethod("writeArrow", &KuduJS::WriteArrow),
+    InstanceMethod("writeRows", &KuduJS::WriteRows),
+    InstanceMethod("enableSpillQueue", &KuduJS::EnableSpillQueue),
+    InstanceMethod("spillQueueMetrics", &KuduJS::SpillQueueMetrics),
+    InstanceMethod("enableWriteCoalescing", &KuduJS::EnableWriteCoalescing),
+    InstanceMethod("flushWrites", &KuduJS::FlushWrites),
+    InstanceMethod("writeCoalescerMetrics", &KuduJS::WriteCoalescerMetrics),
+    InstanceMethod("enableScanCache", &KuduJS::EnableScanCache),
+    InstanceMethod("scanCacheMetrics", &KuduJS::ScanCacheMetrics),
+    InstanceMethod("configureWorkClass", &KuduJS::ConfigureWorkClass),
+    InstanceMethod("schedulerMetrics", &KuduJS::SchedulerMetrics),
+    InstanceMethod("setMemoryLimits", &KuduJS::SetMemoryLimits),
+    InstanceMethod("memoryUsage", &KuduJS::MemoryUsage),
+    InstanceMethod("prewarm", &KuduJS::Prewarm),
+    InstanceMethod("startCapture", &KuduJS::StartCapture),
+    InstanceMethod("stopCapture", &KuduJS::StopCapture),
+    InstanceMethod("replayCapture", &KuduJS::ReplayCapture),
+    InstanceMethod("configureTenants", &KuduJS::ConfigureTenants),
+    InstanceMethod("setTenantQuota", &KuduJS::SetTenantQuota),
+    InstanceMethod("tenantMetrics", &KuduJS::TenantMetrics),
+    InstanceMethod("onCompletion", &KuduJS::OnCompletion),
+    InstanceMethod("offCompletion", &KuduJS::OffCompletion),
+    InstanceMethod("completionMetrics", &KuduJS::CompletionMetrics),
+    InstanceMethod("writeRowsAsync", &KuduJS::WriteRowsAsync),
+    InstanceMethod("streamScan", &KuduJS::StreamScan),
   });
 
   constructor = Napi::Persistent(func);
@@ -28,9 +208,14 @@ KuduJS::KuduJS(const Napi::CallbackInfo& info) : Napi::ObjectWrap<KuduJS>(info)
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
 
+  // Freed by the destructor, which also runs when construction throws.
+  this->actualClass_ = NULL;
+  this->scheduler_ = NULL;
+
   int length = info.Length();
-  if (length != 1 || !info[0].IsArray()) {
+  if (length < 1 || !info[0].IsArray() || info[0].As<Napi::Array>().Length() == 0) {
     Napi::TypeError::New(env, "Array expected").ThrowAsJavaScriptException();
+    return;
   }
 
   Napi::Array value = info[0].As<Napi::Array>();
@@ -38,8 +223,71 @@ KuduJS::KuduJS(const Napi::CallbackInfo& info) : Napi::ObjectWrap<KuduJS>(info)
   for (unsigned int i = 0; i < value.Length(); i++) {
     master_addrs.push_back(value.Get(i).ToString());
   }
-  
-  this->actualClass_ = new KuduClass(master_addrs);
+
+  ClientOptions options;
+  options.adminTimeoutMillis = 20000;
+  options.rpcTimeoutMillis = 0;
+  options.negotiationTimeoutMillis = 0;
+  options.numReactors = 0;
+  options.verboseLogLevel = 0;
+  vector<string> prewarm;
+  if (length > 1 && info[1].IsObject()) {
+    Napi::Object opts = info[1].As<Napi::Object>();
+    if (!ParseIntOption(opts, "adminTimeoutMs", &options.adminTimeoutMillis) || options.adminTimeoutMillis < 1) {
+      Napi::TypeError::New(env, "adminTimeoutMs must be a positive whole number").ThrowAsJavaScriptException();
+      return;
+    }
+    if (!ParseIntOption(opts, "rpcTimeoutMs", &options.rpcTimeoutMillis)) {
+      Napi::TypeError::New(env, "rpcTimeoutMs must be a non-negative whole number").ThrowAsJavaScriptException();
+      return;
+    }
+    if (!ParseIntOption(opts, "negotiationTimeoutMs", &options.negotiationTimeoutMillis)) {
+      Napi::TypeError::New(env, "negotiationTimeoutMs must be a non-negative whole number").ThrowAsJavaScriptException();
+      return;
+    }
+    if (!ParseIntOption(opts, "reactors", &options.numReactors)) {
+      Napi::TypeError::New(env, "reactors must be a non-negative whole number").ThrowAsJavaScriptException();
+      return;
+    }
+    if (!ParseIntOption(opts, "verboseLogLevel", &options.verboseLogLevel)) {
+      Napi::TypeError::New(env, "verboseLogLevel must be a non-negative whole number").ThrowAsJavaScriptException();
+      return;
+    }
+    if (opts.Has("prewarm")) {
+      if (!opts.Get("prewarm").IsArray()) {
+        Napi::TypeError::New(env, "prewarm must be an array of table names").ThrowAsJavaScriptException();
+        return;
+      }
+      prewarm = ParseStrings(opts.Get("prewarm").As<Napi::Array>());
+    }
+  }
+  this->actualClass_ = new KuduClass(master_addrs, options);
+  Status s = this->actualClass_->status();
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return;
+  }
+
+  // Async jobs share the libuv pool, so never admit more than it can run.
+  // Batch jobs are kept to half of it, leaving room for interactive ones.
+  const char* poolSize = getenv("UV_THREADPOOL_SIZE");
+  int maxConcurrent = poolSize != NULL && atoi(poolSize) > 0 ? atoi(poolSize) : 4;
+  this->scheduler_ = new WorkScheduler(maxConcurrent);
+  this->scheduler_->Configure("interactive", WorkClassOptions{10, maxConcurrent, 0, 0});
+  this->scheduler_->Configure("batch", WorkClassOptions{0, std::max(1, maxConcurrent / 2), 8, 256 * 1024 * 1024});
+
+  // Tablet locations are fetched in the background; `prewarmed` settles once
+  // they are cached.
+  if (!prewarm.empty()) {
+    info.This().As<Napi::Object>().Set("prewarmed", SubmitPrewarm(env, prewarm, "interactive"));
+  }
+}
+
+// Async jobs hold a reference to the object until they settle, so none are
+// left by the time it is collected.
+KuduJS::~KuduJS() {
+  delete this->actualClass_;
+  delete this->scheduler_;
 }
 
 Napi::Value KuduJS::CreateTable(const Napi::CallbackInfo& info) {
@@ -56,13 +304,8 @@ Napi::Value KuduJS::CreateTable(const Napi::CallbackInfo& info) {
   Napi::Number numTablets = info[2].As<Napi::Number>();
   Napi::Number partitioning = info[3].As<Napi::Number>();
   Napi::Array colNamesPartitioning = info[4].As<Napi::Array>();
-  vector<KSchema> sc;
+  vector<KSchema> sc = ParseSchema(schema);
   vector<string> columns;
-  for (unsigned int i = 0; i < schema.Length(); i++) {
-    Napi::Object value = schema.Get(i).ToObject();
-    KSchema tmp = KSchema(value.Get("key").ToString(), value.Get("type").ToNumber(), value.Get("primaryKey").ToBoolean(), value.Get("notNull").ToBoolean());
-    sc.push_back(tmp);
-  }
   for (unsigned int i = 0; i < colNamesPartitioning.Length(); i++) {
     columns.push_back(colNamesPartitioning.Get(i).ToString());
   }
@@ -86,18 +329,90 @@ Napi::Value KuduJS::DeleteTable(const Napi::CallbackInfo& info) {
   return Napi::Number::New(info.Env(), 0);
 }
 
+Napi::Value KuduJS::CreateTimeSeriesTable(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 3 || !info[0].IsString() || !info[1].IsArray() || !info[2].IsObject()) {
+    Napi::TypeError::New(env, "Table name, schema and partitioning options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  Napi::Object opts = info[2].As<Napi::Object>();
+  TimePartitioning options = ParseTimePartitioning(opts);
+  int64_t from = opts.Has("from") ? opts.Get("from").ToNumber().Int64Value() :
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  Status s = this->actualClass_->CreateTimeSeriesTable(info[0].ToString(), ParseSchema(info[1].As<Napi::Array>()), options, from);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::AddRangePartition(const Napi::CallbackInfo& info) {
+  return AlterRangePartition(info, false);
+}
+
+Napi::Value KuduJS::DropRangePartition(const Napi::CallbackInfo& info) {
+  return AlterRangePartition(info, true);
+}
+
+Napi::Value KuduJS::AlterRangePartition(const Napi::CallbackInfo& info, bool drop) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 4 || !info[0].IsString() || !info[1].IsString() || !info[2].IsNumber() || !info[3].IsNumber()) {
+    Napi::TypeError::New(env, "Table name, column, lower and upper bound expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  Status s = this->actualClass_->AlterRangePartition(info[0].ToString(), info[1].ToString(),
+      info[2].ToNumber().Int64Value(), info[3].ToNumber().Int64Value(), drop);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::MaintainTimePartitions(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 2 || !info[0].IsString() || !info[1].IsObject()) {
+    Napi::TypeError::New(env, "Table name and partitioning options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  PartitionChanges changes = PartitionChanges();
+  Status s = this->actualClass_->MaintainTimePartitions(info[0].ToString(), ParseTimePartitioning(info[1].As<Napi::Object>()), &changes);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("added", Napi::Number::New(env, changes.added));
+  result.Set("dropped", Napi::Number::New(env, changes.dropped));
+  return result;
+}
+
 Napi::Value KuduJS::InsertRow(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
 
-  if (  info.Length() != 2 || !info[0].IsString()) {
+  if (  info.Length() < 2 || !info[0].IsString()) {
     Napi::TypeError::New(env, "Arguments missing").ThrowAsJavaScriptException();
     return Napi::Number::New(info.Env(), -1);
   }
 
   Napi::String tableName = info[0].As<Napi::String>();
   Napi::Object row = info[1].As<Napi::Object>();
-  this->actualClass_->InsertRow(tableName.ToString(), row);
+  Status s = this->actualClass_->InsertRow(tableName.ToString(), row, ParseTenant(info, 2));
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
 
   return Napi::Number::New(info.Env(), 0);
 }
@@ -106,14 +421,18 @@ Napi::Value KuduJS::UpdateRow(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
 
-  if (  info.Length() != 2 || !info[0].IsString()) {
+  if (  info.Length() < 2 || !info[0].IsString()) {
     Napi::TypeError::New(env, "Arguments missing").ThrowAsJavaScriptException();
     return Napi::Number::New(info.Env(), -1);
   }
 
   Napi::String tableName = info[0].As<Napi::String>();
   Napi::Object row = info[1].As<Napi::Object>();
-  this->actualClass_->UpdateRow(tableName.ToString(), row);
+  Status s = this->actualClass_->UpdateRow(tableName.ToString(), row, ParseTenant(info, 2));
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
 
   return Napi::Number::New(info.Env(), 0);
 }
@@ -122,14 +441,18 @@ Napi::Value KuduJS::UpsertRow(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
 
-  if (  info.Length() != 2 || !info[0].IsString()) {
+  if (  info.Length() < 2 || !info[0].IsString()) {
     Napi::TypeError::New(env, "Arguments missing").ThrowAsJavaScriptException();
     return Napi::Number::New(info.Env(), -1);
   }
 
   Napi::String tableName = info[0].As<Napi::String>();
   Napi::Object row = info[1].As<Napi::Object>();
-  this->actualClass_->UpsertRow(tableName.ToString(), row);
+  Status s = this->actualClass_->UpsertRow(tableName.ToString(), row, ParseTenant(info, 2));
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
 
   return Napi::Number::New(info.Env(), 0);
 }
@@ -138,14 +461,18 @@ Napi::Value KuduJS::InsertRows(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
 
-  if (  info.Length() != 2 || !info[0].IsString()) {
+  if (  info.Length() < 2 || !info[0].IsString()) {
     Napi::TypeError::New(env, "Arguments missing").ThrowAsJavaScriptException();
     return Napi::Number::New(info.Env(), -1);
   }
 
   Napi::String tableName = info[0].As<Napi::String>();
   Napi::Array rows = info[1].As<Napi::Array>();
-  this->actualClass_->InsertRows(tableName.ToString(), rows);
+  Status s = this->actualClass_->InsertRows(tableName.ToString(), rows, ParseTenant(info, 2));
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
 
   return Napi::Number::New(info.Env(), 0);
 }
@@ -154,16 +481,1051 @@ Napi::Value KuduJS::ScanRow(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
 
-  if (  info.Length() != 2 || !info[0].IsString()) {
+  if (  info.Length() < 2 || !info[0].IsString()) {
     Napi::TypeError::New(env, "Arguments missing").ThrowAsJavaScriptException();
     return Napi::Number::New(info.Env(), -1);
   }
 
   Napi::String tableName = info[0].As<Napi::String>();
-  Napi::Array result = this->actualClass_->ScanRow(tableName.ToString(), info);
+  vector<KPredicate> predicates = ParsePredicates(info[1].As<Napi::Array>());
+  bool arrow = false;
+  ScanOptions options;
+  options.useCache = true;
+  options.layout = RowMaterializer::OBJECTS;
+  options.dictionary = false;
+  options.ordered = false;
+  options.limit = 0;
+  options.parallelism = 4;
+  options.tenant = ParseTenant(info, 2);
+  options.maxInFlight = 0;
+  if (info.Length() > 2 && info[2].IsObject()) {
+    Napi::Object opts = info[2].As<Napi::Object>();
+    arrow = opts.Has("format") && opts.Get("format").ToString().Utf8Value() == "arrow";
+    if (opts.Has("projection")) {
+      options.projection = ParseStrings(opts.Get("projection").As<Napi::Array>());
+    }
+    if (opts.Has("cache")) {
+      options.useCache = opts.Get("cache").ToBoolean();
+    }
+    if (opts.Has("layout")) {
+      string name = opts.Get("layout").ToString().Utf8Value();
+      if (name == "tuples") {
+        options.layout = RowMaterializer::TUPLES;
+      } else if (name == "columns") {
+        options.layout = RowMaterializer::COLUMNS;
+      }
+    }
+    if (opts.Has("dictionary")) {
+      options.dictionary = opts.Get("dictionary").ToBoolean();
+    }
+    if (opts.Has("ordered")) {
+      options.ordered = opts.Get("ordered").ToBoolean();
+    }
+    if (opts.Has("orderBy")) {
+      // A column name, or an array of names and {column, descending} objects.
+      Napi::Value orderBy = opts.Get("orderBy");
+      Napi::Array keys = Napi::Array::New(env);
+      if (orderBy.IsArray()) {
+        keys = orderBy.As<Napi::Array>();
+      } else {
+        keys.Set((uint32_t)0, orderBy);
+      }
+      for (uint32_t i = 0; i < keys.Length(); i++) {
+        Napi::Value key = keys.Get(i);
+        if (key.IsObject()) {
+          Napi::Object k = key.As<Napi::Object>();
+          options.orderBy.push_back(k.Get("column").ToString().Utf8Value());
+          options.descending.push_back(k.Has("descending") && k.Get("descending").ToBoolean());
+        } else {
+          options.orderBy.push_back(key.ToString().Utf8Value());
+          options.descending.push_back(false);
+        }
+      }
+    }
+    if (opts.Has("limit")) {
+      options.limit = opts.Get("limit").ToNumber().Int64Value();
+    }
+    if (opts.Has("parallelism")) {
+      options.parallelism = opts.Get("parallelism").ToNumber().Int32Value();
+    }
+  }
 
-  // return Napi::Array::New(info.Env(), 0);
-  //return result;
-  // return Napi::Array::New(info.Env(), result);
+  if (arrow) {
+    // The IPC stream is handed to JS as a Buffer over the native memory.
+    string* ipc = new string();
+    Status s = this->actualClass_->ScanArrow(tableName.ToString(), predicates, options, ipc);
+    if (!s.ok()) {
+      delete ipc;
+      Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    return Napi::Buffer<char>::New(env, &(*ipc)[0], ipc->size(), [](Napi::Env, char*, string* hint) {
+      delete hint;
+    }, ipc);
+  }
+
+  Napi::Value result;
+  Status s = this->actualClass_->ScanRows(env, tableName.ToString(), predicates, options, &result);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
   return result;
 }
+
+Napi::Value KuduJS::ScanJoin(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 3 || !info[0].IsString() || !info[1].IsString() || !info[2].IsObject()) {
+    Napi::TypeError::New(env, "Two table names and join options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  Napi::Object opts = info[2].As<Napi::Object>();
+  JoinOptions options;
+  options.semi = opts.Has("type") && opts.Get("type").ToString().Utf8Value() == "semi";
+  options.parallelism = 4;
+  options.inListLimit = 1000;
+  int layout = RowMaterializer::OBJECTS;
+  bool dictionary = false;
+  if (opts.Has("on")) {
+    // Column names shared by both tables, or {left, right} pairs.
+    Napi::Array on = opts.Get("on").As<Napi::Array>();
+    for (uint32_t i = 0; i < on.Length(); i++) {
+      Napi::Value key = on.Get(i);
+      if (key.IsObject()) {
+        Napi::Object pair = key.As<Napi::Object>();
+        options.leftKeys.push_back(pair.Get("left").ToString());
+        options.rightKeys.push_back(pair.Get("right").ToString());
+      } else {
+        options.leftKeys.push_back(key.ToString());
+        options.rightKeys.push_back(key.ToString());
+      }
+    }
+  }
+  if (opts.Has("predicates")) {
+    options.leftPredicates = ParsePredicates(opts.Get("predicates").As<Napi::Array>());
+  }
+  if (opts.Has("rightPredicates")) {
+    options.rightPredicates = ParsePredicates(opts.Get("rightPredicates").As<Napi::Array>());
+  }
+  if (opts.Has("projection")) {
+    options.leftProjection = ParseStrings(opts.Get("projection").As<Napi::Array>());
+  }
+  if (opts.Has("rightProjection")) {
+    options.rightProjection = ParseStrings(opts.Get("rightProjection").As<Napi::Array>());
+  }
+  if (opts.Has("parallelism")) {
+    options.parallelism = opts.Get("parallelism").ToNumber().Int32Value();
+  }
+  if (opts.Has("inListLimit")) {
+    options.inListLimit = opts.Get("inListLimit").ToNumber().Int64Value();
+  }
+  if (opts.Has("layout")) {
+    string name = opts.Get("layout").ToString().Utf8Value();
+    if (name == "tuples") {
+      layout = RowMaterializer::TUPLES;
+    } else if (name == "columns") {
+      layout = RowMaterializer::COLUMNS;
+    }
+  }
+  if (opts.Has("dictionary")) {
+    dictionary = opts.Get("dictionary").ToBoolean();
+  }
+  string workClass = "batch";
+  if (opts.Has("workClass")) {
+    workClass = opts.Get("workClass").ToString();
+  }
+
+  JoinWorker* worker = new JoinWorker(env, this->actualClass_, info[0].ToString(), info[1].ToString(), options, layout, dictionary);
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
+
+Napi::Value KuduJS::ScanRollup(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 2 || !info[0].IsString() || !info[1].IsObject()) {
+    Napi::TypeError::New(env, "Table name and rollup options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  Napi::Object opts = info[1].As<Napi::Object>();
+  if (!opts.Has("timeColumn") || !opts.Has("bucket")) {
+    Napi::TypeError::New(env, "Rollup options need a timeColumn and a bucket").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  RollupOptions options;
+  options.timeColumn = opts.Get("timeColumn").ToString().Utf8Value();
+  options.bucketMicros = ParseBucket(opts.Get("bucket"));
+  options.hasFrom = false;
+  options.from = 0;
+  options.hasTo = false;
+  options.to = 0;
+  options.parallelism = 4;
+  if (opts.Has("range")) {
+    // Microseconds, from inclusive and to exclusive.
+    Napi::Object range = opts.Get("range").As<Napi::Object>();
+    if (range.Has("from")) {
+      options.hasFrom = true;
+      options.from = range.Get("from").ToNumber().Int64Value();
+    }
+    if (range.Has("to")) {
+      options.hasTo = true;
+      options.to = range.Get("to").ToNumber().Int64Value();
+    }
+  }
+  if (opts.Has("aggs")) {
+    // {fn, column, name} objects, or 'count' for the number of rows.
+    Napi::Array aggs = opts.Get("aggs").As<Napi::Array>();
+    for (uint32_t i = 0; i < aggs.Length(); i++) {
+      Napi::Value value = aggs.Get(i);
+      RollupAgg agg;
+      string fn = "count";
+      if (value.IsObject()) {
+        Napi::Object a = value.As<Napi::Object>();
+        fn = a.Has("fn") ? a.Get("fn").ToString().Utf8Value() : fn;
+        agg.column = a.Has("column") ? a.Get("column").ToString().Utf8Value() : "";
+        agg.name = a.Has("name") ? a.Get("name").ToString().Utf8Value() : "";
+      } else {
+        fn = value.ToString().Utf8Value();
+      }
+      std::transform(fn.begin(), fn.end(), fn.begin(), ::tolower);
+      if (fn == "count") {
+        agg.function = RollupAgg::COUNT;
+      } else if (fn == "sum") {
+        agg.function = RollupAgg::SUM;
+      } else if (fn == "min") {
+        agg.function = RollupAgg::MIN;
+      } else if (fn == "max") {
+        agg.function = RollupAgg::MAX;
+      } else if (fn == "avg") {
+        agg.function = RollupAgg::AVG;
+      } else {
+        Napi::TypeError::New(env, "Unknown aggregate function: " + fn).ThrowAsJavaScriptException();
+        return Napi::Number::New(info.Env(), -1);
+      }
+      if (agg.name.empty()) {
+        agg.name = agg.column.empty() ? fn : fn + "_" + agg.column;
+      }
+      options.aggs.push_back(agg);
+    }
+  } else {
+    RollupAgg count;
+    count.function = RollupAgg::COUNT;
+    count.name = "count";
+    options.aggs.push_back(count);
+  }
+  if (opts.Has("groupBy")) {
+    options.groupBy = ParseStrings(opts.Get("groupBy").As<Napi::Array>());
+  }
+  if (opts.Has("predicates")) {
+    options.predicates = ParsePredicates(opts.Get("predicates").As<Napi::Array>());
+  }
+  if (opts.Has("parallelism")) {
+    options.parallelism = opts.Get("parallelism").ToNumber().Int32Value();
+  }
+  string workClass = "batch";
+  if (opts.Has("workClass")) {
+    workClass = opts.Get("workClass").ToString();
+  }
+
+  RollupWorker* worker = new RollupWorker(env, this->actualClass_, info[0].ToString(), options, ParseTenant(info, 1));
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
+
+Napi::Value KuduJS::ExplainScan(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 2 || !info[0].IsString() || !info[1].IsArray()) {
+    Napi::TypeError::New(env, "Table name and predicates expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  vector<KPredicate> predicates = ParsePredicates(info[1].As<Napi::Array>());
+  vector<string> projection;
+  bool execute = false;
+  string workClass = "batch";
+  if (info.Length() > 2 && info[2].IsObject()) {
+    Napi::Object opts = info[2].As<Napi::Object>();
+    if (opts.Has("projection")) {
+      projection = ParseStrings(opts.Get("projection").As<Napi::Array>());
+    }
+    if (opts.Has("execute")) {
+      execute = opts.Get("execute").ToBoolean();
+    }
+    if (opts.Has("workClass")) {
+      workClass = opts.Get("workClass").ToString();
+    }
+  }
+
+  ExplainWorker* worker = new ExplainWorker(env, this->actualClass_, info[0].ToString(), predicates, projection, execute);
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
+
+Napi::Value KuduJS::ExportTable(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+    Napi::TypeError::New(env, "Table name and path expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  ExportOptions options;
+  options.format = "arrow";
+  options.parallelism = 4;
+  options.batchBytes = 8 * 1024 * 1024;
+  options.maxBufferedBytes = 64 * 1024 * 1024;
+  string workClass = "batch";
+  if (info.Length() > 2 && info[2].IsObject()) {
+    Napi::Object opts = info[2].As<Napi::Object>();
+    if (opts.Has("format")) {
+      options.format = opts.Get("format").ToString();
+    }
+    if (opts.Has("predicates")) {
+      options.predicates = ParsePredicates(opts.Get("predicates").As<Napi::Array>());
+    }
+    if (opts.Has("projection")) {
+      options.projection = ParseStrings(opts.Get("projection").As<Napi::Array>());
+    }
+    if (opts.Has("parallelism")) {
+      options.parallelism = opts.Get("parallelism").ToNumber().Int32Value();
+    }
+    if (opts.Has("batchBytes")) {
+      options.batchBytes = opts.Get("batchBytes").ToNumber().Int64Value();
+    }
+    if (opts.Has("maxBufferedBytes")) {
+      options.maxBufferedBytes = opts.Get("maxBufferedBytes").ToNumber().Int64Value();
+    }
+    if (opts.Has("workClass")) {
+      workClass = opts.Get("workClass").ToString();
+    }
+  }
+
+  Napi::String tableName = info[0].As<Napi::String>();
+  Napi::String path = info[1].As<Napi::String>();
+  ExportWorker* worker = new ExportWorker(env, this->actualClass_, tableName.ToString(), path.ToString(), options);
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
+
+Napi::Value KuduJS::WriteArrow(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 3 || !info[0].IsString() || !info[1].IsNumber() ||
+        !(info[2].IsTypedArray() || info[2].IsArrayBuffer())) {
+    Napi::TypeError::New(env, "Table name, operation and Arrow IPC buffer expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  // Decoded in place, the record batches are never copied out of JS memory.
+  const uint8_t* data;
+  size_t length;
+  if (info[2].IsTypedArray()) {
+    Napi::TypedArray array = info[2].As<Napi::TypedArray>();
+    data = static_cast<const uint8_t*>(array.ArrayBuffer().Data()) + array.ByteOffset();
+    length = array.ByteLength();
+  } else {
+    Napi::ArrayBuffer buffer = info[2].As<Napi::ArrayBuffer>();
+    data = static_cast<const uint8_t*>(buffer.Data());
+    length = buffer.ByteLength();
+  }
+
+  Napi::String tableName = info[0].As<Napi::String>();
+  int64_t applied = 0;
+  Status s = this->actualClass_->WriteArrow(tableName.ToString(), info[1].ToNumber().Int32Value(), data, length, ParseTenant(info, 3), &applied);
+  if (!s.ok()) {
+    // Rows before the failure are written, the caller needs to know how many.
+    Napi::Error error = Napi::Error::New(env, s.ToString());
+    error.Set("applied", Napi::Number::New(env, applied));
+    error.ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  return Napi::Number::New(info.Env(), applied);
+}
+
+Napi::Value KuduJS::WriteRows(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 3 || !info[0].IsString() || !info[1].IsNumber() || !info[2].IsArray()) {
+    Napi::TypeError::New(env, "Table name, operation and rows expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  PipelineOptions options;
+  options.parallelism = 4;
+  options.timeoutMillis = 30000;
+  options.tenant = ParseTenant(info, 3);
+  string workClass = "batch";
+  if (info.Length() > 3 && info[3].IsObject()) {
+    Napi::Object opts = info[3].As<Napi::Object>();
+    if (opts.Has("parallelism")) {
+      Napi::Value parallelism = opts.Get("parallelism");
+      if (!parallelism.IsNumber() || !(parallelism.As<Napi::Number>().DoubleValue() >= 1)) {
+        Napi::TypeError::New(env, "parallelism must be at least 1").ThrowAsJavaScriptException();
+        return env.Null();
+      }
+      // Capped to the number of cores by the pipeline.
+      options.parallelism = std::min<double>(parallelism.As<Napi::Number>().DoubleValue(), std::numeric_limits<int>::max());
+    }
+    if (opts.Has("timeoutMs")) {
+      options.timeoutMillis = opts.Get("timeoutMs").ToNumber().Int32Value();
+    }
+    if (opts.Has("workClass")) {
+      workClass = opts.Get("workClass").ToString();
+    }
+  }
+
+  // The rows are copied out of JS here, everything else runs off this thread.
+  Napi::String tableName = info[0].As<Napi::String>();
+  WriteWorker* worker = new WriteWorker(env, this->actualClass_, tableName.ToString(), info[1].ToNumber().Int32Value(), options);
+  MarshalRows(info[2].As<Napi::Array>(), worker->rows());
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
+
+
+Napi::Value KuduJS::EnableSpillQueue(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 1 || !info[0].IsObject()) {
+    Napi::TypeError::New(env, "Options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  Napi::Object opts = info[0].As<Napi::Object>();
+  if (!opts.Has("directory")) {
+    Napi::TypeError::New(env, "Spill directory is missing").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  SpillOptions options;
+  options.directory = opts.Get("directory").ToString();
+  options.segmentBytes = 64 * 1024 * 1024;
+  options.maxDiskBytes = 1024 * 1024 * 1024;
+  options.initialBackoffMillis = 500;
+  options.maxBackoffMillis = 30000;
+  options.replayOnStartup = true;
+  options.sync = false;
+  if (opts.Has("segmentBytes")) {
+    options.segmentBytes = opts.Get("segmentBytes").ToNumber().Int64Value();
+  }
+  if (opts.Has("maxDiskBytes")) {
+    options.maxDiskBytes = opts.Get("maxDiskBytes").ToNumber().Int64Value();
+  }
+  if (opts.Has("initialBackoffMs")) {
+    options.initialBackoffMillis = opts.Get("initialBackoffMs").ToNumber().Int32Value();
+  }
+  if (opts.Has("maxBackoffMs")) {
+    options.maxBackoffMillis = opts.Get("maxBackoffMs").ToNumber().Int32Value();
+  }
+  if (opts.Has("replayOnStartup")) {
+    options.replayOnStartup = opts.Get("replayOnStartup").ToBoolean();
+  }
+  if (opts.Has("sync")) {
+    options.sync = opts.Get("sync").ToBoolean();
+  }
+
+  Status s = this->actualClass_->EnableSpillQueue(options);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::SpillQueueMetrics(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  SpillMetrics metrics;
+  if (!this->actualClass_->SpillQueueMetrics(&metrics)) {
+    return env.Null();
+  }
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("spilledRows", metrics.spilledRows);
+  result.Set("replayedRows", metrics.replayedRows);
+  result.Set("droppedRows", metrics.droppedRows);
+  result.Set("failedRows", metrics.failedRows);
+  result.Set("quarantinedRows", metrics.quarantinedRows);
+  result.Set("pendingRows", metrics.pendingRows);
+  result.Set("replayAttempts", metrics.replayAttempts);
+  result.Set("diskBytes", metrics.diskBytes);
+  result.Set("segments", metrics.segments);
+  result.Set("lastError", metrics.lastError);
+  return result;
+}
+
+Napi::Value KuduJS::EnableWriteCoalescing(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  CoalesceOptions options;
+  options.windowMillis = 100;
+  options.maxKeys = 10000;
+  if (info.Length() > 0 && info[0].IsObject()) {
+    Napi::Object opts = info[0].As<Napi::Object>();
+    if (opts.Has("windowMs")) {
+      options.windowMillis = opts.Get("windowMs").ToNumber().Int32Value();
+    }
+    if (opts.Has("maxKeys")) {
+      options.maxKeys = opts.Get("maxKeys").ToNumber().Int64Value();
+    }
+  }
+
+  Status s = this->actualClass_->EnableWriteCoalescing(options);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::FlushWrites(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  Status s = this->actualClass_->FlushWrites();
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::WriteCoalescerMetrics(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  CoalesceMetrics metrics;
+  if (!this->actualClass_->WriteCoalescerMetrics(&metrics)) {
+    return env.Null();
+  }
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("bufferedRows", metrics.bufferedRows);
+  result.Set("mergedRows", metrics.mergedRows);
+  result.Set("writtenRows", metrics.writtenRows);
+  result.Set("failedRows", metrics.failedRows);
+  result.Set("flushes", metrics.flushes);
+  result.Set("pendingKeys", metrics.pendingKeys);
+  result.Set("lastError", metrics.lastError);
+  return result;
+}
+
+Napi::Value KuduJS::EnableScanCache(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  ScanCacheOptions options;
+  options.maxBytes = 64 * 1024 * 1024;
+  options.ttlMillis = 60000;
+  if (info.Length() > 0 && info[0].IsObject()) {
+    Napi::Object opts = info[0].As<Napi::Object>();
+    if (opts.Has("maxBytes")) {
+      options.maxBytes = opts.Get("maxBytes").ToNumber().Int64Value();
+    }
+    if (opts.Has("ttlMs")) {
+      options.ttlMillis = opts.Get("ttlMs").ToNumber().Int32Value();
+    }
+  }
+  this->actualClass_->EnableScanCache(options);
+
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::ScanCacheMetrics(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  ::ScanCacheMetrics metrics = this->actualClass_->GetScanCacheMetrics();
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("hits", metrics.hits);
+  result.Set("misses", metrics.misses);
+  result.Set("evictions", metrics.evictions);
+  result.Set("invalidations", metrics.invalidations);
+  result.Set("entries", metrics.entries);
+  result.Set("bytes", metrics.bytes);
+  return result;
+}
+
+Napi::Value KuduJS::ConfigureWorkClass(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 2 || !info[0].IsString() || !info[1].IsObject()) {
+    Napi::TypeError::New(env, "Work class name and options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  WorkClassOptions options;
+  options.priority = 0;
+  options.maxConcurrent = this->scheduler_->maxConcurrent();
+  options.maxScanners = 0;
+  options.maxBufferedBytes = 0;
+  Napi::Object opts = info[1].As<Napi::Object>();
+  if (opts.Has("priority")) {
+    options.priority = opts.Get("priority").ToNumber().Int32Value();
+  }
+  if (opts.Has("maxConcurrent")) {
+    options.maxConcurrent = opts.Get("maxConcurrent").ToNumber().Int32Value();
+  }
+  if (opts.Has("maxScanners")) {
+    options.maxScanners = opts.Get("maxScanners").ToNumber().Int32Value();
+  }
+  if (opts.Has("maxBufferedBytes")) {
+    options.maxBufferedBytes = opts.Get("maxBufferedBytes").ToNumber().Int64Value();
+  }
+  if (options.maxConcurrent < 1) {
+    Napi::RangeError::New(env, "maxConcurrent must be at least 1").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  this->scheduler_->Configure(info[0].As<Napi::String>().Utf8Value(), options);
+
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::SchedulerMetrics(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  Napi::Object classes = Napi::Object::New(env);
+  for (const auto& entry : this->scheduler_->metrics()) {
+    const WorkClassMetrics& metrics = entry.second;
+    Napi::Object m = Napi::Object::New(env);
+    m.Set("queued", metrics.queued);
+    m.Set("running", metrics.running);
+    m.Set("completed", metrics.completed);
+    m.Set("scanners", metrics.scanners);
+    m.Set("bufferedBytes", metrics.bufferedBytes);
+    m.Set("avgWaitMs", metrics.avgWaitMillis);
+    m.Set("maxWaitMs", metrics.maxWaitMillis);
+    classes.Set(entry.first, m);
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("running", this->scheduler_->running());
+  result.Set("maxConcurrent", this->scheduler_->maxConcurrent());
+  result.Set("classes", classes);
+  return result;
+}
+
+static Napi::Object UsageObject(Napi::Env env, const MemoryTracker::Usage& usage) {
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("current", usage.current);
+  result.Set("peak", usage.peak);
+  result.Set("limit", usage.limit);
+  return result;
+}
+
+Napi::Value KuduJS::SetMemoryLimits(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 1 || !info[0].IsObject()) {
+    Napi::TypeError::New(env, "Options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  // Everything is checked before anything is applied, so a bad option does
+  // not leave the limits half updated.
+  Napi::Object opts = info[0].As<Napi::Object>();
+  double total = -1;
+  double limits[MemoryTracker::NUM_COMPONENTS];
+  double waitMillis = -1;
+  bool valid = !opts.Has("total") || ParseNonNegative(opts.Get("total"), &total);
+  for (int c = 0; c < MemoryTracker::NUM_COMPONENTS; c++) {
+    const char* name = MemoryTracker::Name(static_cast<MemoryTracker::Component>(c));
+    limits[c] = -1;
+    valid = valid && (!opts.Has(name) || ParseNonNegative(opts.Get(name), &limits[c]));
+  }
+  valid = valid && (!opts.Has("waitMs") || ParseNonNegative(opts.Get("waitMs"), &waitMillis));
+  if (!valid || waitMillis > std::numeric_limits<int>::max()) {
+    Napi::TypeError::New(env, "Memory limits and waitMs must be non-negative numbers").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  // Limits are process wide, shared by every client.
+  MemoryTracker* tracker = MemoryTracker::Global();
+  if (total >= 0) {
+    tracker->SetTotalLimit(static_cast<size_t>(total));
+  }
+  for (int c = 0; c < MemoryTracker::NUM_COMPONENTS; c++) {
+    if (limits[c] >= 0) {
+      tracker->SetLimit(static_cast<MemoryTracker::Component>(c), static_cast<size_t>(limits[c]));
+    }
+  }
+  if (waitMillis >= 0) {
+    tracker->SetWaitMillis(static_cast<int>(waitMillis));
+  }
+
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::MemoryUsage(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  MemoryTracker* tracker = MemoryTracker::Global();
+  Napi::Object components = Napi::Object::New(env);
+  for (int c = 0; c < MemoryTracker::NUM_COMPONENTS; c++) {
+    MemoryTracker::Component component = static_cast<MemoryTracker::Component>(c);
+    components.Set(MemoryTracker::Name(component), UsageObject(env, tracker->usage(component)));
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("total", UsageObject(env, tracker->total()));
+  result.Set("components", components);
+  return result;
+}
+
+Napi::Value KuduJS::Prewarm(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Array of table names expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  string workClass = "interactive";
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object opts = info[1].As<Napi::Object>();
+    if (opts.Has("workClass")) {
+      workClass = opts.Get("workClass").ToString();
+    }
+  }
+  return SubmitPrewarm(env, ParseStrings(info[0].As<Napi::Array>()), workClass);
+}
+
+Napi::Value KuduJS::StartCapture(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Capture file path expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  CaptureOptions options;
+  options.path = info[0].ToString();
+  options.bufferRecords = 65536;
+  options.flushIntervalMillis = 100;
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object opts = info[1].As<Napi::Object>();
+    if (opts.Has("bufferRecords")) {
+      options.bufferRecords = opts.Get("bufferRecords").ToNumber().Int64Value();
+    }
+    if (opts.Has("flushIntervalMs")) {
+      options.flushIntervalMillis = opts.Get("flushIntervalMs").ToNumber().Int32Value();
+    }
+  }
+
+  Status s = this->actualClass_->StartCapture(options);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::StopCapture(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  CaptureStats stats;
+  if (!this->actualClass_->StopCapture(&stats)) {
+    return env.Null();
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("records", Napi::Number::New(env, stats.records));
+  result.Set("dropped", Napi::Number::New(env, stats.dropped));
+  result.Set("bytes", Napi::Number::New(env, stats.bytes));
+  if (!stats.lastError.empty()) {
+    result.Set("lastError", Napi::String::New(env, stats.lastError));
+  }
+  return result;
+}
+
+Napi::Value KuduJS::ReplayCapture(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Capture file path expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  ReplayOptions options;
+  options.speed = 1;
+  options.concurrency = 8;
+  string workClass = "batch";
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object opts = info[1].As<Napi::Object>();
+    if (opts.Has("speed")) {
+      options.speed = opts.Get("speed").ToNumber().DoubleValue();
+    }
+    if (opts.Has("concurrency")) {
+      options.concurrency = opts.Get("concurrency").ToNumber().Int32Value();
+    }
+    if (opts.Has("workClass")) {
+      workClass = opts.Get("workClass").ToString();
+    }
+  }
+
+  ReplayWorker* worker = new ReplayWorker(env, this->actualClass_, info[0].ToString(), options);
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
+
+Napi::Value KuduJS::ConfigureTenants(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 1 || !info[0].IsObject()) {
+    Napi::TypeError::New(env, "Options expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  Napi::Object opts = info[0].As<Napi::Object>();
+  TenantLimits limits;
+  limits.defaultQuota = ParseTenantQuota(opts.Has("defaultQuota") ? opts.Get("defaultQuota").As<Napi::Object>() : Napi::Object::New(env));
+  limits.totalRowsPerSecond = opts.Has("totalRowsPerSecond") ? opts.Get("totalRowsPerSecond").ToNumber().DoubleValue() : 0;
+  limits.totalBytesPerSecond = opts.Has("totalBytesPerSecond") ? opts.Get("totalBytesPerSecond").ToNumber().DoubleValue() : 0;
+  this->actualClass_->ConfigureTenants(limits);
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::SetTenantQuota(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() != 2 || !info[0].IsString() || !info[1].IsObject()) {
+    Napi::TypeError::New(env, "Tenant key and quota expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  this->actualClass_->SetTenantQuota(info[0].ToString(), ParseTenantQuota(info[1].As<Napi::Object>()));
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::TenantMetrics(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  Napi::Object result = Napi::Object::New(env);
+  for (const auto& entry : this->actualClass_->GetTenantMetrics()) {
+    const ::TenantMetrics& metrics = entry.second;
+    Napi::Object tenant = Napi::Object::New(env);
+    tenant.Set("operations", Napi::Number::New(env, metrics.operations));
+    tenant.Set("rows", Napi::Number::New(env, metrics.rows));
+    tenant.Set("bytes", Napi::Number::New(env, metrics.bytes));
+    tenant.Set("throttledMillis", Napi::Number::New(env, metrics.throttledMillis));
+    tenant.Set("waiting", Napi::Number::New(env, metrics.waiting));
+    tenant.Set("rejected", Napi::Number::New(env, metrics.rejected));
+    result.Set(entry.first, tenant);
+  }
+  return result;
+}
+
+static Napi::Object CompletionMetricsObject(Napi::Env env, const ::CompletionMetrics& metrics) {
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("pushed", Napi::Number::New(env, metrics.pushed));
+  result.Set("delivered", Napi::Number::New(env, metrics.delivered));
+  result.Set("dropped", Napi::Number::New(env, metrics.dropped));
+  result.Set("ticks", Napi::Number::New(env, metrics.ticks));
+  result.Set("wakeups", Napi::Number::New(env, metrics.wakeups));
+  return result;
+}
+
+Napi::Value KuduJS::OnCompletion(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 1 || !info[0].IsFunction()) {
+    Napi::TypeError::New(env, "Listener function expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  CompletionOptions options;
+  options.maxPerTick = 1024;
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object opts = info[1].As<Napi::Object>();
+    if (opts.Has("maxPerTick")) {
+      options.maxPerTick = opts.Get("maxPerTick").ToNumber().Int64Value();
+    }
+  }
+
+  Status s = this->actualClass_->OpenCompletions(env, info[0].As<Napi::Function>(), options);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  return Napi::Number::New(info.Env(), 0);
+}
+
+Napi::Value KuduJS::OffCompletion(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  ::CompletionMetrics metrics;
+  if (!this->actualClass_->CloseCompletions(&metrics)) {
+    return env.Null();
+  }
+  return CompletionMetricsObject(env, metrics);
+}
+
+Napi::Value KuduJS::CompletionMetrics(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  ::CompletionMetrics metrics;
+  if (!this->actualClass_->GetCompletionMetrics(&metrics)) {
+    return env.Null();
+  }
+  return CompletionMetricsObject(env, metrics);
+}
+
+Napi::Value KuduJS::WriteRowsAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 3 || !info[0].IsString() || !info[1].IsNumber() || !info[2].IsArray()) {
+    Napi::TypeError::New(env, "Table name, operation and rows expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  int64_t id;
+  Status s = this->actualClass_->WriteRowsAsync(info[0].ToString(), info[1].ToNumber().Int32Value(),
+                                                info[2].As<Napi::Array>(), ParseTenant(info, 3), &id);
+  if (!s.ok()) {
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  return Napi::Number::New(env, id);
+}
+
+Napi::Value KuduJS::StreamScan(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Napi::HandleScope scope(env);
+
+  if (  info.Length() < 2 || !info[0].IsString() || !info[1].IsArray()) {
+    Napi::TypeError::New(env, "Table name and predicates expected").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  ::CompletionMetrics metrics;
+  if (!this->actualClass_->GetCompletionMetrics(&metrics)) {
+    Napi::Error::New(env, "No completion listener, call onCompletion first").ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+
+  ScanOptions options;
+  options.useCache = false;
+  options.layout = RowMaterializer::COLUMNS;
+  options.dictionary = false;
+  options.ordered = false;
+  options.limit = 0;
+  options.parallelism = 1;
+  options.tenant = ParseTenant(info, 2);
+  options.maxInFlight = 16;
+  string workClass = "interactive";
+  if (info.Length() > 2 && info[2].IsObject()) {
+    Napi::Object opts = info[2].As<Napi::Object>();
+    if (opts.Has("projection")) {
+      options.projection = ParseStrings(opts.Get("projection").As<Napi::Array>());
+    }
+    if (opts.Has("limit")) {
+      options.limit = opts.Get("limit").ToNumber().Int64Value();
+    }
+    if (opts.Has("maxInFlight")) {
+      options.maxInFlight = opts.Get("maxInFlight").ToNumber().Int32Value();
+      if (options.maxInFlight < 1) {
+        Napi::TypeError::New(env, "maxInFlight must be at least 1").ThrowAsJavaScriptException();
+        return Napi::Number::New(info.Env(), -1);
+      }
+    }
+    if (opts.Has("workClass")) {
+      workClass = opts.Get("workClass").ToString();
+    }
+  }
+
+  int64_t id = this->actualClass_->NextCompletionId();
+  StreamScanWorker* worker = new StreamScanWorker(env, this->actualClass_, info[0].ToString(),
+                                                  ParsePredicates(info[1].As<Napi::Array>()), options, id,
+                                                  std::shared_ptr<StreamScanState>(new StreamScanState()));
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), -1);
+  }
+  return Napi::Number::New(env, id);
+}
+
+Napi::Value KuduJS::SubmitPrewarm(Napi::Env env, const vector<string>& tables, const string& workClass) {
+  PrewarmWorker* worker = new PrewarmWorker(env, this->actualClass_, tables);
+  Napi::Promise promise = worker->GetPromise();
+  worker->KeepAlive(this->Value());
+  Status s = this->scheduler_->Submit(workClass, worker);
+  if (!s.ok()) {
+    delete worker;
+    Napi::Error::New(env, s.ToString()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return promise;
+}
@@ -1,19 +1,57 @@
 #include <napi.h>
 #include "kuduclass.h"
+#include "kuduworkers.h"
 
 class KuduJS : public Napi::ObjectWrap<KuduJS> {
  public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports); //Init function for setting the export key to JS
   KuduJS(const Napi::CallbackInfo& info); //Constructor to initialise
+  ~KuduJS();
 
  private:
   static Napi::FunctionReference constructor; //reference to store the class definition that needs to be exported to JS
   Napi::Value CreateTable(const Napi::CallbackInfo& info);
   Napi::Value DeleteTable(const Napi::CallbackInfo& info);
+  Napi::Value CreateTimeSeriesTable(const Napi::CallbackInfo& info);
+  Napi::Value AddRangePartition(const Napi::CallbackInfo& info);
+  Napi::Value DropRangePartition(const Napi::CallbackInfo& info);
+  Napi::Value AlterRangePartition(const Napi::CallbackInfo& info, bool drop);
+  Napi::Value MaintainTimePartitions(const Napi::CallbackInfo& info);
   Napi::Value InsertRow(const Napi::CallbackInfo& info);
   Napi::Value UpdateRow(const Napi::CallbackInfo& info);
   Napi::Value UpsertRow(const Napi::CallbackInfo& info);
   Napi::Value InsertRows(const Napi::CallbackInfo& info);
   Napi::Value ScanRow(const Napi::CallbackInfo& info);
+  Napi::Value ScanJoin(const Napi::CallbackInfo& info);
+  Napi::Value ScanRollup(const Napi::CallbackInfo& info);
+  Napi::Value ExplainScan(const Napi::CallbackInfo& info);
+  Napi::Value ExportTable(const Napi::CallbackInfo& info);
+  Napi::Value WriteArrow(const Napi::CallbackInfo& info);
+  Napi::Value WriteRows(const Napi::CallbackInfo& info);
+  Napi::Value EnableSpillQueue(const Napi::CallbackInfo& info);
+  Napi::Value SpillQueueMetrics(const Napi::CallbackInfo& info);
+  Napi::Value EnableWriteCoalescing(const Napi::CallbackInfo& info);
+  Napi::Value FlushWrites(const Napi::CallbackInfo& info);
+  Napi::Value WriteCoalescerMetrics(const Napi::CallbackInfo& info);
+  Napi::Value EnableScanCache(const Napi::CallbackInfo& info);
+  Napi::Value ScanCacheMetrics(const Napi::CallbackInfo& info);
+  Napi::Value ConfigureWorkClass(const Napi::CallbackInfo& info);
+  Napi::Value SchedulerMetrics(const Napi::CallbackInfo& info);
+  Napi::Value SetMemoryLimits(const Napi::CallbackInfo& info);
+  Napi::Value MemoryUsage(const Napi::CallbackInfo& info);
+  Napi::Value Prewarm(const Napi::CallbackInfo& info);
+  Napi::Value StartCapture(const Napi::CallbackInfo& info);
+  Napi::Value StopCapture(const Napi::CallbackInfo& info);
+  Napi::Value ReplayCapture(const Napi::CallbackInfo& info);
+  Napi::Value ConfigureTenants(const Napi::CallbackInfo& info);
+  Napi::Value SetTenantQuota(const Napi::CallbackInfo& info);
+  Napi::Value TenantMetrics(const Napi::CallbackInfo& info);
+  Napi::Value OnCompletion(const Napi::CallbackInfo& info);
+  Napi::Value OffCompletion(const Napi::CallbackInfo& info);
+  Napi::Value CompletionMetrics(const Napi::CallbackInfo& info);
+  Napi::Value WriteRowsAsync(const Napi::CallbackInfo& info);
+  Napi::Value StreamScan(const Napi::CallbackInfo& info);
+  Napi::Value SubmitPrewarm(Napi::Env env, const vector<string>& tables, const string& workClass);
   KuduClass *actualClass_; //internal instance of actualclass used to perform actual operations.
+  WorkScheduler *scheduler_; //admits async jobs by work class
 };
\ No newline at end of file
@@ -32,6 +32,12 @@ Napi::Object kudujs::Init(Napi::Env env, Napi::Object exports) {
     Partitioning.Set("HASH", 1);
     Partitioning.Set("RANGEHASH", 2);
     exports.Set("Partitioning", Partitioning);
+    Napi::Object Operation = Napi::Object::New(env);
+    Operation.Set("INSERT", 0);
+    Operation.Set("UPDATE", 1);
+    Operation.Set("UPSERT", 2);
+    Operation.Set("DELETE", 3);
+    exports.Set("Operation", Operation);
     return exports;
 }
 
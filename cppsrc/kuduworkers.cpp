@@ -0,0 +1,393 @@
+#include "kuduworkers.h"
+#include "completionchannel.h"
+
+#include <algorithm>
+
+// What a Kudu scanner returns per batch by default, to size stream buffers.
+static const size_t kStreamBatchBytes = 1024 * 1024;
+
+ExportWorker::ExportWorker(Napi::Env env, KuduClass* kudu, string tableName, string path, ExportOptions options)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu),
+      tableName_(tableName), path_(path), options_(options) {
+  this->stats_ = ExportStats();
+}
+
+Napi::Promise ExportWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int ExportWorker::requestedScanners() const {
+  return std::max(1, this->options_.parallelism);
+}
+
+size_t ExportWorker::requestedBufferedBytes() const {
+  return this->options_.maxBufferedBytes;
+}
+
+void ExportWorker::Grant(const WorkGrant& grant) {
+  this->options_.parallelism = grant.scanners;
+  this->options_.maxBufferedBytes = grant.bufferedBytes;
+}
+
+void ExportWorker::Execute() {
+  Status s = this->kudu_->ExportTable(this->tableName_, this->path_, this->options_, &this->stats_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void ExportWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("rows", Napi::Number::New(env, this->stats_.rows));
+  result.Set("batches", Napi::Number::New(env, this->stats_.batches));
+  result.Set("bytes", Napi::Number::New(env, this->stats_.bytes));
+  result.Set("tablets", Napi::Number::New(env, this->stats_.tablets));
+  this->deferred_.Resolve(result);
+  Release();
+}
+
+void ExportWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+WriteWorker::WriteWorker(Napi::Env env, KuduClass* kudu, string tableName, int operation, PipelineOptions options)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu),
+      tableName_(tableName), operation_(operation), options_(options) {
+  this->stats_ = PipelineStats();
+}
+
+MarshaledRows* WriteWorker::rows() {
+  return &this->rows_;
+}
+
+Napi::Promise WriteWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int WriteWorker::requestedScanners() const {
+  return std::max(1, this->options_.parallelism);
+}
+
+void WriteWorker::Grant(const WorkGrant& grant) {
+  this->options_.parallelism = grant.scanners;
+}
+
+void WriteWorker::Execute() {
+  Status s = this->kudu_->WriteRowsParallel(this->tableName_, this->operation_, this->rows_, this->options_, &this->stats_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void WriteWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("rows", Napi::Number::New(env, this->stats_.rows));
+  result.Set("tablets", Napi::Number::New(env, this->stats_.tablets));
+  this->deferred_.Resolve(result);
+  Release();
+}
+
+void WriteWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+PrewarmWorker::PrewarmWorker(Napi::Env env, KuduClass* kudu, vector<string> tables)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu), tables_(tables) {
+  this->stats_ = PrewarmStats();
+}
+
+Napi::Promise PrewarmWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int PrewarmWorker::requestedScanners() const {
+  return 1;
+}
+
+void PrewarmWorker::Execute() {
+  Status s = this->kudu_->Prewarm(this->tables_, &this->stats_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void PrewarmWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("tables", Napi::Number::New(env, this->stats_.tables));
+  result.Set("tablets", Napi::Number::New(env, this->stats_.tablets));
+  result.Set("failed", Napi::Number::New(env, this->stats_.failed));
+  result.Set("millis", Napi::Number::New(env, this->stats_.millis));
+  this->deferred_.Resolve(result);
+  Release();
+}
+
+void PrewarmWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+ReplayWorker::ReplayWorker(Napi::Env env, KuduClass* kudu, string path, ReplayOptions options)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu), path_(path), options_(options) {
+  this->stats_ = ReplayStats();
+}
+
+Napi::Promise ReplayWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int ReplayWorker::requestedScanners() const {
+  return std::max(1, this->options_.concurrency);
+}
+
+void ReplayWorker::Grant(const WorkGrant& grant) {
+  this->options_.concurrency = grant.scanners;
+}
+
+void ReplayWorker::Execute() {
+  Status s = this->kudu_->ReplayCapture(this->path_, this->options_, &this->stats_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void ReplayWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("operations", Napi::Number::New(env, this->stats_.operations));
+  result.Set("writes", Napi::Number::New(env, this->stats_.writes));
+  result.Set("scans", Napi::Number::New(env, this->stats_.scans));
+  result.Set("rowsWritten", Napi::Number::New(env, this->stats_.rowsWritten));
+  result.Set("rowsScanned", Napi::Number::New(env, this->stats_.rowsScanned));
+  result.Set("failed", Napi::Number::New(env, this->stats_.failed));
+  result.Set("capturedMillis", Napi::Number::New(env, this->stats_.capturedMillis));
+  result.Set("replayedMillis", Napi::Number::New(env, this->stats_.replayedMillis));
+  result.Set("maxLagMillis", Napi::Number::New(env, this->stats_.maxLagMillis));
+  result.Set("millis", Napi::Number::New(env, this->stats_.millis));
+  if (!this->stats_.lastError.empty()) {
+    result.Set("lastError", Napi::String::New(env, this->stats_.lastError));
+  }
+  this->deferred_.Resolve(result);
+  Release();
+}
+
+void ReplayWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+JoinWorker::JoinWorker(Napi::Env env, KuduClass* kudu, string leftTable, string rightTable, JoinOptions options, int layout, bool dictionary)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu), leftTable_(leftTable),
+      rightTable_(rightTable), options_(options), layout_(layout), dictionary_(dictionary),
+      batches_(MemoryTracker::SCAN_BATCHES) {
+}
+
+Napi::Promise JoinWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int JoinWorker::requestedScanners() const {
+  return std::max(1, this->options_.parallelism);
+}
+
+void JoinWorker::Grant(const WorkGrant& grant) {
+  this->options_.parallelism = grant.scanners;
+}
+
+void JoinWorker::Execute() {
+  Status s = this->kudu_->ScanJoin(this->leftTable_, this->rightTable_, this->options_, &this->batches_, &this->columns_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void JoinWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::Value rows;
+  Status s = KuduClass::MaterializeRows(env, *this->columns_, this->layout_, this->dictionary_, &rows);
+  this->columns_.reset();
+  this->batches_.Release();
+  if (s.ok()) {
+    this->deferred_.Resolve(rows);
+  } else {
+    this->deferred_.Reject(Napi::Error::New(env, s.ToString()).Value());
+  }
+  Release();
+}
+
+void JoinWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+ExplainWorker::ExplainWorker(Napi::Env env, KuduClass* kudu, string tableName, vector<KPredicate> predicates, vector<string> projection, bool execute)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu), tableName_(tableName),
+      predicates_(predicates), projection_(projection), execute_(execute) {
+  this->plan_ = ScanPlan();
+}
+
+Napi::Promise ExplainWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int ExplainWorker::requestedScanners() const {
+  return this->execute_ ? 1 : 0;
+}
+
+void ExplainWorker::Execute() {
+  Status s = this->kudu_->ExplainScan(this->tableName_, this->predicates_, this->projection_, this->execute_, &this->plan_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void ExplainWorker::OnOK() {
+  Napi::Env env = Env();
+  const ScanPlan& plan = this->plan_;
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("tablets", Napi::Number::New(env, plan.tablets));
+  result.Set("totalTablets", Napi::Number::New(env, plan.totalTablets));
+  Napi::Array servers = Napi::Array::New(env, plan.servers.size());
+  for (size_t i = 0; i < plan.servers.size(); i++) {
+    servers.Set(i, Napi::String::New(env, plan.servers[i]));
+  }
+  result.Set("servers", servers);
+  result.Set("estimatedBytes", Napi::Number::New(env, plan.estimatedBytes));
+  result.Set("estimatedRows", Napi::Number::New(env, plan.estimatedRows));
+  result.Set("executed", Napi::Boolean::New(env, plan.executed));
+  if (plan.executed) {
+    result.Set("millis", Napi::Number::New(env, plan.millis));
+  }
+  Napi::Array tablets = Napi::Array::New(env, plan.tabletPlans.size());
+  for (size_t i = 0; i < plan.tabletPlans.size(); i++) {
+    const TabletPlan& tablet = plan.tabletPlans[i];
+    Napi::Object item = Napi::Object::New(env);
+    item.Set("id", Napi::String::New(env, tablet.id));
+    item.Set("leader", Napi::String::New(env, tablet.leader));
+    Napi::Array replicas = Napi::Array::New(env, tablet.replicas.size());
+    for (size_t j = 0; j < tablet.replicas.size(); j++) {
+      replicas.Set(j, Napi::String::New(env, tablet.replicas[j]));
+    }
+    item.Set("replicas", replicas);
+    item.Set("lowerKey", Napi::String::New(env, tablet.lowerKey));
+    item.Set("upperKey", Napi::String::New(env, tablet.upperKey));
+    if (plan.executed) {
+      item.Set("rows", Napi::Number::New(env, tablet.rows));
+      item.Set("bytes", Napi::Number::New(env, tablet.bytes));
+      item.Set("millis", Napi::Number::New(env, tablet.millis));
+      Napi::Object metrics = Napi::Object::New(env);
+      for (const auto& metric : tablet.metrics) {
+        metrics.Set(metric.first, Napi::Number::New(env, metric.second));
+      }
+      item.Set("metrics", metrics);
+    }
+    tablets.Set(i, item);
+  }
+  result.Set("tabletPlans", tablets);
+  this->deferred_.Resolve(result);
+  Release();
+}
+
+void ExplainWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+RollupWorker::RollupWorker(Napi::Env env, KuduClass* kudu, string tableName, RollupOptions options, string tenant)
+    : ScheduledWorker(env), deferred_(Napi::Promise::Deferred::New(env)), kudu_(kudu), tableName_(tableName),
+      options_(options), tenant_(tenant) {
+  this->result_.rowsScanned = 0;
+  this->result_.bytesScanned = 0;
+}
+
+Napi::Promise RollupWorker::GetPromise() const {
+  return this->deferred_.Promise();
+}
+
+int RollupWorker::requestedScanners() const {
+  return std::max(1, this->options_.parallelism);
+}
+
+void RollupWorker::Grant(const WorkGrant& grant) {
+  this->options_.parallelism = grant.scanners;
+}
+
+void RollupWorker::Execute() {
+  Status s = this->kudu_->ScanRollup(this->tableName_, this->options_, this->tenant_, &this->result_);
+  if (!s.ok()) {
+    SetError(s.ToString());
+  }
+}
+
+void RollupWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::Value result;
+  Status s = KuduClass::MaterializeRollup(env, this->options_, this->result_, &result);
+  if (s.ok()) {
+    this->deferred_.Resolve(result);
+  } else {
+    this->deferred_.Reject(Napi::Error::New(env, s.ToString()).Value());
+  }
+  Release();
+}
+
+void RollupWorker::OnError(const Napi::Error& e) {
+  this->deferred_.Reject(e.Value());
+  Release();
+}
+
+StreamScanWorker::StreamScanWorker(Napi::Env env, KuduClass* kudu, string tableName, vector<KPredicate> predicates, ScanOptions options, int64_t id,
+                                   std::shared_ptr<StreamScanState> state)
+    : ScheduledWorker(env), kudu_(kudu), tableName_(tableName), predicates_(predicates), options_(options), id_(id), state_(state) {
+}
+
+int StreamScanWorker::requestedScanners() const {
+  return 1;
+}
+
+size_t StreamScanWorker::requestedBufferedBytes() const {
+  return this->options_.maxInFlight * kStreamBatchBytes;
+}
+
+// Only the first run sizes the window; runs that resume the scan keep it.
+void StreamScanWorker::Grant(const WorkGrant& grant) {
+  size_t batches = std::max<size_t>(1, grant.bufferedBytes / kStreamBatchBytes);
+  this->options_.maxInFlight = static_cast<int>(std::min<size_t>(this->options_.maxInFlight, batches));
+}
+
+void StreamScanWorker::Execute() {
+  // Failures were already pushed to the listener as the last batch.
+  Status s = this->kudu_->StreamScan(this->tableName_, this->predicates_, this->options_, this->id_, this->state_.get());
+  if (!s.ok()) {
+    KUDU_LOG(WARNING) << "Streamed scan of " << this->tableName_ << " failed: " << s.ToString();
+  }
+}
+
+void StreamScanWorker::OnOK() {
+  if (!this->state_->done) {
+    // The window is full. Rather than hold a pool thread until the listener
+    // catches up, the rest of the scan is queued again under its work class
+    // once a batch has been delivered.
+    StreamScanWorker* next = new StreamScanWorker(Env(), this->kudu_, this->tableName_, this->predicates_, this->options_, this->id_, this->state_);
+    Continue(next);
+    std::function<void()> resume = [next]() {
+      Status s = next->Resume();
+      if (!s.ok()) {
+        KUDU_LOG(WARNING) << "Unable to resume a streamed scan: " << s.ToString();
+        delete next;
+      }
+    };
+    if (!this->state_->window->ResumeOnRelease(resume)) {
+      resume();
+    }
+  }
+  Release();
+}
+
+void StreamScanWorker::OnError(const Napi::Error&) {
+  Release();
+}
@@ -0,0 +1,212 @@
+#ifndef KUDUJS_KUDUWORKERS_H
+#define KUDUJS_KUDUWORKERS_H
+
+#include <napi.h>
+#include "kuduclass.h"
+#include "hashjoin.h"
+#include "memtracker.h"
+#include "rollup.h"
+#include "scanplan.h"
+#include "tableexport.h"
+#include "trafficcapture.h"
+#include "writepipeline.h"
+#include "workscheduler.h"
+
+// Runs KuduClass::ExportTable on the libuv thread pool and settles a promise
+// with the export statistics. Its parallelism and buffer size are capped by
+// what the work class grants.
+class ExportWorker : public ScheduledWorker {
+ public:
+  ExportWorker(Napi::Env env, KuduClass* kudu, string tableName, string path, ExportOptions options);
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+  size_t requestedBufferedBytes() const override;
+  void Grant(const WorkGrant& grant) override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  string tableName_;
+  string path_;
+  ExportOptions options_;
+  ExportStats stats_;
+};
+
+// Runs KuduClass::WriteRowsParallel on the libuv thread pool over rows that
+// were marshaled on the JS thread, and settles a promise with the stats. Its
+// writer threads are capped by the scanners the work class grants.
+class WriteWorker : public ScheduledWorker {
+ public:
+  WriteWorker(Napi::Env env, KuduClass* kudu, string tableName, int operation, PipelineOptions options);
+  MarshaledRows* rows();
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+  void Grant(const WorkGrant& grant) override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  string tableName_;
+  int operation_;
+  PipelineOptions options_;
+  MarshaledRows rows_;
+  PipelineStats stats_;
+};
+
+// Runs KuduClass::Prewarm on the libuv thread pool and settles a promise with
+// the prewarm statistics. Tables that cannot be prewarmed are only counted, so
+// the promise never rejects. Tables are looked up one at a time, on a single
+// scanner.
+class PrewarmWorker : public ScheduledWorker {
+ public:
+  PrewarmWorker(Napi::Env env, KuduClass* kudu, vector<string> tables);
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  vector<string> tables_;
+  PrewarmStats stats_;
+};
+
+// Runs KuduClass::ReplayCapture on the libuv thread pool and settles a
+// promise with the replay statistics. Its concurrency is capped by the
+// scanners the work class grants.
+class ReplayWorker : public ScheduledWorker {
+ public:
+  ReplayWorker(Napi::Env env, KuduClass* kudu, string path, ReplayOptions options);
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+  void Grant(const WorkGrant& grant) override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  string path_;
+  ReplayOptions options_;
+  ReplayStats stats_;
+};
+
+// Runs KuduClass::ScanJoin on the libuv thread pool and settles a promise with
+// the joined rows, built on the JS thread in the requested layout. The probe
+// side's parallelism is capped by what the work class grants.
+class JoinWorker : public ScheduledWorker {
+ public:
+  JoinWorker(Napi::Env env, KuduClass* kudu, string leftTable, string rightTable, JoinOptions options, int layout, bool dictionary);
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+  void Grant(const WorkGrant& grant) override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  string leftTable_;
+  string rightTable_;
+  JoinOptions options_;
+  int layout_;
+  bool dictionary_;
+  MemoryReservation batches_; // held until the rows are built
+  std::shared_ptr<const ColumnarBatch> columns_;
+};
+
+// Runs KuduClass::ExplainScan on the libuv thread pool and settles a promise
+// with the plan. An executed plan scans its tablets one at a time, so it asks
+// the work class for a single scanner.
+class ExplainWorker : public ScheduledWorker {
+ public:
+  ExplainWorker(Napi::Env env, KuduClass* kudu, string tableName, vector<KPredicate> predicates, vector<string> projection, bool execute);
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  string tableName_;
+  vector<KPredicate> predicates_;
+  vector<string> projection_;
+  bool execute_;
+  ScanPlan plan_;
+};
+
+// Runs KuduClass::ScanRollup on the libuv thread pool and settles a promise
+// with the rollup, built on the JS thread. The tablets aggregated at once are
+// capped by the scanners the work class grants.
+class RollupWorker : public ScheduledWorker {
+ public:
+  RollupWorker(Napi::Env env, KuduClass* kudu, string tableName, RollupOptions options, string tenant);
+  Napi::Promise GetPromise() const;
+  int requestedScanners() const override;
+  void Grant(const WorkGrant& grant) override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  KuduClass* kudu_;
+  string tableName_;
+  RollupOptions options_;
+  string tenant_;
+  RollupResult result_;
+};
+
+// Runs KuduClass::StreamScan on the libuv thread pool. There is no promise:
+// the batches, and any error, reach JS through the completion listener, the
+// last one flagged as such. A stream asks for one scanner and a buffer for
+// maxInFlight batches, and waits on fewer batches when granted less.
+class StreamScanWorker : public ScheduledWorker {
+ public:
+  StreamScanWorker(Napi::Env env, KuduClass* kudu, string tableName, vector<KPredicate> predicates, ScanOptions options, int64_t id,
+                   std::shared_ptr<StreamScanState> state);
+  int requestedScanners() const override;
+  size_t requestedBufferedBytes() const override;
+  void Grant(const WorkGrant& grant) override;
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error& e) override;
+
+ private:
+  KuduClass* kudu_;
+  string tableName_;
+  vector<KPredicate> predicates_;
+  ScanOptions options_;
+  int64_t id_;
+  std::shared_ptr<StreamScanState> state_;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "memtracker.h"
+
+#include <algorithm>
+#include <chrono>
+
+// Cleared on the JS thread, where charges fail instead of waiting.
+static thread_local bool t_mayWait = true;
+
+MemoryTracker::WaitScope::WaitScope(bool mayWait) : previous_(t_mayWait) {
+  t_mayWait = mayWait;
+}
+
+MemoryTracker::WaitScope::~WaitScope() {
+  t_mayWait = this->previous_;
+}
+
+MemoryTracker::MemoryTracker() {
+  for (int c = 0; c < NUM_COMPONENTS; c++) {
+    this->components_[c] = Usage();
+  }
+  this->total_ = Usage();
+  this->waitMillis_ = 1000;
+}
+
+MemoryTracker* MemoryTracker::Global() {
+  static MemoryTracker tracker;
+  return &tracker;
+}
+
+void MemoryTracker::MarkJsThread() {
+  t_mayWait = false;
+}
+
+bool MemoryTracker::MayWait() {
+  return t_mayWait;
+}
+
+const char* MemoryTracker::Name(Component component) {
+  switch (component) {
+    case SCAN_BATCHES:
+      return "scanBatches";
+    case SCAN_RESULTS:
+      return "scanResults";
+    case WRITE_BUFFERS:
+      return "writeBuffers";
+    case SCAN_CACHE:
+      return "scanCache";
+    case EXPORT_BUFFERS:
+      return "exportBuffers";
+    default:
+      return "unknown";
+  }
+}
+
+void MemoryTracker::SetLimit(Component component, size_t limit) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->components_[component].limit = limit;
+  this->released_.notify_all();
+}
+
+void MemoryTracker::SetTotalLimit(size_t limit) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->total_.limit = limit;
+  this->released_.notify_all();
+}
+
+void MemoryTracker::SetWaitMillis(int waitMillis) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->waitMillis_ = waitMillis;
+}
+
+bool MemoryTracker::Fits(Component component, size_t bytes) const {
+  const Usage& usage = this->components_[component];
+  return (usage.limit == 0 || usage.current + bytes <= usage.limit) &&
+      (this->total_.limit == 0 || this->total_.current + bytes <= this->total_.limit);
+}
+
+void MemoryTracker::Charge(Component component, size_t bytes) {
+  Usage& usage = this->components_[component];
+  usage.current += bytes;
+  usage.peak = std::max(usage.peak, usage.current);
+  this->total_.current += bytes;
+  this->total_.peak = std::max(this->total_.peak, this->total_.current);
+}
+
+string MemoryTracker::Exceeded(Component component, size_t bytes) const {
+  return "Memory limit exceeded for " + string(Name(component)) + ": " + std::to_string(bytes) +
+      " more bytes requested, " + std::to_string(this->components_[component].current) + " in use";
+}
+
+Status MemoryTracker::Consume(Component component, size_t bytes) {
+  if (!t_mayWait) {
+    return TryConsume(component, bytes);
+  }
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  const Usage& usage = this->components_[component];
+  // A charge larger than a limit can never fit, so it fails without waiting.
+  bool possible = (usage.limit == 0 || bytes <= usage.limit) &&
+      (this->total_.limit == 0 || bytes <= this->total_.limit);
+  if (!possible || !this->released_.wait_for(lock, std::chrono::milliseconds(this->waitMillis_),
+                                             [this, component, bytes] { return Fits(component, bytes); })) {
+    return Status::RuntimeError(Exceeded(component, bytes));
+  }
+  Charge(component, bytes);
+  return Status::OK();
+}
+
+Status MemoryTracker::TryConsume(Component component, size_t bytes) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (!Fits(component, bytes)) {
+    return Status::ServiceUnavailable(Exceeded(component, bytes));
+  }
+  Charge(component, bytes);
+  return Status::OK();
+}
+
+void MemoryTracker::Release(Component component, size_t bytes) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->components_[component].current -= bytes;
+  this->total_.current -= bytes;
+  this->released_.notify_all();
+}
+
+MemoryTracker::Usage MemoryTracker::usage(Component component) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->components_[component];
+}
+
+MemoryTracker::Usage MemoryTracker::total() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->total_;
+}
+
+MemoryReservation::MemoryReservation(MemoryTracker::Component component) : component_(component) {
+  this->bytes_ = 0;
+}
+
+MemoryReservation::~MemoryReservation() {
+  Release();
+}
+
+Status MemoryReservation::Grow(size_t bytes) {
+  KUDU_RETURN_NOT_OK(MemoryTracker::Global()->Consume(this->component_, bytes));
+  this->bytes_ += bytes;
+  return Status::OK();
+}
+
+bool MemoryReservation::TryGrow(size_t bytes) {
+  if (!MemoryTracker::Global()->TryConsume(this->component_, bytes).ok()) {
+    return false;
+  }
+  this->bytes_ += bytes;
+  return true;
+}
+
+Status MemoryReservation::GrowUpTo(size_t wanted, size_t minimum, size_t* granted) {
+  minimum = std::min(minimum, wanted);
+  for (size_t bytes = wanted; bytes > minimum; bytes /= 2) {
+    if (TryGrow(bytes)) {
+      *granted = bytes;
+      return Status::OK();
+    }
+  }
+  KUDU_RETURN_NOT_OK(Grow(minimum));
+  *granted = minimum;
+  return Status::OK();
+}
+
+void MemoryReservation::Release() {
+  if (this->bytes_ > 0) {
+    MemoryTracker::Global()->Release(this->component_, this->bytes_);
+    this->bytes_ = 0;
+  }
+}
+
+size_t MemoryReservation::bytes() const {
+  return this->bytes_;
+}
@@ -0,0 +1,99 @@
+#ifndef KUDUJS_MEMTRACKER_H
+#define KUDUJS_MEMTRACKER_H
+
+#include <condition_variable>
+#include <mutex>
+#include "kuduclass.h"
+
+// Process-wide accounting of the memory held by the native layer. Every
+// component charges what it allocates against its own limit and against the
+// total one; a limit of 0 means no limit. Charges that do not fit wait up to
+// waitMillis for other threads to release memory, then fail.
+//
+// The JS thread must never be parked, so there Consume fails at once with
+// ServiceUnavailable instead of waiting. Threads doing the work of a call made
+// on the JS thread take that over with a WaitScope.
+class MemoryTracker {
+ public:
+  enum Component {
+    SCAN_BATCHES, // columnar scan results being accumulated
+    SCAN_RESULTS, // JS values being built from them
+    WRITE_BUFFERS, // session mutation buffers
+    SCAN_CACHE,
+    EXPORT_BUFFERS,
+    NUM_COMPONENTS
+  };
+
+  struct Usage {
+    size_t current;
+    size_t peak;
+    size_t limit;
+  };
+
+  // Whether charges made on the calling thread may wait, while it lives.
+  class WaitScope {
+   public:
+    explicit WaitScope(bool mayWait);
+    ~WaitScope();
+
+   private:
+    bool previous_;
+  };
+
+  static MemoryTracker* Global();
+  static const char* Name(Component component);
+  static void MarkJsThread();
+  static bool MayWait();
+
+  void SetLimit(Component component, size_t limit);
+  void SetTotalLimit(size_t limit);
+  void SetWaitMillis(int waitMillis);
+  Status Consume(Component component, size_t bytes);
+  // Never waits, fails with ServiceUnavailable when the charge does not fit.
+  Status TryConsume(Component component, size_t bytes);
+  void Release(Component component, size_t bytes);
+  Usage usage(Component component);
+  Usage total();
+
+ private:
+  MemoryTracker();
+
+  std::mutex mutex_;
+  std::condition_variable released_;
+  Usage components_[NUM_COMPONENTS];
+  Usage total_;
+  int waitMillis_;
+
+  bool Fits(Component component, size_t bytes) const;
+  void Charge(Component component, size_t bytes);
+  string Exceeded(Component component, size_t bytes) const;
+};
+
+// Kudu's default mutation buffer for a write session, and the smallest one a
+// session is shrunk to when memory is short.
+static const size_t kSessionBufferBytes = 7 * 1024 * 1024;
+static const size_t kMinSessionBufferBytes = 256 * 1024;
+
+// Memory charged to one component on behalf of a single owner, released when
+// the reservation goes away.
+class MemoryReservation {
+ public:
+  explicit MemoryReservation(MemoryTracker::Component component);
+  ~MemoryReservation();
+  Status Grow(size_t bytes);
+  bool TryGrow(size_t bytes);
+  // Reserves as much of wanted as is free, halving down to minimum before
+  // waiting for that much, so callers can shrink their buffers under pressure.
+  Status GrowUpTo(size_t wanted, size_t minimum, size_t* granted);
+  void Release();
+  size_t bytes() const;
+
+ private:
+  MemoryTracker::Component component_;
+  size_t bytes_;
+
+  MemoryReservation(const MemoryReservation&) = delete;
+  MemoryReservation& operator=(const MemoryReservation&) = delete;
+};
+
+#endif
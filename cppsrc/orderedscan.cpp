@@ -0,0 +1,269 @@
+#include "orderedscan.h"
+
+#include <algorithm>
+#include <queue>
+#include <thread>
+
+using kudu::client::KuduScanner;
+
+// Dead rows a tablet run may hold beyond its limit before it is compacted.
+static const int64_t kCompactSlackRows = 4096;
+
+OrderedScanner::OrderedScanner(const shared_ptr<KuduTable>& table, const vector<KPredicate>& predicates,
+                               const vector<string>& projection, const ScanOrder& order, int parallelism)
+    : table_(table), predicates_(predicates), projection_(projection), order_(order),
+      parallelism_(parallelism), nextToken_(0), boundVersion_(0), failed_(false) {
+  this->keyOrdered_ = false;
+}
+
+OrderedScanner::~OrderedScanner() {
+  for (KuduScanToken* token : this->tokens_) {
+    delete token;
+  }
+}
+
+Status OrderedScanner::Resolve(const KuduSchema& projected) {
+  KuduSchema schema = this->table_->schema();
+  vector<int> keyIndexes;
+  schema.GetPrimaryKeyColumnIndexes(&keyIndexes);
+  vector<string> keys;
+  for (int i : keyIndexes) {
+    keys.push_back(schema.Column(i).name());
+  }
+  if (this->order_.primaryKey) {
+    this->order_.columns = keys;
+    this->order_.descending.assign(keys.size(), false);
+  }
+  if (this->order_.columns.empty()) {
+    return Status::InvalidArgument("No columns to order by");
+  }
+
+  this->keyOrdered_ = this->order_.columns.size() <= keys.size();
+  for (size_t i = 0; i < this->order_.columns.size(); i++) {
+    const string& name = this->order_.columns[i];
+    int index = -1;
+    for (int c = 0, l = projected.num_columns(); c < l; c++) {
+      if (projected.Column(c).name() == name) {
+        index = c;
+        break;
+      }
+    }
+    if (index < 0) {
+      return Status::InvalidArgument("Order column must be part of the projection: " + name);
+    }
+    this->columns_.push_back(index);
+    if (this->keyOrdered_ && (this->order_.descending[i] || keys[i] != name)) {
+      this->keyOrdered_ = false;
+    }
+  }
+  return Status::OK();
+}
+
+int OrderedScanner::Compare(const ColumnarBatch& a, int64_t ra, const ColumnarBatch& b, int64_t rb) const {
+  for (size_t i = 0; i < this->columns_.size(); i++) {
+    int c = this->columns_[i];
+    bool na = a.IsNull(c, ra);
+    bool nb = b.IsNull(c, rb);
+    if (na || nb) {
+      if (na != nb) {
+        return na ? 1 : -1;
+      }
+      continue;
+    }
+    int cmp = ColumnarBatch::CompareValues(a.columns()[c], ra, b.columns()[c], rb);
+    if (cmp != 0) {
+      return this->order_.descending[i] ? -cmp : cmp;
+    }
+  }
+  return 0;
+}
+
+Status OrderedScanner::Run(std::shared_ptr<ColumnarBatch>* result) {
+  KuduScanner scanner(this->table_.get());
+  if (!this->projection_.empty()) {
+    KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(this->projection_));
+  }
+  KuduSchema projected = scanner.GetProjectionSchema();
+  KUDU_RETURN_NOT_OK(Resolve(projected));
+  this->bound_.reset(new ColumnarBatch(projected));
+
+  KUDU_RETURN_NOT_OK(BuildScanTokens(this->table_, this->predicates_, this->projection_, &this->tokens_));
+  this->runs_.resize(this->tokens_.size());
+
+  vector<std::thread> threads;
+  this->mayWait_ = MemoryTracker::MayWait();
+  int parallelism = std::max(1, std::min<int>(this->parallelism_, this->tokens_.size()));
+  for (int i = 0; i < parallelism; i++) {
+    threads.push_back(std::thread(&OrderedScanner::ScanTokens, this));
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  KUDU_RETURN_NOT_OK(this->error_);
+
+  // K-way merge of the sorted runs; ties go to the earlier tablet.
+  auto later = [this](const std::pair<size_t, size_t>& x, const std::pair<size_t, size_t>& y) {
+    const TabletRun& a = this->runs_[x.first];
+    const TabletRun& b = this->runs_[y.first];
+    int cmp = Compare(*a.rows, a.order[x.second], *b.rows, b.order[y.second]);
+    return cmp != 0 ? cmp > 0 : x.first > y.first;
+  };
+  std::priority_queue<std::pair<size_t, size_t>, vector<std::pair<size_t, size_t>>, decltype(later)> heads(later);
+  for (size_t t = 0; t < this->runs_.size(); t++) {
+    if (!this->runs_[t].order.empty()) {
+      heads.push(std::make_pair(t, 0));
+    }
+  }
+
+  std::shared_ptr<ColumnarBatch> merged(new ColumnarBatch(projected));
+  while (!heads.empty() && (this->order_.limit == 0 || merged->num_rows() < this->order_.limit)) {
+    std::pair<size_t, size_t> head = heads.top();
+    heads.pop();
+    const TabletRun& run = this->runs_[head.first];
+    merged->AppendRow(*run.rows, run.order[head.second]);
+    if (head.second + 1 < run.order.size()) {
+      heads.push(std::make_pair(head.first, head.second + 1));
+    }
+  }
+  KUDU_RETURN_NOT_OK(merged->CheckSize());
+  *result = merged;
+  return Status::OK();
+}
+
+void OrderedScanner::ScanTokens() {
+  MemoryTracker::WaitScope scope(this->mayWait_);
+  while (!this->failed_) {
+    size_t i = this->nextToken_++;
+    if (i >= this->tokens_.size()) {
+      break;
+    }
+    Status s = ScanToken(this->tokens_[i], &this->runs_[i]);
+    if (!s.ok()) {
+      Fail(s);
+      break;
+    }
+  }
+}
+
+Status OrderedScanner::ScanToken(KuduScanToken* token, TabletRun* run) {
+  KuduScanner* raw;
+  KUDU_RETURN_NOT_OK(token->IntoKuduScanner(&raw));
+  std::unique_ptr<KuduScanner> scanner(raw);
+  if (this->keyOrdered_) {
+    KUDU_RETURN_NOT_OK(scanner->SetReadMode(KuduScanner::READ_AT_SNAPSHOT));
+    KUDU_RETURN_NOT_OK(scanner->SetOrderMode(KuduScanner::ORDERED));
+  }
+  KUDU_RETURN_NOT_OK(scanner->Open());
+
+  KuduSchema schema = scanner->GetProjectionSchema();
+  ColumnarBatch scratch(schema);
+  ColumnarBatch bound(schema);
+  uint64_t boundVersion = 0;
+  run->rows.reset(new ColumnarBatch(schema));
+  run->memory.reset(new MemoryReservation(MemoryTracker::SCAN_BATCHES));
+  MemoryReservation& memory = *run->memory;
+
+  // Without key order the run is kept as a heap with its worst row on top.
+  ColumnarBatch* rows = run->rows.get();
+  vector<int64_t>& heap = run->order;
+  auto better = [this, &rows](int64_t a, int64_t b) { return Compare(*rows, a, *rows, b) < 0; };
+  int64_t limit = this->order_.limit;
+  bool done = false;
+
+  KuduScanBatch batch;
+  while (!done && scanner->HasMoreRows() && !this->failed_) {
+    KUDU_RETURN_NOT_OK(scanner->NextBatch(&batch));
+    scratch.Clear();
+    KUDU_RETURN_NOT_OK(scratch.Append(batch));
+    if (limit > 0) {
+      RefreshBound(&bound, &boundVersion);
+    }
+
+    for (int64_t r = 0; r < scratch.num_rows(); r++) {
+      if (bound.num_rows() > 0 && Compare(scratch, r, bound, 0) > 0) {
+        if (this->keyOrdered_) {
+          done = true;
+          break;
+        }
+        continue;
+      }
+      if (limit == 0 || static_cast<int64_t>(heap.size()) < limit) {
+        rows->AppendRow(scratch, r);
+        heap.push_back(rows->num_rows() - 1);
+        if (limit > 0 && !this->keyOrdered_) {
+          std::push_heap(heap.begin(), heap.end(), better);
+        }
+        if (limit > 0 && static_cast<int64_t>(heap.size()) == limit) {
+          Publish(*rows, this->keyOrdered_ ? heap.back() : heap.front());
+        }
+        continue;
+      }
+      if (this->keyOrdered_) {
+        done = true;
+        break;
+      }
+      if (Compare(scratch, r, *rows, heap.front()) >= 0) {
+        continue;
+      }
+      rows->AppendRow(scratch, r);
+      std::pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = rows->num_rows() - 1;
+      std::push_heap(heap.begin(), heap.end(), better);
+      Publish(*rows, heap.front());
+    }
+
+    // Rows pushed out of the heap are dropped once they pile up.
+    if (limit > 0 && rows->num_rows() > 2 * limit + kCompactSlackRows) {
+      std::unique_ptr<ColumnarBatch> kept(new ColumnarBatch(schema));
+      for (int64_t& index : heap) {
+        kept->AppendRow(*rows, index);
+        index = kept->num_rows() - 1;
+      }
+      run->rows = std::move(kept);
+      rows = run->rows.get();
+    }
+    KUDU_RETURN_NOT_OK(rows->CheckSize());
+    if (rows->ByteSize() > memory.bytes()) {
+      KUDU_RETURN_NOT_OK(memory.Grow(rows->ByteSize() - memory.bytes()));
+    }
+  }
+
+  if (!this->keyOrdered_) {
+    if (limit > 0) {
+      std::sort_heap(heap.begin(), heap.end(), better);
+    } else {
+      std::stable_sort(heap.begin(), heap.end(), better);
+    }
+  }
+  return Status::OK();
+}
+
+void OrderedScanner::Publish(const ColumnarBatch& rows, int64_t row) {
+  // A tablet holding limit rows at least as good as this one means no row
+  // worse than it can be part of the result.
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->bound_->num_rows() > 0 && Compare(rows, row, *this->bound_, 0) >= 0) {
+    return;
+  }
+  this->bound_->Clear();
+  this->bound_->AppendRow(rows, row);
+  this->boundVersion_++;
+}
+
+void OrderedScanner::RefreshBound(ColumnarBatch* bound, uint64_t* version) {
+  if (this->boundVersion_ == *version) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  bound->Clear();
+  bound->AppendRow(*this->bound_, 0);
+  *version = this->boundVersion_;
+}
+
+void OrderedScanner::Fail(const Status& s) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (!this->failed_) {
+    this->error_ = s;
+    this->failed_ = true;
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef KUDUJS_ORDEREDSCAN_H
+#define KUDUJS_ORDEREDSCAN_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "kuduclass.h"
+#include "columnarbatch.h"
+#include "memtracker.h"
+
+using kudu::client::KuduScanToken;
+
+struct ScanOrder {
+  bool primaryKey; // order by the primary key columns, ascending
+  vector<string> columns; // otherwise order by these
+  vector<bool> descending; // per column
+  int64_t limit; // keep only the first rows, 0 for all of them
+};
+
+// Scans every tablet in parallel and returns the rows in the requested order,
+// nulls last. Each tablet keeps its own sorted run, bounded to limit rows by a
+// heap, and the runs are merged at the end.
+//
+// With a limit, the row that would currently be last of the result is shared
+// between tablets so they can skip rows that cannot make it. When the order
+// is a prefix of the primary key, tablets are scanned in key order and stop
+// as soon as no later row can make it either.
+class OrderedScanner {
+ public:
+  OrderedScanner(const shared_ptr<KuduTable>& table, const vector<KPredicate>& predicates,
+                 const vector<string>& projection, const ScanOrder& order, int parallelism);
+  ~OrderedScanner();
+  Status Run(std::shared_ptr<ColumnarBatch>* result);
+
+ private:
+  struct TabletRun {
+    std::unique_ptr<ColumnarBatch> rows;
+    vector<int64_t> order; // rows in result order once the scan is done
+    std::unique_ptr<MemoryReservation> memory; // held until the merge is done
+  };
+
+  shared_ptr<KuduTable> table_;
+  vector<KPredicate> predicates_;
+  vector<string> projection_;
+  ScanOrder order_;
+  int parallelism_;
+  vector<int> columns_; // projection index per order column
+  bool keyOrdered_; // tablets return rows already in result order
+  vector<KuduScanToken*> tokens_;
+  vector<TabletRun> runs_;
+  std::atomic<size_t> nextToken_;
+
+  std::mutex mutex_;
+  std::unique_ptr<ColumnarBatch> bound_; // worst row still needed, or empty
+  std::atomic<uint64_t> boundVersion_;
+  Status error_;
+  std::atomic<bool> failed_;
+  bool mayWait_; // whether memory charges may wait, taken from the calling thread
+
+  Status Resolve(const KuduSchema& projected);
+  int Compare(const ColumnarBatch& a, int64_t ra, const ColumnarBatch& b, int64_t rb) const;
+  void ScanTokens();
+  Status ScanToken(KuduScanToken* token, TabletRun* run);
+  void Publish(const ColumnarBatch& rows, int64_t row);
+  void RefreshBound(ColumnarBatch* bound, uint64_t* version);
+  void Fail(const Status& s);
+};
+
+#endif
@@ -0,0 +1,456 @@
+#include "rollup.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include "hashjoin.h"
+
+using kudu::client::KuduColumnSchema;
+using kudu::client::KuduScanner;
+
+static const uint32_t kNoSlot = std::numeric_limits<uint32_t>::max();
+// Rough cost of a slot outside its accumulators: its bucket, group and row
+// count, plus the hash map node pointing at it.
+static const size_t kSlotBytes = 3 * sizeof(int64_t) + 32;
+
+static int IndexOf(const vector<string>& names, const string& name) {
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] == name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int AddColumn(vector<string>* names, const string& name) {
+  int index = IndexOf(*names, name);
+  if (index >= 0) {
+    return index;
+  }
+  names->push_back(name);
+  return names->size() - 1;
+}
+
+static bool IsNumeric(KuduColumnSchema::DataType type) {
+  switch (type) {
+    case KuduColumnSchema::INT8:
+    case KuduColumnSchema::INT16:
+    case KuduColumnSchema::INT32:
+    case KuduColumnSchema::INT64:
+    case KuduColumnSchema::UNIXTIME_MICROS:
+    case KuduColumnSchema::FLOAT:
+    case KuduColumnSchema::DOUBLE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+Rollup::Rollup(const shared_ptr<KuduTable>& table, const RollupOptions& options)
+    : table_(table), options_(options), nextToken_(0), rows_(0), bytes_(0), failed_(false) {
+}
+
+Rollup::~Rollup() {
+  for (KuduScanToken* token : this->tokens_) {
+    delete token;
+  }
+}
+
+int64_t Rollup::BucketOf(int64_t time, int64_t width) {
+  // Division truncates towards zero, buckets before the epoch floor instead.
+  int64_t bucket = time / width;
+  if (time % width != 0 && time < 0) {
+    bucket--;
+  }
+  return bucket * width;
+}
+
+Status Rollup::Plan() {
+  if (this->options_.bucketMicros <= 0) {
+    return Status::InvalidArgument("Rollup bucket must be positive");
+  }
+  if (this->options_.aggs.empty()) {
+    return Status::InvalidArgument("Rollup needs at least one aggregate");
+  }
+  KuduSchema schema = this->table_->schema();
+  auto typeOf = [&schema](const string& name, KuduColumnSchema::DataType* type) {
+    for (int i = 0, l = schema.num_columns(); i < l; i++) {
+      if (schema.Column(i).name() == name) {
+        *type = schema.Column(i).type();
+        return true;
+      }
+    }
+    return false;
+  };
+
+  KuduColumnSchema::DataType type;
+  if (!typeOf(this->options_.timeColumn, &type)) {
+    return Status::NotFound("Unknown time column: " + this->options_.timeColumn);
+  }
+  if (type != KuduColumnSchema::UNIXTIME_MICROS && type != KuduColumnSchema::INT64) {
+    return Status::InvalidArgument("Rollup time column must be UNIXTIME_MICROS or INT64: " + this->options_.timeColumn);
+  }
+  this->scan_.push_back(this->options_.timeColumn);
+  for (const string& name : this->options_.groupBy) {
+    if (!typeOf(name, &type)) {
+      return Status::NotFound("Unknown group by column: " + name);
+    }
+    this->groupColumns_.push_back(AddColumn(&this->scan_, name));
+  }
+  for (const RollupAgg& agg : this->options_.aggs) {
+    if (agg.column.empty()) {
+      if (agg.function != RollupAgg::COUNT) {
+        return Status::InvalidArgument("Only COUNT may omit its column: " + agg.name);
+      }
+      this->aggValues_.push_back(-1);
+      continue;
+    }
+    if (!typeOf(agg.column, &type)) {
+      return Status::NotFound("Unknown aggregate column: " + agg.column);
+    }
+    if (agg.function != RollupAgg::COUNT && !IsNumeric(type)) {
+      return Status::InvalidArgument("Aggregate column must be numeric: " + agg.column);
+    }
+    int column = AddColumn(&this->scan_, agg.column);
+    int value = std::find(this->valueColumns_.begin(), this->valueColumns_.end(), column) - this->valueColumns_.begin();
+    if (value == static_cast<int>(this->valueColumns_.size())) {
+      this->valueColumns_.push_back(column);
+    }
+    this->aggValues_.push_back(value);
+  }
+
+  KuduScanner scanner(this->table_.get());
+  KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(this->scan_));
+  ColumnarBatch shape(scanner.GetProjectionSchema());
+  for (int c : this->groupColumns_) {
+    this->groupShape_.push_back(shape.columns()[c]);
+  }
+
+  // The range is pushed down so only its partitions and rows are read.
+  vector<KPredicate> predicates = this->options_.predicates;
+  if (this->options_.hasFrom) {
+    predicates.push_back(KPredicate(this->options_.timeColumn, KuduPredicate::GREATER_EQUAL,
+                                    static_cast<double>(this->options_.from), false));
+  }
+  if (this->options_.hasTo) {
+    predicates.push_back(KPredicate(this->options_.timeColumn, KuduPredicate::LESS,
+                                    static_cast<double>(this->options_.to), false));
+  }
+  return BuildScanTokens(this->table_, predicates, this->scan_, &this->tokens_);
+}
+
+Status Rollup::Run(RollupResult* result) {
+  KUDU_RETURN_NOT_OK(Plan());
+
+  this->partials_.resize(this->tokens_.size());
+  vector<std::thread> threads;
+  this->mayWait_ = MemoryTracker::MayWait();
+  int parallelism = std::max(1, std::min<int>(this->options_.parallelism, this->tokens_.size()));
+  for (int i = 0; i < parallelism; i++) {
+    threads.push_back(std::thread(&Rollup::AggregateTokens, this));
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  KUDU_RETURN_NOT_OK(this->error_);
+
+  Partial merged;
+  KUDU_RETURN_NOT_OK(Merge(&merged));
+
+  size_t slots = merged.slotBuckets.size();
+  vector<uint32_t> order(slots);
+  std::iota(order.begin(), order.end(), 0);
+  // Groups are ordered by value, column by column; their encoded keys are
+  // only good for equality. Group values are never null.
+  const vector<ColumnarBatch::Column>& groupValues = merged.groups->columns();
+  std::sort(order.begin(), order.end(), [&merged, &groupValues](uint32_t a, uint32_t b) {
+    if (merged.slotBuckets[a] != merged.slotBuckets[b]) {
+      return merged.slotBuckets[a] < merged.slotBuckets[b];
+    }
+    for (const ColumnarBatch::Column& column : groupValues) {
+      int cmp = ColumnarBatch::CompareValues(column, merged.slotGroups[a], column, merged.slotGroups[b]);
+      if (cmp != 0) {
+        return cmp < 0;
+      }
+    }
+    return false;
+  });
+
+  vector<int> groupColumns(this->groupShape_.size());
+  std::iota(groupColumns.begin(), groupColumns.end(), 0);
+  size_t width = this->valueColumns_.size();
+  result->groups.reset(new ColumnarBatch(this->groupShape_));
+  result->buckets.reserve(slots);
+  result->values.assign(this->options_.aggs.size(), vector<double>());
+  for (vector<double>& values : result->values) {
+    values.reserve(slots);
+  }
+  const double none = std::numeric_limits<double>::quiet_NaN();
+  for (uint32_t slot : order) {
+    result->buckets.push_back(merged.slotBuckets[slot]);
+    if (!groupColumns.empty()) {
+      result->groups->AppendCells(0, *merged.groups, groupColumns, merged.slotGroups[slot]);
+      result->groups->EndRow();
+    }
+    for (size_t a = 0; a < this->options_.aggs.size(); a++) {
+      int value = this->aggValues_[a];
+      if (value < 0) {
+        result->values[a].push_back(merged.slotRows[slot]);
+        continue;
+      }
+      // Aggregates over no values are NaN, the typed array stand-in for null.
+      const Accumulator& acc = merged.accumulators[slot * width + value];
+      switch (this->options_.aggs[a].function) {
+        case RollupAgg::COUNT:
+          result->values[a].push_back(acc.count);
+          break;
+        case RollupAgg::SUM:
+          result->values[a].push_back(acc.count > 0 ? acc.sum : none);
+          break;
+        case RollupAgg::MIN:
+          result->values[a].push_back(acc.count > 0 ? acc.min : none);
+          break;
+        case RollupAgg::MAX:
+          result->values[a].push_back(acc.count > 0 ? acc.max : none);
+          break;
+        case RollupAgg::AVG:
+          result->values[a].push_back(acc.count > 0 ? acc.sum / acc.count : none);
+          break;
+      }
+    }
+  }
+  KUDU_RETURN_NOT_OK(result->groups->CheckSize());
+  result->rowsScanned = this->rows_;
+  result->bytesScanned = this->bytes_;
+  return Status::OK();
+}
+
+void Rollup::AggregateTokens() {
+  MemoryTracker::WaitScope scope(this->mayWait_);
+  while (!this->failed_) {
+    size_t i = this->nextToken_++;
+    if (i >= this->tokens_.size()) {
+      break;
+    }
+    Status s = AggregateToken(this->tokens_[i], &this->partials_[i]);
+    if (!s.ok()) {
+      Fail(s);
+      break;
+    }
+  }
+}
+
+Status Rollup::AggregateToken(KuduScanToken* token, Partial* partial) {
+  KuduScanner* raw;
+  KUDU_RETURN_NOT_OK(token->IntoKuduScanner(&raw));
+  std::unique_ptr<KuduScanner> scanner(raw);
+  KUDU_RETURN_NOT_OK(scanner->Open());
+
+  ColumnarBatch scratch(scanner->GetProjectionSchema());
+  partial->groups.reset(new ColumnarBatch(this->groupShape_));
+  partial->memory.reset(new MemoryReservation(MemoryTracker::SCAN_BATCHES));
+  vector<uint32_t> slots;
+
+  KuduScanBatch batch;
+  while (scanner->HasMoreRows() && !this->failed_) {
+    KUDU_RETURN_NOT_OK(scanner->NextBatch(&batch));
+    this->rows_ += batch.NumRows();
+    this->bytes_ += batch.direct_data().size() + batch.indirect_data().size();
+    scratch.Clear();
+    KUDU_RETURN_NOT_OK(scratch.Append(batch));
+    AssignSlots(scratch, partial, &slots);
+    Accumulate(scratch, slots, partial);
+    KUDU_RETURN_NOT_OK(partial->groups->CheckSize());
+
+    size_t size = partial->groups->ByteSize() + partial->slotBuckets.size() * kSlotBytes +
+        partial->accumulators.size() * sizeof(Accumulator);
+    if (size > partial->memory->bytes()) {
+      KUDU_RETURN_NOT_OK(partial->memory->Grow(size - partial->memory->bytes()));
+    }
+  }
+  return Status::OK();
+}
+
+// Maps every row of the batch to its (bucket, group) slot, or kNoSlot for
+// rows left out. Consecutive rows mostly share a bucket and group, so the
+// last slot is tried before the hash maps.
+void Rollup::AssignSlots(const ColumnarBatch& batch, Partial* partial, vector<uint32_t>* slots) {
+  int64_t n = batch.num_rows();
+  slots->assign(n, kNoSlot);
+  if (n == 0) {
+    return;
+  }
+  // Both time column types are stored as 8 byte integers.
+  vector<int64_t> buckets(n);
+  memcpy(buckets.data(), batch.columns()[0].values.data(), n * sizeof(int64_t));
+  int64_t width = this->options_.bucketMicros;
+  for (int64_t r = 0; r < n; r++) {
+    buckets[r] = BucketOf(buckets[r], width);
+  }
+
+  bool grouped = !this->groupColumns_.empty();
+  int64_t group = grouped ? -1 : Group(partial, batch, this->groupColumns_, 0, string());
+  int64_t lastBucket = 0;
+  int64_t lastGroup = -1;
+  uint32_t lastSlot = kNoSlot;
+  string key;
+  for (int64_t r = 0; r < n; r++) {
+    if (batch.IsNull(0, r)) {
+      continue;
+    }
+    if (grouped) {
+      if (!JoinHashTable::EncodeKey(batch, this->groupColumns_, r, &key)) {
+        continue;
+      }
+      group = Group(partial, batch, this->groupColumns_, r, key);
+    }
+    if (lastSlot == kNoSlot || buckets[r] != lastBucket || group != lastGroup) {
+      lastSlot = Slot(partial, buckets[r], group);
+      lastBucket = buckets[r];
+      lastGroup = group;
+    }
+    (*slots)[r] = lastSlot;
+    partial->slotRows[lastSlot]++;
+  }
+}
+
+template <typename T>
+void Rollup::Fold(const ColumnarBatch& batch, int column, const vector<uint32_t>& slots,
+                  Accumulator* accumulators, size_t stride) {
+  const ColumnarBatch::Column& col = batch.columns()[column];
+  const char* values = col.values.data();
+  bool nullable = !col.validity.empty();
+  for (size_t r = 0; r < slots.size(); r++) {
+    if (slots[r] == kNoSlot || (nullable && batch.IsNull(column, r))) {
+      continue;
+    }
+    T raw;
+    memcpy(&raw, values + r * sizeof(T), sizeof(T));
+    double v = static_cast<double>(raw);
+    Accumulator& acc = accumulators[slots[r] * stride];
+    acc.count++;
+    acc.sum += v;
+    acc.min = std::min(acc.min, v);
+    acc.max = std::max(acc.max, v);
+  }
+}
+
+// Folds each value column into the slots with a loop specialised for its
+// type. Columns only counted may have any type.
+void Rollup::Accumulate(const ColumnarBatch& batch, const vector<uint32_t>& slots, Partial* partial) {
+  size_t width = this->valueColumns_.size();
+  for (size_t v = 0; v < width; v++) {
+    int column = this->valueColumns_[v];
+    Accumulator* accumulators = partial->accumulators.data() + v;
+    switch (batch.columns()[column].type) {
+      case KuduColumnSchema::INT8:
+        Fold<int8_t>(batch, column, slots, accumulators, width);
+        break;
+      case KuduColumnSchema::INT16:
+        Fold<int16_t>(batch, column, slots, accumulators, width);
+        break;
+      case KuduColumnSchema::INT32:
+        Fold<int32_t>(batch, column, slots, accumulators, width);
+        break;
+      case KuduColumnSchema::INT64:
+      case KuduColumnSchema::UNIXTIME_MICROS:
+        Fold<int64_t>(batch, column, slots, accumulators, width);
+        break;
+      case KuduColumnSchema::FLOAT:
+        Fold<float>(batch, column, slots, accumulators, width);
+        break;
+      case KuduColumnSchema::DOUBLE:
+        Fold<double>(batch, column, slots, accumulators, width);
+        break;
+      default:
+        for (size_t r = 0; r < slots.size(); r++) {
+          if (slots[r] != kNoSlot && !batch.IsNull(column, r)) {
+            accumulators[slots[r] * width].count++;
+          }
+        }
+        break;
+    }
+  }
+}
+
+uint32_t Rollup::Slot(Partial* partial, int64_t bucket, int64_t group) {
+  std::unordered_map<int64_t, uint32_t>& slots = partial->bucketSlots[group];
+  auto it = slots.find(bucket);
+  if (it != slots.end()) {
+    return it->second;
+  }
+  uint32_t slot = partial->slotBuckets.size();
+  partial->slotBuckets.push_back(bucket);
+  partial->slotGroups.push_back(group);
+  partial->slotRows.push_back(0);
+  Accumulator empty = {0, 0, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+  partial->accumulators.resize(partial->accumulators.size() + this->valueColumns_.size(), empty);
+  slots.emplace(bucket, slot);
+  return slot;
+}
+
+int64_t Rollup::Group(Partial* partial, const ColumnarBatch& source, const vector<int>& columns,
+                      int64_t row, const string& key) {
+  auto it = partial->groupIds.find(key);
+  if (it != partial->groupIds.end()) {
+    return it->second;
+  }
+  int64_t group = partial->groupKeys.size();
+  partial->groupKeys.push_back(key);
+  partial->groupIds.emplace(key, group);
+  partial->groups->AppendCells(0, source, columns, row);
+  partial->groups->EndRow();
+  partial->bucketSlots.emplace_back();
+  return group;
+}
+
+// Merges the partials of every token, releasing each once it is folded in.
+Status Rollup::Merge(Partial* merged) {
+  merged->groups.reset(new ColumnarBatch(this->groupShape_));
+  merged->memory.reset(new MemoryReservation(MemoryTracker::SCAN_BATCHES));
+  vector<int> groupColumns(this->groupShape_.size());
+  std::iota(groupColumns.begin(), groupColumns.end(), 0);
+  size_t width = this->valueColumns_.size();
+
+  for (Partial& partial : this->partials_) {
+    if (partial.groups == nullptr) {
+      continue;
+    }
+    vector<int64_t> groups(partial.groupKeys.size());
+    for (size_t g = 0; g < groups.size(); g++) {
+      groups[g] = Group(merged, *partial.groups, groupColumns, g, partial.groupKeys[g]);
+    }
+    for (size_t s = 0; s < partial.slotBuckets.size(); s++) {
+      uint32_t slot = Slot(merged, partial.slotBuckets[s], groups[partial.slotGroups[s]]);
+      merged->slotRows[slot] += partial.slotRows[s];
+      for (size_t v = 0; v < width; v++) {
+        const Accumulator& from = partial.accumulators[s * width + v];
+        Accumulator& to = merged->accumulators[slot * width + v];
+        to.count += from.count;
+        to.sum += from.sum;
+        to.min = std::min(to.min, from.min);
+        to.max = std::max(to.max, from.max);
+      }
+    }
+    partial = Partial();
+    KUDU_RETURN_NOT_OK(merged->groups->CheckSize());
+
+    size_t size = merged->groups->ByteSize() + merged->slotBuckets.size() * kSlotBytes +
+        merged->accumulators.size() * sizeof(Accumulator);
+    if (size > merged->memory->bytes()) {
+      KUDU_RETURN_NOT_OK(merged->memory->Grow(size - merged->memory->bytes()));
+    }
+  }
+  return Status::OK();
+}
+
+void Rollup::Fail(const Status& s) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (!this->failed_) {
+    this->error_ = s;
+    this->failed_ = true;
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef KUDUJS_ROLLUP_H
+#define KUDUJS_ROLLUP_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "kuduclass.h"
+#include "columnarbatch.h"
+#include "memtracker.h"
+
+using kudu::client::KuduScanToken;
+
+struct RollupAgg {
+  enum Function { COUNT, SUM, MIN, MAX, AVG };
+  Function function;
+  string column; // empty to count rows
+  string name; // key of the result array
+};
+
+struct RollupOptions {
+  string timeColumn; // UNIXTIME_MICROS or INT64
+  int64_t bucketMicros;
+  bool hasFrom; // range is [from, to)
+  int64_t from;
+  bool hasTo;
+  int64_t to;
+  vector<RollupAgg> aggs;
+  vector<string> groupBy;
+  vector<KPredicate> predicates;
+  int parallelism; // concurrent scan tokens
+};
+
+struct RollupResult {
+  vector<int64_t> buckets; // start of each row's bucket
+  std::unique_ptr<ColumnarBatch> groups; // group by values of each row
+  vector<vector<double>> values; // one array per aggregate
+  int64_t rowsScanned;
+  int64_t bytesScanned;
+};
+
+// Downsamples a time-series table natively. Every scan token is aggregated
+// on its own thread into per (bucket, group) slots, a column at a time: the
+// bucket of each row is computed over the whole time column first, then each
+// value column is folded into the slots by a loop specialised for its type.
+// The partial slots of all tablets are merged at the end and returned sorted
+// by bucket, then group, so the work left for JS is proportional to the
+// output rather than to the rows scanned.
+//
+// Buckets are aligned to the epoch. Rows with a null time, or a null in any
+// group by column, are left out; nulls in value columns are skipped by every
+// aggregate but a COUNT of rows.
+class Rollup {
+ public:
+  Rollup(const shared_ptr<KuduTable>& table, const RollupOptions& options);
+  ~Rollup();
+  Status Run(RollupResult* result);
+
+  static int64_t BucketOf(int64_t time, int64_t width);
+
+ private:
+  struct Accumulator {
+    int64_t count; // non-null values
+    double sum;
+    double min;
+    double max;
+  };
+  // Aggregation state of one scan token, and after merging of the whole scan.
+  struct Partial {
+    std::unique_ptr<ColumnarBatch> groups; // one row per distinct group
+    vector<string> groupKeys;
+    std::unordered_map<string, int64_t> groupIds;
+    vector<std::unordered_map<int64_t, uint32_t>> bucketSlots; // by group id
+    vector<int64_t> slotBuckets;
+    vector<int64_t> slotGroups;
+    vector<int64_t> slotRows;
+    vector<Accumulator> accumulators; // slots x value columns
+    std::unique_ptr<MemoryReservation> memory;
+  };
+
+  shared_ptr<KuduTable> table_;
+  RollupOptions options_;
+  vector<string> scan_; // projection: time, group by, then value columns
+  vector<int> groupColumns_; // by scanned index
+  vector<int> valueColumns_;
+  vector<int> aggValues_; // value column of each aggregate, -1 for rows
+  vector<ColumnarBatch::Column> groupShape_;
+  vector<KuduScanToken*> tokens_;
+  vector<Partial> partials_;
+  std::atomic<size_t> nextToken_;
+  std::atomic<int64_t> rows_;
+  std::atomic<int64_t> bytes_;
+
+  std::mutex mutex_;
+  Status error_;
+  std::atomic<bool> failed_;
+  bool mayWait_; // whether memory charges may wait, taken from the calling thread
+
+  Status Plan();
+  void AggregateTokens();
+  Status AggregateToken(KuduScanToken* token, Partial* partial);
+  void AssignSlots(const ColumnarBatch& batch, Partial* partial, vector<uint32_t>* slots);
+  void Accumulate(const ColumnarBatch& batch, const vector<uint32_t>& slots, Partial* partial);
+  template <typename T>
+  static void Fold(const ColumnarBatch& batch, int column, const vector<uint32_t>& slots,
+                   Accumulator* accumulators, size_t stride);
+  uint32_t Slot(Partial* partial, int64_t bucket, int64_t group);
+  int64_t Group(Partial* partial, const ColumnarBatch& source, const vector<int>& columns,
+                int64_t row, const string& key);
+  Status Merge(Partial* merged);
+  void Fail(const Status& s);
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "rowcodec.h"
+
+#include <cstring>
+
+using kudu::Slice;
+using kudu::client::KuduColumnSchema;
+
+KuduWriteOperation* NewOperation(KuduTable* table, int operation) {
+  switch (operation) {
+    case K_INSERT:
+      return table->NewInsert();
+    case K_UPDATE:
+      return table->NewUpdate();
+    case K_UPSERT:
+      return table->NewUpsert();
+    case K_DELETE:
+      return table->NewDelete();
+    default:
+      return NULL;
+  }
+}
+
+template <typename T>
+static void Put(string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool Take(const uint8_t** data, const uint8_t* end, T* value) {
+  if (end - *data < static_cast<ptrdiff_t>(sizeof(T))) {
+    return false;
+  }
+  memcpy(value, *data, sizeof(T));
+  *data += sizeof(T);
+  return true;
+}
+
+Status EncodeRow(const KuduPartialRow& row, const KuduSchema& schema, string* out) {
+  size_t countPos = out->size();
+  uint16_t count = 0;
+  Put<uint16_t>(out, 0);
+  for (int i = 0, l = schema.num_columns(); i < l; i++) {
+    if (!row.IsColumnSet(i)) {
+      continue;
+    }
+    KuduColumnSchema::DataType type = schema.Column(i).type();
+    if (type == KuduColumnSchema::DECIMAL) {
+      out->resize(countPos);
+      return Status::NotSupported("Unable to encode DECIMAL column " + schema.Column(i).name());
+    }
+    count++;
+    Put<uint16_t>(out, i);
+    bool isNull = row.IsNull(i);
+    Put<uint8_t>(out, isNull);
+    if (isNull) {
+      continue;
+    }
+    switch (type) {
+      case KuduColumnSchema::INT8:
+      {
+        int8_t val;
+        row.GetInt8(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::INT16:
+      {
+        int16_t val;
+        row.GetInt16(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::INT32:
+      {
+        int32_t val;
+        row.GetInt32(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::INT64:
+      {
+        int64_t val;
+        row.GetInt64(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::UNIXTIME_MICROS:
+      {
+        int64_t val;
+        row.GetUnixTimeMicros(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::BOOL:
+      {
+        bool val;
+        row.GetBool(i, &val);
+        Put<uint8_t>(out, val);
+        break;
+      }
+      case KuduColumnSchema::FLOAT:
+      {
+        float val;
+        row.GetFloat(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::DOUBLE:
+      {
+        double val;
+        row.GetDouble(i, &val);
+        Put(out, val);
+        break;
+      }
+      case KuduColumnSchema::STRING:
+      case KuduColumnSchema::BINARY:
+      {
+        Slice val;
+        if (type == KuduColumnSchema::STRING) {
+          row.GetString(i, &val);
+        } else {
+          row.GetBinary(i, &val);
+        }
+        Put<uint32_t>(out, val.size());
+        out->append(reinterpret_cast<const char*>(val.data()), val.size());
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  memcpy(&(*out)[countPos], &count, sizeof(count));
+  return Status::OK();
+}
+
+Status DecodeRow(const uint8_t* data, size_t length, const KuduSchema& schema, KuduPartialRow* row) {
+  const uint8_t* end = data + length;
+  uint16_t count;
+  if (!Take(&data, end, &count)) {
+    return Status::Corruption("Truncated row");
+  }
+  for (uint16_t c = 0; c < count; c++) {
+    uint16_t idx;
+    uint8_t isNull;
+    if (!Take(&data, end, &idx) || !Take(&data, end, &isNull) || idx >= schema.num_columns()) {
+      return Status::Corruption("Invalid encoded row");
+    }
+    if (isNull) {
+      KUDU_RETURN_NOT_OK(row->SetNull(idx));
+      continue;
+    }
+    bool ok = true;
+    switch (schema.Column(idx).type()) {
+      case KuduColumnSchema::INT8:
+      {
+        int8_t val;
+        ok = Take(&data, end, &val) && row->SetInt8(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::INT16:
+      {
+        int16_t val;
+        ok = Take(&data, end, &val) && row->SetInt16(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::INT32:
+      {
+        int32_t val;
+        ok = Take(&data, end, &val) && row->SetInt32(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::INT64:
+      {
+        int64_t val;
+        ok = Take(&data, end, &val) && row->SetInt64(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::UNIXTIME_MICROS:
+      {
+        int64_t val;
+        ok = Take(&data, end, &val) && row->SetUnixTimeMicros(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::BOOL:
+      {
+        uint8_t val;
+        ok = Take(&data, end, &val) && row->SetBool(idx, val != 0).ok();
+        break;
+      }
+      case KuduColumnSchema::FLOAT:
+      {
+        float val;
+        ok = Take(&data, end, &val) && row->SetFloat(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::DOUBLE:
+      {
+        double val;
+        ok = Take(&data, end, &val) && row->SetDouble(idx, val).ok();
+        break;
+      }
+      case KuduColumnSchema::STRING:
+      case KuduColumnSchema::BINARY:
+      {
+        uint32_t size;
+        ok = Take(&data, end, &size) && end - data >= static_cast<ptrdiff_t>(size);
+        if (ok) {
+          Slice val(data, size);
+          data += size;
+          ok = schema.Column(idx).type() == KuduColumnSchema::STRING ?
+              row->SetString(idx, val).ok() : row->SetBinary(idx, val).ok();
+        }
+        break;
+      }
+      default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+      return Status::Corruption("Encoded row does not match the table schema");
+    }
+  }
+  return Status::OK();
+}
+
+uint32_t SchemaFingerprint(const KuduSchema& schema) {
+  string description;
+  for (int i = 0, l = schema.num_columns(); i < l; i++) {
+    KuduColumnSchema col = schema.Column(i);
+    Put<uint32_t>(&description, col.name().size());
+    description.append(col.name());
+    Put<uint8_t>(&description, col.type());
+    Put<uint8_t>(&description, col.is_nullable());
+  }
+  return Crc32c(reinterpret_cast<const uint8_t*>(description.data()), description.size());
+}
+
+struct Crc32cTable {
+  uint32_t entries[256];
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; k++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+uint32_t Crc32c(const uint8_t* data, size_t length) {
+  static const Crc32cTable table;
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFF;
+}
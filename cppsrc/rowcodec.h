@@ -0,0 +1,39 @@
+#ifndef KUDUJS_ROWCODEC_H
+#define KUDUJS_ROWCODEC_H
+
+#include <string>
+#include <kudu/client/client.h>
+#include <kudu/client/write_op.h>
+#include <kudu/common/partial_row.h>
+
+using std::string;
+using kudu::KuduPartialRow;
+using kudu::Status;
+using kudu::client::KuduSchema;
+using kudu::client::KuduTable;
+using kudu::client::KuduWriteOperation;
+
+// Operation codes as exported to JS in kudujs.Operation.
+enum KOperation {
+  K_INSERT = 0,
+  K_UPDATE = 1,
+  K_UPSERT = 2,
+  K_DELETE = 3
+};
+
+KuduWriteOperation* NewOperation(KuduTable* table, int operation);
+
+// Compact binary encoding of the columns set in a KuduPartialRow. Columns are
+// addressed by index, so decoding needs the same table schema; store a
+// SchemaFingerprint next to rows that may outlive it. DECIMAL cells are not
+// supported, a row with one set returns NotSupported and appends nothing.
+Status EncodeRow(const KuduPartialRow& row, const KuduSchema& schema, string* out);
+Status DecodeRow(const uint8_t* data, size_t length, const KuduSchema& schema, KuduPartialRow* row);
+
+// Checksum of the column names, types and nullability of a schema, which
+// changes with any ALTER TABLE that would make encoded rows decode wrongly.
+uint32_t SchemaFingerprint(const KuduSchema& schema);
+
+uint32_t Crc32c(const uint8_t* data, size_t length);
+
+#endif
@@ -0,0 +1,245 @@
+#include "rowmaterializer.h"
+
+#include <cstring>
+
+template <typename T>
+static T CellValue(const ColumnarBatch::Column& col, int64_t row) {
+  T val;
+  memcpy(&val, col.values.data() + row * sizeof(T), sizeof(T));
+  return val;
+}
+
+static napi_value ReadInt8(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_create_int32(env, CellValue<int8_t>(col, row), &result);
+  return result;
+}
+
+static napi_value ReadInt16(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_create_int32(env, CellValue<int16_t>(col, row), &result);
+  return result;
+}
+
+static napi_value ReadInt32(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_create_int32(env, CellValue<int32_t>(col, row), &result);
+  return result;
+}
+
+static napi_value ReadInt64(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_create_int64(env, CellValue<int64_t>(col, row), &result);
+  return result;
+}
+
+static napi_value ReadFloat(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_create_double(env, CellValue<float>(col, row), &result);
+  return result;
+}
+
+static napi_value ReadDouble(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_create_double(env, CellValue<double>(col, row), &result);
+  return result;
+}
+
+static napi_value ReadBool(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  napi_get_boolean(env, (col.values[row >> 3] & (1 << (row & 7))) != 0, &result);
+  return result;
+}
+
+static napi_value ReadBytes(napi_env env, const ColumnarBatch::Column& col, int64_t row) {
+  napi_value result;
+  int32_t start = col.offsets[row];
+  napi_create_string_utf8(env, col.values.data() + start, col.offsets[row + 1] - start, &result);
+  return result;
+}
+
+static napi_value ReadNull(napi_env env, const ColumnarBatch::Column&, int64_t) {
+  napi_value result;
+  napi_get_null(env, &result);
+  return result;
+}
+
+RowMaterializer::CellReader RowMaterializer::ReaderFor(KuduColumnSchema::DataType type) {
+  switch (type) {
+    case KuduColumnSchema::INT8:
+      return ReadInt8;
+    case KuduColumnSchema::INT16:
+      return ReadInt16;
+    case KuduColumnSchema::INT32:
+      return ReadInt32;
+    case KuduColumnSchema::INT64:
+    case KuduColumnSchema::UNIXTIME_MICROS:
+      return ReadInt64;
+    case KuduColumnSchema::FLOAT:
+      return ReadFloat;
+    case KuduColumnSchema::DOUBLE:
+      return ReadDouble;
+    case KuduColumnSchema::BOOL:
+      return ReadBool;
+    case KuduColumnSchema::STRING:
+    case KuduColumnSchema::BINARY:
+      return ReadBytes;
+    default:
+      return ReadNull;
+  }
+}
+
+// Dictionaries larger than this, or with more than one distinct value per
+// two rows, cost more than the duplicate strings they would save.
+static const size_t kMaxDictionaryEntries = 1 << 16;
+static const double kMaxDictionaryRatio = 0.5;
+
+RowMaterializer::RowMaterializer(Napi::Env env, const ColumnarBatch& shape, Layout layout, bool dictionary)
+    : env_(env), layout_(layout) {
+  this->rows_ = Napi::Array::New(env, shape.num_rows());
+  this->next_ = 0;
+  napi_get_null(env, &this->null_);
+
+  const vector<ColumnarBatch::Column>& cols = shape.columns();
+  for (size_t c = 0; c < cols.size(); c++) {
+    if (cols[c].type == KuduColumnSchema::DECIMAL) {
+      continue;
+    }
+    ColumnPlan plan;
+    plan.column = c;
+    plan.key = Napi::String::New(env, cols[c].name);
+    plan.read = ReaderFor(cols[c].type);
+    if (dictionary && cols[c].type == KuduColumnSchema::STRING) {
+      plan.dictionary.reset(new StringDictionary(kMaxDictionaryEntries, kMaxDictionaryRatio));
+    }
+    if (layout == COLUMNS) {
+      plan.values = Napi::Array::New(env, shape.num_rows());
+    }
+
+    napi_property_descriptor property;
+    memset(&property, 0, sizeof(property));
+    property.name = plan.key;
+    property.attributes = static_cast<napi_property_attributes>(napi_writable | napi_enumerable | napi_configurable);
+    this->properties_.push_back(property);
+    this->plan_.push_back(std::move(plan));
+  }
+}
+
+napi_value RowMaterializer::DictionaryString(ColumnPlan* plan, uint32_t code) {
+  if (code == StringDictionary::kNullCode) {
+    return this->null_;
+  }
+  if (plan->strings.size() <= code) {
+    plan->strings.resize(code + 1, NULL);
+  }
+  if (plan->strings[code] == NULL) {
+    const string& value = plan->dictionary->values()[code];
+    napi_create_string_utf8(this->env_, value.data(), value.size(), &plan->strings[code]);
+  }
+  return plan->strings[code];
+}
+
+napi_value RowMaterializer::Cell(const ColumnarBatch& batch, size_t column, int64_t row, size_t codeBase) {
+  ColumnPlan& plan = this->plan_[column];
+  if (plan.dictionary) {
+    return DictionaryString(&plan, plan.dictionary->codes()[codeBase + row]);
+  }
+  if (batch.IsNull(plan.column, row)) {
+    return this->null_;
+  }
+  return plan.read(this->env_, batch.columns()[plan.column], row);
+}
+
+void RowMaterializer::DropDictionary(size_t column) {
+  ColumnPlan& plan = this->plan_[column];
+  if (this->layout_ == COLUMNS) {
+    // Rows already encoded move over to the plain value array.
+    const vector<uint32_t>& codes = plan.dictionary->codes();
+    for (size_t i = 0; i < codes.size(); i++) {
+      napi_set_element(this->env_, plan.values, i, DictionaryString(&plan, codes[i]));
+    }
+  }
+  plan.dictionary.reset();
+  plan.strings.clear();
+}
+
+void RowMaterializer::Append(const ColumnarBatch& batch) {
+  size_t n = this->plan_.size();
+  size_t base = this->next_;
+  for (size_t c = 0; c < n; c++) {
+    if (this->plan_[c].dictionary && !this->plan_[c].dictionary->Encode(batch, this->plan_[c].column)) {
+      DropDictionary(c);
+    }
+  }
+
+  if (this->layout_ == COLUMNS) {
+    for (size_t c = 0; c < n; c++) {
+      if (this->plan_[c].dictionary) {
+        continue;
+      }
+      for (int64_t r = 0; r < batch.num_rows(); r++) {
+        napi_set_element(this->env_, this->plan_[c].values, base + r, Cell(batch, c, r, base));
+      }
+    }
+    this->next_ += batch.num_rows();
+    return;
+  }
+
+  for (int64_t r = 0; r < batch.num_rows(); r++) {
+    napi_value row;
+    if (this->layout_ == OBJECTS) {
+      for (size_t c = 0; c < n; c++) {
+        this->properties_[c].value = Cell(batch, c, r, base);
+      }
+      napi_create_object(this->env_, &row);
+      napi_define_properties(this->env_, row, n, this->properties_.data());
+    } else {
+      napi_create_array_with_length(this->env_, n, &row);
+      for (size_t c = 0; c < n; c++) {
+        napi_set_element(this->env_, row, c, Cell(batch, c, r, base));
+      }
+    }
+    napi_set_element(this->env_, this->rows_, this->next_++, row);
+  }
+}
+
+Napi::Value RowMaterializer::Result() {
+  if (this->layout_ == OBJECTS) {
+    return this->rows_;
+  }
+  Napi::Object result = Napi::Object::New(this->env_);
+  if (this->layout_ == TUPLES) {
+    Napi::Array names = Napi::Array::New(this->env_, this->plan_.size());
+    for (size_t c = 0; c < this->plan_.size(); c++) {
+      names.Set(static_cast<uint32_t>(c), this->plan_[c].key);
+    }
+    result.Set("columns", names);
+    result.Set("rows", this->rows_);
+    return result;
+  }
+
+  Napi::Object columns = Napi::Object::New(this->env_);
+  for (ColumnPlan& plan : this->plan_) {
+    if (!plan.dictionary) {
+      columns.Set(plan.key, plan.values);
+      continue;
+    }
+    const vector<uint32_t>& codes = plan.dictionary->codes();
+    Napi::Uint32Array codeArray = Napi::Uint32Array::New(this->env_, codes.size());
+    if (!codes.empty()) {
+      memcpy(codeArray.Data(), codes.data(), codes.size() * sizeof(uint32_t));
+    }
+    size_t entries = plan.dictionary->values().size();
+    Napi::Array dictionary = Napi::Array::New(this->env_, entries);
+    for (size_t i = 0; i < entries; i++) {
+      dictionary.Set(static_cast<uint32_t>(i), Napi::Value(this->env_, DictionaryString(&plan, i)));
+    }
+    Napi::Object column = Napi::Object::New(this->env_);
+    column.Set("codes", codeArray);
+    column.Set("dictionary", dictionary);
+    columns.Set(plan.key, column);
+  }
+  result.Set("rowCount", static_cast<double>(this->next_));
+  result.Set("columns", columns);
+  return result;
+}
@@ -0,0 +1,59 @@
+#ifndef KUDUJS_ROWMATERIALIZER_H
+#define KUDUJS_ROWMATERIALIZER_H
+
+#include <memory>
+#include <napi.h>
+#include "columnarbatch.h"
+#include "stringdictionary.h"
+
+// Converts columnar scan results to JS values following a plan computed once
+// per scan: the column keys are created a single time and reused for every
+// row, and each column gets a reader picked by type up front.
+//
+// OBJECTS builds one object per row and always defines every column, nulls
+// included, in projection order and in a single call, so all rows share one
+// hidden class. TUPLES returns { columns: [names], rows: [[values]] } instead.
+// COLUMNS returns { rowCount, columns: { name: values } } with one array per
+// column.
+//
+// With dictionary set, STRING columns are dictionary encoded: equal values
+// share a single JS string, and in the COLUMNS layout the column comes back as
+// { codes: Uint32Array, dictionary: [strings] } with 0xFFFFFFFF for nulls.
+// Columns with too many distinct values silently stay plain.
+//
+// DECIMAL columns are left out of every layout, as scanRow always did.
+class RowMaterializer {
+ public:
+  enum Layout { OBJECTS, TUPLES, COLUMNS };
+
+  RowMaterializer(Napi::Env env, const ColumnarBatch& shape, Layout layout, bool dictionary);
+  void Append(const ColumnarBatch& batch);
+  Napi::Value Result();
+
+ private:
+  typedef napi_value (*CellReader)(napi_env env, const ColumnarBatch::Column& col, int64_t row);
+
+  struct ColumnPlan {
+    size_t column; // index in the batch
+    Napi::String key;
+    CellReader read;
+    std::unique_ptr<StringDictionary> dictionary; // NULL for plain columns
+    vector<napi_value> strings; // JS value per dictionary code, made on first use
+    Napi::Array values; // COLUMNS layout, plain columns only
+  };
+
+  Napi::Env env_;
+  Layout layout_;
+  Napi::Array rows_;
+  uint32_t next_;
+  napi_value null_;
+  vector<ColumnPlan> plan_;
+  vector<napi_property_descriptor> properties_; // keys fixed, values refilled per row
+
+  napi_value Cell(const ColumnarBatch& batch, size_t column, int64_t row, size_t codeBase);
+  napi_value DictionaryString(ColumnPlan* plan, uint32_t code);
+  void DropDictionary(size_t column);
+  static CellReader ReaderFor(KuduColumnSchema::DataType type);
+};
+
+#endif
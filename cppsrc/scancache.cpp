@@ -0,0 +1,140 @@
+#include "scancache.h"
+#include "memtracker.h"
+
+#include <algorithm>
+#include <chrono>
+
+ScanCache::ScanCache() {
+  this->options_.maxBytes = 0;
+  this->options_.ttlMillis = 0;
+  this->bytes_ = 0;
+  this->metrics_ = ScanCacheMetrics();
+}
+
+void ScanCache::Configure(const ScanCacheOptions& options) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->options_ = options;
+  while (!this->lru_.empty() && this->bytes_ > this->options_.maxBytes) {
+    Erase(std::prev(this->lru_.end()));
+    this->metrics_.evictions++;
+  }
+}
+
+bool ScanCache::enabled() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->options_.maxBytes > 0;
+}
+
+string ScanCache::Key(const string& tableName, const vector<KPredicate>& predicates, const vector<string>& projection) {
+  // Conjunctions are order independent, so the predicates are sorted to make
+  // equivalent scans share an entry. Projection order shapes the result and
+  // is kept as given.
+  vector<string> terms;
+  for (const KPredicate& predicate : predicates) {
+    terms.push_back(predicate.ToString());
+  }
+  std::sort(terms.begin(), terms.end());
+
+  string key = tableName;
+  key.push_back('\0');
+  for (const string& term : terms) {
+    key.append(term);
+    key.push_back('\0');
+  }
+  key.push_back('\0');
+  for (const string& column : projection) {
+    key.append(column);
+    key.push_back('\0');
+  }
+  return key;
+}
+
+uint64_t ScanCache::Generation(const string& tableName) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->generations_[tableName];
+}
+
+std::shared_ptr<const ColumnarBatch> ScanCache::Get(const string& key, const string& tableName) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  auto found = this->index_.find(key);
+  if (found == this->index_.end()) {
+    this->metrics_.misses++;
+    return NULL;
+  }
+  std::list<Entry>::iterator it = found->second;
+  if ((it->expires > 0 && it->expires <= NowMillis()) || it->generation != this->generations_[tableName]) {
+    Erase(it);
+    this->metrics_.misses++;
+    return NULL;
+  }
+  this->lru_.splice(this->lru_.begin(), this->lru_, it);
+  this->metrics_.hits++;
+  return it->batch;
+}
+
+void ScanCache::Put(const string& key, const string& tableName, uint64_t generation, const std::shared_ptr<const ColumnarBatch>& batch) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  size_t bytes = batch->ByteSize() + key.size();
+  if (bytes > this->options_.maxBytes || generation != this->generations_[tableName]) {
+    return;
+  }
+  auto found = this->index_.find(key);
+  if (found != this->index_.end()) {
+    Erase(found->second);
+  }
+  // The cache never waits for memory, it just skips entries that do not fit.
+  if (!MemoryTracker::Global()->TryConsume(MemoryTracker::SCAN_CACHE, bytes).ok()) {
+    return;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.tableName = tableName;
+  entry.generation = generation;
+  entry.expires = this->options_.ttlMillis > 0 ? NowMillis() + this->options_.ttlMillis : 0;
+  entry.bytes = bytes;
+  entry.batch = batch;
+  this->lru_.push_front(entry);
+  this->index_[key] = this->lru_.begin();
+  this->bytes_ += bytes;
+
+  while (this->bytes_ > this->options_.maxBytes) {
+    Erase(std::prev(this->lru_.end()));
+    this->metrics_.evictions++;
+  }
+}
+
+void ScanCache::Invalidate(const string& tableName) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->generations_[tableName]++;
+  // Stale entries would be skipped by the generation check anyway; dropping
+  // them here just returns their memory to the budget straight away.
+  for (auto it = this->lru_.begin(); it != this->lru_.end();) {
+    auto next = std::next(it);
+    if (it->tableName == tableName) {
+      Erase(it);
+      this->metrics_.invalidations++;
+    }
+    it = next;
+  }
+}
+
+ScanCacheMetrics ScanCache::metrics() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  ScanCacheMetrics metrics = this->metrics_;
+  metrics.entries = this->lru_.size();
+  metrics.bytes = this->bytes_;
+  return metrics;
+}
+
+void ScanCache::Erase(std::list<Entry>::iterator it) {
+  MemoryTracker::Global()->Release(MemoryTracker::SCAN_CACHE, it->bytes);
+  this->bytes_ -= it->bytes;
+  this->index_.erase(it->key);
+  this->lru_.erase(it);
+}
+
+int64_t ScanCache::NowMillis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,66 @@
+#ifndef KUDUJS_SCANCACHE_H
+#define KUDUJS_SCANCACHE_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "kuduclass.h"
+#include "columnarbatch.h"
+
+struct ScanCacheOptions {
+  size_t maxBytes; // 0 disables the cache
+  int ttlMillis; // 0 keeps entries until they are evicted or invalidated
+};
+
+struct ScanCacheMetrics {
+  int64_t hits;
+  int64_t misses;
+  int64_t evictions;
+  int64_t invalidations;
+  int64_t entries;
+  int64_t bytes;
+};
+
+// In-process LRU cache of scan results in columnar form, keyed by table,
+// normalized predicates and projection.
+//
+// Every table has a write generation that is bumped by writes issued through
+// this client. A scan records the generation it started at, so a result that
+// raced with a write is never served after it.
+class ScanCache {
+ public:
+  ScanCache();
+  void Configure(const ScanCacheOptions& options);
+  bool enabled();
+  static string Key(const string& tableName, const vector<KPredicate>& predicates, const vector<string>& projection);
+  uint64_t Generation(const string& tableName);
+  std::shared_ptr<const ColumnarBatch> Get(const string& key, const string& tableName);
+  void Put(const string& key, const string& tableName, uint64_t generation, const std::shared_ptr<const ColumnarBatch>& batch);
+  void Invalidate(const string& tableName);
+  ScanCacheMetrics metrics();
+
+ private:
+  struct Entry {
+    string key;
+    string tableName;
+    uint64_t generation;
+    int64_t expires; // steady clock millis, 0 for no TTL
+    size_t bytes;
+    std::shared_ptr<const ColumnarBatch> batch;
+  };
+
+  std::mutex mutex_;
+  ScanCacheOptions options_;
+  std::list<Entry> lru_; // most recently used first
+  std::unordered_map<string, std::list<Entry>::iterator> index_;
+  std::map<string, uint64_t> generations_;
+  size_t bytes_;
+  ScanCacheMetrics metrics_;
+
+  void Erase(std::list<Entry>::iterator it);
+  static int64_t NowMillis();
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "scanplan.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+using kudu::client::KuduReplica;
+using kudu::client::KuduScanBatch;
+using kudu::client::KuduScanner;
+using kudu::client::KuduScanToken;
+using kudu::client::KuduTableStatistics;
+
+static string Hex(const string& bytes) {
+  static const char digits[] = "0123456789abcdef";
+  string out;
+  for (unsigned char c : bytes) {
+    out.push_back(digits[c >> 4]);
+    out.push_back(digits[c & 15]);
+  }
+  return out;
+}
+
+static bool ReadVarint(const string& data, size_t* pos, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < data.size(); shift += 7) {
+    uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The client API has no accessor for a token's partition bounds, so they are
+// read from its serialized ScanTokenPB, where lower_bound_partition_key and
+// upper_bound_partition_key are fields 7 and 8. Anything malformed leaves the
+// bounds empty.
+static void ReadPartitionBounds(const string& token, string* lower, string* upper) {
+  size_t pos = 0;
+  while (pos < token.size()) {
+    uint64_t tag;
+    uint64_t value;
+    if (!ReadVarint(token, &pos, &tag)) {
+      return;
+    }
+    switch (tag & 7) {
+      case 0:
+        if (!ReadVarint(token, &pos, &value)) {
+          return;
+        }
+        break;
+      case 1:
+        pos += 8;
+        break;
+      case 5:
+        pos += 4;
+        break;
+      case 2:
+        if (!ReadVarint(token, &pos, &value) || value > token.size() - pos) {
+          return;
+        }
+        if ((tag >> 3) == 7) {
+          *lower = token.substr(pos, value);
+        } else if ((tag >> 3) == 8) {
+          *upper = token.substr(pos, value);
+        }
+        pos += value;
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+static string Address(const KuduReplica* replica) {
+  return replica->ts().hostname() + ":" + std::to_string(replica->ts().port());
+}
+
+static Status ExecuteToken(KuduScanToken* token, TabletPlan* tablet) {
+  auto start = std::chrono::steady_clock::now();
+  KuduScanner* raw;
+  KUDU_RETURN_NOT_OK(token->IntoKuduScanner(&raw));
+  std::unique_ptr<KuduScanner> scanner(raw);
+  KUDU_RETURN_NOT_OK(scanner->Open());
+  KuduScanBatch batch;
+  while (scanner->HasMoreRows()) {
+    KUDU_RETURN_NOT_OK(scanner->NextBatch(&batch));
+    tablet->rows += batch.NumRows();
+    tablet->bytes += batch.direct_data().size() + batch.indirect_data().size();
+  }
+  tablet->metrics = scanner->GetResourceMetrics().Get();
+  tablet->millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  return Status::OK();
+}
+
+Status ExplainScan(const shared_ptr<KuduClient>& client, const shared_ptr<KuduTable>& table,
+                   const vector<KPredicate>& predicates, const vector<string>& projection,
+                   bool execute, ScanPlan* plan) {
+  vector<KuduScanToken*> tokens;
+  vector<KuduScanToken*> allTokens;
+  Status s = BuildScanTokens(table, predicates, projection, &tokens);
+  if (s.ok()) {
+    s = BuildScanTokens(table, vector<KPredicate>(), projection, &allTokens);
+  }
+  auto release = [&tokens, &allTokens]() {
+    for (KuduScanToken* token : tokens) {
+      delete token;
+    }
+    for (KuduScanToken* token : allTokens) {
+      delete token;
+    }
+  };
+  if (!s.ok()) {
+    release();
+    return s;
+  }
+
+  plan->tablets = tokens.size();
+  plan->totalTablets = allTokens.size();
+  plan->executed = execute;
+  for (KuduScanToken* token : tokens) {
+    TabletPlan tablet = TabletPlan();
+    tablet.id = token->tablet().id();
+    for (const KuduReplica* replica : token->tablet().replicas()) {
+      tablet.replicas.push_back(Address(replica));
+      if (replica->is_leader()) {
+        tablet.leader = Address(replica);
+      }
+    }
+    if (!tablet.leader.empty() &&
+        std::find(plan->servers.begin(), plan->servers.end(), tablet.leader) == plan->servers.end()) {
+      plan->servers.push_back(tablet.leader);
+    }
+    string serialized;
+    if (token->Serialize(&serialized).ok()) {
+      string lower;
+      string upper;
+      ReadPartitionBounds(serialized, &lower, &upper);
+      tablet.lowerKey = Hex(lower);
+      tablet.upperKey = Hex(upper);
+    }
+    plan->tabletPlans.push_back(tablet);
+  }
+
+  // Statistics are only kept by recent masters; without them there is no
+  // estimate rather than an error.
+  plan->estimatedBytes = -1;
+  plan->estimatedRows = -1;
+  KuduTableStatistics* raw = NULL;
+  if (client->GetTableStatistics(table->name(), &raw).ok() && raw != NULL) {
+    std::unique_ptr<KuduTableStatistics> statistics(raw);
+    double share = plan->totalTablets > 0 ? static_cast<double>(plan->tablets) / plan->totalTablets : 0;
+    if (statistics->on_disk_size() >= 0) {
+      plan->estimatedBytes = static_cast<int64_t>(statistics->on_disk_size() * share);
+    }
+    if (statistics->live_row_count() >= 0) {
+      plan->estimatedRows = static_cast<int64_t>(statistics->live_row_count() * share);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; execute && s.ok() && i < tokens.size(); i++) {
+    s = ExecuteToken(tokens[i], &plan->tabletPlans[i]);
+  }
+  plan->millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  release();
+  return s;
+}
@@ -0,0 +1,39 @@
+#ifndef KUDUJS_SCANPLAN_H
+#define KUDUJS_SCANPLAN_H
+
+#include <map>
+#include "kuduclass.h"
+
+struct TabletPlan {
+  string id;
+  string leader; // host:port, empty when unknown
+  vector<string> replicas; // host:port of every replica
+  string lowerKey; // partition key bounds in hex, empty when unbounded
+  string upperKey;
+  // Only filled in when the scan is executed.
+  int64_t rows;
+  int64_t bytes;
+  double millis;
+  std::map<string, int64_t> metrics; // the scanner's resource metrics
+};
+
+struct ScanPlan {
+  int64_t tablets; // left after partition pruning
+  int64_t totalTablets;
+  vector<string> servers; // tablet servers holding a leader to scan
+  int64_t estimatedBytes; // -1 without table statistics
+  int64_t estimatedRows;
+  bool executed;
+  double millis; // whole execution
+  vector<TabletPlan> tabletPlans;
+};
+
+// Builds the scan tokens for the predicates and projection and describes the
+// tablets they would read. Estimates scale the table statistics by the share
+// of tablets left after pruning. When execute is set every token is also
+// scanned, one after the other, recording what each returned.
+Status ExplainScan(const shared_ptr<KuduClient>& client, const shared_ptr<KuduTable>& table,
+                   const vector<KPredicate>& predicates, const vector<string>& projection,
+                   bool execute, ScanPlan* plan);
+
+#endif
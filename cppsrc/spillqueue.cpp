@@ -0,0 +1,490 @@
+#include "spillqueue.h"
+#include "rowcodec.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using kudu::client::KuduDelete;
+using kudu::client::KuduError;
+using kudu::client::KuduSession;
+
+static const char kSegmentMagic[8] = { 'K', 'J', 'S', 'S', 'P', 'I', 'L', 'L' };
+static const uint32_t kSegmentVersion = 2;
+static const size_t kSegmentHeaderBytes = 16;
+static const size_t kRecordHeaderBytes = 8;
+static const int kReplayBatchRows = 1000;
+
+// Returns the payload of the record at *pos and advances past it, or false at
+// the end of the written part of the segment.
+static bool NextRecord(const uint8_t* data, size_t size, size_t* pos, const uint8_t** payload, uint32_t* length) {
+  if (size - *pos < kRecordHeaderBytes) {
+    return false;
+  }
+  uint32_t crc;
+  memcpy(length, data + *pos, sizeof(uint32_t));
+  memcpy(&crc, data + *pos + 4, sizeof(uint32_t));
+  if (*length == 0 || size - *pos - kRecordHeaderBytes < *length) {
+    return false;
+  }
+  *payload = data + *pos + kRecordHeaderBytes;
+  if (Crc32c(*payload, *length) != crc) {
+    return false;
+  }
+  *pos += kRecordHeaderBytes + *length;
+  return true;
+}
+
+static string SegmentPath(const string& directory, int64_t seq) {
+  return directory + "/spill-" + std::to_string(seq) + ".log";
+}
+
+static string QuarantinePath(const string& directory, int64_t seq) {
+  return directory + "/quarantine-" + std::to_string(seq) + ".log";
+}
+
+SpillQueue::SpillQueue(const shared_ptr<KuduClient>& client, const SpillOptions& options)
+    : client_(client), options_(options) {
+  this->activeFd_ = -1;
+  this->activeMap_ = NULL;
+  this->activeOffset_ = 0;
+  this->nextSeq_ = 0;
+  this->stopping_ = false;
+  this->metrics_ = SpillMetrics();
+}
+
+SpillQueue::~SpillQueue() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->stopping_ = true;
+  }
+  this->wakeup_.notify_all();
+  if (this->replayer_.joinable()) {
+    this->replayer_.join();
+  }
+  // Whatever is left on disk is picked up by the next process that opens the
+  // queue with replayOnStartup.
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  SealSegment();
+}
+
+bool SpillQueue::IsRetryable(const Status& s) {
+  return s.IsTimedOut() || s.IsServiceUnavailable() || s.IsNetworkError() ||
+      s.IsAborted() || s.IsIncomplete();
+}
+
+Status SpillQueue::Open() {
+  if (this->options_.segmentBytes <= kSegmentHeaderBytes + kRecordHeaderBytes) {
+    return Status::InvalidArgument("Spill segment size is too small");
+  }
+  if (mkdir(this->options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    return Status::IOError("Unable to create spill directory " + this->options_.directory, strerror(errno), errno);
+  }
+  DIR* dir = opendir(this->options_.directory.c_str());
+  if (dir == NULL) {
+    return Status::IOError("Unable to open spill directory " + this->options_.directory, strerror(errno), errno);
+  }
+  vector<int64_t> seqs;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    long long seq;
+    char suffix[8];
+    if (sscanf(entry->d_name, "spill-%lld.%7s", &seq, suffix) == 2 && strcmp(suffix, "log") == 0) {
+      seqs.push_back(seq);
+    }
+  }
+  closedir(dir);
+  std::sort(seqs.begin(), seqs.end());
+  if (!seqs.empty()) {
+    this->nextSeq_ = seqs.back() + 1;
+  }
+
+  // Segments from a previous process are left untouched unless asked to
+  // replay them, new segments never reuse their sequence numbers.
+  for (size_t i = 0; this->options_.replayOnStartup && i < seqs.size(); i++) {
+    Segment segment;
+    segment.seq = seqs[i];
+    segment.path = SegmentPath(this->options_.directory, seqs[i]);
+    segment.replayOffset = kSegmentHeaderBytes;
+    int fd = open(segment.path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      KUDU_LOG(WARNING) << "Skipping unreadable spill segment " << segment.path;
+      continue;
+    }
+    segment.size = st.st_size;
+    void* map = segment.size > 0 ? mmap(NULL, segment.size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+      KUDU_LOG(WARNING) << "Skipping unreadable spill segment " << segment.path;
+      continue;
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(map);
+    uint32_t version = 0;
+    if (segment.size >= kSegmentHeaderBytes) {
+      memcpy(&version, data + sizeof(kSegmentMagic), sizeof(version));
+    }
+    // Earlier versions carry no schema fingerprint, so they are left on disk.
+    if (segment.size < kSegmentHeaderBytes || memcmp(data, kSegmentMagic, sizeof(kSegmentMagic)) != 0 ||
+        version != kSegmentVersion) {
+      munmap(map, segment.size);
+      KUDU_LOG(WARNING) << "Skipping spill segment with a bad header " << segment.path;
+      continue;
+    }
+    size_t end;
+    segment.rows = CountRecords(data, segment.size, &end);
+    munmap(map, segment.size);
+    this->metrics_.pendingRows += segment.rows;
+    this->metrics_.diskBytes += segment.size;
+    this->metrics_.segments++;
+    this->sealed_.push_back(segment);
+  }
+
+  this->replayer_ = std::thread(&SpillQueue::ReplayLoop, this);
+  return Status::OK();
+}
+
+int64_t SpillQueue::CountRecords(const uint8_t* data, size_t size, size_t* end) {
+  int64_t rows = 0;
+  size_t pos = kSegmentHeaderBytes;
+  const uint8_t* payload;
+  uint32_t length;
+  while (NextRecord(data, size, &pos, &payload, &length)) {
+    rows++;
+  }
+  *end = pos;
+  return rows;
+}
+
+Status SpillQueue::OpenSegment() {
+  if (this->metrics_.diskBytes + this->options_.segmentBytes > this->options_.maxDiskBytes) {
+    return Status::IOError("Spill queue disk quota reached");
+  }
+  this->active_.seq = this->nextSeq_++;
+  this->active_.path = SegmentPath(this->options_.directory, this->active_.seq);
+  this->active_.size = this->options_.segmentBytes;
+  this->active_.replayOffset = kSegmentHeaderBytes;
+  this->active_.rows = 0;
+
+  int fd = open(this->active_.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Status::IOError("Unable to create spill segment " + this->active_.path, strerror(errno), errno);
+  }
+  // The file is sized up front so that appends are plain memory writes; the
+  // unwritten tail stays sparse and reads back as zeroes.
+  void* map = MAP_FAILED;
+  if (ftruncate(fd, this->options_.segmentBytes) == 0) {
+    map = mmap(NULL, this->options_.segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (map == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    unlink(this->active_.path.c_str());
+    return Status::IOError("Unable to map spill segment " + this->active_.path, strerror(err), err);
+  }
+  this->activeFd_ = fd;
+  this->activeMap_ = static_cast<uint8_t*>(map);
+  memcpy(this->activeMap_, kSegmentMagic, sizeof(kSegmentMagic));
+  memcpy(this->activeMap_ + sizeof(kSegmentMagic), &kSegmentVersion, sizeof(kSegmentVersion));
+  this->activeOffset_ = kSegmentHeaderBytes;
+  this->metrics_.diskBytes += this->options_.segmentBytes;
+  this->metrics_.segments++;
+  return Status::OK();
+}
+
+void SpillQueue::SealSegment() {
+  if (this->activeFd_ < 0) {
+    return;
+  }
+  msync(this->activeMap_, this->activeOffset_, MS_SYNC);
+  munmap(this->activeMap_, this->options_.segmentBytes);
+  // Trimming the sparse tail keeps the quota accounting honest for sealed
+  // segments; the end of the file marks the end of the records.
+  if (ftruncate(this->activeFd_, this->activeOffset_) != 0) {
+    KUDU_LOG(WARNING) << "Unable to trim spill segment " << this->active_.path;
+  }
+  close(this->activeFd_);
+  this->activeFd_ = -1;
+  this->activeMap_ = NULL;
+  this->metrics_.diskBytes -= this->options_.segmentBytes;
+
+  if (this->active_.rows == 0) {
+    unlink(this->active_.path.c_str());
+    this->metrics_.segments--;
+    return;
+  }
+  this->active_.size = this->activeOffset_;
+  this->metrics_.diskBytes += this->active_.size;
+  this->sealed_.push_back(this->active_);
+}
+
+Status SpillQueue::Append(const string& tableName, const KuduSchema& schema, int operation, const KuduPartialRow& row) {
+  string record(kRecordHeaderBytes, '\0');
+  record.push_back(static_cast<char>(operation));
+  uint16_t tableLength = tableName.size();
+  record.append(reinterpret_cast<const char*>(&tableLength), sizeof(tableLength));
+  record.append(tableName);
+  uint32_t fingerprint = SchemaFingerprint(schema);
+  record.append(reinterpret_cast<const char*>(&fingerprint), sizeof(fingerprint));
+  KUDU_RETURN_NOT_OK(EncodeRow(row, schema, &record));
+
+  uint32_t length = record.size() - kRecordHeaderBytes;
+  uint32_t crc = Crc32c(reinterpret_cast<const uint8_t*>(record.data()) + kRecordHeaderBytes, length);
+  if (kSegmentHeaderBytes + record.size() > this->options_.segmentBytes) {
+    return Status::InvalidArgument("Row is larger than a spill segment");
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->activeFd_ >= 0 && this->activeOffset_ + record.size() > this->options_.segmentBytes) {
+    SealSegment();
+  }
+  if (this->activeFd_ < 0) {
+    Status s = OpenSegment();
+    if (!s.ok()) {
+      this->metrics_.droppedRows++;
+      this->metrics_.lastError = s.ToString();
+      return s;
+    }
+  }
+
+  uint8_t* dest = this->activeMap_ + this->activeOffset_;
+  memcpy(dest + kRecordHeaderBytes, record.data() + kRecordHeaderBytes, length);
+  memcpy(dest + 4, &crc, sizeof(crc));
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(dest, &length, sizeof(length));
+  if (this->options_.sync) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = this->activeOffset_ & ~(page - 1);
+    msync(this->activeMap_ + start, this->activeOffset_ + record.size() - start, MS_SYNC);
+  }
+  this->activeOffset_ += record.size();
+  this->active_.rows++;
+  this->metrics_.spilledRows++;
+  this->metrics_.pendingRows++;
+  return Status::OK();
+}
+
+SpillMetrics SpillQueue::metrics() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->metrics_;
+}
+
+void SpillQueue::ReplayLoop() {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  // Rows only get here once the cluster misbehaved, so the first replay waits
+  // for the initial backoff instead of hammering it straight away.
+  int delay = this->options_.initialBackoffMillis;
+  while (!this->stopping_) {
+    if (delay > 0) {
+      this->wakeup_.wait_for(lock, std::chrono::milliseconds(delay), [this] { return this->stopping_.load(); });
+      if (this->stopping_) {
+        break;
+      }
+    }
+    if (this->sealed_.empty() && this->activeFd_ >= 0 && this->active_.rows > 0) {
+      SealSegment();
+    }
+    if (this->sealed_.empty()) {
+      delay = this->options_.initialBackoffMillis;
+      continue;
+    }
+
+    Segment segment = this->sealed_.front();
+    this->metrics_.replayAttempts++;
+    lock.unlock();
+    Status s = ReplaySegment(&segment);
+    lock.lock();
+
+    // Appends only ever push to the back, so the front is still this segment.
+    this->sealed_.front().replayOffset = segment.replayOffset;
+    if (s.ok()) {
+      unlink(segment.path.c_str());
+      this->metrics_.diskBytes -= segment.size;
+      this->metrics_.segments--;
+      this->sealed_.pop_front();
+      delay = 0;
+    } else {
+      KUDU_LOG(WARNING) << "Spill replay of " << segment.path << " failed: " << s.ToString();
+      this->metrics_.lastError = s.ToString();
+      delay = std::min(this->options_.maxBackoffMillis,
+          delay == 0 ? this->options_.initialBackoffMillis : delay * 2);
+    }
+  }
+}
+
+Status SpillQueue::ReplaySegment(Segment* segment) {
+  int fd = open(segment->path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Status::IOError("Unable to open spill segment " + segment->path, strerror(errno), errno);
+  }
+  void* map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return Status::IOError("Unable to map spill segment " + segment->path, strerror(errno), errno);
+  }
+  madvise(map, segment->size, MADV_SEQUENTIAL);
+  Status s = ApplyRecords(static_cast<const uint8_t*>(map), segment->size, segment);
+  munmap(map, segment->size);
+  return s;
+}
+
+Status SpillQueue::ApplyRecords(const uint8_t* data, size_t size, Segment* segment) {
+  shared_ptr<KuduSession> session = this->client_->NewSession();
+  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::MANUAL_FLUSH));
+  session->SetTimeoutMillis(5000);
+
+  size_t pos = segment->replayOffset;
+  bool more = true;
+  while (more && !this->stopping_) {
+    // Records are applied in chunks and the replay offset only moves past a
+    // chunk once all of it reached the cluster. A retried chunk re-applies rows
+    // that already succeeded, which is why duplicates are tolerated below.
+    size_t chunkEnd = pos;
+    int64_t rows = 0;
+    int64_t failed = 0;
+    std::set<string> touched;
+    vector<std::pair<const uint8_t*, size_t>> quarantined;
+    const uint8_t* payload;
+    uint32_t length;
+    while (rows < kReplayBatchRows && (more = NextRecord(data, size, &chunkEnd, &payload, &length))) {
+      rows++;
+      uint16_t tableLength = 0;
+      if (length >= 3) {
+        memcpy(&tableLength, payload + 1, sizeof(tableLength));
+      }
+      size_t rowStart = 3u + tableLength + sizeof(uint32_t);
+      if (length < rowStart) {
+        failed++;
+        continue;
+      }
+      string tableName(reinterpret_cast<const char*>(payload) + 3, tableLength);
+      uint32_t fingerprint;
+      memcpy(&fingerprint, payload + 3 + tableLength, sizeof(fingerprint));
+      shared_ptr<KuduTable> table;
+      Status s = GetTable(tableName, fingerprint, &table);
+      if (s.IsNotFound()) {
+        failed++;
+        continue;
+      }
+      KUDU_RETURN_NOT_OK(s);
+      if (SchemaFingerprint(table->schema()) != fingerprint) {
+        quarantined.push_back(std::make_pair(payload - kRecordHeaderBytes, kRecordHeaderBytes + length));
+        continue;
+      }
+
+      KuduWriteOperation* op = NewOperation(table.get(), payload[0]);
+      if (op == NULL) {
+        failed++;
+        continue;
+      }
+      s = DecodeRow(payload + rowStart, length - rowStart, table->schema(), op->mutable_row());
+      if (!s.ok()) {
+        delete op;
+        failed++;
+        continue;
+      }
+      KUDU_RETURN_NOT_OK(session->Apply(op));
+      touched.insert(tableName);
+    }
+    if (rows == 0) {
+      break;
+    }
+
+    Status s = session->Flush();
+    // Part of the chunk may have been written even when it has to be retried.
+    if (this->options_.onReplayed) {
+      for (const string& tableName : touched) {
+        this->options_.onReplayed(tableName);
+      }
+    }
+    vector<KuduError*> errors;
+    bool overflow;
+    session->GetPendingErrors(&errors, &overflow);
+    Status retry = overflow ? s : Status::OK();
+    for (KuduError* error : errors) {
+      const Status& es = error->status();
+      bool duplicate = es.IsAlreadyPresent() ||
+          (es.IsNotFound() && dynamic_cast<const KuduDelete*>(&error->failed_op()) != NULL);
+      if (IsRetryable(es)) {
+        retry = es;
+      } else if (!duplicate) {
+        KUDU_LOG(WARNING) << "Dropping spilled row rejected by the server: " << es.ToString();
+        failed++;
+      }
+      delete error;
+    }
+    if (!s.ok() && errors.empty()) {
+      retry = s;
+    }
+    KUDU_RETURN_NOT_OK(retry);
+    // Only once the chunk is done, so that a retried chunk does not
+    // quarantine its records twice.
+    KUDU_RETURN_NOT_OK(Quarantine(*segment, quarantined));
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->metrics_.replayedRows += rows - failed - quarantined.size();
+    this->metrics_.failedRows += failed;
+    this->metrics_.quarantinedRows += quarantined.size();
+    this->metrics_.pendingRows -= rows;
+    segment->replayOffset = chunkEnd;
+    pos = chunkEnd;
+  }
+  if (this->stopping_ && more) {
+    return Status::Aborted("Spill queue is shutting down");
+  }
+  return Status::OK();
+}
+
+// Reopens a cached table whose schema no longer matches the record, in case
+// the cached schema is the stale one.
+Status SpillQueue::GetTable(const string& tableName, uint32_t fingerprint, shared_ptr<KuduTable>* table) {
+  auto it = this->tables_.find(tableName);
+  if (it != this->tables_.end() && SchemaFingerprint(it->second->schema()) == fingerprint) {
+    *table = it->second;
+    return Status::OK();
+  }
+  KUDU_RETURN_NOT_OK(this->client_->OpenTable(tableName, table));
+  this->tables_[tableName] = *table;
+  return Status::OK();
+}
+
+// Appends the records, as they are, to the quarantine segment of the one they
+// were read from, so they can be inspected or replayed by hand.
+Status SpillQueue::Quarantine(const Segment& segment, const vector<std::pair<const uint8_t*, size_t>>& records) {
+  if (records.empty()) {
+    return Status::OK();
+  }
+  string path = QuarantinePath(this->options_.directory, segment.seq);
+  FILE* file = fopen(path.c_str(), "ab");
+  if (file == NULL) {
+    return Status::IOError("Unable to open quarantine segment " + path, strerror(errno), errno);
+  }
+  bool ok = fseek(file, 0, SEEK_END) == 0;
+  if (ok && ftell(file) == 0) {
+    char header[kSegmentHeaderBytes] = { 0 };
+    memcpy(header, kSegmentMagic, sizeof(kSegmentMagic));
+    memcpy(header + sizeof(kSegmentMagic), &kSegmentVersion, sizeof(kSegmentVersion));
+    ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+  }
+  for (size_t i = 0; ok && i < records.size(); i++) {
+    ok = fwrite(records[i].first, 1, records[i].second, file) == records[i].second;
+  }
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    return Status::IOError("Unable to write quarantine segment " + path);
+  }
+  KUDU_LOG(WARNING) << "Quarantined " << records.size() << " spilled rows whose table schema changed in " << path;
+  return Status::OK();
+}
@@ -0,0 +1,99 @@
+#ifndef KUDUJS_SPILLQUEUE_H
+#define KUDUJS_SPILLQUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "kuduclass.h"
+
+using kudu::KuduPartialRow;
+
+struct SpillOptions {
+  string directory;
+  size_t segmentBytes; // size of each mmap-backed log segment
+  size_t maxDiskBytes; // quota over all segments, rows are dropped past it
+  int initialBackoffMillis;
+  int maxBackoffMillis;
+  bool replayOnStartup; // replay segments left behind by a previous process
+  bool sync; // msync every record before the write returns
+  std::function<void(const string&)> onReplayed; // called with each table written by a replay
+};
+
+struct SpillMetrics {
+  int64_t spilledRows;
+  int64_t replayedRows;
+  int64_t droppedRows; // rejected because the quota was reached
+  int64_t failedRows; // rejected for good by the server during replay
+  int64_t quarantinedRows; // spilled under a schema the table no longer has
+  int64_t pendingRows;
+  int64_t replayAttempts;
+  int64_t diskBytes;
+  int segments;
+  string lastError;
+};
+
+// Durable local queue for rows that could not be written because a tablet
+// server was slow or unavailable. Rows are appended to segmented, checksummed
+// log files and re-applied by a background thread with exponential backoff.
+//
+// Segment layout: a 16 byte header followed by records of
+// [u32 length][u32 crc32c][u8 operation][u16 table length][table]
+// [u32 schema fingerprint][row], where the row uses the EncodeRow format. The
+// length is written last, so a record torn by a crash reads as the end of the
+// segment.
+//
+// Rows only decode against the schema they were encoded with. A record whose
+// fingerprint no longer matches its table, after an ALTER TABLE, is not
+// applied but moved to a quarantine-<seq>.log segment next to the queue,
+// which is never replayed automatically.
+class SpillQueue {
+ public:
+  SpillQueue(const shared_ptr<KuduClient>& client, const SpillOptions& options);
+  ~SpillQueue();
+  Status Open();
+  Status Append(const string& tableName, const KuduSchema& schema, int operation, const KuduPartialRow& row);
+  SpillMetrics metrics();
+
+  // Errors worth retrying later rather than reporting to the caller.
+  static bool IsRetryable(const Status& s);
+
+ private:
+  struct Segment {
+    int64_t seq;
+    string path;
+    size_t size;
+    size_t replayOffset;
+    int64_t rows;
+  };
+
+  shared_ptr<KuduClient> client_;
+  SpillOptions options_;
+  std::map<string, shared_ptr<KuduTable>> tables_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::deque<Segment> sealed_;
+  Segment active_;
+  int activeFd_;
+  uint8_t* activeMap_;
+  size_t activeOffset_;
+  int64_t nextSeq_;
+  std::atomic<bool> stopping_;
+  std::thread replayer_;
+  SpillMetrics metrics_;
+
+  Status OpenSegment();
+  void SealSegment();
+  void ReplayLoop();
+  Status ReplaySegment(Segment* segment);
+  Status ApplyRecords(const uint8_t* data, size_t size, Segment* segment);
+  Status GetTable(const string& tableName, uint32_t fingerprint, shared_ptr<KuduTable>* table);
+  Status Quarantine(const Segment& segment, const vector<std::pair<const uint8_t*, size_t>>& records);
+  static int64_t CountRecords(const uint8_t* data, size_t size, size_t* end);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "stringdictionary.h"
+
+// Cardinality is only judged once this many rows were seen, so that a short
+// prefix of distinct values does not disable encoding for the whole column.
+static const size_t kMinSampleRows = 1024;
+
+StringDictionary::StringDictionary(size_t maxEntries, double maxRatio)
+    : maxEntries_(maxEntries), maxRatio_(maxRatio) {
+}
+
+bool StringDictionary::Encode(const ColumnarBatch& batch, size_t column) {
+  const ColumnarBatch::Column& col = batch.columns()[column];
+  size_t start = this->codes_.size();
+  size_t entries = this->values_.size();
+  this->codes_.reserve(start + batch.num_rows());
+
+  for (int64_t r = 0; r < batch.num_rows(); r++) {
+    if (batch.IsNull(column, r)) {
+      this->codes_.push_back(kNullCode);
+      continue;
+    }
+    std::string_view value(col.values.data() + col.offsets[r], col.offsets[r + 1] - col.offsets[r]);
+    auto it = this->index_.find(value);
+    if (it != this->index_.end()) {
+      this->codes_.push_back(it->second);
+      continue;
+    }
+
+    size_t seen = this->codes_.size() + 1;
+    if (this->values_.size() >= this->maxEntries_ ||
+        (seen >= kMinSampleRows && this->values_.size() + 1 > seen * this->maxRatio_)) {
+      // Roll back this batch so the caller can fall back to plain values.
+      for (size_t i = entries; i < this->values_.size(); i++) {
+        this->index_.erase(this->values_[i]);
+      }
+      this->values_.resize(entries);
+      this->codes_.resize(start);
+      return false;
+    }
+    uint32_t code = this->values_.size();
+    this->values_.push_back(string(value));
+    this->index_.emplace(this->values_.back(), code);
+    this->codes_.push_back(code);
+  }
+  return true;
+}
+
+const vector<uint32_t>& StringDictionary::codes() const {
+  return this->codes_;
+}
+
+const std::deque<string>& StringDictionary::values() const {
+  return this->values_;
+}
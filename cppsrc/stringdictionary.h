@@ -0,0 +1,31 @@
+#ifndef KUDUJS_STRINGDICTIONARY_H
+#define KUDUJS_STRINGDICTIONARY_H
+
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include "columnarbatch.h"
+
+// Dictionary encoding of a STRING column: every distinct value is stored once
+// and rows refer to it by code. Encoding gives up as soon as the column turns
+// out to have too many distinct values for it to pay off.
+class StringDictionary {
+ public:
+  static const uint32_t kNullCode = 0xFFFFFFFF;
+
+  StringDictionary(size_t maxEntries, double maxRatio);
+  // Appends the codes for one column of a batch. Returns false, leaving the
+  // codes as they were, once the column is not worth encoding.
+  bool Encode(const ColumnarBatch& batch, size_t column);
+  const vector<uint32_t>& codes() const;
+  const std::deque<string>& values() const;
+
+ private:
+  size_t maxEntries_;
+  double maxRatio_;
+  vector<uint32_t> codes_;
+  std::deque<string> values_; // stable storage for the index keys
+  std::unordered_map<std::string_view, uint32_t> index_;
+};
+
+#endif
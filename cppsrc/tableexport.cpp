@@ -0,0 +1,197 @@
+#include "tableexport.h"
+#include "arrowipc.h"
+#include "memtracker.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+using kudu::client::KuduScanner;
+
+static const size_t kWriteBufferBytes = 4 * 1024 * 1024;
+
+TableExporter::TableExporter(const shared_ptr<KuduTable>& table, const ExportOptions& options)
+    : table_(table), options_(options), nextToken_(0) {
+  this->queuedBytes_ = 0;
+  this->running_ = 0;
+  this->failed_ = false;
+}
+
+TableExporter::~TableExporter() {
+  for (KuduScanToken* token : this->tokens_) {
+    delete token;
+  }
+  for (ColumnarBatch* batch : this->queue_) {
+    delete batch;
+  }
+}
+
+Status TableExporter::Run(const string& path, ExportStats* stats) {
+  bool fileFormat = this->options_.format.empty() || this->options_.format == "arrow";
+  if (!fileFormat && this->options_.format != "arrows") {
+    return Status::InvalidArgument("Unknown export format: " + this->options_.format);
+  }
+
+  // The projection schema is needed up front to write the Arrow schema, even
+  // when partition pruning leaves no tablet to scan.
+  KuduScanner scanner(this->table_.get());
+  if (!this->options_.projection.empty()) {
+    KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(this->options_.projection));
+  }
+  ColumnarBatch header(scanner.GetProjectionSchema());
+
+  // The queue budget is charged up front, and shrunk when memory is short.
+  MemoryReservation buffers(MemoryTracker::EXPORT_BUFFERS);
+  KUDU_RETURN_NOT_OK(buffers.GrowUpTo(this->options_.maxBufferedBytes, this->options_.batchBytes,
+                                      &this->options_.maxBufferedBytes));
+
+  KUDU_RETURN_NOT_OK(BuildScanTokens(this->table_, this->options_.predicates, this->options_.projection, &this->tokens_));
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    return Status::IOError("Unable to open export file " + path);
+  }
+  vector<char> writeBuffer(kWriteBufferBytes);
+  setvbuf(file, writeBuffer.data(), _IOFBF, writeBuffer.size());
+
+  ArrowWriter writer(file, fileFormat);
+  Status s = writer.WriteSchema(header);
+
+  vector<std::thread> threads;
+  if (s.ok()) {
+    int parallelism = std::max(1, std::min<int>(this->options_.parallelism, this->tokens_.size()));
+    this->running_ = parallelism;
+    for (int i = 0; i < parallelism; i++) {
+      threads.push_back(std::thread(&TableExporter::ScanTokens, this));
+    }
+  }
+
+  int64_t rows = 0;
+  int64_t batches = 0;
+  ColumnarBatch* batch;
+  while (s.ok() && (batch = Pop()) != NULL) {
+    s = writer.WriteBatch(*batch);
+    rows += batch->num_rows();
+    batches++;
+    delete batch;
+    if (!s.ok()) {
+      Fail(s);
+    }
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  if (s.ok() && this->failed_) {
+    s = this->error_;
+  }
+  if (s.ok()) {
+    s = writer.Finish();
+  }
+  if (fclose(file) != 0 && s.ok()) {
+    s = Status::IOError("Unable to close export file " + path);
+  }
+  if (!s.ok()) {
+    // A truncated file would look like a complete export of fewer rows.
+    remove(path.c_str());
+    return s;
+  }
+
+  stats->rows = rows;
+  stats->batches = batches;
+  stats->bytes = writer.bytes_written();
+  stats->tablets = this->tokens_.size();
+  return Status::OK();
+}
+
+void TableExporter::ScanTokens() {
+  for (;;) {
+    if (Failed()) {
+      break;
+    }
+    size_t i = this->nextToken_++;
+    if (i >= this->tokens_.size()) {
+      break;
+    }
+    Status s = ScanToken(this->tokens_[i]);
+    if (!s.ok()) {
+      Fail(s);
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->running_--;
+  this->notEmpty_.notify_all();
+}
+
+Status TableExporter::ScanToken(KuduScanToken* token) {
+  KuduScanner* raw;
+  KUDU_RETURN_NOT_OK(token->IntoKuduScanner(&raw));
+  std::unique_ptr<KuduScanner> scanner(raw);
+  KUDU_RETURN_NOT_OK(scanner->Open());
+
+  KuduSchema schema = scanner->GetProjectionSchema();
+  std::unique_ptr<ColumnarBatch> columns(new ColumnarBatch(schema));
+  KuduScanBatch batch;
+  while (scanner->HasMoreRows() && !Failed()) {
+    KUDU_RETURN_NOT_OK(scanner->NextBatch(&batch));
+    KUDU_RETURN_NOT_OK(columns->Append(batch));
+    if (columns->ByteSize() >= this->options_.batchBytes) {
+      if (!Push(columns.release())) {
+        return Status::OK();
+      }
+      columns.reset(new ColumnarBatch(schema));
+    }
+  }
+  if (columns->num_rows() > 0) {
+    Push(columns.release());
+  }
+  return Status::OK();
+}
+
+bool TableExporter::Failed() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->failed_;
+}
+
+bool TableExporter::Push(ColumnarBatch* batch) {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  // A single batch larger than the budget is still let through when the
+  // queue is empty, otherwise the export could never make progress.
+  this->notFull_.wait(lock, [this, batch] {
+    return this->failed_ || this->queue_.empty() ||
+        this->queuedBytes_ + batch->ByteSize() <= this->options_.maxBufferedBytes;
+  });
+  if (this->failed_) {
+    delete batch;
+    return false;
+  }
+  this->queuedBytes_ += batch->ByteSize();
+  this->queue_.push_back(batch);
+  this->notEmpty_.notify_one();
+  return true;
+}
+
+ColumnarBatch* TableExporter::Pop() {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  this->notEmpty_.wait(lock, [this] {
+    return !this->queue_.empty() || this->running_ == 0 || this->failed_;
+  });
+  if (this->queue_.empty() || this->failed_) {
+    return NULL;
+  }
+  ColumnarBatch* batch = this->queue_.front();
+  this->queue_.pop_front();
+  this->queuedBytes_ -= batch->ByteSize();
+  this->notFull_.notify_all();
+  return batch;
+}
+
+void TableExporter::Fail(const Status& s) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (!this->failed_) {
+    this->failed_ = true;
+    this->error_ = s;
+  }
+  this->notEmpty_.notify_all();
+  this->notFull_.notify_all();
+}
@@ -0,0 +1,61 @@
+#ifndef KUDUJS_TABLEEXPORT_H
+#define KUDUJS_TABLEEXPORT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "kuduclass.h"
+#include "columnarbatch.h"
+
+using kudu::client::KuduScanToken;
+
+struct ExportOptions {
+  string format; // "arrow" (IPC file) or "arrows" (IPC stream)
+  vector<KPredicate> predicates;
+  vector<string> projection;
+  int parallelism; // concurrent tablet scans
+  size_t batchBytes; // target size of each record batch
+  size_t maxBufferedBytes; // scanned but not yet written data
+};
+
+struct ExportStats {
+  int64_t rows;
+  int64_t batches;
+  int64_t bytes;
+  int tablets;
+};
+
+// Exports a table to a local file. Scan tokens are read in parallel and their
+// batches handed to the calling thread through a queue bounded by
+// maxBufferedBytes, so memory stays flat no matter how large the table is.
+class TableExporter {
+ public:
+  TableExporter(const shared_ptr<KuduTable>& table, const ExportOptions& options);
+  ~TableExporter();
+  Status Run(const string& path, ExportStats* stats);
+
+ private:
+  shared_ptr<KuduTable> table_;
+  ExportOptions options_;
+  vector<KuduScanToken*> tokens_;
+  std::atomic<size_t> nextToken_;
+
+  std::mutex mutex_;
+  std::condition_variable notEmpty_;
+  std::condition_variable notFull_;
+  std::deque<ColumnarBatch*> queue_;
+  size_t queuedBytes_;
+  int running_;
+  Status error_;
+  bool failed_;
+
+  void ScanTokens();
+  Status ScanToken(KuduScanToken* token);
+  bool Push(ColumnarBatch* batch);
+  ColumnarBatch* Pop();
+  void Fail(const Status& s);
+  bool Failed();
+};
+
+#endif
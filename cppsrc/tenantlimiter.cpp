@@ -0,0 +1,248 @@
+#include "tenantlimiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+// Retry hint for an operation turned away only because others are queued.
+static const double kQueuedRetrySeconds = 0.001;
+// Idle tenants without a quota of their own are dropped once there are this
+// many, so that arbitrary keys cannot grow the map without bound.
+static const size_t kPruneTenants = 1024;
+
+TenantLimiter::TenantLimiter() {
+  this->enabled_ = false;
+  this->limits_ = TenantLimits();
+  this->limits_.defaultQuota.burstSeconds = 1;
+  this->limits_.defaultQuota.weight = 1;
+  this->virtualTime_ = 0;
+  this->nextSeq_ = 0;
+  this->pruneAt_ = kPruneTenants;
+  SetRate(&this->totalRows_, 0, 1);
+  SetRate(&this->totalBytes_, 0, 1);
+}
+
+void TenantLimiter::Configure(const TenantLimits& limits) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->limits_ = limits;
+  SetRate(&this->totalRows_, limits.totalRowsPerSecond, limits.defaultQuota.burstSeconds);
+  SetRate(&this->totalBytes_, limits.totalBytesPerSecond, limits.defaultQuota.burstSeconds);
+  for (auto& entry : this->tenants_) {
+    Tenant& tenant = entry.second;
+    if (!tenant.custom) {
+      tenant.quota = limits.defaultQuota;
+      SetRate(&tenant.rows, tenant.quota.rowsPerSecond, tenant.quota.burstSeconds);
+      SetRate(&tenant.bytes, tenant.quota.bytesPerSecond, tenant.quota.burstSeconds);
+    }
+  }
+  this->enabled_ = true;
+}
+
+void TenantLimiter::SetQuota(const string& key, const TenantQuota& quota) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  Tenant* tenant = GetTenant(key);
+  tenant->quota = quota;
+  tenant->custom = true;
+  SetRate(&tenant->rows, quota.rowsPerSecond, quota.burstSeconds);
+  SetRate(&tenant->bytes, quota.bytesPerSecond, quota.burstSeconds);
+  this->enabled_ = true;
+}
+
+bool TenantLimiter::enabled() const {
+  return this->enabled_.load(std::memory_order_relaxed);
+}
+
+void TenantLimiter::Acquire(const string& key, size_t rows, size_t bytes) {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  Tenant* tenant = GetTenant(key);
+  TimePoint start = std::chrono::steady_clock::now();
+  tenant->metrics.operations++;
+  tenant->metrics.rows += rows;
+  tenant->metrics.bytes += bytes;
+  tenant->metrics.waiting++;
+
+  // Waiting tenants are never pruned, so the pointer outlives the unlocked waits.
+  WaitFor(&lock, std::max(Take(&tenant->rows, rows, start), Take(&tenant->bytes, bytes, start)));
+
+  if (this->totalRows_.rate > 0 || this->totalBytes_.rate > 0) {
+    double tag = std::max(this->virtualTime_, tenant->finish) + Cost(rows, bytes) / std::max(tenant->quota.weight, 1e-6);
+    tenant->finish = tag;
+    std::pair<double, uint64_t> ticket(tag, this->nextSeq_++);
+    this->queue_.insert(ticket);
+    this->pending_.insert(ticket);
+    for (;;) {
+      this->turn_.wait(lock, [this, &ticket]() {
+        return *this->queue_.begin() == ticket;
+      });
+      TimePoint now = std::chrono::steady_clock::now();
+      double wait = std::max(Debt(&this->totalRows_, now), Debt(&this->totalBytes_, now));
+      if (wait <= 0) {
+        break;
+      }
+      // Steps out of the queue while the totals refill, so that nobody is
+      // held behind a sleeping thread, and comes back with the same tag.
+      this->queue_.erase(ticket);
+      this->turn_.notify_all();
+      WaitFor(&lock, wait);
+      this->queue_.insert(ticket);
+    }
+    this->virtualTime_ = std::max(this->virtualTime_, tag);
+    TimePoint now = std::chrono::steady_clock::now();
+    Take(&this->totalRows_, rows, now);
+    Take(&this->totalBytes_, bytes, now);
+    this->queue_.erase(ticket);
+    this->pending_.erase(ticket);
+    this->turn_.notify_all();
+  }
+
+  tenant->metrics.waiting--;
+  tenant->metrics.throttledMillis +=
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+Status TenantLimiter::TryAcquire(const string& key, size_t rows, size_t bytes) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  Tenant* tenant = GetTenant(key);
+  TimePoint now = std::chrono::steady_clock::now();
+  double wait = std::max(Debt(&tenant->rows, now), Debt(&tenant->bytes, now));
+  bool shared = this->totalRows_.rate > 0 || this->totalBytes_.rate > 0;
+  double tag = 0;
+  if (shared) {
+    tag = std::max(this->virtualTime_, tenant->finish) + Cost(rows, bytes) / std::max(tenant->quota.weight, 1e-6);
+    double totals = std::max(Debt(&this->totalRows_, now), Debt(&this->totalBytes_, now));
+    if (this->pending_.empty()) {
+      wait = std::max(wait, totals);
+    } else if (tag > this->pending_.begin()->first) {
+      // The tenant has had more than its share, a waiting one goes first.
+      wait = std::max(wait, std::max(totals, kQueuedRetrySeconds));
+    }
+    // Otherwise it is owed its turn before everyone waiting, and takes it
+    // even if that puts the totals into debt; its tag moves past theirs.
+  }
+  if (wait > 0) {
+    tenant->metrics.rejected++;
+    std::ostringstream message;
+    message << "Tenant '" << key << "' is over its rate limit, retry after " << std::ceil(wait * 1000) << " ms";
+    return Status::ServiceUnavailable(message.str());
+  }
+
+  tenant->metrics.operations++;
+  tenant->metrics.rows += rows;
+  tenant->metrics.bytes += bytes;
+  Take(&tenant->rows, rows, now);
+  Take(&tenant->bytes, bytes, now);
+  if (shared) {
+    tenant->finish = tag;
+    this->virtualTime_ = std::max(this->virtualTime_, tag);
+    Take(&this->totalRows_, rows, now);
+    Take(&this->totalBytes_, bytes, now);
+  }
+  return Status::OK();
+}
+
+void TenantLimiter::Charge(const string& key, size_t rows, size_t bytes) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  Tenant* tenant = GetTenant(key);
+  TimePoint now = std::chrono::steady_clock::now();
+  tenant->metrics.rows += rows;
+  tenant->metrics.bytes += bytes;
+  Take(&tenant->rows, rows, now);
+  Take(&tenant->bytes, bytes, now);
+  Take(&this->totalRows_, rows, now);
+  Take(&this->totalBytes_, bytes, now);
+}
+
+std::map<string, TenantMetrics> TenantLimiter::metrics() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  std::map<string, TenantMetrics> result;
+  for (const auto& entry : this->tenants_) {
+    result[entry.first] = entry.second.metrics;
+  }
+  return result;
+}
+
+// Called with the mutex held.
+TenantLimiter::Tenant* TenantLimiter::GetTenant(const string& key) {
+  auto it = this->tenants_.find(key);
+  if (it != this->tenants_.end()) {
+    return &it->second;
+  }
+  if (this->tenants_.size() >= this->pruneAt_) {
+    Prune(std::chrono::steady_clock::now());
+    this->pruneAt_ = std::max(kPruneTenants, this->tenants_.size() * 2);
+  }
+  Tenant& tenant = this->tenants_[key];
+  tenant.quota = this->limits_.defaultQuota;
+  tenant.custom = false;
+  SetRate(&tenant.rows, tenant.quota.rowsPerSecond, tenant.quota.burstSeconds);
+  SetRate(&tenant.bytes, tenant.quota.bytesPerSecond, tenant.quota.burstSeconds);
+  tenant.finish = 0;
+  tenant.metrics = TenantMetrics();
+  return &tenant;
+}
+
+// Drops tenants that are back where a new one would start: default quota,
+// nothing waiting, full buckets and no finish tag ahead of the virtual time.
+// Called with the mutex held.
+void TenantLimiter::Prune(TimePoint now) {
+  for (auto it = this->tenants_.begin(); it != this->tenants_.end();) {
+    Tenant& tenant = it->second;
+    if (!tenant.custom && tenant.metrics.waiting == 0 && tenant.finish <= this->virtualTime_ &&
+        Full(&tenant.rows, now) && Full(&tenant.bytes, now)) {
+      it = this->tenants_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Seconds of the total rates the request takes up, called with the mutex held.
+double TenantLimiter::Cost(size_t rows, size_t bytes) const {
+  double cost = 0;
+  if (this->totalRows_.rate > 0) {
+    cost = std::max(cost, rows / this->totalRows_.rate);
+  }
+  if (this->totalBytes_.rate > 0) {
+    cost = std::max(cost, bytes / this->totalBytes_.rate);
+  }
+  return cost;
+}
+
+void TenantLimiter::WaitFor(std::unique_lock<std::mutex>* lock, double seconds) {
+  if (seconds <= 0) {
+    return;
+  }
+  lock->unlock();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  lock->lock();
+}
+
+void TenantLimiter::SetRate(Bucket* bucket, double rate, double burstSeconds) {
+  bucket->rate = rate;
+  bucket->depth = std::max(rate * burstSeconds, 1.0);
+  bucket->tokens = bucket->depth;
+  bucket->updated = std::chrono::steady_clock::now();
+}
+
+// Refills the bucket and takes amount from it, returning how long to wait
+// until it is out of debt.
+double TenantLimiter::Take(Bucket* bucket, double amount, TimePoint now) {
+  if (bucket->rate <= 0) {
+    return 0;
+  }
+  double elapsed = std::max(0.0, std::chrono::duration<double>(now - bucket->updated).count());
+  bucket->tokens = std::min(bucket->depth, bucket->tokens + elapsed * bucket->rate);
+  bucket->updated = std::max(bucket->updated, now);
+  bucket->tokens -= amount;
+  return bucket->tokens < 0 ? -bucket->tokens / bucket->rate : 0;
+}
+
+// Refills the bucket and returns how long until it is out of debt.
+double TenantLimiter::Debt(Bucket* bucket, TimePoint now) {
+  return Take(bucket, 0, now);
+}
+
+bool TenantLimiter::Full(Bucket* bucket, TimePoint now) {
+  Take(bucket, 0, now);
+  return bucket->rate <= 0 || bucket->tokens >= bucket->depth;
+}
@@ -0,0 +1,108 @@
+#ifndef KUDUJS_TENANTLIMITER_H
+#define KUDUJS_TENANTLIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include "kuduclass.h"
+
+struct TenantQuota {
+  double rowsPerSecond; // 0 for no limit
+  double bytesPerSecond; // 0 for no limit
+  double burstSeconds; // bucket depth, in seconds worth of the rate
+  double weight; // share of the total rates when tenants compete for them
+};
+
+struct TenantLimits {
+  TenantQuota defaultQuota; // for keys without a quota of their own
+  double totalRowsPerSecond; // over all tenants, 0 for no limit
+  double totalBytesPerSecond;
+};
+
+struct TenantMetrics {
+  int64_t operations;
+  int64_t rows;
+  int64_t bytes;
+  double throttledMillis; // time spent waiting for tokens
+  int waiting; // operations waiting right now
+  int64_t rejected; // operations turned away by TryAcquire
+};
+
+// Token-bucket limits on the rows and bytes each tenant key writes and scans
+// through a client, so that one tenant's bulk load cannot take every session.
+// Buckets may go into debt: a request larger than the bucket is let through
+// once the bucket has refilled, and the debt delays the tenant's next one.
+//
+// When total rates are set, requests that passed their own tenant's buckets
+// also share the total ones in weighted fair order: each gets a virtual finish
+// tag of max(virtual time, the tenant's last tag) + cost / weight, and the
+// request with the lowest tag takes the total buckets next.
+//
+// Acquire sleeps, so it is only for worker threads, and it leaves the queue
+// while it sleeps off a debt of the totals. Calls made on the JS thread use
+// TryAcquire, which turns a throttled tenant away instead of stalling the
+// event loop, and every other tenant with it. It only looks at the caller's
+// own tenant: its buckets, and whether its next tag would be later than that
+// of an Acquire still waiting for the totals.
+class TenantLimiter {
+ public:
+  TenantLimiter();
+  void Configure(const TenantLimits& limits);
+  void SetQuota(const string& key, const TenantQuota& quota);
+  bool enabled() const;
+  // Waits until the tenant may write or scan that much and charges it.
+  void Acquire(const string& key, size_t rows, size_t bytes);
+  // Charges the tenant if its buckets are not in debt and it has not had
+  // more than its share of the totals. Otherwise charges nothing and returns
+  // ServiceUnavailable, saying how long to wait before retrying.
+  Status TryAcquire(const string& key, size_t rows, size_t bytes);
+  // Charges what was already read without waiting; the debt is waited off by
+  // the tenant's next Acquire.
+  void Charge(const string& key, size_t rows, size_t bytes);
+  std::map<string, TenantMetrics> metrics();
+
+ private:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  struct Bucket {
+    double rate;
+    double depth;
+    double tokens;
+    TimePoint updated;
+  };
+  struct Tenant {
+    TenantQuota quota;
+    bool custom; // has a quota of its own
+    Bucket rows;
+    Bucket bytes;
+    double finish; // virtual finish tag of its last request
+    TenantMetrics metrics;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable turn_;
+  std::atomic<bool> enabled_;
+  TenantLimits limits_;
+  std::map<string, Tenant> tenants_;
+  Bucket totalRows_;
+  Bucket totalBytes_;
+  double virtualTime_;
+  uint64_t nextSeq_;
+  size_t pruneAt_; // tenants_ size that triggers the next Prune
+  std::set<std::pair<double, uint64_t>> queue_; // tags waiting for their turn at the totals
+  std::set<std::pair<double, uint64_t>> pending_; // and those sleeping off their debt
+
+  Tenant* GetTenant(const string& key);
+  void Prune(TimePoint now);
+  double Cost(size_t rows, size_t bytes) const;
+  void WaitFor(std::unique_lock<std::mutex>* lock, double seconds);
+  static void SetRate(Bucket* bucket, double rate, double burstSeconds);
+  static double Take(Bucket* bucket, double amount, TimePoint now);
+  static double Debt(Bucket* bucket, TimePoint now);
+  static bool Full(Bucket* bucket, TimePoint now);
+};
+
+#endif
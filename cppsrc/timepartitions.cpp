@@ -0,0 +1,256 @@
+#include "timepartitions.h"
+
+#include <ctime>
+#include <memory>
+
+using kudu::client::KuduColumnSchema;
+using kudu::client::KuduPartitioner;
+using kudu::client::KuduPartitionerBuilder;
+using kudu::client::KuduTableAlterer;
+using kudu::client::KuduTableCreator;
+
+static const int64_t kMicrosPerHour = 3600LL * 1000 * 1000;
+static const int64_t kMicrosPerDay = 24 * kMicrosPerHour;
+
+// Never walk back further than this many periods when dropping.
+static const int kMaxDroppedPeriods = 100000;
+
+static int64_t FloorDiv(int64_t a, int64_t b) {
+  int64_t q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+int64_t PeriodStart(int period, int64_t micros) {
+  switch (period) {
+    case TimePartitioning::HOUR:
+      return FloorDiv(micros, kMicrosPerHour) * kMicrosPerHour;
+    case TimePartitioning::WEEK:
+      // The epoch was a Thursday; weeks start on Monday.
+      return (FloorDiv(FloorDiv(micros, kMicrosPerDay) + 3, 7) * 7 - 3) * kMicrosPerDay;
+    case TimePartitioning::MONTH:
+    {
+      time_t seconds = static_cast<time_t>(FloorDiv(micros, 1000000));
+      struct tm t;
+      gmtime_r(&seconds, &t);
+      t.tm_mday = 1;
+      t.tm_hour = 0;
+      t.tm_min = 0;
+      t.tm_sec = 0;
+      return static_cast<int64_t>(timegm(&t)) * 1000000;
+    }
+    default:
+      return FloorDiv(micros, kMicrosPerDay) * kMicrosPerDay;
+  }
+}
+
+int64_t AddPeriods(int period, int64_t start, int64_t n) {
+  switch (period) {
+    case TimePartitioning::HOUR:
+      return start + n * kMicrosPerHour;
+    case TimePartitioning::WEEK:
+      return start + n * 7 * kMicrosPerDay;
+    case TimePartitioning::MONTH:
+    {
+      time_t seconds = static_cast<time_t>(FloorDiv(start, 1000000));
+      struct tm t;
+      gmtime_r(&seconds, &t);
+      t.tm_mon += static_cast<int>(n);
+      return static_cast<int64_t>(timegm(&t)) * 1000000;
+    }
+    default:
+      return start + n * kMicrosPerDay;
+  }
+}
+
+Status SetTimeBound(KuduPartialRow* row, const KuduSchema& schema, const string& column, int64_t micros) {
+  for (int i = 0, l = schema.num_columns(); i < l; i++) {
+    KuduColumnSchema col = schema.Column(i);
+    if (col.name() != column) {
+      continue;
+    }
+    switch (col.type()) {
+      case KuduColumnSchema::UNIXTIME_MICROS:
+        return row->SetUnixTimeMicros(i, micros);
+      case KuduColumnSchema::INT64:
+        return row->SetInt64(i, micros);
+      default:
+        return Status::InvalidArgument("Time partition column must be UNIXTIME_MICROS or INT64: " + column);
+    }
+  }
+  return Status::NotFound("No such column: " + column);
+}
+
+// A row with every primary key column set, so the partitioner can place it;
+// only the time column matters to the range it falls in.
+static Status SetProbeKey(KuduPartialRow* row, const KuduSchema& schema, const string& column, int64_t micros) {
+  vector<int> keys;
+  schema.GetPrimaryKeyColumnIndexes(&keys);
+  for (int i : keys) {
+    KuduColumnSchema col = schema.Column(i);
+    if (col.name() == column) {
+      continue;
+    }
+    switch (col.type()) {
+      case KuduColumnSchema::INT8:
+        KUDU_RETURN_NOT_OK(row->SetInt8(i, 0));
+        break;
+      case KuduColumnSchema::INT16:
+        KUDU_RETURN_NOT_OK(row->SetInt16(i, 0));
+        break;
+      case KuduColumnSchema::INT32:
+        KUDU_RETURN_NOT_OK(row->SetInt32(i, 0));
+        break;
+      case KuduColumnSchema::INT64:
+        KUDU_RETURN_NOT_OK(row->SetInt64(i, 0));
+        break;
+      case KuduColumnSchema::UNIXTIME_MICROS:
+        KUDU_RETURN_NOT_OK(row->SetUnixTimeMicros(i, 0));
+        break;
+      case KuduColumnSchema::STRING:
+        KUDU_RETURN_NOT_OK(row->SetStringCopy(i, ""));
+        break;
+      case KuduColumnSchema::BINARY:
+        KUDU_RETURN_NOT_OK(row->SetBinaryCopy(i, ""));
+        break;
+      default:
+        return Status::NotSupported("Unsupported primary key column type for partition lookups: " + col.name());
+    }
+  }
+  return SetTimeBound(row, schema, column, micros);
+}
+
+// The partition a row at micros would go to, -1 when no range covers it.
+static Status FindPartition(KuduPartitioner* partitioner, const KuduSchema& schema, const string& column,
+                            int64_t micros, int* partition) {
+  std::unique_ptr<KuduPartialRow> row(schema.NewRow());
+  KUDU_RETURN_NOT_OK(SetProbeKey(row.get(), schema, column, micros));
+  *partition = -1;
+  return partitioner->PartitionRow(*row, partition);
+}
+
+static Status IsCovered(KuduPartitioner* partitioner, const KuduSchema& schema, const string& column,
+                        int64_t micros, bool* covered) {
+  int partition;
+  KUDU_RETURN_NOT_OK(FindPartition(partitioner, schema, column, micros, &partition));
+  *covered = partition >= 0;
+  return Status::OK();
+}
+
+// Whether [start, end) is exactly one range partition, rather than part of a
+// wider one or split over several.
+static Status IsWholeRange(KuduPartitioner* partitioner, const KuduSchema& schema, const string& column,
+                           int64_t start, int64_t end, bool* whole) {
+  int first, last, before, after;
+  KUDU_RETURN_NOT_OK(FindPartition(partitioner, schema, column, start, &first));
+  KUDU_RETURN_NOT_OK(FindPartition(partitioner, schema, column, end - 1, &last));
+  KUDU_RETURN_NOT_OK(FindPartition(partitioner, schema, column, start - 1, &before));
+  KUDU_RETURN_NOT_OK(FindPartition(partitioner, schema, column, end, &after));
+  *whole = first >= 0 && first == last && before != first && after != first;
+  return Status::OK();
+}
+
+Status CreateTimeSeriesTable(const shared_ptr<KuduClient>& client, const string& tableName, const KuduSchema& schema,
+                             const TimePartitioning& options, int64_t from, int64_t now) {
+  int64_t last = AddPeriods(options.period, PeriodStart(options.period, now), options.ahead);
+  if (PeriodStart(options.period, from) > last) {
+    // Without a single range Kudu would create one unbounded range, which
+    // could never be added to or dropped from.
+    return Status::InvalidArgument("Time series tables must start no later than ahead periods past now");
+  }
+  std::unique_ptr<KuduTableCreator> creator(client->NewTableCreator());
+  creator->table_name(tableName)
+      .schema(&schema)
+      .set_range_partition_columns({ options.column });
+  for (int64_t start = PeriodStart(options.period, from); start <= last; start = AddPeriods(options.period, start, 1)) {
+    KuduPartialRow* lower = schema.NewRow();
+    KuduPartialRow* upper = schema.NewRow();
+    // The creator owns the bounds as soon as they are added.
+    creator->add_range_partition(lower, upper);
+    KUDU_RETURN_NOT_OK(SetTimeBound(lower, schema, options.column, start));
+    KUDU_RETURN_NOT_OK(SetTimeBound(upper, schema, options.column, AddPeriods(options.period, start, 1)));
+  }
+  if (!options.hashColumns.empty()) {
+    creator->add_hash_partitions(options.hashColumns, options.hashBuckets);
+  }
+  KUDU_LOG(INFO) << "Creating time series table " << tableName;
+  return creator->Create();
+}
+
+Status AlterTimeRange(const shared_ptr<KuduClient>& client, const string& tableName, const string& column,
+                      int64_t lower, int64_t upper, bool drop) {
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(client->OpenTable(tableName, &table));
+  const KuduSchema& schema = table->schema();
+  std::unique_ptr<KuduTableAlterer> alterer(client->NewTableAlterer(tableName));
+  KuduPartialRow* lowerRow = schema.NewRow();
+  KuduPartialRow* upperRow = schema.NewRow();
+  if (drop) {
+    alterer->DropRangePartition(lowerRow, upperRow);
+  } else {
+    alterer->AddRangePartition(lowerRow, upperRow);
+  }
+  KUDU_RETURN_NOT_OK(SetTimeBound(lowerRow, schema, column, lower));
+  KUDU_RETURN_NOT_OK(SetTimeBound(upperRow, schema, column, upper));
+  return alterer->Alter();
+}
+
+Status MaintainTimePartitions(const shared_ptr<KuduClient>& client, const string& tableName,
+                              const TimePartitioning& options, int64_t now, PartitionChanges* changes) {
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(client->OpenTable(tableName, &table));
+  const KuduSchema& schema = table->schema();
+  KuduPartitioner* raw;
+  KUDU_RETURN_NOT_OK(KuduPartitionerBuilder(table).Build(&raw));
+  std::unique_ptr<KuduPartitioner> partitioner(raw);
+
+  std::unique_ptr<KuduTableAlterer> alterer(client->NewTableAlterer(tableName));
+  int64_t current = PeriodStart(options.period, now);
+  for (int64_t i = 0; i <= options.ahead; i++) {
+    int64_t start = AddPeriods(options.period, current, i);
+    bool covered;
+    KUDU_RETURN_NOT_OK(IsCovered(partitioner.get(), schema, options.column, start, &covered));
+    if (covered) {
+      continue;
+    }
+    KuduPartialRow* lower = schema.NewRow();
+    KuduPartialRow* upper = schema.NewRow();
+    alterer->AddRangePartition(lower, upper);
+    KUDU_RETURN_NOT_OK(SetTimeBound(lower, schema, options.column, start));
+    KUDU_RETURN_NOT_OK(SetTimeBound(upper, schema, options.column, AddPeriods(options.period, start, 1)));
+    changes->added++;
+  }
+
+  if (options.retention > 0) {
+    int64_t end = AddPeriods(options.period, current, -options.retention);
+    for (int dropped = 0; dropped < kMaxDroppedPeriods; dropped++) {
+      int64_t start = AddPeriods(options.period, end, -1);
+      bool covered;
+      KUDU_RETURN_NOT_OK(IsCovered(partitioner.get(), schema, options.column, start, &covered));
+      if (!covered) {
+        break;
+      }
+      // Dropping [start, end) only works when it is a range of its own; a
+      // range added with other bounds has to be dropped by hand.
+      bool whole;
+      KUDU_RETURN_NOT_OK(IsWholeRange(partitioner.get(), schema, options.column, start, end, &whole));
+      if (!whole) {
+        return Status::InvalidArgument("Range partition covering the period before the retention cutoff of " +
+                                       tableName + " does not span exactly one period");
+      }
+      KuduPartialRow* lower = schema.NewRow();
+      KuduPartialRow* upper = schema.NewRow();
+      alterer->DropRangePartition(lower, upper);
+      KUDU_RETURN_NOT_OK(SetTimeBound(lower, schema, options.column, start));
+      KUDU_RETURN_NOT_OK(SetTimeBound(upper, schema, options.column, end));
+      changes->dropped++;
+      end = start;
+    }
+  }
+
+  if (changes->added == 0 && changes->dropped == 0) {
+    return Status::OK();
+  }
+  KUDU_LOG(INFO) << "Altering time partitions of " << tableName << ": " << changes->added << " added, "
+                 << changes->dropped << " dropped";
+  return alterer->Alter();
+}
@@ -0,0 +1,54 @@
+#ifndef KUDUJS_TIMEPARTITIONS_H
+#define KUDUJS_TIMEPARTITIONS_H
+
+#include <kudu/common/partial_row.h>
+#include "kuduclass.h"
+
+using kudu::KuduPartialRow;
+
+// Time-series tables are range partitioned on a UNIXTIME_MICROS or INT64
+// column holding microseconds since the epoch, with one bounded range per
+// period aligned to UTC. Periods are [start, next start).
+struct TimePartitioning {
+  enum Period { HOUR, DAY, WEEK, MONTH };
+
+  string column;
+  int period; // a Period
+  int64_t ahead; // periods kept created beyond the current one
+  int64_t retention; // past periods kept, 0 to keep them all
+  vector<string> hashColumns; // optional hash partitioning within each range
+  int hashBuckets;
+};
+
+struct PartitionChanges {
+  int64_t added;
+  int64_t dropped;
+};
+
+// Start of the period holding micros, and the start of the period n periods
+// after (or before, for negative n) the one starting at start.
+int64_t PeriodStart(int period, int64_t micros);
+int64_t AddPeriods(int period, int64_t start, int64_t n);
+
+// Fills the range partition bounds of a table creator or alterer.
+Status SetTimeBound(KuduPartialRow* row, const KuduSchema& schema, const string& column, int64_t micros);
+
+// Creates a table with the periods from the one holding from up to ahead
+// periods past the one holding now. from must not be later than that.
+Status CreateTimeSeriesTable(const shared_ptr<KuduClient>& client, const string& tableName, const KuduSchema& schema,
+                             const TimePartitioning& options, int64_t from, int64_t now);
+
+// Adds or drops the range partition [lower, upper) of the time column.
+Status AlterTimeRange(const shared_ptr<KuduClient>& client, const string& tableName, const string& column,
+                      int64_t lower, int64_t upper, bool drop);
+
+// Adds the missing periods up to ahead past the current one and drops the
+// periods older than retention, in a single alter. Only whole periods next to
+// each other are dropped, walking back from the retention cutoff until a
+// period that is not covered by a range partition. Every range walked over
+// must span exactly one period, as those created here do; if one does not,
+// nothing is altered and InvalidArgument is returned.
+Status MaintainTimePartitions(const shared_ptr<KuduClient>& client, const string& tableName,
+                              const TimePartitioning& options, int64_t now, PartitionChanges* changes);
+
+#endif
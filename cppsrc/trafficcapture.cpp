@@ -0,0 +1,530 @@
+#include "trafficcapture.h"
+#include "rowcodec.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using kudu::client::KuduError;
+using kudu::client::KuduScanBatch;
+using kudu::client::KuduScanner;
+using kudu::client::KuduSession;
+using kudu::client::KuduWriteOperation;
+
+static const char kCaptureMagic[8] = { 'K', 'J', 'S', 'C', 'A', 'P', 'T', 'R' };
+static const uint32_t kCaptureVersion = 1;
+static const size_t kCaptureHeaderBytes = 12;
+static const size_t kRecordHeaderBytes = 8;
+static const size_t kWriteChunkBytes = 1024 * 1024;
+
+enum PredicateValue { NUMBER_VALUE = 0, BOOL_VALUE = 1, STRING_VALUE = 2 };
+
+template <typename T>
+static void Put(string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool Take(const uint8_t** data, const uint8_t* end, T* value) {
+  if (end - *data < static_cast<ptrdiff_t>(sizeof(T))) {
+    return false;
+  }
+  memcpy(value, *data, sizeof(T));
+  *data += sizeof(T);
+  return true;
+}
+
+static bool TakeBytes(const uint8_t** data, const uint8_t* end, size_t length, string* value) {
+  if (end - *data < static_cast<ptrdiff_t>(length)) {
+    return false;
+  }
+  value->assign(reinterpret_cast<const char*>(*data), length);
+  *data += length;
+  return true;
+}
+
+static Status WriteFully(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return Status::IOError("Unable to write capture file", strerror(errno), errno);
+    }
+    written += n;
+  }
+  return Status::OK();
+}
+
+void AppendCapturedRow(const KuduPartialRow& row, const KuduSchema& schema, string* rows) {
+  size_t lengthPos = rows->size();
+  Put<uint32_t>(rows, 0);
+  if (!EncodeRow(row, schema, rows).ok()) {
+    rows->resize(lengthPos);
+    return;
+  }
+  uint32_t length = rows->size() - lengthPos - sizeof(uint32_t);
+  memcpy(&(*rows)[lengthPos], &length, sizeof(length));
+}
+
+TrafficRecorder::TrafficRecorder(const CaptureOptions& options) : options_(options) {
+  size_t capacity = 2;
+  while (capacity < options.bufferRecords) {
+    capacity *= 2;
+  }
+  this->slots_.reset(new Slot[capacity]);
+  for (size_t i = 0; i < capacity; i++) {
+    this->slots_[i].sequence = i;
+    this->slots_[i].record = NULL;
+  }
+  this->mask_ = capacity - 1;
+  this->head_ = 0;
+  this->tail_ = 0;
+  this->fd_ = -1;
+  this->stopping_ = false;
+  this->records_ = 0;
+  this->dropped_ = 0;
+  this->bytes_ = 0;
+}
+
+TrafficRecorder::~TrafficRecorder() {
+  Stop();
+  // Records pushed while the writer was finishing never made it to disk.
+  for (string* record = Pop(); record != NULL; record = Pop()) {
+    delete record;
+  }
+}
+
+Status TrafficRecorder::Open() {
+  this->fd_ = open(this->options_.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (this->fd_ < 0) {
+    return Status::IOError("Unable to create capture file " + this->options_.path, strerror(errno), errno);
+  }
+  string header(kCaptureMagic, sizeof(kCaptureMagic));
+  Put<uint32_t>(&header, kCaptureVersion);
+  Status s = WriteFully(this->fd_, header);
+  if (!s.ok()) {
+    close(this->fd_);
+    this->fd_ = -1;
+    return s;
+  }
+  this->bytes_ = header.size();
+  this->started_ = std::chrono::steady_clock::now();
+  this->writer_ = std::thread(&TrafficRecorder::WriteLoop, this);
+  KUDU_LOG(INFO) << "Capturing traffic to " << this->options_.path;
+  return Status::OK();
+}
+
+void TrafficRecorder::Stop() {
+  if (!this->writer_.joinable()) {
+    return;
+  }
+  this->stopping_ = true;
+  this->writer_.join();
+  close(this->fd_);
+  this->fd_ = -1;
+  KUDU_LOG(INFO) << "Captured " << this->records_.load() << " operations to " << this->options_.path;
+}
+
+CaptureStats TrafficRecorder::stats() {
+  CaptureStats stats;
+  stats.records = this->records_;
+  stats.dropped = this->dropped_;
+  stats.bytes = this->bytes_;
+  std::lock_guard<std::mutex> lock(this->errorMutex_);
+  stats.lastError = this->lastError_;
+  return stats;
+}
+
+int64_t TrafficRecorder::Now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->started_).count();
+}
+
+string* TrafficRecorder::NewRecord(int kind, int operation, const string& tableName, int64_t start) {
+  string* record = new string(kRecordHeaderBytes, '\0');
+  Put<uint8_t>(record, kind);
+  Put<uint8_t>(record, operation);
+  Put<int64_t>(record, start);
+  Put<uint32_t>(record, std::max<int64_t>(Now() - start, 0));
+  Put<uint16_t>(record, tableName.size());
+  record->append(tableName);
+  return record;
+}
+
+void TrafficRecorder::RecordWrite(const string& tableName, int operation, int64_t start, const string& rows, uint32_t count) {
+  string* record = NewRecord(WRITE, operation, tableName, start);
+  Put<uint32_t>(record, count);
+  record->append(rows);
+  Push(record);
+}
+
+void TrafficRecorder::RecordScan(const string& tableName, int64_t start, const vector<KPredicate>& predicates,
+                                 const vector<string>& projection, int64_t limit) {
+  string* record = NewRecord(SCAN, 0, tableName, start);
+  Put<int64_t>(record, limit);
+  Put<uint16_t>(record, projection.size());
+  for (const string& column : projection) {
+    Put<uint16_t>(record, column.size());
+    record->append(column);
+  }
+  Put<uint16_t>(record, predicates.size());
+  for (const KPredicate& predicate : predicates) {
+    string column = predicate.GetColName();
+    Put<uint16_t>(record, column.size());
+    record->append(column);
+    Put<uint8_t>(record, predicate.GetComparisonOp());
+    if (predicate.IsString()) {
+      string value = predicate.GetString();
+      Put<uint8_t>(record, STRING_VALUE);
+      Put<uint32_t>(record, value.size());
+      record->append(value);
+    } else {
+      Put<uint8_t>(record, predicate.IsBool() ? BOOL_VALUE : NUMBER_VALUE);
+      Put<double>(record, predicate.GetNumber());
+    }
+  }
+  Push(record);
+}
+
+// Producers claim a slot by advancing head_ and publish it by bumping the
+// slot's sequence, which the writer waits for before taking the record.
+void TrafficRecorder::Push(string* record) {
+  if (this->stopping_.load(std::memory_order_acquire)) {
+    delete record;
+    this->dropped_++;
+    return;
+  }
+  size_t pos = this->head_.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot& slot = this->slots_[pos & this->mask_];
+    size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (this->head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        slot.record = record;
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        this->records_++;
+        return;
+      }
+    } else if (diff < 0) {
+      delete record;
+      this->dropped_++;
+      return;
+    } else {
+      pos = this->head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+string* TrafficRecorder::Pop() {
+  Slot& slot = this->slots_[this->tail_ & this->mask_];
+  if (slot.sequence.load(std::memory_order_acquire) != this->tail_ + 1) {
+    return NULL;
+  }
+  string* record = slot.record;
+  slot.sequence.store(this->tail_ + this->mask_ + 1, std::memory_order_release);
+  this->tail_++;
+  return record;
+}
+
+void TrafficRecorder::WriteLoop() {
+  string buffer;
+  while (!this->stopping_.load(std::memory_order_acquire)) {
+    if (!Drain(&buffer)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(this->options_.flushIntervalMillis));
+    }
+  }
+  while (Drain(&buffer)) {
+  }
+}
+
+// Writes out every record in the ring, returning whether there were any.
+bool TrafficRecorder::Drain(string* buffer) {
+  bool drained = false;
+  for (string* record = Pop(); record != NULL; record = Pop()) {
+    drained = true;
+    uint32_t length = record->size() - kRecordHeaderBytes;
+    uint32_t crc = Crc32c(reinterpret_cast<const uint8_t*>(record->data()) + kRecordHeaderBytes, length);
+    memcpy(&(*record)[0], &length, sizeof(length));
+    memcpy(&(*record)[4], &crc, sizeof(crc));
+    buffer->append(*record);
+    delete record;
+    if (buffer->size() >= kWriteChunkBytes) {
+      break;
+    }
+  }
+  if (buffer->empty()) {
+    return drained;
+  }
+  Status s = WriteFully(this->fd_, *buffer);
+  if (s.ok()) {
+    this->bytes_ += buffer->size();
+  } else {
+    std::lock_guard<std::mutex> lock(this->errorMutex_);
+    if (this->lastError_.empty()) {
+      KUDU_LOG(WARNING) << "Traffic capture to " << this->options_.path << " failed: " << s.ToString();
+    }
+    this->lastError_ = s.ToString();
+  }
+  buffer->clear();
+  return drained;
+}
+
+TrafficReplayer::TrafficReplayer(const shared_ptr<KuduClient>& client, const ReplayOptions& options)
+    : client_(client), options_(options), tables_(client) {
+  this->next_ = 0;
+  this->stats_ = NULL;
+}
+
+Status TrafficReplayer::Run(const string& path, ReplayStats* stats) {
+  KUDU_RETURN_NOT_OK(Load(path));
+  KUDU_LOG(INFO) << "Replaying " << this->records_.size() << " captured operations from " << path;
+  this->stats_ = stats;
+  this->next_ = 0;
+  this->begin_ = std::chrono::steady_clock::now();
+  size_t count = std::min(static_cast<size_t>(std::max(this->options_.concurrency, 1)), this->records_.size());
+  vector<std::thread> threads;
+  for (size_t i = 0; i < count; i++) {
+    threads.push_back(std::thread(&TrafficReplayer::ReplayLoop, this));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  stats->millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->begin_).count();
+  return Status::OK();
+}
+
+// Reads every record of the capture up to the first torn or corrupt one, in
+// the order the operations started.
+Status TrafficReplayer::Load(const string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return Status::IOError("Unable to open capture file " + path, strerror(errno), errno);
+  }
+  string data;
+  char chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.append(chunk, n);
+  }
+  bool failed = ferror(file) != 0;
+  fclose(file);
+  if (failed) {
+    return Status::IOError("Unable to read capture file " + path);
+  }
+
+  uint32_t version = 0;
+  if (data.size() >= kCaptureHeaderBytes) {
+    memcpy(&version, data.data() + sizeof(kCaptureMagic), sizeof(version));
+  }
+  if (data.size() < kCaptureHeaderBytes || memcmp(data.data(), kCaptureMagic, sizeof(kCaptureMagic)) != 0 ||
+      version != kCaptureVersion) {
+    return Status::Corruption("Not a capture file: " + path);
+  }
+
+  const uint8_t* base = reinterpret_cast<const uint8_t*>(data.data());
+  size_t pos = kCaptureHeaderBytes;
+  while (data.size() - pos >= kRecordHeaderBytes) {
+    uint32_t length;
+    uint32_t crc;
+    memcpy(&length, base + pos, sizeof(length));
+    memcpy(&crc, base + pos + 4, sizeof(crc));
+    const uint8_t* p = base + pos + kRecordHeaderBytes;
+    if (data.size() - pos - kRecordHeaderBytes < length || Crc32c(p, length) != crc) {
+      KUDU_LOG(WARNING) << "Capture file " << path << " ends with a damaged record";
+      break;
+    }
+    const uint8_t* end = p + length;
+    pos += kRecordHeaderBytes + length;
+
+    Record record;
+    uint8_t kind;
+    uint8_t operation;
+    uint16_t tableLength;
+    if (!Take(&p, end, &kind) || !Take(&p, end, &operation) || !Take(&p, end, &record.start) ||
+        !Take(&p, end, &record.duration) || !Take(&p, end, &tableLength) ||
+        !TakeBytes(&p, end, tableLength, &record.table)) {
+      return Status::Corruption("Malformed capture record in " + path);
+    }
+    record.kind = kind;
+    record.operation = operation;
+    record.payload.assign(reinterpret_cast<const char*>(p), end - p);
+    this->records_.push_back(std::move(record));
+  }
+  std::stable_sort(this->records_.begin(), this->records_.end(), [](const Record& a, const Record& b) {
+    return a.start < b.start;
+  });
+  return Status::OK();
+}
+
+void TrafficReplayer::ReplayLoop() {
+  for (size_t i = this->next_++; i < this->records_.size(); i = this->next_++) {
+    const Record& record = this->records_[i];
+    std::chrono::steady_clock::time_point due = this->begin_;
+    if (this->options_.speed > 0) {
+      due += std::chrono::microseconds(static_cast<int64_t>(record.start / this->options_.speed));
+      std::this_thread::sleep_until(due);
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int64_t rows = 0;
+    Status s = Replay(record, &rows);
+    double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    ReplayStats* stats = this->stats_;
+    stats->operations++;
+    stats->capturedMillis += record.duration / 1000.0;
+    stats->replayedMillis += millis;
+    if (this->options_.speed > 0) {
+      stats->maxLagMillis = std::max(stats->maxLagMillis, std::chrono::duration<double, std::milli>(start - due).count());
+    }
+    if (record.kind == TrafficRecorder::WRITE) {
+      stats->writes++;
+      stats->rowsWritten += rows;
+    } else {
+      stats->scans++;
+      stats->rowsScanned += rows;
+    }
+    if (!s.ok()) {
+      stats->failed++;
+      stats->lastError = s.ToString();
+    }
+  }
+}
+
+Status TrafficReplayer::Replay(const Record& record, int64_t* rows) {
+  shared_ptr<KuduTable> table;
+  KUDU_RETURN_NOT_OK(GetTable(record.table, &table));
+  switch (record.kind) {
+    case TrafficRecorder::WRITE:
+      return ReplayWrite(table, record, rows);
+    case TrafficRecorder::SCAN:
+      return ReplayScan(table, record, rows);
+    default:
+      return Status::NotSupported("Unknown captured operation");
+  }
+}
+
+Status TrafficReplayer::ReplayWrite(const shared_ptr<KuduTable>& table, const Record& record, int64_t* rows) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(record.payload.data());
+  const uint8_t* end = p + record.payload.size();
+  uint32_t count;
+  if (!Take(&p, end, &count)) {
+    return Status::Corruption("Malformed captured write");
+  }
+
+  shared_ptr<KuduSession> session = this->client_->NewSession();
+  KUDU_RETURN_NOT_OK(session->SetFlushMode(KuduSession::AUTO_FLUSH_BACKGROUND));
+  session->SetTimeoutMillis(5000);
+  KuduSchema schema = table->schema();
+  Status s;
+  for (uint32_t i = 0; i < count && s.ok(); i++) {
+    uint32_t length;
+    if (!Take(&p, end, &length) || end - p < static_cast<ptrdiff_t>(length)) {
+      s = Status::Corruption("Malformed captured row");
+      break;
+    }
+    KuduWriteOperation* op = NewOperation(table.get(), record.operation);
+    if (op == NULL) {
+      s = Status::InvalidArgument("Unknown write operation");
+      break;
+    }
+    s = DecodeRow(p, length, schema, op->mutable_row());
+    p += length;
+    if (!s.ok()) {
+      delete op;
+      break;
+    }
+    s = session->Apply(op);
+    if (s.ok()) {
+      (*rows)++;
+    }
+  }
+  Status fs = session->Flush();
+  vector<KuduError*> errors;
+  bool overflow;
+  session->GetPendingErrors(&errors, &overflow);
+  for (KuduError* error : errors) {
+    if (s.ok()) {
+      s = error->status();
+    }
+    delete error;
+  }
+  if (s.ok()) {
+    s = fs;
+  }
+  return s;
+}
+
+Status TrafficReplayer::ReplayScan(const shared_ptr<KuduTable>& table, const Record& record, int64_t* rows) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(record.payload.data());
+  const uint8_t* end = p + record.payload.size();
+  int64_t limit;
+  uint16_t columns;
+  if (!Take(&p, end, &limit) || !Take(&p, end, &columns)) {
+    return Status::Corruption("Malformed captured scan");
+  }
+  vector<string> projection(columns);
+  for (string& column : projection) {
+    uint16_t length;
+    if (!Take(&p, end, &length) || !TakeBytes(&p, end, length, &column)) {
+      return Status::Corruption("Malformed captured scan");
+    }
+  }
+  uint16_t count;
+  if (!Take(&p, end, &count)) {
+    return Status::Corruption("Malformed captured scan");
+  }
+  vector<KPredicate> predicates;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t length;
+    string column;
+    uint8_t op;
+    uint8_t kind;
+    if (!Take(&p, end, &length) || !TakeBytes(&p, end, length, &column) || !Take(&p, end, &op) ||
+        !Take(&p, end, &kind)) {
+      return Status::Corruption("Malformed captured predicate");
+    }
+    if (kind == STRING_VALUE) {
+      uint32_t valueLength;
+      string value;
+      if (!Take(&p, end, &valueLength) || !TakeBytes(&p, end, valueLength, &value)) {
+        return Status::Corruption("Malformed captured predicate");
+      }
+      predicates.push_back(KPredicate(column, op, value));
+    } else {
+      double value;
+      if (!Take(&p, end, &value)) {
+        return Status::Corruption("Malformed captured predicate");
+      }
+      predicates.push_back(KPredicate(column, op, value, kind == BOOL_VALUE));
+    }
+  }
+
+  KuduScanner scanner(table.get());
+  for (const KPredicate& predicate : predicates) {
+    KUDU_RETURN_NOT_OK(scanner.AddConjunctPredicate(predicate.ToKuduPredicate(table.get())));
+  }
+  if (!projection.empty()) {
+    KUDU_RETURN_NOT_OK(scanner.SetProjectedColumnNames(projection));
+  }
+  if (limit > 0) {
+    KUDU_RETURN_NOT_OK(scanner.SetLimit(limit));
+  }
+  KUDU_RETURN_NOT_OK(scanner.Open());
+  KuduScanBatch batch;
+  while (scanner.HasMoreRows()) {
+    KUDU_RETURN_NOT_OK(scanner.NextBatch(&batch));
+    *rows += batch.NumRows();
+  }
+  return Status::OK();
+}
+
+Status TrafficReplayer::GetTable(const string& tableName, shared_ptr<KuduTable>* table) {
+  return this->tables_.Get(tableName, table);
+}
@@ -0,0 +1,143 @@
+#ifndef KUDUJS_TRAFFICCAPTURE_H
+#define KUDUJS_TRAFFICCAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "kuduclass.h"
+
+using kudu::KuduPartialRow;
+
+struct CaptureOptions {
+  string path;
+  size_t bufferRecords; // capacity of the ring, rounded up to a power of two
+  int flushIntervalMillis; // how long the writer sleeps once the ring is empty
+};
+
+struct CaptureStats {
+  int64_t records;
+  int64_t dropped; // the ring was full, or the capture already stopped
+  int64_t bytes;
+  string lastError;
+};
+
+struct ReplayOptions {
+  double speed; // 1 replays at the captured pace, 0 as fast as possible
+  int concurrency;
+};
+
+struct ReplayStats {
+  int64_t operations;
+  int64_t writes;
+  int64_t scans;
+  int64_t rowsWritten;
+  int64_t rowsScanned;
+  int64_t failed;
+  double capturedMillis; // time the operations took when captured
+  double replayedMillis; // and when replayed
+  double maxLagMillis; // furthest an operation started behind schedule
+  double millis;
+  string lastError;
+};
+
+// Appends the row to a capture payload in the EncodeRow format, length
+// prefixed. A row the codec cannot encode is left out, like records that
+// find the ring full.
+void AppendCapturedRow(const KuduPartialRow& row, const KuduSchema& schema, string* rows);
+
+// Records the writes and scans issued through a KuduClass to a capture file.
+// Callers encode their record and push it onto a bounded lock-free ring; a
+// background thread drains it to disk, so recording never waits on I/O. A
+// full ring drops the record rather than slowing the caller down.
+//
+// File layout: an 8 byte magic and a u32 version, followed by records of
+// [u32 length][u32 crc32c][u8 kind][u8 operation][i64 start][u32 duration]
+// [u16 table length][table][payload], times in microseconds since the
+// capture started. A write payload is [u32 rows] and each row as
+// [u32 length][EncodeRow bytes]; a scan payload is [i64 limit]
+// [u16 columns][u16 length][name]... [u16 predicates][predicate]....
+// Rows are encoded by column index, so replays need the same schemas.
+class TrafficRecorder {
+ public:
+  enum Kind { WRITE = 0, SCAN = 1 };
+
+  explicit TrafficRecorder(const CaptureOptions& options);
+  ~TrafficRecorder();
+  Status Open();
+  // Writes out every record pushed so far and closes the file.
+  void Stop();
+  CaptureStats stats();
+
+  int64_t Now() const; // microseconds since the capture started
+  void RecordWrite(const string& tableName, int operation, int64_t start, const string& rows, uint32_t count);
+  void RecordScan(const string& tableName, int64_t start, const vector<KPredicate>& predicates,
+                  const vector<string>& projection, int64_t limit);
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    string* record;
+  };
+
+  CaptureOptions options_;
+  std::chrono::steady_clock::time_point started_;
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+  std::atomic<size_t> head_; // next slot to claim, shared by producers
+  size_t tail_; // next slot to drain, only touched by the writer
+  int fd_;
+  std::thread writer_;
+  std::atomic<bool> stopping_;
+  std::atomic<int64_t> records_;
+  std::atomic<int64_t> dropped_;
+  std::atomic<int64_t> bytes_;
+  std::mutex errorMutex_;
+  string lastError_;
+
+  string* NewRecord(int kind, int operation, const string& tableName, int64_t start);
+  void Push(string* record);
+  string* Pop();
+  void WriteLoop();
+  bool Drain(string* buffer);
+};
+
+// Re-issues a capture file against the cluster of a client. Operations are
+// started in their captured order, each once its start time divided by the
+// speed has passed, on a pool of threads. Failed operations are counted, not
+// fatal, as production traffic seldom replays cleanly on another cluster.
+class TrafficReplayer {
+ public:
+  TrafficReplayer(const shared_ptr<KuduClient>& client, const ReplayOptions& options);
+  Status Run(const string& path, ReplayStats* stats);
+
+ private:
+  struct Record {
+    int kind;
+    int operation;
+    int64_t start;
+    uint32_t duration;
+    string table;
+    string payload;
+  };
+
+  shared_ptr<KuduClient> client_;
+  ReplayOptions options_;
+  vector<Record> records_;
+  TableCache tables_;
+  std::chrono::steady_clock::time_point begin_;
+  std::atomic<size_t> next_;
+  std::mutex mutex_; // stats_
+  ReplayStats* stats_;
+
+  Status Load(const string& path);
+  void ReplayLoop();
+  Status Replay(const Record& record, int64_t* rows);
+  Status ReplayWrite(const shared_ptr<KuduTable>& table, const Record& record, int64_t* rows);
+  Status ReplayScan(const shared_ptr<KuduTable>& table, const Record& record, int64_t* rows);
+  Status GetTable(const string& tableName, shared_ptr<KuduTable>* table);
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "workscheduler.h"
+
+#include <algorithm>
+
+ScheduledWorker::ScheduledWorker(Napi::Env env) : Napi::AsyncWorker(env) {
+  this->scheduler_ = NULL;
+  this->grant_ = WorkGrant();
+}
+
+int ScheduledWorker::requestedScanners() const {
+  return 0;
+}
+
+size_t ScheduledWorker::requestedBufferedBytes() const {
+  return 0;
+}
+
+void ScheduledWorker::Grant(const WorkGrant&) {
+}
+
+void ScheduledWorker::KeepAlive(const Napi::Object& owner) {
+  this->owner_ = Napi::Persistent(owner);
+}
+
+void ScheduledWorker::Release() {
+  if (this->scheduler_ != NULL) {
+    this->scheduler_->Release(this);
+    this->scheduler_ = NULL;
+  }
+}
+
+void ScheduledWorker::Continue(ScheduledWorker* next) {
+  next->scheduler_ = this->scheduler_;
+  next->workClass_ = this->workClass_;
+  next->KeepAlive(this->owner_.Value());
+}
+
+Status ScheduledWorker::Resume() {
+  return this->scheduler_->Submit(this->workClass_, this);
+}
+
+WorkScheduler::WorkScheduler(int maxConcurrent) : maxConcurrent_(maxConcurrent) {
+  this->running_ = 0;
+}
+
+void WorkScheduler::Configure(const string& name, const WorkClassOptions& options) {
+  auto it = this->classes_.find(name);
+  if (it == this->classes_.end()) {
+    WorkClass workClass = WorkClass();
+    workClass.options = options;
+    this->classes_[name] = workClass;
+  } else {
+    it->second.options = options;
+  }
+  // Raised limits may let queued jobs start right away.
+  Dispatch();
+}
+
+Status WorkScheduler::Submit(const string& name, ScheduledWorker* worker) {
+  auto it = this->classes_.find(name);
+  if (it == this->classes_.end()) {
+    return Status::InvalidArgument("Unknown work class: " + name);
+  }
+  worker->scheduler_ = this;
+  worker->workClass_ = name;
+  it->second.queue.push_back(Queued{worker, std::chrono::steady_clock::now()});
+  Dispatch();
+  return Status::OK();
+}
+
+void WorkScheduler::Release(ScheduledWorker* worker) {
+  WorkClass& workClass = this->classes_[worker->workClass_];
+  workClass.running--;
+  workClass.completed++;
+  workClass.scanners -= worker->grant_.scanners;
+  workClass.bufferedBytes -= worker->grant_.bufferedBytes;
+  this->running_--;
+  Dispatch();
+}
+
+bool WorkScheduler::Admit(const WorkClass& workClass, const ScheduledWorker* worker, WorkGrant* grant) {
+  if (workClass.running >= workClass.options.maxConcurrent) {
+    return false;
+  }
+
+  // A job asking for scan resources needs at least one scanner, and gets
+  // fewer scanners and a smaller buffer than asked for when the class is busy.
+  const WorkClassOptions& options = workClass.options;
+  grant->scanners = worker->requestedScanners();
+  if (grant->scanners > 0 && options.maxScanners > 0) {
+    grant->scanners = std::min(grant->scanners, options.maxScanners - workClass.scanners);
+    if (grant->scanners < 1) {
+      return false;
+    }
+  }
+  grant->bufferedBytes = worker->requestedBufferedBytes();
+  if (grant->bufferedBytes > 0 && options.maxBufferedBytes > 0) {
+    if (workClass.bufferedBytes >= options.maxBufferedBytes) {
+      return false;
+    }
+    grant->bufferedBytes = std::min(grant->bufferedBytes, options.maxBufferedBytes - workClass.bufferedBytes);
+  }
+  return true;
+}
+
+void WorkScheduler::Dispatch() {
+  while (this->running_ < this->maxConcurrent_) {
+    WorkClass* next = NULL;
+    WorkGrant grant;
+    for (auto& entry : this->classes_) {
+      WorkClass& workClass = entry.second;
+      WorkGrant candidate;
+      if (workClass.queue.empty() || !Admit(workClass, workClass.queue.front().worker, &candidate)) {
+        continue;
+      }
+      // Equal priorities take turns by the age of their oldest job.
+      if (next == NULL || workClass.options.priority > next->options.priority ||
+          (workClass.options.priority == next->options.priority &&
+           workClass.queue.front().submitted < next->queue.front().submitted)) {
+        next = &workClass;
+        grant = candidate;
+      }
+    }
+    if (next == NULL) {
+      return;
+    }
+
+    Queued queued = next->queue.front();
+    next->queue.pop_front();
+    double waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queued.submitted).count();
+    next->totalWaitMillis += waited;
+    next->maxWaitMillis = std::max(next->maxWaitMillis, waited);
+    next->started++;
+    next->running++;
+    next->scanners += grant.scanners;
+    next->bufferedBytes += grant.bufferedBytes;
+    this->running_++;
+
+    queued.worker->grant_ = grant;
+    queued.worker->Grant(grant);
+    queued.worker->Queue();
+  }
+}
+
+int WorkScheduler::maxConcurrent() const {
+  return this->maxConcurrent_;
+}
+
+int WorkScheduler::running() const {
+  return this->running_;
+}
+
+std::map<string, WorkClassMetrics> WorkScheduler::metrics() const {
+  std::map<string, WorkClassMetrics> result;
+  for (const auto& entry : this->classes_) {
+    const WorkClass& workClass = entry.second;
+    WorkClassMetrics m;
+    m.queued = workClass.queue.size();
+    m.running = workClass.running;
+    m.completed = workClass.completed;
+    m.scanners = workClass.scanners;
+    m.bufferedBytes = workClass.bufferedBytes;
+    m.avgWaitMillis = workClass.started > 0 ? workClass.totalWaitMillis / workClass.started : 0;
+    m.maxWaitMillis = workClass.maxWaitMillis;
+    result[entry.first] = m;
+  }
+  return result;
+}
@@ -0,0 +1,104 @@
+#ifndef KUDUJS_WORKSCHEDULER_H
+#define KUDUJS_WORKSCHEDULER_H
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <napi.h>
+#include "kuduclass.h"
+
+class WorkScheduler;
+
+struct WorkClassOptions {
+  int priority; // higher goes first when capacity frees up
+  int maxConcurrent; // running jobs of this class
+  int maxScanners; // scanner and writer threads across running jobs, 0 for no limit
+  size_t maxBufferedBytes; // scan buffers across running jobs, 0 for no limit
+};
+
+struct WorkClassMetrics {
+  int64_t queued;
+  int64_t running;
+  int64_t completed;
+  int scanners;
+  size_t bufferedBytes;
+  double avgWaitMillis; // time from submission to start
+  double maxWaitMillis;
+};
+
+struct WorkGrant {
+  int scanners;
+  size_t bufferedBytes;
+};
+
+// An async job that runs on the libuv pool once its work class admits it.
+// Subclasses report the scan resources they would like, are told what they
+// got before Execute runs, and must call Release() once settled.
+class ScheduledWorker : public Napi::AsyncWorker {
+ public:
+  explicit ScheduledWorker(Napi::Env env);
+  virtual int requestedScanners() const;
+  virtual size_t requestedBufferedBytes() const;
+  virtual void Grant(const WorkGrant& grant);
+  // Keeps the object that started the job from being collected, and the
+  // native state it owns from being freed, until the job has settled.
+  void KeepAlive(const Napi::Object& owner);
+
+ protected:
+  void Release();
+  // Hands this job's work class and owner to next, which carries on where
+  // this job left off. Resume() queues it, from the JS thread.
+  void Continue(ScheduledWorker* next);
+  Status Resume();
+
+ private:
+  friend class WorkScheduler;
+  WorkScheduler* scheduler_;
+  string workClass_;
+  WorkGrant grant_;
+  Napi::ObjectReference owner_;
+};
+
+// Admits async jobs from named work classes so that interactive requests are
+// not stuck behind exports and bulk loads. Every class has its own queue and
+// limits; whenever a slot frees up the highest priority class that has both
+// queued work and room for it starts its oldest job. Jobs are never preempted.
+//
+// Only used from the JS thread: jobs are submitted from API calls and released
+// from OnOK/OnError, so no locking is needed.
+class WorkScheduler {
+ public:
+  explicit WorkScheduler(int maxConcurrent);
+  void Configure(const string& name, const WorkClassOptions& options);
+  Status Submit(const string& name, ScheduledWorker* worker);
+  void Release(ScheduledWorker* worker);
+  int maxConcurrent() const;
+  int running() const;
+  std::map<string, WorkClassMetrics> metrics() const;
+
+ private:
+  struct Queued {
+    ScheduledWorker* worker;
+    std::chrono::steady_clock::time_point submitted;
+  };
+  struct WorkClass {
+    WorkClassOptions options;
+    std::deque<Queued> queue;
+    int running;
+    int scanners;
+    size_t bufferedBytes;
+    int64_t completed;
+    int64_t started;
+    double totalWaitMillis;
+    double maxWaitMillis;
+  };
+
+  int maxConcurrent_;
+  int running_;
+  std::map<string, WorkClass> classes_;
+
+  void Dispatch();
+  static bool Admit(const WorkClass& workClass, const ScheduledWorker* worker, WorkGrant* grant);
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "writecoalescer.h"
+#include "rowcodec.h"
+
+WriteCoalescer::WriteCoalescer(const shared_ptr<KuduClient>& client, const CoalesceOptions& options, const SessionFlusher& flusher)
+    : tables_(client), options_(options), flusher_(flusher) {
+  this->pendingKeys_ = 0;
+  this->stopping_ = false;
+  this->metrics_ = CoalesceMetrics();
+}
+
+WriteCoalescer::~WriteCoalescer() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->stopping_ = true;
+  }
+  this->wakeup_.notify_all();
+  if (this->thread_.joinable()) {
+    this->thread_.join();
+  }
+  Status s = Flush();
+  if (!s.ok()) {
+    KUDU_LOG(WARNING) << "Unable to flush coalesced writes: " << s.ToString();
+  }
+}
+
+void WriteCoalescer::Start() {
+  this->thread_ = std::thread(&WriteCoalescer::FlushLoop, this);
+}
+
+Status WriteCoalescer::GetTable(const string& tableName, shared_ptr<KuduTable>* table) {
+  return this->tables_.Get(tableName, table);
+}
+
+Status WriteCoalescer::Add(const shared_ptr<KuduTable>& table, int operation, const KuduPartialRow& row) {
+  if (operation != K_UPSERT && operation != K_UPDATE) {
+    return Status::InvalidArgument("Only updates and upserts can be coalesced");
+  }
+  string key;
+  KUDU_RETURN_NOT_OK(row.EncodeRowKey(&key));
+
+  // Merging goes through the row codec, which copies exactly the columns set
+  // in the incoming row over the buffered one.
+  string cells;
+  KUDU_RETURN_NOT_OK(EncodeRow(row, table->schema(), &cells));
+
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    TableBuffer& buffer = this->buffers_[table->name()];
+    if (!buffer.table) {
+      buffer.table = table;
+    }
+    auto it = buffer.rows.find(key);
+    if (it == buffer.rows.end()) {
+      Pending pending;
+      pending.operation = operation;
+      pending.row = new KuduPartialRow(row);
+      buffer.rows.emplace(key, pending);
+      this->pendingKeys_++;
+    } else {
+      KUDU_RETURN_NOT_OK(DecodeRow(reinterpret_cast<const uint8_t*>(cells.data()), cells.size(),
+          table->schema(), it->second.row));
+      if (operation == K_UPSERT) {
+        it->second.operation = K_UPSERT;
+      }
+      this->metrics_.mergedRows++;
+    }
+    this->metrics_.bufferedRows++;
+    full = this->pendingKeys_ >= this->options_.maxKeys;
+  }
+  if (full) {
+    this->wakeup_.notify_all();
+  }
+  return Status::OK();
+}
+
+Status WriteCoalescer::Flush() {
+  std::lock_guard<std::mutex> flushLock(this->flushMutex_);
+  std::map<string, TableBuffer> buffers;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    buffers.swap(this->buffers_);
+    this->pendingKeys_ = 0;
+  }
+
+  Status result;
+  for (auto& entry : buffers) {
+    Status s = WriteTable(&entry.second);
+    if (!s.ok()) {
+      KUDU_LOG(WARNING) << "Coalesced write to " << entry.first << " failed: " << s.ToString();
+      if (result.ok()) {
+        result = s;
+      }
+    }
+  }
+  return result;
+}
+
+Status WriteCoalescer::FlushTable(const string& tableName) {
+  std::lock_guard<std::mutex> flushLock(this->flushMutex_);
+  TableBuffer buffer;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    auto it = this->buffers_.find(tableName);
+    if (it == this->buffers_.end()) {
+      return Status::OK();
+    }
+    buffer = std::move(it->second);
+    this->buffers_.erase(it);
+    this->pendingKeys_ -= buffer.rows.size();
+  }
+  return WriteTable(&buffer);
+}
+
+Status WriteCoalescer::WriteTable(TableBuffer* buffer) {
+  Status result;
+  int64_t written = 0;
+  int64_t failed = 0;
+  for (int operation : { K_UPSERT, K_UPDATE }) {
+    shared_ptr<KuduSession> session = buffer->table->client()->NewSession();
+    Status s = session->SetFlushMode(KuduSession::AUTO_FLUSH_BACKGROUND);
+    session->SetTimeoutMillis(5000);
+    int64_t rows = 0;
+    for (auto& entry : buffer->rows) {
+      if (entry.second.operation != operation) {
+        continue;
+      }
+      rows++;
+      if (s.ok()) {
+        KuduWriteOperation* op = NewOperation(buffer->table.get(), operation);
+        *op->mutable_row() = *entry.second.row;
+        s = session->Apply(op);
+      }
+    }
+    if (rows == 0) {
+      continue;
+    }
+    if (s.ok()) {
+      s = this->flusher_(buffer->table, operation, session);
+    }
+    if (s.ok()) {
+      written += rows;
+    } else {
+      failed += rows;
+      if (result.ok()) {
+        result = s;
+      }
+    }
+  }
+  for (auto& entry : buffer->rows) {
+    delete entry.second.row;
+  }
+
+  if (this->options_.onFlushed) {
+    this->options_.onFlushed(buffer->table->name(), written + failed, result);
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->metrics_.flushes++;
+  this->metrics_.writtenRows += written;
+  this->metrics_.failedRows += failed;
+  if (!result.ok()) {
+    this->metrics_.lastError = result.ToString();
+  }
+  return result;
+}
+
+CoalesceMetrics WriteCoalescer::metrics() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  CoalesceMetrics metrics = this->metrics_;
+  metrics.pendingKeys = this->pendingKeys_;
+  return metrics;
+}
+
+void WriteCoalescer::FlushLoop() {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  while (!this->stopping_) {
+    this->wakeup_.wait_for(lock, std::chrono::milliseconds(this->options_.windowMillis), [this] {
+      return this->stopping_ || this->pendingKeys_ >= this->options_.maxKeys;
+    });
+    if (this->stopping_) {
+      break;
+    }
+    if (this->pendingKeys_ == 0) {
+      continue;
+    }
+    lock.unlock();
+    Flush();
+    lock.lock();
+  }
+}
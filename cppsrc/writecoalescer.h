@@ -0,0 +1,83 @@
+#ifndef KUDUJS_WRITECOALESCER_H
+#define KUDUJS_WRITECOALESCER_H
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "kuduclass.h"
+
+using kudu::KuduPartialRow;
+using kudu::client::KuduSession;
+
+struct CoalesceOptions {
+  int windowMillis; // how long writes are held back for merging
+  size_t maxKeys; // buffered keys that trigger an early flush
+  std::function<void(const string&, int64_t, const Status&)> onFlushed; // called with the rows and outcome of each table a flush wrote
+};
+
+struct CoalesceMetrics {
+  int64_t bufferedRows; // rows handed to the buffer
+  int64_t mergedRows; // rows folded into an already buffered key
+  int64_t writtenRows; // operations sent to the cluster
+  int64_t failedRows;
+  int64_t flushes;
+  int64_t pendingKeys;
+  string lastError;
+};
+
+// Buffers updates and upserts keyed by their encoded primary key and merges
+// successive writes to the same key, last writer wins per column. Every
+// windowMillis the surviving rows are written through one batched session per
+// table, so a hot key costs one operation per window instead of one per call.
+//
+// A key that saw an upsert is written as an upsert; a key that only saw
+// updates stays an update so it cannot create rows. Rows the row codec cannot
+// merge, those with a DECIMAL cell, are refused with NotSupported.
+//
+// Writes made to a table without the coalescer must FlushTable it first, or
+// older buffered rows would land after them.
+class WriteCoalescer {
+ public:
+  typedef std::function<Status(const shared_ptr<KuduTable>&, int, const shared_ptr<KuduSession>&)> SessionFlusher;
+
+  WriteCoalescer(const shared_ptr<KuduClient>& client, const CoalesceOptions& options, const SessionFlusher& flusher);
+  ~WriteCoalescer();
+  void Start();
+  Status GetTable(const string& tableName, shared_ptr<KuduTable>* table);
+  Status Add(const shared_ptr<KuduTable>& table, int operation, const KuduPartialRow& row);
+  Status Flush();
+  // Writes out the rows buffered for one table, after any flush in progress.
+  Status FlushTable(const string& tableName);
+  CoalesceMetrics metrics();
+
+ private:
+  struct Pending {
+    int operation;
+    KuduPartialRow* row;
+  };
+  struct TableBuffer {
+    shared_ptr<KuduTable> table;
+    std::unordered_map<string, Pending> rows;
+  };
+
+  TableCache tables_;
+  CoalesceOptions options_;
+  SessionFlusher flusher_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::map<string, TableBuffer> buffers_;
+  size_t pendingKeys_;
+  bool stopping_;
+  std::thread thread_;
+  std::mutex flushMutex_; // serializes flushes from the timer and from JS
+  CoalesceMetrics metrics_;
+
+  void FlushLoop();
+  Status WriteTable(TableBuffer* buffer);
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "writepipeline.h"
+#include "rowcodec.h"
+#include "trafficcapture.h"
+#include "columnarbatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unordered_map>
+
+using kudu::client::KuduPartitionerBuilder;
+
+// Rows claimed by an encoder at a time, small enough to spread skewed input
+// over all threads.
+static const size_t kChunkRows = 256;
+
+size_t MarshaledRows::num_rows() const {
+  return this->rowStarts.empty() ? 0 : this->rowStarts.size() - 1;
+}
+
+void MarshalRows(const Napi::Array& rows, MarshaledRows* out) {
+  std::unordered_map<string, uint32_t> names;
+  out->rowStarts.reserve(rows.Length() + 1);
+
+  for (uint32_t i = 0; i < rows.Length(); i++) {
+    out->rowStarts.push_back(out->cells.size());
+    Napi::Object value = rows.Get(i).ToObject();
+    Napi::Array props = value.GetPropertyNames();
+    for (uint32_t p = 0; p < props.Length(); p++) {
+      string prop = props.Get(p).ToString();
+      auto it = names.find(prop);
+      if (it == names.end()) {
+        it = names.emplace(prop, out->names.size()).first;
+        out->names.push_back(prop);
+      }
+
+      MarshaledRows::Cell cell;
+      cell.name = it->second;
+      cell.number = 0;
+      Napi::Value v = value.Get(prop);
+      if (v.IsNull() || v.IsUndefined()) {
+        cell.kind = MarshaledRows::NONE;
+      } else if (v.IsNumber()) {
+        cell.kind = MarshaledRows::NUMBER;
+        cell.number = v.As<Napi::Number>().DoubleValue();
+      } else if (v.IsBoolean()) {
+        cell.kind = MarshaledRows::BOOLEAN;
+        cell.number = v.As<Napi::Boolean>().Value() ? 1 : 0;
+      } else {
+        cell.kind = MarshaledRows::TEXT;
+        cell.text = v.ToString().Utf8Value();
+      }
+      out->cells.push_back(std::move(cell));
+    }
+  }
+  out->rowStarts.push_back(out->cells.size());
+}
+
+// Formats a number the way JS would for the common cases: integers without a
+// fraction and everything else with the shortest digits that round trip.
+static string NumberText(double number) {
+  char buf[32];
+  for (int precision = 1; precision <= 17; precision++) {
+    snprintf(buf, sizeof(buf), "%.*g", precision, number);
+    if (strtod(buf, NULL) == number) {
+      break;
+    }
+  }
+  return buf;
+}
+
+static double CellNumber(const MarshaledRows::Cell& cell) {
+  return cell.kind == MarshaledRows::TEXT ? strtod(cell.text.c_str(), NULL) : cell.number;
+}
+
+static Status SetCell(KuduPartialRow* row, int idx, KuduColumnSchema::DataType type, const MarshaledRows::Cell& cell) {
+  if (cell.kind == MarshaledRows::NONE) {
+    return row->SetNull(idx);
+  }
+  switch (type) {
+    case KuduColumnSchema::INT8:
+      return row->SetInt8(idx, CellNumber(cell));
+    case KuduColumnSchema::INT16:
+      return row->SetInt16(idx, CellNumber(cell));
+    case KuduColumnSchema::INT32:
+      return row->SetInt32(idx, CellNumber(cell));
+    case KuduColumnSchema::INT64:
+      return row->SetInt64(idx, CellNumber(cell));
+    case KuduColumnSchema::UNIXTIME_MICROS:
+      return row->SetUnixTimeMicros(idx, CellNumber(cell));
+    case KuduColumnSchema::FLOAT:
+      return row->SetFloat(idx, CellNumber(cell));
+    case KuduColumnSchema::DOUBLE:
+      return row->SetDouble(idx, CellNumber(cell));
+    case KuduColumnSchema::BOOL:
+      if (cell.kind == MarshaledRows::TEXT) {
+        return row->SetBool(idx, !cell.text.empty());
+      }
+      return row->SetBool(idx, cell.number != 0 && !std::isnan(cell.number));
+    case KuduColumnSchema::STRING:
+      if (cell.kind == MarshaledRows::TEXT) {
+        return row->SetString(idx, cell.text);
+      }
+      if (cell.kind == MarshaledRows::BOOLEAN) {
+        return row->SetString(idx, cell.number != 0 ? "true" : "false");
+      }
+      return row->SetString(idx, NumberText(cell.number));
+    case KuduColumnSchema::BINARY:
+      if (cell.kind == MarshaledRows::TEXT) {
+        return row->SetBinary(idx, cell.text);
+      }
+      if (cell.kind == MarshaledRows::BOOLEAN) {
+        return row->SetBinary(idx, cell.number != 0 ? "true" : "false");
+      }
+      return row->SetBinary(idx, NumberText(cell.number));
+    default:
+      return Status::OK();
+  }
+}
+
+WritePipeline::WritePipeline(const shared_ptr<KuduTable>& table, int operation, const PipelineOptions& options,
+                             const WriteCoalescer::SessionFlusher& flusher)
+    : table_(table), operation_(operation), options_(options), flusher_(flusher),
+      buffers_(MemoryTracker::WRITE_BUFFERS), next_(0), failed_(false) {
+  this->input_ = NULL;
+  this->captured_ = NULL;
+  this->limiter_ = NULL;
+  this->capturedCount_ = NULL;
+  this->sessionBufferBytes_ = kSessionBufferBytes;
+}
+
+void WritePipeline::Throttle(TenantLimiter* limiter) {
+  this->limiter_ = limiter;
+}
+
+void WritePipeline::CaptureRows(string* rows, int64_t* count) {
+  this->captured_ = rows;
+  this->capturedCount_ = count;
+}
+
+Status WritePipeline::Run(const MarshaledRows& rows, PipelineStats* stats) {
+  this->input_ = &rows;
+
+  // Property names are resolved to columns once for the whole input, and
+  // properties without a matching column are ignored like in WriteRows.
+  KuduSchema schema = this->table_->schema();
+  this->columns_.assign(rows.names.size(), -1);
+  this->types_.resize(rows.names.size());
+  for (size_t n = 0; n < rows.names.size(); n++) {
+    for (int i = 0, l = schema.num_columns(); i < l; i++) {
+      KuduColumnSchema col = schema.Column(i);
+      if (col.name().compare(rows.names[n]) == 0) {
+        this->columns_[n] = i;
+        this->types_[n] = col.type();
+        break;
+      }
+    }
+  }
+
+  KuduPartitioner* raw;
+  KUDU_RETURN_NOT_OK(KuduPartitionerBuilder(this->table_).Build(&raw));
+  int partitions = raw->NumPartitions();
+  delete raw;
+  for (int p = 0; p < partitions; p++) {
+    this->routes_.emplace_back(new Route());
+    this->routes_.back()->applied = 0;
+  }
+
+  // Every tablet may get a session. When memory is short their buffers
+  // shrink, and Apply blocks until background flushes catch up.
+  size_t granted;
+  KUDU_RETURN_NOT_OK(this->buffers_.GrowUpTo(partitions * kSessionBufferBytes, partitions * kMinSessionBufferBytes, &granted));
+  this->sessionBufferBytes_ = granted / std::max(1, partitions);
+
+  // More threads than cores would not encode any faster.
+  int threadLimit = std::max(1, this->options_.parallelism);
+  int cores = std::thread::hardware_concurrency();
+  if (cores > 0) {
+    threadLimit = std::min(threadLimit, cores);
+  }
+  this->ops_.resize(rows.num_rows());
+  this->partitions_.assign(rows.num_rows(), -1);
+  size_t chunks = (rows.num_rows() + kChunkRows - 1) / kChunkRows;
+  int parallelism = std::max<int>(1, std::min<size_t>(threadLimit, chunks));
+  vector<std::thread> threads;
+  for (int i = 0; i < parallelism; i++) {
+    threads.push_back(std::thread(&WritePipeline::EncodeRows, this));
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  KUDU_RETURN_NOT_OK(this->error_);
+
+  for (size_t i = 0; i < this->partitions_.size(); i++) {
+    this->routes_[this->partitions_[i]]->rows.push_back(i);
+  }
+
+  // Whatever was applied before a failure is still flushed, so the outcome of
+  // every applied row is known when Run returns.
+  this->next_ = 0;
+  threads.clear();
+  parallelism = std::max(1, std::min(threadLimit, partitions));
+  for (int i = 0; i < parallelism; i++) {
+    threads.push_back(std::thread(&WritePipeline::WriteRoutes, this));
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  if (this->captured_ != NULL) {
+    for (const std::unique_ptr<Route>& route : this->routes_) {
+      this->captured_->append(route->captured);
+      *this->capturedCount_ += route->applied;
+    }
+  }
+  KUDU_RETURN_NOT_OK(this->error_);
+
+  stats->rows = 0;
+  stats->tablets = 0;
+  for (const std::unique_ptr<Route>& route : this->routes_) {
+    stats->rows += route->applied;
+    if (route->applied > 0) {
+      stats->tablets++;
+    }
+  }
+  return Status::OK();
+}
+
+void WritePipeline::EncodeRows() {
+  // Partitioners are not shared between threads.
+  KuduPartitioner* raw;
+  Status s = KuduPartitionerBuilder(this->table_).Build(&raw);
+  if (!s.ok()) {
+    Fail(s);
+    return;
+  }
+  std::unique_ptr<KuduPartitioner> partitioner(raw);
+
+  size_t total = this->input_->num_rows();
+  while (!this->failed_) {
+    size_t start = this->next_.fetch_add(kChunkRows);
+    if (start >= total) {
+      break;
+    }
+    size_t end = std::min(start + kChunkRows, total);
+    size_t bytes = 0;
+    for (size_t i = start; i < end; i++) {
+      s = EncodeRow(partitioner.get(), i, &bytes);
+      if (!s.ok()) {
+        Fail(s);
+        return;
+      }
+    }
+    // Tokens are taken a chunk at a time; the wait for a chunk's debt holds
+    // back this thread's next one.
+    if (this->limiter_ != NULL) {
+      this->limiter_->Acquire(this->options_.tenant, end - start, bytes);
+    }
+  }
+}
+
+Status WritePipeline::EncodeRow(KuduPartitioner* partitioner, size_t index, size_t* bytes) {
+  KuduWriteOperation* op = NewOperation(this->table_.get(), this->operation_);
+  if (op == NULL) {
+    return Status::InvalidArgument("Unknown write operation");
+  }
+  std::unique_ptr<KuduWriteOperation> owned(op);
+
+  KuduPartialRow* row = op->mutable_row();
+  for (size_t c = this->input_->rowStarts[index]; c < this->input_->rowStarts[index + 1]; c++) {
+    const MarshaledRows::Cell& cell = this->input_->cells[c];
+    int idx = this->columns_[cell.name];
+    if (idx < 0) {
+      continue;
+    }
+    KUDU_RETURN_NOT_OK(SetCell(row, idx, this->types_[cell.name], cell));
+    *bytes += cell.kind == MarshaledRows::TEXT ? cell.text.size() : ColumnarBatch::ValueWidth(this->types_[cell.name]);
+  }
+
+  int partition;
+  KUDU_RETURN_NOT_OK(partitioner->PartitionRow(*row, &partition));
+  if (partition < 0 || partition >= static_cast<int>(this->routes_.size())) {
+    return Status::NotFound("No tablet covers the row");
+  }
+  this->ops_[index] = std::move(owned);
+  this->partitions_[index] = partition;
+  return Status::OK();
+}
+
+void WritePipeline::WriteRoutes() {
+  for (;;) {
+    size_t i = this->next_++;
+    if (i >= this->routes_.size()) {
+      break;
+    }
+    Route* route = this->routes_[i].get();
+    Status s = WriteRoute(route);
+    if (!s.ok()) {
+      Fail(s);
+    }
+    if (!route->session) {
+      continue;
+    }
+    s = this->flusher_(this->table_, this->operation_, route->session);
+    if (!s.ok()) {
+      Fail(s);
+    }
+  }
+}
+
+// Applies the rows of one tablet in input order, stopping at the first error
+// or once another route failed.
+Status WritePipeline::WriteRoute(Route* route) {
+  for (size_t i = 0; i < route->rows.size() && !this->failed_; i++) {
+    if (!route->session) {
+      shared_ptr<KuduSession> created = this->table_->client()->NewSession();
+      KUDU_RETURN_NOT_OK(created->SetFlushMode(KuduSession::AUTO_FLUSH_BACKGROUND));
+      KUDU_RETURN_NOT_OK(created->SetMutationBufferSpace(this->sessionBufferBytes_));
+      created->SetTimeoutMillis(this->options_.timeoutMillis);
+      route->session = created;
+    }
+    std::unique_ptr<KuduWriteOperation>& op = this->ops_[route->rows[i]];
+    if (this->captured_ != NULL) {
+      AppendCapturedRow(op->row(), this->table_->schema(), &route->captured);
+    }
+    KUDU_RETURN_NOT_OK(route->session->Apply(op.release()));
+    route->applied++;
+  }
+  return Status::OK();
+}
+
+void WritePipeline::Fail(const Status& s) {
+  std::lock_guard<std::mutex> lock(this->errorMutex_);
+  if (!this->failed_) {
+    this->error_ = s;
+    this->failed_ = true;
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef KUDUJS_WRITEPIPELINE_H
+#define KUDUJS_WRITEPIPELINE_H
+
+#include <atomic>
+#include <mutex>
+#include "writecoalescer.h"
+#include "memtracker.h"
+#include "tenantlimiter.h"
+
+using kudu::client::KuduColumnSchema;
+using kudu::client::KuduPartitioner;
+using kudu::client::KuduWriteOperation;
+
+// Rows copied out of their JS objects in a single pass on the JS thread, so
+// that they can be encoded elsewhere. Property names are interned and cells
+// keep the JS type they had, conversion to the column type happens later.
+struct MarshaledRows {
+  enum Kind { NONE, NUMBER, BOOLEAN, TEXT };
+  struct Cell {
+    uint32_t name; // index into names
+    uint8_t kind;
+    double number; // NUMBER and BOOLEAN
+    string text; // TEXT
+  };
+  vector<string> names;
+  vector<Cell> cells;
+  vector<size_t> rowStarts; // first cell of each row, plus the end
+
+  size_t num_rows() const;
+};
+
+void MarshalRows(const Napi::Array& rows, MarshaledRows* out);
+
+struct PipelineOptions {
+  int parallelism; // encoding threads, also the number of tablets written at once
+  int timeoutMillis; // per session
+  string tenant; // key the rows are rate limited under
+};
+
+struct PipelineStats {
+  int64_t rows;
+  int tablets; // tablets that received rows
+};
+
+// Writes a set of marshaled rows with one session per tablet. Encoder threads
+// turn rows into operations and find their tablet by partition key. Then each
+// tablet's rows are applied by a single thread in input order, so two writes
+// to the same key land in the order they were given, and every session only
+// talks to one tablet server: a slow one holds back its own rows only.
+// Sessions flush in the background while their rows are applied.
+class WritePipeline {
+ public:
+  WritePipeline(const shared_ptr<KuduTable>& table, int operation, const PipelineOptions& options,
+                const WriteCoalescer::SessionFlusher& flusher);
+  // Writes nothing when a row fails to encode.
+  Status Run(const MarshaledRows& rows, PipelineStats* stats);
+  // Also collects every applied row in the AppendCapturedRow format, for a
+  // traffic capture. Filled in by Run, failed or not.
+  void CaptureRows(string* rows, int64_t* count);
+  // Makes encoders wait for the tenant's rate limits after each chunk of rows.
+  void Throttle(TenantLimiter* limiter);
+
+ private:
+  struct Route {
+    vector<size_t> rows; // indexes into ops_, in input order
+    shared_ptr<KuduSession> session;
+    int64_t applied;
+    string captured;
+  };
+
+  shared_ptr<KuduTable> table_;
+  int operation_;
+  PipelineOptions options_;
+  WriteCoalescer::SessionFlusher flusher_;
+
+  const MarshaledRows* input_;
+  string* captured_;
+  TenantLimiter* limiter_;
+  int64_t* capturedCount_;
+  vector<int> columns_; // schema column per interned name, -1 when unknown
+  vector<KuduColumnSchema::DataType> types_;
+  vector<std::unique_ptr<KuduWriteOperation>> ops_; // per row, until applied
+  vector<int> partitions_; // per row
+  vector<std::unique_ptr<Route>> routes_;
+  MemoryReservation buffers_;
+  size_t sessionBufferBytes_;
+  std::atomic<size_t> next_;
+
+  std::mutex errorMutex_;
+  Status error_;
+  std::atomic<bool> failed_;
+
+  void EncodeRows();
+  Status EncodeRow(KuduPartitioner* partitioner, size_t index, size_t* bytes);
+  void WriteRoutes();
+  Status WriteRoute(Route* route);
+  void Fail(const Status& s);
+};
+
+#endif
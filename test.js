@@ -1,5 +1,27 @@
+const assert = require('assert');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
 const kudujsAddon = require('./build/Release/kudujs.node');
 
+function rowsBetween(from, to) {
+  const result = [];
+  for (let i = from; i < to; i += 1) {
+    result.push({
+      id: i, int_val: i * 100, string_val: `test_${i}`, non_null_with_default: i,
+    });
+  }
+  return result;
+}
+
+// Completion listeners do not keep the process alive, so wait by polling.
+function until(check) {
+  return new Promise((resolve) => {
+    const poll = () => (check() ? resolve() : setTimeout(poll, 10));
+    poll();
+  });
+}
+
 function multiRowGenerator() {
   const result = [];
   for (let i = 0; i < 5000; i += 1) {
@@ -36,6 +58,12 @@ const colPartitions = ['id'];
 
 const multiRow = multiRowGenerator();
 
+// Options are checked before connecting.
+assert.throws(() => new kudujsAddon.KuduJS(['localhost:7051'], { reactors: -1 }), TypeError);
+assert.throws(() => new kudujsAddon.KuduJS(['localhost:7051'], { adminTimeoutMs: 0 }), TypeError);
+assert.throws(() => new kudujsAddon.KuduJS(['localhost:7051'], { rpcTimeoutMs: 1.5 }), TypeError);
+assert.throws(() => new kudujsAddon.KuduJS(['localhost:7051'], { prewarm: 'test_table_2' }), TypeError);
+
 const classInstance = new kudujsAddon.KuduJS(['prew1b2b.mipodo.com:7051', 'prew2b2b.mipodo.com:7051', 'prew3b2b.mipodo.com:7051']);
 classInstance.createTable('test_table_2', schema, numTablets, kudujsAddon.Partitioning.RANGE, colPartitions);
 classInstance.insertRow('test_table_2', {
@@ -52,6 +80,175 @@ classInstance.upsertRow('test_table_2', {
 });
 classInstance.insertRows('test_table_2', multiRow);
 console.log(classInstance.scanRow('test_table_2', predicate));
-classInstance.deleteTable('test_table_2');
+
+assert.throws(() => classInstance.setMemoryLimits({ total: -1 }), TypeError);
+
+// deleteTable aborts on a missing table, so only these are dropped at the end.
+const createdTables = ['test_table_2'];
+
+async function testWriteRows() {
+  const stats = await classInstance.writeRows('test_table_2', kudujsAddon.Operation.UPSERT, rowsBetween(6000, 6100), { parallelism: 2 });
+  console.log('writeRows', stats);
+  assert.strictEqual(stats.rows, 100);
+  const written = classInstance.scanRow('test_table_2', [
+    { colName: 'id', comparisonOp: kudujsAddon.ComparisonOp.GREATER_EQUAL, value: 6000 },
+    { colName: 'id', comparisonOp: kudujsAddon.ComparisonOp.LESS, value: 6100 },
+  ]);
+  assert.strictEqual(written.length, 100);
+  assert.strictEqual(written.find((row) => row.id === 6050).string_val, 'test_6050');
+}
+
+async function testArrow() {
+  const count = classInstance.scanRow('test_table_2', []).length;
+  const ipc = classInstance.scanRow('test_table_2', [], { format: 'arrow' });
+  assert.ok(Buffer.isBuffer(ipc) && ipc.length > 0);
+
+  classInstance.createTable('test_table_2_copy', schema, numTablets, kudujsAddon.Partitioning.RANGE, colPartitions);
+  createdTables.push('test_table_2_copy');
+  const applied = classInstance.writeArrow('test_table_2_copy', kudujsAddon.Operation.UPSERT, ipc);
+  console.log('writeArrow', applied);
+  assert.strictEqual(applied, count);
+  assert.strictEqual(classInstance.scanRow('test_table_2_copy', []).length, count);
+  const copied = classInstance.scanRow('test_table_2_copy', predicate);
+  assert.deepStrictEqual(copied.map((row) => row.id).sort(), classInstance.scanRow('test_table_2', predicate).map((row) => row.id).sort());
+
+  const file = path.join(os.tmpdir(), `kudujs-test-${process.pid}.arrow`);
+  const stats = await classInstance.exportTable('test_table_2', file, { format: 'arrow', parallelism: 2 });
+  console.log('exportTable', stats);
+  assert.strictEqual(stats.rows, count);
+  assert.strictEqual(fs.readFileSync(file).subarray(0, 6).toString(), 'ARROW1');
+  fs.unlinkSync(file);
+}
+
+async function testScanCache() {
+  classInstance.enableScanCache({ maxBytes: 16 * 1024 * 1024, ttlMs: 60000 });
+  classInstance.scanRow('test_table_2', predicate);
+  classInstance.scanRow('test_table_2', predicate);
+  const before = classInstance.scanCacheMetrics();
+  assert.ok(before.hits >= 1);
+  // A write through the client drops the cached scans of its table.
+  classInstance.updateRow('test_table_2', {
+    id: 5001, int_val: 42, non_null_with_default: 5, string_val: 'hello',
+  });
+  const after = classInstance.scanRow('test_table_2', predicate);
+  assert.strictEqual(after.find((row) => row.id === 5001).int_val, 42);
+  assert.ok(classInstance.scanCacheMetrics().invalidations > before.invalidations);
+}
+
+const tsSchema = [
+  {
+    key: 'ts', type: kudujsAddon.DataType.UNIXTIME_MICROS, primaryKey: true, notNull: true,
+  },
+  {
+    key: 'host', type: kudujsAddon.DataType.STRING, primaryKey: true, notNull: true,
+  },
+  {
+    key: 'cpu', type: kudujsAddon.DataType.DOUBLE, primaryKey: false, notNull: false,
+  },
+];
+const hourMicros = 3600 * 1000 * 1000;
+const dayMicros = 24 * hourMicros;
+
+async function testTimeSeries() {
+  const today = Math.floor(Date.now() / 86400000) * dayMicros;
+  classInstance.createTimeSeriesTable('test_ts_2', tsSchema, {
+    column: 'ts', period: 'day', ahead: 2, from: today - 3 * dayMicros,
+  });
+  createdTables.push('test_ts_2');
+  for (let h = 0; h < 24; h += 1) {
+    for (const host of ['b', 'a']) {
+      classInstance.insertRow('test_ts_2', { ts: today + h * hourMicros, host, cpu: h });
+    }
+  }
+
+  // Buckets come back in order, and the groups of a bucket by value.
+  const rollup = await classInstance.scanRollup('test_ts_2', {
+    timeColumn: 'ts', bucket: '1h', aggs: ['count', { fn: 'max', column: 'cpu' }], groupBy: ['host'],
+  });
+  console.log('scanRollup', rollup.rowCount);
+  assert.strictEqual(rollup.rowCount, 48);
+  for (let i = 0; i < rollup.rowCount; i += 1) {
+    assert.strictEqual(rollup.buckets[i], today + Math.floor(i / 2) * hourMicros);
+    assert.strictEqual(rollup.groups.host[i], i % 2 === 0 ? 'a' : 'b');
+    assert.strictEqual(rollup.values.count[i], 1);
+    assert.strictEqual(rollup.values.max_cpu[i], Math.floor(i / 2));
+  }
+
+  // Repeated strings share one dictionary entry.
+  const { rowCount, columns: { host } } = classInstance.scanRow('test_ts_2', [], {
+    projection: ['host'], layout: 'columns', dictionary: true, cache: false,
+  });
+  assert.strictEqual(rowCount, 48);
+  assert.ok(host.codes instanceof Uint32Array);
+  assert.deepStrictEqual([...host.dictionary].sort(), ['a', 'b']);
+  assert.strictEqual(Array.from(host.codes).filter((code) => host.dictionary[code] === 'a').length, 24);
+
+  // Partitions were created from three days ago to two days ahead; keeping
+  // one past day drops the two before it.
+  const changes = classInstance.maintainTimePartitions('test_ts_2', {
+    column: 'ts', period: 'day', ahead: 2, retention: 1,
+  });
+  console.log('maintainTimePartitions', changes);
+  assert.deepStrictEqual(changes, { added: 0, dropped: 2 });
+  assert.throws(() => classInstance.insertRow('test_ts_2', { ts: today - 3 * dayMicros, host: 'a', cpu: 0 }));
+}
+
+async function testCompletions() {
+  const events = [];
+  classInstance.onCompletion((batch) => events.push(...batch), { maxPerTick: 64 });
+
+  const writeId = classInstance.writeRowsAsync('test_table_2', kudujsAddon.Operation.INSERT, rowsBetween(7000, 7010));
+  await until(() => events.some((e) => e.type === 'flush' && e.id === writeId));
+  const flush = events.find((e) => e.type === 'flush' && e.id === writeId);
+  assert.strictEqual(flush.rows, 10);
+  assert.strictEqual(flush.error, undefined);
+  assert.strictEqual(flush.errors.length, 0);
+
+  // A window of one batch makes the scan pause and resume between batches.
+  const count = classInstance.scanRow('test_table_2', [], { cache: false }).length;
+  const scanId = classInstance.streamScan('test_table_2', [], { projection: ['id'], maxInFlight: 1 });
+  await until(() => events.some((e) => e.type === 'batch' && e.id === scanId && e.last));
+  const batches = events.filter((e) => e.type === 'batch' && e.id === scanId);
+  console.log('streamScan', batches.length, 'batches');
+  assert.strictEqual(batches.filter((e) => e.last).length, 1);
+  assert.ok(batches.every((e) => e.error === undefined));
+  assert.strictEqual(batches.reduce((sum, e) => sum + e.rows, 0), count);
+  assert.strictEqual(batches.reduce((sum, e) => sum + (e.columns ? e.columns.id.length : 0), 0), count);
+
+  const metrics = classInstance.offCompletion();
+  console.log('completions', metrics);
+  assert.strictEqual(metrics.delivered, events.length);
+}
+
+async function testTenantQuota() {
+  classInstance.setTenantQuota('test_tenant', { rowsPerSecond: 1, burstSeconds: 1 });
+  // The first call is let through and leaves the tenant in debt.
+  classInstance.insertRows('test_table_2', rowsBetween(8000, 8010), { tenant: 'test_tenant' });
+  assert.throws(() => classInstance.insertRow('test_table_2', rowsBetween(8010, 8011)[0], { tenant: 'test_tenant' }), /rate limit/);
+  classInstance.insertRow('test_table_2', rowsBetween(8011, 8012)[0], { tenant: 'other_tenant' });
+  const metrics = classInstance.tenantMetrics();
+  console.log('tenants', metrics);
+  assert.strictEqual(metrics.test_tenant.rejected, 1);
+  assert.strictEqual(metrics.other_tenant.rejected, 0);
+}
+
+async function main() {
+  try {
+    await testWriteRows();
+    await testArrow();
+    await testScanCache();
+    await testTimeSeries();
+    await testCompletions();
+    await testTenantQuota();
+    console.log('ok');
+  } finally {
+    createdTables.forEach((table) => classInstance.deleteTable(table));
+  }
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exitCode = 1;
+});
 
 module.exports = kudujsAddon;